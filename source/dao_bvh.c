@@ -0,0 +1,316 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "dao_bvh.h"
+
+
+#define DAOX_BVH_LEAF_SIZE  4
+
+
+static void DaoxBounds_Union( DaoxVector3D *min, DaoxVector3D *max, DaoxVector3D *min2, DaoxVector3D *max2 )
+{
+	if( min2->x < min->x ) min->x = min2->x;
+	if( min2->y < min->y ) min->y = min2->y;
+	if( min2->z < min->z ) min->z = min2->z;
+	if( max2->x > max->x ) max->x = max2->x;
+	if( max2->y > max->y ) max->y = max2->y;
+	if( max2->z > max->z ) max->z = max2->z;
+}
+static DaoxOBBox3D DaoxBounds_ToBox( DaoxVector3D *min, DaoxVector3D *max )
+{
+	DaoxOBBox3D box;
+	box.O = *min;
+	box.X = DaoxVector3D_XYZ( max->x, min->y, min->z );
+	box.Y = DaoxVector3D_XYZ( min->x, max->y, min->z );
+	box.Z = DaoxVector3D_XYZ( min->x, min->y, max->z );
+	box.C = DaoxVector3D_XYZ( 0.5*(min->x + max->x), 0.5*(min->y + max->y), 0.5*(min->z + max->z) );
+	box.R = DaoxVector3D_Dist( & box.O, & box.C );
+	return box;
+}
+
+
+
+static void DaoxBVHItem_AddNode( DaoxBVHItem *self, DaoxSceneNode *node )
+{
+	daoint i;
+
+	if( node->renderable ){
+		DaoxModel *model = (DaoxModel*) node;
+		DaoxMatrix4D transform = DaoxSceneNode_GetWorldTransform( node );
+		DaoxOBBox3D obbox = DaoxOBBox3D_Transform( & node->obbox, & transform );
+		DaoxOBBox3D aabox;
+		DaoxVector3D max;
+
+		if( node->ctype == daox_type_model && model->skeleton != NULL ){
+			obbox = DaoxOBBox3D_Scale( & obbox, 8.0 );
+		}
+		aabox = DaoxOBBox3D_ToAABox( & obbox );
+		max = DaoxOBBox3D_GetDiagonalVertex( & aabox );
+		if( self->empty ){
+			self->min = aabox.O;
+			self->max = max;
+			self->empty = 0;
+		}else{
+			DaoxBounds_Union( & self->min, & self->max, & aabox.O, & max );
+		}
+	}
+	node->cached |= DAOX_WORLD_BOUNDS;
+	for(i=0; i<node->children->size; ++i){
+		DaoxBVHItem_AddNode( self, node->children->items.pSceneNode[i] );
+	}
+}
+static void DaoxBVHItem_Update( DaoxBVHItem *self )
+{
+	self->min = self->max = DaoxVector3D_XYZ( 0.0, 0.0, 0.0 );
+	self->empty = 1;
+	DaoxBVHItem_AddNode( self, self->node );
+}
+
+static float DaoxBVHItem_Center( const void *item, int axis )
+{
+	DaoxBVHItem *self = (DaoxBVHItem*) item;
+	if( axis == 0 ) return self->min.x + self->max.x;
+	if( axis == 1 ) return self->min.y + self->max.y;
+	return self->min.z + self->max.z;
+}
+static int DaoxBVHItem_CompareX( const void *first, const void *second )
+{
+	float c1 = DaoxBVHItem_Center( first, 0 ), c2 = DaoxBVHItem_Center( second, 0 );
+	return c1 < c2 ? -1 : (c1 > c2);
+}
+static int DaoxBVHItem_CompareY( const void *first, const void *second )
+{
+	float c1 = DaoxBVHItem_Center( first, 1 ), c2 = DaoxBVHItem_Center( second, 1 );
+	return c1 < c2 ? -1 : (c1 > c2);
+}
+static int DaoxBVHItem_CompareZ( const void *first, const void *second )
+{
+	float c1 = DaoxBVHItem_Center( first, 2 ), c2 = DaoxBVHItem_Center( second, 2 );
+	return c1 < c2 ? -1 : (c1 > c2);
+}
+
+
+
+
+DaoxSceneBVH* DaoxSceneBVH_New()
+{
+	DaoxSceneBVH *self = (DaoxSceneBVH*) dao_calloc( 1, sizeof(DaoxSceneBVH) );
+	self->nodes = DArray_New( sizeof(DaoxBVHNode) );
+	self->items = DArray_New( sizeof(DaoxBVHItem) );
+	return self;
+}
+void DaoxSceneBVH_Delete( DaoxSceneBVH *self )
+{
+	DArray_Delete( self->nodes );
+	DArray_Delete( self->items );
+	dao_free( self );
+}
+
+static int DaoxSceneBVH_MakeNode( DaoxSceneBVH *self, int parent )
+{
+	DaoxBVHNode *node = (DaoxBVHNode*) DArray_Push( self->nodes );
+	memset( node, 0, sizeof(DaoxBVHNode) );
+	node->parent = parent;
+	node->left = node->right = -1;
+	return self->nodes->size - 1;
+}
+static void DaoxSceneBVH_Bound( DaoxSceneBVH *self, int index )
+{
+	DaoxBVHNode *nodes = (DaoxBVHNode*) self->nodes->data.base;
+	DaoxBVHItem *items = (DaoxBVHItem*) self->items->data.base;
+	DaoxBVHNode *node = nodes + index;
+	int i;
+
+	node->empty = 1;
+	node->dirty = 0;
+	if( node->left < 0 ){
+		for(i=node->first; i<node->first+node->count; ++i){
+			DaoxBVHItem *item = items + i;
+			if( item->empty ) continue;
+			if( node->empty ){
+				node->min = item->min;
+				node->max = item->max;
+				node->empty = 0;
+			}else{
+				DaoxBounds_Union( & node->min, & node->max, & item->min, & item->max );
+			}
+		}
+		return;
+	}
+	for(i=0; i<2; ++i){
+		DaoxBVHNode *child = nodes + (i ? node->right : node->left);
+		if( child->empty ) continue;
+		if( node->empty ){
+			node->min = child->min;
+			node->max = child->max;
+			node->empty = 0;
+		}else{
+			DaoxBounds_Union( & node->min, & node->max, & child->min, & child->max );
+		}
+	}
+}
+/*
+// Split the items at the median of their centers along the longest axis
+// of the center bounds:
+*/
+static void DaoxSceneBVH_Split( DaoxSceneBVH *self, int index, int first, int count )
+{
+	DaoxBVHItem *items = (DaoxBVHItem*) self->items->data.base;
+	DaoxBVHNode *node;
+	DaoxVector3D min, max;
+	int i, left, right, half = count / 2;
+
+	if( count <= DAOX_BVH_LEAF_SIZE ){
+		node = (DaoxBVHNode*) self->nodes->data.base + index;
+		node->first = first;
+		node->count = count;
+		for(i=first; i<first+count; ++i) items[i].leaf = index;
+		DaoxSceneBVH_Bound( self, index );
+		return;
+	}
+
+	min.x = max.x = DaoxBVHItem_Center( items + first, 0 );
+	min.y = max.y = DaoxBVHItem_Center( items + first, 1 );
+	min.z = max.z = DaoxBVHItem_Center( items + first, 2 );
+	for(i=first+1; i<first+count; ++i){
+		DaoxVector3D center;
+		center.x = DaoxBVHItem_Center( items + i, 0 );
+		center.y = DaoxBVHItem_Center( items + i, 1 );
+		center.z = DaoxBVHItem_Center( items + i, 2 );
+		DaoxBounds_Union( & min, & max, & center, & center );
+	}
+	max = DaoxVector3D_Sub( & max, & min );
+	if( max.x >= max.y && max.x >= max.z ){
+		qsort( items + first, count, sizeof(DaoxBVHItem), DaoxBVHItem_CompareX );
+	}else if( max.y >= max.z ){
+		qsort( items + first, count, sizeof(DaoxBVHItem), DaoxBVHItem_CompareY );
+	}else{
+		qsort( items + first, count, sizeof(DaoxBVHItem), DaoxBVHItem_CompareZ );
+	}
+
+	left = DaoxSceneBVH_MakeNode( self, index );
+	DaoxSceneBVH_Split( self, left, first, half );
+	right = DaoxSceneBVH_MakeNode( self, index );
+	DaoxSceneBVH_Split( self, right, first + half, count - half );
+
+	node = (DaoxBVHNode*) self->nodes->data.base + index;
+	node->left = left;
+	node->right = right;
+	DaoxSceneBVH_Bound( self, index );
+}
+void DaoxSceneBVH_Build( DaoxSceneBVH *self, DaoxScene *scene )
+{
+	DaoxBVHItem *items;
+	daoint i;
+
+	self->refits = 0;
+	self->changes = scene->changes;
+	self->nodes->size = 0;
+	DArray_Resize( self->items, scene->nodes->size );
+	items = (DaoxBVHItem*) self->items->data.base;
+	for(i=0; i<scene->nodes->size; ++i){
+		items[i].node = scene->nodes->items.pSceneNode[i];
+		DaoxBVHItem_Update( items + i );
+	}
+	if( self->items->size == 0 ) return;
+	DaoxSceneBVH_MakeNode( self, -1 );
+	DaoxSceneBVH_Split( self, 0, 0, self->items->size );
+}
+/*
+// Refit the hierarchy for the top level nodes with moved subtrees.
+// Only the nodes on the paths from the leaves of such nodes to the root
+// are updated, in the reverse order of the node array;
+*/
+void DaoxSceneBVH_Update( DaoxSceneBVH *self, DaoxScene *scene )
+{
+	DaoxBVHNode *nodes = (DaoxBVHNode*) self->nodes->data.base;
+	DaoxBVHItem *items = (DaoxBVHItem*) self->items->data.base;
+	daoint i, k, moved = 0;
+
+	if( self->changes != scene->changes || self->refits > 4*self->items->size ){
+		DaoxSceneBVH_Build( self, scene );
+		return;
+	}
+	for(i=0; i<self->items->size; ++i){
+		DaoxBVHItem *item = items + i;
+		if( item->node->cached & DAOX_WORLD_BOUNDS ) continue;
+		DaoxBVHItem_Update( item );
+		for(k=item->leaf; k>=0 && nodes[k].dirty == 0; k=nodes[k].parent) nodes[k].dirty = 1;
+		moved += 1;
+	}
+	if( moved == 0 ) return;
+
+	self->refits += moved;
+	for(i=self->nodes->size-1; i>=0; --i){
+		if( nodes[i].dirty ) DaoxSceneBVH_Bound( self, i );
+	}
+}
+
+static void DaoxSceneBVH_AddItems( DaoxSceneBVH *self, int index, DList *nodes )
+{
+	DaoxBVHNode *node = (DaoxBVHNode*) self->nodes->data.base + index;
+	DaoxBVHItem *items = (DaoxBVHItem*) self->items->data.base;
+	int i;
+
+	if( node->empty ) return;
+	if( node->left >= 0 ){
+		DaoxSceneBVH_AddItems( self, node->left, nodes );
+		DaoxSceneBVH_AddItems( self, node->right, nodes );
+		return;
+	}
+	for(i=node->first; i<node->first+node->count; ++i){
+		if( items[i].empty == 0 ) DList_Append( nodes, items[i].node );
+	}
+}
+static void DaoxSceneBVH_CullNode( DaoxSceneBVH *self, DaoxViewFrustum *frustum, int index, DList *nodes )
+{
+	DaoxBVHNode *node = (DaoxBVHNode*) self->nodes->data.base + index;
+	DaoxOBBox3D box;
+	int check;
+
+	if( node->empty ) return;
+
+	box = DaoxBounds_ToBox( & node->min, & node->max );
+	check = DaoxViewFrustum_Visible( frustum, & box );
+	if( check < 0 ) return;
+	if( check > 0 || node->left < 0 ){
+		/* The items in the leaves intersecting the frustum are checked by the renderer; */
+		DaoxSceneBVH_AddItems( self, index, nodes );
+		return;
+	}
+	DaoxSceneBVH_CullNode( self, frustum, node->left, nodes );
+	DaoxSceneBVH_CullNode( self, frustum, node->right, nodes );
+}
+void DaoxSceneBVH_Cull( DaoxSceneBVH *self, DaoxViewFrustum *frustum, DList *nodes )
+{
+	if( self->nodes->size == 0 ) return;
+	DaoxSceneBVH_CullNode( self, frustum, 0, nodes );
+}
@@ -0,0 +1,96 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __DAO_BVH__
+#define __DAO_BVH__
+
+#include "dao_scene.h"
+
+
+typedef struct DaoxBVHNode   DaoxBVHNode;
+typedef struct DaoxBVHItem   DaoxBVHItem;
+
+
+/*
+// Axis aligned bounds of the subtree of a top level scene node:
+*/
+struct DaoxBVHItem
+{
+	DaoxSceneNode  *node;
+	DaoxVector3D    min;
+	DaoxVector3D    max;
+	int             leaf;   /* the leaf of the hierarchy containing the item; */
+	uchar_t         empty;  /* no renderable node in the subtree; */
+};
+
+/*
+// Node of the hierarchy. The nodes are stored in depth first order,
+// so the children of a node always follow the node in the array;
+*/
+struct DaoxBVHNode
+{
+	DaoxVector3D  min;
+	DaoxVector3D  max;
+	int           parent;
+	int           left;    /* -1 for leaf; */
+	int           right;
+	int           first;   /* the items of a leaf: [first,first+count); */
+	int           count;
+	uchar_t       dirty;
+	uchar_t       empty;
+};
+
+
+/*
+// DaoxSceneBVH:
+// -- Bounding volume hierarchy over the world space bounds of the top level nodes;
+// -- Subtrees with moved nodes are detected by the bounds flag of the nodes,
+//    and refitted incrementally before culling;
+// -- It is rebuilt when top level nodes are added, or when it has been refitted
+//    for too many times;
+*/
+struct DaoxSceneBVH
+{
+	DArray  *nodes;   /* <DaoxBVHNode>; */
+	DArray  *items;   /* <DaoxBVHItem>; */
+	int      refits;
+	uint_t   changes; /* DaoxScene::changes of the build; */
+};
+
+DaoxSceneBVH* DaoxSceneBVH_New();
+void DaoxSceneBVH_Delete( DaoxSceneBVH *self );
+
+void DaoxSceneBVH_Build( DaoxSceneBVH *self, DaoxScene *scene );
+void DaoxSceneBVH_Update( DaoxSceneBVH *self, DaoxScene *scene );
+
+/*
+// Append the top level nodes whose bounds are visible to "nodes":
+*/
+void DaoxSceneBVH_Cull( DaoxSceneBVH *self, DaoxViewFrustum *frustum, DList *nodes );
+
+#endif
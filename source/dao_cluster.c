@@ -0,0 +1,198 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <math.h>
+#include <string.h>
+
+#include "dao_cluster.h"
+
+
+
+DaoxLightClusters* DaoxLightClusters_New()
+{
+	DaoxLightClusters *self = (DaoxLightClusters*) dao_calloc( 1, sizeof(DaoxLightClusters) );
+	self->lights = DArray_New( sizeof(float) );
+	self->clusters = DArray_New( sizeof(float) );
+	self->indices = DArray_New( sizeof(float) );
+	self->offsets = DArray_New( sizeof(int) );
+	self->counts = DArray_New( sizeof(int) );
+	self->points = DArray_New( sizeof(DaoxVector3D) );
+	return self;
+}
+void DaoxLightClusters_Delete( DaoxLightClusters *self )
+{
+	DArray_Delete( self->lights );
+	DArray_Delete( self->clusters );
+	DArray_Delete( self->indices );
+	DArray_Delete( self->offsets );
+	DArray_Delete( self->counts );
+	DArray_Delete( self->points );
+	dao_free( self );
+}
+
+static int DaoxLightClusters_Slice( DaoxLightClusters *self, float depth )
+{
+	int slice = (int) floor( log( depth / self->near ) * self->logScale );
+	if( slice < 0 ) return 0;
+	if( slice >= DAOX_CLUSTER_Z ) return DAOX_CLUSTER_Z - 1;
+	return slice;
+}
+static float DaoxLightClusters_SliceDepth( DaoxLightClusters *self, int slice )
+{
+	return self->near * exp( slice / self->logScale );
+}
+static int DaoxLightClusters_Clamp( int value, int max )
+{
+	if( value < 0 ) return 0;
+	if( value >= max ) return max - 1;
+	return value;
+}
+
+/*
+// Count the clusters overlapping with the light, or add the light to the
+// lists of the clusters if "indices" is not NULL. The light sphere is
+// bounded by a box, which is projected with the near and far depths of
+// each slice, so that the tile range of each slice is conservative;
+*/
+static void DaoxLightClusters_Assign( DaoxLightClusters *self, int id, DaoxVector3D P, float range, float *indices )
+{
+	int *offsets = self->offsets->data.ints;
+	int *counts = self->counts->data.ints;
+	float depth = - P.z;
+	float zmin = self->near;
+	float zmax = self->far;
+	int ix, iy, iz, z0 = 0, z1 = DAOX_CLUSTER_Z - 1;
+
+	if( range > 0.0 ){
+		if( depth + range < self->near || depth - range > self->far ) return;
+		if( depth - range > zmin ) zmin = depth - range;
+		if( depth + range < zmax ) zmax = depth + range;
+		z0 = DaoxLightClusters_Slice( self, zmin );
+		z1 = DaoxLightClusters_Slice( self, zmax );
+	}
+	for(iz=z0; iz<=z1; ++iz){
+		int x0 = 0, x1 = DAOX_CLUSTER_X - 1;
+		int y0 = 0, y1 = DAOX_CLUSTER_Y - 1;
+		if( range > 0.0 ){
+			float s0 = DaoxLightClusters_SliceDepth( self, iz );
+			float s1 = DaoxLightClusters_SliceDepth( self, iz + 1 );
+			float xmin = P.x - range, xmax = P.x + range;
+			float ymin = P.y - range, ymax = P.y + range;
+			float u0, u1, v0, v1;
+			if( s0 < zmin ) s0 = zmin;
+			if( s1 > zmax ) s1 = zmax;
+			u0 = xmin < 0.0 ? xmin / s0 : xmin / s1;
+			u1 = xmax > 0.0 ? xmax / s0 : xmax / s1;
+			v0 = ymin < 0.0 ? ymin / s0 : ymin / s1;
+			v1 = ymax > 0.0 ? ymax / s0 : ymax / s1;
+			x0 = (int) floor( (u0 - self->tanLeft) * self->scaleX );
+			x1 = (int) floor( (u1 - self->tanLeft) * self->scaleX );
+			y0 = (int) floor( (v0 - self->tanBottom) * self->scaleY );
+			y1 = (int) floor( (v1 - self->tanBottom) * self->scaleY );
+			if( x1 < 0 || x0 >= DAOX_CLUSTER_X ) continue;
+			if( y1 < 0 || y0 >= DAOX_CLUSTER_Y ) continue;
+			x0 = DaoxLightClusters_Clamp( x0, DAOX_CLUSTER_X );
+			x1 = DaoxLightClusters_Clamp( x1, DAOX_CLUSTER_X );
+			y0 = DaoxLightClusters_Clamp( y0, DAOX_CLUSTER_Y );
+			y1 = DaoxLightClusters_Clamp( y1, DAOX_CLUSTER_Y );
+		}
+		for(iy=y0; iy<=y1; ++iy){
+			int cluster = (iz * DAOX_CLUSTER_Y + iy) * DAOX_CLUSTER_X + x0;
+			for(ix=x0; ix<=x1; ++ix, ++cluster){
+				if( indices ) indices[ offsets[cluster] + counts[cluster] ] = id;
+				counts[cluster] += 1;
+			}
+		}
+	}
+}
+
+void DaoxLightClusters_Build( DaoxLightClusters *self, DaoxViewFrustum *frustum, DaoxMatrix4D *worldToView, DList *lights )
+{
+	float *data, *clusters;
+	int *offsets, *counts;
+	int i, total = 0;
+
+	self->near = frustum->near;
+	self->far = frustum->far > 1.01 * frustum->near ? frustum->far : 1.01 * frustum->near;
+	self->logScale = DAOX_CLUSTER_Z / log( self->far / self->near );
+	self->tanLeft = frustum->left / frustum->near;
+	self->tanBottom = frustum->bottom / frustum->near;
+	self->scaleX = DAOX_CLUSTER_X * frustum->near / (frustum->right - frustum->left);
+	self->scaleY = DAOX_CLUSTER_Y * frustum->near / (frustum->top - frustum->bottom);
+
+	self->lightCount = lights->size;
+	self->lightRows = (lights->size + DAOX_LIGHT_ROW - 1) / DAOX_LIGHT_ROW;
+	if( self->lightRows == 0 ) self->lightRows = 1;
+	DArray_Resize( self->lights, self->lightRows * DAOX_LIGHT_ROW * 8 );
+	DArray_Resize( self->points, lights->size );
+	memset( self->lights->data.floats, 0, self->lights->size * sizeof(float) );
+	data = self->lights->data.floats;
+	for(i=0; i<lights->size; ++i, data += 8){
+		DaoxLight *light = lights->items.pLight[i];
+		DaoxVector3D pos = DaoxSceneNode_GetWorldPosition( (DaoxSceneNode*) light );
+		self->points->data.vectors3d[i] = DaoxMatrix4D_MulVector( worldToView, & pos, 1.0 );
+		data[0] = pos.x;
+		data[1] = pos.y;
+		data[2] = pos.z;
+		data[3] = light->range;
+		data[4] = light->intensity.red;
+		data[5] = light->intensity.green;
+		data[6] = light->intensity.blue;
+		data[7] = light->intensity.alpha;
+	}
+
+	DArray_Resize( self->offsets, DAOX_CLUSTERS );
+	DArray_Resize( self->counts, DAOX_CLUSTERS );
+	DArray_Resize( self->clusters, 2*DAOX_CLUSTERS );
+	memset( self->counts->data.ints, 0, DAOX_CLUSTERS * sizeof(int) );
+	for(i=0; i<lights->size; ++i){
+		DaoxLight *light = lights->items.pLight[i];
+		DaoxVector3D P = self->points->data.vectors3d[i];
+		DaoxLightClusters_Assign( self, i, P, light->range, NULL );
+	}
+	offsets = self->offsets->data.ints;
+	counts = self->counts->data.ints;
+	clusters = self->clusters->data.floats;
+	for(i=0; i<DAOX_CLUSTERS; ++i){
+		offsets[i] = total;
+		clusters[2*i] = total;
+		clusters[2*i+1] = counts[i];
+		total += counts[i];
+		counts[i] = 0;
+	}
+
+	self->indexCount = total;
+	self->indexRows = (total + DAOX_LIGHT_INDEX_ROW - 1) / DAOX_LIGHT_INDEX_ROW;
+	if( self->indexRows == 0 ) self->indexRows = 1;
+	DArray_Resize( self->indices, self->indexRows * DAOX_LIGHT_INDEX_ROW );
+	for(i=0; i<lights->size; ++i){
+		DaoxLight *light = lights->items.pLight[i];
+		DaoxVector3D P = self->points->data.vectors3d[i];
+		DaoxLightClusters_Assign( self, i, P, light->range, self->indices->data.floats );
+	}
+}
@@ -0,0 +1,89 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __DAO_CLUSTER__
+#define __DAO_CLUSTER__
+
+#include "dao_scene.h"
+
+
+/*
+// Dimensions of the view space cluster grid (tiles in screen space and
+// exponential slices in view depth), and the row widths of the textures
+// used to pass the lights and the light index lists to the shaders:
+*/
+#define DAOX_CLUSTER_X  16
+#define DAOX_CLUSTER_Y  8
+#define DAOX_CLUSTER_Z  24
+
+#define DAOX_LIGHT_ROW        256   /* lights per row (2 RGBA texels per light); */
+#define DAOX_LIGHT_INDEX_ROW  1024  /* light indices per row; */
+
+#define DAOX_CLUSTERS  (DAOX_CLUSTER_X*DAOX_CLUSTER_Y*DAOX_CLUSTER_Z)
+
+
+typedef struct DaoxLightClusters  DaoxLightClusters;
+
+
+/*
+// DaoxLightClusters:
+// -- Assignment of the lights to the clusters of the view frustum for
+//    clustered forward shading;
+// -- Lights with zero range are unbounded and assigned to all clusters;
+// -- The data is laid out for uploading as float textures:
+//    lights: 2 RGBA texels per light: (position, range) and intensity;
+//    clusters: 1 RG texel per cluster: (index offset, light count);
+//    indices: 1 R texel per entry of the light index lists;
+*/
+struct DaoxLightClusters
+{
+	int     lightCount;
+	int     lightRows;
+	int     indexCount;
+	int     indexRows;
+	float   near;
+	float   far;
+	float   logScale;  /* slices per unit of log(depth/near); */
+	float   tanLeft;
+	float   tanBottom;
+	float   scaleX;    /* tiles per unit of x/depth; */
+	float   scaleY;    /* tiles per unit of y/depth; */
+	DArray *lights;    /* <float>; */
+	DArray *clusters;  /* <float>; */
+	DArray *indices;   /* <float>; */
+	DArray *offsets;   /* <int>; */
+	DArray *counts;    /* <int>; */
+	DArray *points;    /* <DaoxVector3D>: view space light positions; */
+};
+
+DaoxLightClusters* DaoxLightClusters_New();
+void DaoxLightClusters_Delete( DaoxLightClusters *self );
+
+void DaoxLightClusters_Build( DaoxLightClusters *self, DaoxViewFrustum *frustum, DaoxMatrix4D *worldToView, DList *lights );
+
+#endif
@@ -51,6 +51,7 @@
 #define DAO_ARRAY_ITEM_TYPES \
 	struct DaoxVector2D     *vectors2d; \
 	struct DaoxVector3D     *vectors3d; \
+	struct DaoxOBBox3D      *obboxes3d; \
 	struct DaoxMatrix4D     *matrices4d; \
 	struct DaoxVertex       *vertices;  \
 	struct DaoxTriangle     *triangles; \
@@ -0,0 +1,428 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dao_compression.h"
+
+
+
+int DaoxTextureFormat_BlockSize( int format )
+{
+	switch( format ){
+	case DAOX_TEXTURE_BC1 : return 8;
+	case DAOX_TEXTURE_BC3 : return 16;
+	case DAOX_TEXTURE_BC5 : return 16;
+	case DAOX_TEXTURE_ETC2_RGB : return 8;
+	case DAOX_TEXTURE_ETC2_RGBA : return 16;
+	}
+	return 4;
+}
+int DaoxTextureFormat_GLFormat( int format )
+{
+	switch( format ){
+	case DAOX_TEXTURE_BC1 : return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case DAOX_TEXTURE_BC3 : return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case DAOX_TEXTURE_BC5 : return GL_COMPRESSED_RG_RGTC2;
+	case DAOX_TEXTURE_ETC2_RGB : return GL_COMPRESSED_RGB8_ETC2;
+	case DAOX_TEXTURE_ETC2_RGBA : return GL_COMPRESSED_RGBA8_ETC2_EAC;
+	}
+	return GL_RGBA8;
+}
+daoint DaoxTextureFormat_LevelSize( int format, int width, int height )
+{
+	int blockSize = DaoxTextureFormat_BlockSize( format );
+	if( format == DAOX_TEXTURE_RGBA8 ) return blockSize * (daoint) width * height;
+	return blockSize * (daoint) ((width + 3) / 4) * ((height + 3) / 4);
+}
+
+
+
+/*
+// BC1 color block: two RGB565 end points, and 2-bit indices to the end points
+// and their 1/3 and 2/3 interpolations (with the first end point greater);
+// The end points are the extremes of the colors along their principal axis.
+*/
+static int DaoxBC_Pack565( const float color[3] )
+{
+	int r = (int)( color[0] * 31.0 / 255.0 + 0.5 );
+	int g = (int)( color[1] * 63.0 / 255.0 + 0.5 );
+	int b = (int)( color[2] * 31.0 / 255.0 + 0.5 );
+	r = r < 0 ? 0 : (r > 31 ? 31 : r);
+	g = g < 0 ? 0 : (g > 63 ? 63 : g);
+	b = b < 0 ? 0 : (b > 31 ? 31 : b);
+	return (r << 11) | (g << 5) | b;
+}
+static void DaoxBC_Unpack565( int color, int rgb[3] )
+{
+	int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+static void DaoxBC1_EncodeBlock( const uchar_t block[64], uchar_t *dest )
+{
+	float mean[3] = {0.0, 0.0, 0.0};
+	float cov[3][3] = {{0.0}};
+	float axis[3] = {1.0, 1.0, 1.0};
+	float end0[3], end1[3], mind = 0.0, maxd = 0.0;
+	int palette[4][3];
+	int i, j, k, c0, c1;
+	uint_t indices = 0;
+
+	for(i=0; i<16; ++i){
+		for(j=0; j<3; ++j) mean[j] += block[4*i+j] / 16.0;
+	}
+	for(i=0; i<16; ++i){
+		for(j=0; j<3; ++j){
+			for(k=0; k<3; ++k){
+				cov[j][k] += (block[4*i+j] - mean[j]) * (block[4*i+k] - mean[k]);
+			}
+		}
+	}
+	for(i=0; i<4; ++i){ /* Power iterations for the principal axis; */
+		float v[3], len;
+		for(j=0; j<3; ++j) v[j] = cov[j][0]*axis[0] + cov[j][1]*axis[1] + cov[j][2]*axis[2];
+		len = sqrt( v[0]*v[0] + v[1]*v[1] + v[2]*v[2] );
+		if( len < 1E-6 ) break;
+		for(j=0; j<3; ++j) axis[j] = v[j] / len;
+	}
+	for(i=0; i<16; ++i){
+		float d = 0.0;
+		for(j=0; j<3; ++j) d += (block[4*i+j] - mean[j]) * axis[j];
+		if( i == 0 || d < mind ) mind = d;
+		if( i == 0 || d > maxd ) maxd = d;
+	}
+	for(j=0; j<3; ++j){
+		end0[j] = mean[j] + maxd * axis[j];
+		end1[j] = mean[j] + mind * axis[j];
+	}
+	c0 = DaoxBC_Pack565( end0 );
+	c1 = DaoxBC_Pack565( end1 );
+	if( c0 < c1 ){
+		int c = c0;  c0 = c1;  c1 = c;
+	}
+	if( c0 != c1 ){
+		DaoxBC_Unpack565( c0, palette[0] );
+		DaoxBC_Unpack565( c1, palette[1] );
+		for(j=0; j<3; ++j){
+			palette[2][j] = (2*palette[0][j] + palette[1][j]) / 3;
+			palette[3][j] = (palette[0][j] + 2*palette[1][j]) / 3;
+		}
+		for(i=0; i<16; ++i){
+			int best = 0, minError = 0;
+			for(k=0; k<4; ++k){
+				int error = 0;
+				for(j=0; j<3; ++j){
+					int d = palette[k][j] - block[4*i+j];
+					error += d * d;
+				}
+				if( k == 0 || error < minError ){
+					minError = error;
+					best = k;
+				}
+			}
+			indices |= (uint_t) best << (2*i);
+		}
+	}
+	dest[0] = c0 & 0xff;
+	dest[1] = c0 >> 8;
+	dest[2] = c1 & 0xff;
+	dest[3] = c1 >> 8;
+	for(i=0; i<4; ++i) dest[4+i] = (indices >> (8*i)) & 0xff;
+}
+/*
+// BC4 single channel block: two 8-bit end points (the maximum and the minimum),
+// and 3-bit indices to the end points and their six interpolations;
+*/
+static void DaoxBC4_EncodeBlock( const uchar_t block[64], int channel, uchar_t *dest )
+{
+	unsigned long long bits = 0;
+	int i, k, a0 = 0, a1 = 255, palette[8];
+
+	for(i=0; i<16; ++i){
+		int value = block[4*i+channel];
+		if( value > a0 ) a0 = value;
+		if( value < a1 ) a1 = value;
+	}
+	palette[0] = a0;
+	palette[1] = a1;
+	for(k=2; k<8; ++k) palette[k] = ((8-k)*a0 + (k-1)*a1 + 3) / 7;
+	if( a0 != a1 ){
+		for(i=0; i<16; ++i){
+			int value = block[4*i+channel];
+			int best = 0, minError = 256;
+			for(k=0; k<8; ++k){
+				int error = abs( palette[k] - value );
+				if( error < minError ){
+					minError = error;
+					best = k;
+				}
+			}
+			bits |= (unsigned long long) best << (3*i);
+		}
+	}
+	dest[0] = a0;
+	dest[1] = a1;
+	for(i=0; i<6; ++i) dest[2+i] = (bits >> (8*i)) & 0xff;
+}
+
+
+
+/*
+// ETC2 RGB block in the individual mode of ETC1 (so that it never triggers
+// the ETC2 specific modes): two sub-blocks (2x4 or 4x2 by the flip bit) with
+// RGB444 base colors and intensity modifier tables, and 2-bit indices to the
+// modifiers of the table; The data is stored in big endian, and the pixels
+// are indexed in column major order.
+*/
+static const int daox_etc1_modifiers[8][2] =
+{
+	{2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}
+};
+static int DaoxETC_Clamp( int value )
+{
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+static int DaoxETC1_EncodeSubblock( const uchar_t block[64], int flip, int sub, int base[3], int *table, int indices[16] )
+{
+	int pixels[8];
+	int i, j, k, t, minError = -1;
+	int sum[3] = {0, 0, 0};
+
+	for(i=0; i<8; ++i){
+		int x = flip ? (i % 4) : (2*sub + i % 2);
+		int y = flip ? (2*sub + i / 4) : (i / 2);
+		pixels[i] = 4*y + x;
+		for(j=0; j<3; ++j) sum[j] += block[4*pixels[i]+j];
+	}
+	for(j=0; j<3; ++j) base[j] = (sum[j] * 15 + 8 * 255 / 2) / (8 * 255);
+	for(t=0; t<8; ++t){
+		int modifiers[4], choices[8], error = 0;
+		modifiers[0] = daox_etc1_modifiers[t][0];
+		modifiers[1] = daox_etc1_modifiers[t][1];
+		modifiers[2] = - modifiers[0];
+		modifiers[3] = - modifiers[1];
+		for(i=0; i<8; ++i){
+			const uchar_t *pixel = block + 4*pixels[i];
+			int best = 0, minError2 = -1;
+			for(k=0; k<4; ++k){
+				int error2 = 0;
+				for(j=0; j<3; ++j){
+					int d = DaoxETC_Clamp( 17*base[j] + modifiers[k] ) - pixel[j];
+					error2 += d * d;
+				}
+				if( minError2 < 0 || error2 < minError2 ){
+					minError2 = error2;
+					best = k;
+				}
+			}
+			choices[i] = best;
+			error += minError2;
+		}
+		if( minError < 0 || error < minError ){
+			minError = error;
+			*table = t;
+			for(i=0; i<8; ++i) indices[pixels[i]] = choices[i];
+		}
+	}
+	return minError;
+}
+static void DaoxETC1_EncodeBlock( const uchar_t block[64], uchar_t *dest )
+{
+	int bases[2][2][3], tables[2][2], indices[2][16];
+	int i, flip, best = 0, errors[2];
+	uint_t high, low = 0;
+
+	for(flip=0; flip<2; ++flip){
+		errors[flip] = DaoxETC1_EncodeSubblock( block, flip, 0, bases[flip][0], & tables[flip][0], indices[flip] );
+		errors[flip] += DaoxETC1_EncodeSubblock( block, flip, 1, bases[flip][1], & tables[flip][1], indices[flip] );
+	}
+	best = errors[1] < errors[0];
+	high = (bases[best][0][0] << 28) | (bases[best][1][0] << 24);
+	high |= (bases[best][0][1] << 20) | (bases[best][1][1] << 16);
+	high |= (bases[best][0][2] << 12) | (bases[best][1][2] << 8);
+	high |= (tables[best][0] << 5) | (tables[best][1] << 2) | best; /* diff bit = 0; */
+	for(i=0; i<16; ++i){
+		int index = indices[best][i];
+		int bit = 4 * (i % 4) + i / 4;  /* column major; */
+		low |= (uint_t)(index >> 1) << (16 + bit);
+		low |= (uint_t)(index & 1) << bit;
+	}
+	for(i=0; i<4; ++i){
+		dest[i] = (high >> (24 - 8*i)) & 0xff;
+		dest[4+i] = (low >> (24 - 8*i)) & 0xff;
+	}
+}
+/*
+// EAC alpha block: 8-bit base value, 4-bit multiplier and modifier table,
+// and 3-bit indices to the modifiers (big endian, column major);
+*/
+static const int daox_eac_modifiers[16][8] =
+{
+	{-3, -6,  -9, -15, 2, 5, 8, 14},
+	{-3, -7, -10, -13, 2, 6, 9, 12},
+	{-2, -5,  -8, -13, 1, 4, 7, 12},
+	{-2, -4,  -6, -13, 1, 3, 5, 12},
+	{-3, -6,  -8, -12, 2, 5, 7, 11},
+	{-3, -7,  -9, -11, 2, 6, 8, 10},
+	{-4, -7,  -8, -11, 3, 6, 7, 10},
+	{-3, -5,  -8, -11, 2, 4, 7, 10},
+	{-2, -6,  -8, -10, 1, 5, 7,  9},
+	{-2, -5,  -8, -10, 1, 4, 7,  9},
+	{-2, -4,  -8, -10, 1, 3, 7,  9},
+	{-2, -5,  -7, -10, 1, 4, 6,  9},
+	{-3, -4,  -7, -10, 2, 3, 6,  9},
+	{-1, -2,  -3, -10, 0, 1, 2,  9},
+	{-4, -6,  -8,  -9, 3, 5, 7,  8},
+	{-3, -5,  -7,  -9, 2, 4, 6,  8}
+};
+static void DaoxEAC_EncodeBlock( const uchar_t block[64], uchar_t *dest )
+{
+	unsigned long long bits = 0;
+	int i, k, t, m, amin = 255, amax = 0, base;
+	int bestTable = 13, bestMult = 1, minError = -1;
+
+	for(i=0; i<16; ++i){
+		int alpha = block[4*i+3];
+		if( alpha < amin ) amin = alpha;
+		if( alpha > amax ) amax = alpha;
+	}
+	base = (amin + amax + 1) / 2;
+	for(t=0; t<16 && minError != 0; ++t){
+		const int *modifiers = daox_eac_modifiers[t];
+		int range = modifiers[7] - modifiers[3];
+		int mult = (amax - amin + range/2) / range;
+		for(m=mult-1; m<=mult+1; ++m){
+			int error = 0;
+			if( m < 1 || m > 15 ) continue;
+			for(i=0; i<16 && (minError < 0 || error < minError); ++i){
+				int alpha = block[4*i+3], minError2 = -1;
+				for(k=0; k<8; ++k){
+					int d = DaoxETC_Clamp( base + modifiers[k] * m ) - alpha;
+					if( minError2 < 0 || d*d < minError2 ) minError2 = d*d;
+				}
+				error += minError2;
+			}
+			if( minError < 0 || error < minError ){
+				minError = error;
+				bestTable = t;
+				bestMult = m;
+			}
+		}
+	}
+	bits = ((unsigned long long) base << 56) | ((unsigned long long) bestMult << 52);
+	bits |= (unsigned long long) bestTable << 48;
+	for(i=0; i<16; ++i){
+		int alpha = block[4*i+3];
+		int pixel = 4 * (i % 4) + i / 4;  /* column major; */
+		int best = 0, minError2 = -1;
+		for(k=0; k<8; ++k){
+			int d = DaoxETC_Clamp( base + daox_eac_modifiers[bestTable][k] * bestMult ) - alpha;
+			if( minError2 < 0 || d*d < minError2 ){
+				minError2 = d*d;
+				best = k;
+			}
+		}
+		bits |= (unsigned long long) best << (45 - 3*pixel);
+	}
+	for(i=0; i<8; ++i) dest[i] = (bits >> (56 - 8*i)) & 0xff;
+}
+
+
+
+typedef struct DaoxBlockCompression DaoxBlockCompression;
+struct DaoxBlockCompression
+{
+	int             format;
+	const uchar_t  *rgba;
+	int             width;
+	int             height;
+	uchar_t        *dest;
+};
+
+/* Compress the rows of blocks in [first,last): */
+static void DaoxTextureFormat_CompressRows( void *data, int first, int last )
+{
+	DaoxBlockCompression *job = (DaoxBlockCompression*) data;
+	int blockSize = DaoxTextureFormat_BlockSize( job->format );
+	int blocksX = (job->width + 3) / 4;
+	uchar_t block[64];
+	int by, bx, i;
+
+	for(by=first; by<last; ++by){
+		for(bx=0; bx<blocksX; ++bx){
+			uchar_t *dest = job->dest + ((daoint) by * blocksX + bx) * blockSize;
+			/* The edge pixels are repeated for the partial blocks: */
+			for(i=0; i<16; ++i){
+				int x = 4*bx + i % 4, y = 4*by + i / 4;
+				if( x >= job->width ) x = job->width - 1;
+				if( y >= job->height ) y = job->height - 1;
+				memcpy( block + 4*i, job->rgba + 4 * ((daoint) y * job->width + x), 4 );
+			}
+			switch( job->format ){
+			case DAOX_TEXTURE_BC1 :
+				DaoxBC1_EncodeBlock( block, dest );
+				break;
+			case DAOX_TEXTURE_BC3 :
+				DaoxBC4_EncodeBlock( block, 3, dest );
+				DaoxBC1_EncodeBlock( block, dest + 8 );
+				break;
+			case DAOX_TEXTURE_BC5 :
+				DaoxBC4_EncodeBlock( block, 0, dest );
+				DaoxBC4_EncodeBlock( block, 1, dest + 8 );
+				break;
+			case DAOX_TEXTURE_ETC2_RGB :
+				DaoxETC1_EncodeBlock( block, dest );
+				break;
+			case DAOX_TEXTURE_ETC2_RGBA :
+				DaoxEAC_EncodeBlock( block, dest );
+				DaoxETC1_EncodeBlock( block, dest + 8 );
+				break;
+			}
+		}
+	}
+}
+void DaoxTextureFormat_Compress( int format, const uchar_t *rgba, int width, int height,
+		uchar_t *dest, DaoxThreadPool *workers )
+{
+	DaoxBlockCompression job;
+
+	if( format == DAOX_TEXTURE_RGBA8 ){
+		memcpy( dest, rgba, 4 * (daoint) width * height );
+		return;
+	}
+	job.format = format;
+	job.rgba = rgba;
+	job.width = width;
+	job.height = height;
+	job.dest = dest;
+	DaoxThreadPool_RunRanges( workers, DaoxTextureFormat_CompressRows, & job, (height + 3) / 4, 4 );
+}
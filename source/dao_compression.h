@@ -0,0 +1,84 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __DAO_COMPRESSION__
+#define __DAO_COMPRESSION__
+
+#include "dao_opengl.h"
+#include "dao_parallel.h"
+
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT   0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT  0x83F3
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+#define GL_COMPRESSED_RG_RGTC2            0x8DBD
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2           0x9274
+#endif
+#ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+#define GL_COMPRESSED_RGBA8_ETC2_EAC      0x9278
+#endif
+
+
+/*
+// Texture formats for the streaming, all the compressed formats use 4x4 blocks:
+// BC1: opaque color, 8 bytes per block;
+// BC3: color with alpha (BC1 color and BC4 alpha), 16 bytes per block;
+// BC5: two channels (two BC4 blocks), for normal maps, 16 bytes per block;
+// ETC2_RGB: opaque color (in the ETC1 compatible mode), 8 bytes per block;
+// ETC2_RGBA: color with EAC alpha, 16 bytes per block;
+*/
+enum DaoxTextureFormat
+{
+	DAOX_TEXTURE_RGBA8 = 0,
+	DAOX_TEXTURE_BC1 ,
+	DAOX_TEXTURE_BC3 ,
+	DAOX_TEXTURE_BC5 ,
+	DAOX_TEXTURE_ETC2_RGB ,
+	DAOX_TEXTURE_ETC2_RGBA
+};
+
+
+/* Bytes per 4x4 block (or per pixel for DAOX_TEXTURE_RGBA8): */
+int DaoxTextureFormat_BlockSize( int format );
+int DaoxTextureFormat_GLFormat( int format );
+daoint DaoxTextureFormat_LevelSize( int format, int width, int height );
+
+/*
+// Compress an RGBA image into blocks, with the rows of blocks distributed
+// to the workers (which can be NULL):
+*/
+void DaoxTextureFormat_Compress( int format, const uchar_t *rgba, int width, int height,
+		uchar_t *dest, DaoxThreadPool *workers );
+
+#endif
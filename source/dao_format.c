@@ -422,6 +422,7 @@ DaoxScene* DaoxResource_LoadObjSource( DaoxResource *self, DString *source, DStr
 		DaoxScene_AddNode( scene, (DaoxSceneNode*) model );
 	}
 	//printf( "nodes: %i\n", scene->nodes->size );
+	DaoxScene_MakeLODs( scene, DAOX_MESH_LODS );
 	DaoxObjParser_Delete( parser );
 	DString_Delete( source2 );
 	DString_Delete( string );
@@ -1398,6 +1399,7 @@ int DaoxColladaParser_Parse( void *userdata, DaoXmlNode *node )
 		sceneNode->translation.x = floats->data.floats[0];
 		sceneNode->translation.y = floats->data.floats[1];
 		sceneNode->translation.z = floats->data.floats[2];
+		DaoxSceneNode_MarkDirty( sceneNode );
 		break;
 	case DAE_ROTATE :
 		sceneNode = (DaoxSceneNode*) DaoXmlNode_GetAncestorDataMBS( node, "node", 1 );
@@ -1415,6 +1417,7 @@ int DaoxColladaParser_Parse( void *userdata, DaoXmlNode *node )
 		if( floats->data.floats[0] > 0.9 ) pvector->x = fvalue; else
 		if( floats->data.floats[1] > 0.9 ) pvector->y = fvalue; else
 		if( floats->data.floats[2] > 0.9 ) pvector->z = fvalue;
+		DaoxSceneNode_MarkDirty( sceneNode );
 		break;
 	case DAE_MATRIX :
 		sceneNode = (DaoxSceneNode*) DaoXmlNode_GetAncestorDataMBS( node, "node", 1 );
@@ -1438,6 +1441,7 @@ int DaoxColladaParser_Parse( void *userdata, DaoXmlNode *node )
 		sceneNode->translation.x = matrix.B1;
 		sceneNode->translation.y = matrix.B2;
 		sceneNode->translation.z = matrix.B3;
+		DaoxSceneNode_MarkDirty( sceneNode );
 		// TODO: check or warn matrices that are not rotation with translation;
 		break;
 	case DAE_INSTANCE_CAMERA :
@@ -1750,6 +1754,7 @@ void DaoxSceneNode_ConvertAnglesToAxisRotation( DaoxSceneNode *self )
 		quaternion = DaoxQuaternion_FromEulerAngleVector( joint->orientation );
 		joint->orientation = DaoxQuaternion_ToRotation( & quaternion );
 	}
+	DaoxSceneNode_MarkDirty( self );
 	for(i=0; i<self->children->size; ++i){
 		DaoxSceneNode *node2 = self->children->items.pSceneNode[i];
 		DaoxSceneNode_ConvertAnglesToAxisRotation( node2 );
@@ -1808,6 +1813,7 @@ DaoxScene* DaoxResource_LoadColladaSource( DaoxResource *self, DString *source,
 		DaoxSceneNode_SortAnimations( parser->animatedNodes->items.pSceneNode[i] );
 	}
 	scene = parser->currentScene;
+	if( scene ) DaoxScene_MakeLODs( scene, DAOX_MESH_LODS );
 	DaoxColladaParser_Delete( parser );
 	printf( "Scene: %i nodes; %i lights; %p\n", scene->nodes->size, scene->lights->size, scene->camera );
 	return scene;
@@ -1292,6 +1292,7 @@ static void DaoxMeshUnit_HandleGC( DaoValue *p, DList *values, DList *lists, DLi
 	DaoxMeshUnit *self = (DaoxMeshUnit*) p;
 	if( self->mesh ) DList_Append( values, self->mesh );
 	if( self->material ) DList_Append( values, self->material );
+	DList_Append( lists, self->lods );
 	if( remove ){
 		self->mesh = NULL;
 		self->material = NULL;
@@ -1325,8 +1326,15 @@ DaoTypeCore daoMeshUnitCore =
 };
 
 
+static void MESH_MakeLODs( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxMesh *self = (DaoxMesh*) p[0];
+	DaoxMesh_MakeLODs( self, p[1]->xInteger.value );
+}
+
 static DaoFunctionEntry DaoxMeshMeths[]=
 {
+	{ MESH_MakeLODs,  "MakeLODs( self: Mesh, levels = 3 )" },
 	{ NULL, NULL }
 };
 static void DaoxMesh_HandleGC( DaoValue *p, DList *values, DList *lists, DList *maps, int remove )
@@ -1704,11 +1712,19 @@ static void LIGHT_New( DaoProcess *proc, DaoValue *p[], int N )
 	self->intensity.blue = p[3]->xFloat.value;
 	DaoProcess_PutValue( proc, (DaoValue*) self );
 }
+static void LIGHT_SetRange( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxLight *self = (DaoxLight*) p[0];
+	self->range = p[1]->xFloat.value;
+}
 static DaoFunctionEntry DaoxLightMeths[]=
 {
 	{ LIGHT_New,
 		"Light( litype: enum<ambient,point,directional,spot>, red =1.0, green =1.0, blue =1.0 )"
 	},
+	{ LIGHT_SetRange,
+		"SetRange( self: Light, range: float )"
+	},
 	{ NULL, NULL }
 };
 
@@ -1813,11 +1829,19 @@ static void MODEL_SetMaterial( DaoProcess *proc, DaoValue *p[], int N )
 	DaoxMaterial *mat = (DaoxMaterial*) p[1];
 	DaoxMesh_SetMaterial( self->mesh, mat );
 }
+static void MODEL_SetOccluder( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxModel *self = (DaoxModel*) p[0];
+	self->occluder = p[1]->xBoolean.value;
+}
 static DaoFunctionEntry DaoxModelMeths[]=
 {
 	{ MODEL_SetMaterial,
 		"SetMaterial( self: Model, material: Material )"
 	},
+	{ MODEL_SetOccluder,
+		"SetOccluder( self: Model, occluder = true )"
+	},
 	{ NULL, NULL }
 };
 static void DaoxModel_HandleGC( DaoValue *p, DList *values, DList *lists, DList *maps, int remove )
@@ -2079,6 +2103,11 @@ static void SCENE_New( DaoProcess *proc, DaoValue *p[], int N )
 	DaoxScene *self = DaoxScene_New();
 	DaoProcess_PutValue( proc, (DaoValue*) self );
 }
+static void SCENE_Update( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxScene *self = (DaoxScene*) p[0];
+	DaoxScene_Update( self, p[1]->xFloat.value );
+}
 static void SCENE_SetBackground( DaoProcess *proc, DaoValue *p[], int N )
 {
 	DaoxScene *self = (DaoxScene*) p[0];
@@ -2173,6 +2202,7 @@ static DaoFunctionEntry DaoxSceneMeths[] =
 	{ SCENE_New,         "Scene()" },
 	{ SCENE_SetBackground,  "SetBackground( self: Scene, red: float, green: float, blue: float, alpha = 1.0 )" },
 	{ SCENE_AddNode,     "AddNode( self: Scene, node: SceneNode )" },
+	{ SCENE_Update,      "Update( self: Scene, dtime: float )" },
 	{ SCENE_AddBox,      "AddBox( self: Scene, xlen = 1.0, ylen = 1.0, zlen = 1.0 ) => Model" },
 	{ SCENE_AddSphere,   "AddSphere( self: Scene, radius = 1.0, resolution = 3 ) => Model" },
 	{ SCENE_AddRectTerrain,
@@ -2323,8 +2353,48 @@ static void RENDR_Enable( DaoProcess *proc, DaoValue *p[], int N )
 	switch( p[1]->xEnum.value ){
 	case 0 : self->showAxis = bl; break;
 	case 1 : self->showMesh = bl; break;
+	case 2 : DaoxRenderer_RetainMeshes( self, bl ); break;
+	case 3 : self->instancing = bl; break;
+	case 4 : self->parallel = bl; break;
+	case 5 : self->occlusion = bl; break;
+	case 6 : self->lod = bl; break;
+	case 7 : self->cpuSkinning = bl; break;
+	case 8 : self->profiler->enabled = bl; break;
+	case 9 : self->profiler->dump = bl; break;
+	case 10 : self->depthPrepass = bl; break;
+	case 11 : self->frontToBack = bl; break;
+	case 12 : DaoxRenderer_UseCompactLayout( self, bl ); break;
+	case 13 : self->indirect = bl; break;
+	case 14 : self->variants = bl; break;
+	case 15 : self->streamTextures = bl; break;
 	}
 }
+static void RENDR_SetLODTolerance( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxRenderer *self = (DaoxRenderer*) p[0];
+	self->lodTolerance = p[1]->xFloat.value;
+}
+static void RENDR_GetStats( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxRenderer *self = (DaoxRenderer*) p[0];
+	DaoxFrameStats *stats = & self->profiler->last;
+	int i;
+
+	DaoProcess_NewInteger( proc, stats->frame );
+	for(i=0; i<DAOX_PROFILE_PHASES; ++i) DaoProcess_NewFloat( proc, stats->cpuTimes[i] );
+	DaoProcess_NewFloat( proc, stats->gpuTime );
+	DaoProcess_NewInteger( proc, stats->drawCalls );
+	DaoProcess_NewInteger( proc, stats->triangles );
+	DaoProcess_NewInteger( proc, stats->uploadedBytes );
+	DaoProcess_NewInteger( proc, stats->culledChunks );
+	DaoProcess_NewInteger( proc, stats->occludedChunks );
+	DaoProcess_PutTuple( proc, -(7 + DAOX_PROFILE_PHASES) );
+}
+static void RENDR_SetParticleResolution( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxRenderer *self = (DaoxRenderer*) p[0];
+	self->particleScale = 1 << p[1]->xEnum.value;
+}
 static void RENDR_Render( DaoProcess *proc, DaoValue *p[], int N )
 {
 	DaoxRenderer *self = (DaoxRenderer*) p[0];
@@ -2336,8 +2406,11 @@ static DaoFunctionEntry DaoxRendererMeths[]=
 	{ RENDR_New,         "Renderer( contex: Context )" },
 	{ RENDR_SetCurrentCamera,  "SetCurrentCamera( self: Renderer, camera: Camera )" },
 	{ RENDR_GetCurrentCamera,  "GetCurrentCamera( self: Renderer ) => Camera" },
-	{ RENDR_Enable,  "Enable( self: Renderer, what: enum<axis,mesh>, bl = true )" },
+	{ RENDR_Enable,  "Enable( self: Renderer, what: enum<axis,mesh,retained,instancing,parallel,occlusion,lod,cpuskinning,profiler,profilerdump,prepass,fronttoback,compact,indirect,variants,streaming>, bl = true )" },
+	{ RENDR_SetLODTolerance,  "SetLODTolerance( self: Renderer, pixels: float )" },
+	{ RENDR_SetParticleResolution,  "SetParticleResolution( self: Renderer, resolution: enum<full,half,quarter> )" },
 	{ RENDR_Render,  "Render( self: Renderer, scene: Scene )" },
+	{ RENDR_GetStats,  "GetStats( self: Renderer ) => tuple<frame:int,update:float,prepare:float,upload:float,draw:float,canvas:float,gpu:float,drawCalls:int,triangles:int,uploadedBytes:int,culledChunks:int,occludedChunks:int>" },
 	{ NULL, NULL }
 };
 static void DaoxRenderer_HandleGC( DaoValue *p, DList *values, DList *lists, DList *maps, int remove )
@@ -2346,20 +2419,29 @@ static void DaoxRenderer_HandleGC( DaoValue *p, DList *values, DList *lists, DLi
 	if( self->scene ) DList_Append( values, self->scene );
 	if( self->camera ) DList_Append( values, self->camera );
 	DList_Append( values, self->shader );
+	if( self->downsampleShader ) DList_Append( values, self->downsampleShader );
+	if( self->compositeShader ) DList_Append( values, self->compositeShader );
 	DList_Append( values, self->buffer );
 	DList_Append( values, self->bufferVG );
 	DList_Append( values, self->bufferSK );
+	DList_Append( values, self->bufferRT );
 	DList_Append( values, self->context );
 	DList_Append( values, self->axisMesh );
 	DList_Append( values, self->worldAxis );
 	DList_Append( values, self->localAxis );
+	DaoxMeshStorage_HandleGC( self->storage, values, remove );
+	DaoxMeshStorage_HandleGC( self->storageSK, values, remove );
+	if( self->materials ) DaoxMaterialCache_HandleGC( self->materials, values, remove );
 	if( remove ){
 		self->scene = NULL;
 		self->camera = NULL;
 		self->shader = NULL;
+		self->downsampleShader = NULL;
+		self->compositeShader = NULL;
 		self->buffer = NULL;
 		self->bufferVG = NULL;
 		self->bufferSK = NULL;
+		self->bufferRT = NULL;
 		self->context = NULL;
 		self->axisMesh = NULL;
 		self->worldAxis = NULL;
@@ -2751,16 +2833,51 @@ static void CTX_New( DaoProcess *proc, DaoValue *p[], int N )
 	self->deviceWidth  = p[0]->xInteger.value;
 	self->deviceHeight = p[1]->xInteger.value;
 	DaoProcess_PutValue( proc, (DaoValue*) self );
+	if( p[2]->xBoolean.value && DaoxContext_InitHeadless( self ) == 0 ){
+		DaoProcess_RaiseError( proc, NULL, "Failed to create headless context" );
+	}
 }
 static void CTX_Quit( DaoProcess *proc, DaoValue *p[], int N )
 {
 	DaoxContext *self = (DaoxContext*) p[0];
 	DaoxContext_Clear( self );
 }
+static void CTX_Finish( DaoProcess *proc, DaoValue *p[], int N )
+{
+	glFinish();
+}
+static void CTX_SetTextureBudget( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxContext *self = (DaoxContext*) p[0];
+	daoint budget = p[1]->xInteger.value;
+	daoint upload = p[2]->xInteger.value;
+	DaoxContext_SetTextureBudget( self, budget << 20, upload << 20 );
+}
+static void CTX_SetShaderCache( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxContext *self = (DaoxContext*) p[0];
+	DaoxContext_SetShaderCache( self, DaoValue_TryGetChars( p[1] ) );
+}
+static void CTX_SetTextureCache( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxContext *self = (DaoxContext*) p[0];
+	DaoxContext_SetTextureCache( self, DaoValue_TryGetChars( p[1] ) );
+}
+static void CTX_SetTextureCompression( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoxContext *self = (DaoxContext*) p[0];
+	DaoxContext_SetTextureCompression( self, p[1]->xBoolean.value );
+}
 static DaoFunctionEntry DaoxContextMeths[]=
 {
-	{ CTX_New,   "Context( width: int, height: int )" },
+	{ CTX_New,   "Context( width: int, height: int, headless = false )" },
 	{ CTX_Quit,  "Quit( self: Context )" },
+	{ CTX_Finish,  "Finish( self: Context )" },
+	{ CTX_SetShaderCache,  "SetShaderCache( self: Context, path: string )" },
+	/* GPU memory budget of the textures and uploading per frame in megabytes: */
+	{ CTX_SetTextureBudget,  "SetTextureBudget( self: Context, budget: int, upload = 4 )" },
+	{ CTX_SetTextureCache,  "SetTextureCache( self: Context, path: string )" },
+	{ CTX_SetTextureCompression,  "SetTextureCompression( self: Context, enable = true )" },
 	{ NULL, NULL }
 };
 
@@ -2812,12 +2929,19 @@ static void GRAPHICS_Backend( DaoProcess *proc, DaoValue *p[], int N )
 	DaoProcess_PutEnum( proc, "OpenGL" );
 #   endif
 }
+static void GRAPHICS_GetTime( DaoProcess *proc, DaoValue *p[], int N )
+{
+	DaoProcess_PutFloat( proc, Dao_GetCurrentTime() );
+}
 
 static DaoFunctionEntry globalMeths[]=
 {
 	{ GRAPHICS_Backend,
 		"Backend() => enum<OpenGL,OpenGLES>"
 	},
+	{ GRAPHICS_GetTime,
+		"GetTime() => float"  /* in seconds; */
+	},
 	{ NULL, NULL }
 };
 
@@ -0,0 +1,265 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include <string.h>
+#include "dao_headless.h"
+
+#ifdef DAO_GRAPHICS_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef DAO_GRAPHICS_USE_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+
+
+#ifdef DAO_GRAPHICS_USE_EGL
+
+/*
+// Prefer a display on the first EGL device, which works on GPU servers
+// without X or Wayland; then the Mesa surfaceless platform, which works
+// with llvmpipe on machines without GPU; then the default display.
+*/
+static EGLDisplay DaoxHeadless_GetDisplay()
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+	const char *extensions = eglQueryString( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+
+#ifdef EGL_EXT_platform_base
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = NULL;
+
+	if( extensions && strstr( extensions, "EGL_EXT_platform_base" ) ){
+		getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+			eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+	}
+#ifdef EGL_EXT_platform_device
+	if( getPlatformDisplay && strstr( extensions, "EGL_EXT_platform_device" ) ){
+		PFNEGLQUERYDEVICESEXTPROC queryDevices = (PFNEGLQUERYDEVICESEXTPROC)
+			eglGetProcAddress( "eglQueryDevicesEXT" );
+		EGLDeviceEXT device;
+		EGLint count = 0;
+		if( queryDevices && queryDevices( 1, & device, & count ) && count > 0 ){
+			display = getPlatformDisplay( EGL_PLATFORM_DEVICE_EXT, device, NULL );
+		}
+	}
+#endif
+#ifdef EGL_MESA_platform_surfaceless
+	if( display == EGL_NO_DISPLAY && getPlatformDisplay ){
+		if( strstr( extensions, "EGL_MESA_platform_surfaceless" ) ){
+			display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+		}
+	}
+#endif
+#endif
+	if( display == EGL_NO_DISPLAY ) display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+	return display;
+}
+
+static int DaoxHeadless_InitEGL( DaoxHeadless *self )
+{
+	EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE,     EGL_PBUFFER_BIT,
+		EGL_RED_SIZE,         8,
+		EGL_GREEN_SIZE,       8,
+		EGL_BLUE_SIZE,        8,
+		EGL_ALPHA_SIZE,       8,
+		EGL_DEPTH_SIZE,       24,
+#ifdef DAO_GRAPHICS_USE_GLES
+		EGL_RENDERABLE_TYPE,  EGL_OPENGL_ES2_BIT,
+#else
+		EGL_RENDERABLE_TYPE,  EGL_OPENGL_BIT,
+#endif
+		EGL_NONE
+	};
+	EGLint surfaceAttribs[] = {
+		EGL_WIDTH,   self->width,
+		EGL_HEIGHT,  self->height,
+		EGL_NONE
+	};
+	EGLint contextAttribs[] = {
+#ifdef DAO_GRAPHICS_USE_GLES
+		EGL_CONTEXT_CLIENT_VERSION,  3,
+#else
+		EGL_CONTEXT_MAJOR_VERSION_KHR,        3,
+		EGL_CONTEXT_MINOR_VERSION_KHR,        2,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR,  EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+#endif
+		EGL_NONE
+	};
+	EGLint *attribs = contextAttribs;
+	EGLDisplay display = DaoxHeadless_GetDisplay();
+	EGLSurface surface = EGL_NO_SURFACE;
+	EGLContext context = EGL_NO_CONTEXT;
+	EGLConfig config;
+	EGLint major, minor, count = 0;
+
+	if( display == EGL_NO_DISPLAY ) return 0;
+	if( eglInitialize( display, & major, & minor ) == EGL_FALSE ) return 0;
+
+#ifndef DAO_GRAPHICS_USE_GLES
+	/* The version and profile attributes require EGL_KHR_create_context (or EGL 1.5): */
+	if( major == 1 && minor < 5 ){
+		static EGLint plainAttribs[] = { EGL_NONE };
+		const char *extensions = eglQueryString( display, EGL_EXTENSIONS );
+		if( extensions == NULL || strstr( extensions, "EGL_KHR_create_context" ) == NULL ){
+			attribs = plainAttribs;
+		}
+	}
+#endif
+
+#ifdef DAO_GRAPHICS_USE_GLES
+	if( eglBindAPI( EGL_OPENGL_ES_API ) == EGL_FALSE ) goto Failed;
+#else
+	if( eglBindAPI( EGL_OPENGL_API ) == EGL_FALSE ) goto Failed;
+#endif
+	if( eglChooseConfig( display, configAttribs, & config, 1, & count ) == EGL_FALSE ) goto Failed;
+	if( count == 0 ) goto Failed;
+
+	surface = eglCreatePbufferSurface( display, config, surfaceAttribs );
+	if( surface == EGL_NO_SURFACE ) goto Failed;
+
+	context = eglCreateContext( display, config, EGL_NO_CONTEXT, attribs );
+	if( context == EGL_NO_CONTEXT ) goto Failed;
+
+	self->backend = DAOX_HEADLESS_EGL;
+	self->display = (void*) display;
+	self->surface = (void*) surface;
+	self->context = (void*) context;
+	return 1;
+
+Failed:
+	if( surface != EGL_NO_SURFACE ) eglDestroySurface( display, surface );
+	eglTerminate( display );
+	return 0;
+}
+
+#endif
+
+
+
+#ifdef DAO_GRAPHICS_USE_OSMESA
+
+static int DaoxHeadless_InitOSMesa( DaoxHeadless *self )
+{
+	OSMesaContext context = NULL;
+
+#ifdef OSMESA_CONTEXT_MAJOR_VERSION
+	const int attribs[] = {
+		OSMESA_FORMAT,                 OSMESA_RGBA,
+		OSMESA_DEPTH_BITS,             24,
+		OSMESA_STENCIL_BITS,           8,
+		OSMESA_PROFILE,                OSMESA_CORE_PROFILE,
+		OSMESA_CONTEXT_MAJOR_VERSION,  3,
+		OSMESA_CONTEXT_MINOR_VERSION,  2,
+		0
+	};
+	context = OSMesaCreateContextAttribs( attribs, NULL );
+#else
+	context = OSMesaCreateContextExt( OSMESA_RGBA, 24, 8, 0, NULL );
+#endif
+	if( context == NULL ) return 0;
+
+	self->backend = DAOX_HEADLESS_OSMESA;
+	self->context = (void*) context;
+	self->pixels = dao_calloc( self->width * self->height, 4*sizeof(GLubyte) );
+	return 1;
+}
+
+#endif
+
+
+
+DaoxHeadless* DaoxHeadless_New( int width, int height )
+{
+	DaoxHeadless *self = (DaoxHeadless*) dao_calloc( 1, sizeof(DaoxHeadless) );
+	self->width = width;
+	self->height = height;
+
+#ifdef DAO_GRAPHICS_USE_EGL
+	if( self->backend == DAOX_HEADLESS_NONE ) DaoxHeadless_InitEGL( self );
+#endif
+#ifdef DAO_GRAPHICS_USE_OSMESA
+	if( self->backend == DAOX_HEADLESS_NONE ) DaoxHeadless_InitOSMesa( self );
+#endif
+
+	if( self->backend == DAOX_HEADLESS_NONE || DaoxHeadless_MakeCurrent( self ) == 0 ){
+		DaoxHeadless_Delete( self );
+		return NULL;
+	}
+	return self;
+}
+void DaoxHeadless_Delete( DaoxHeadless *self )
+{
+	switch( self->backend ){
+#ifdef DAO_GRAPHICS_USE_EGL
+	case DAOX_HEADLESS_EGL :
+		eglMakeCurrent( self->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+		eglDestroyContext( self->display, self->context );
+		eglDestroySurface( self->display, self->surface );
+		eglTerminate( self->display );
+		break;
+#endif
+#ifdef DAO_GRAPHICS_USE_OSMESA
+	case DAOX_HEADLESS_OSMESA :
+		OSMesaDestroyContext( (OSMesaContext) self->context );
+		break;
+#endif
+	default : break;
+	}
+	if( self->pixels ) dao_free( self->pixels );
+	dao_free( self );
+}
+
+int DaoxHeadless_MakeCurrent( DaoxHeadless *self )
+{
+	switch( self->backend ){
+#ifdef DAO_GRAPHICS_USE_EGL
+	case DAOX_HEADLESS_EGL :
+		return eglMakeCurrent( self->display, self->surface, self->surface, self->context ) == EGL_TRUE;
+#endif
+#ifdef DAO_GRAPHICS_USE_OSMESA
+	case DAOX_HEADLESS_OSMESA :
+		return OSMesaMakeCurrent( (OSMesaContext) self->context, self->pixels,
+				GL_UNSIGNED_BYTE, self->width, self->height ) == GL_TRUE;
+#endif
+	default : break;
+	}
+	return 0;
+}
+
+const char* DaoxHeadless_GetBackendName( DaoxHeadless *self )
+{
+	switch( self->backend ){
+	case DAOX_HEADLESS_EGL : return "egl";
+	case DAOX_HEADLESS_OSMESA : return "osmesa";
+	}
+	return "none";
+}
@@ -0,0 +1,73 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#ifndef __DAO_HEADLESS__
+#define __DAO_HEADLESS__
+
+#include "dao_opengl.h"
+
+
+enum DaoxHeadlessBackend
+{
+	DAOX_HEADLESS_NONE ,
+	DAOX_HEADLESS_EGL ,     /* EGL pbuffer on a device or surfaceless display; */
+	DAOX_HEADLESS_OSMESA    /* OSMesa software rendering into a client buffer; */
+};
+
+
+/*
+// DaoxHeadless:
+// A rendering context without a window, for rendering on machines without
+// a display server. Its default framebuffer is a pbuffer surface (EGL) or
+// a client memory buffer (OSMesa) of the context device size, so that the
+// renderer and the painter can be used unchanged.
+//
+// The backend is selected at build time by DAO_GRAPHICS_USE_EGL and/or
+// DAO_GRAPHICS_USE_OSMESA. EGL is tried first when both are available.
+*/
+struct DaoxHeadless
+{
+	int    backend;
+	int    width;
+	int    height;
+
+	void  *display;   /* EGLDisplay; */
+	void  *surface;   /* EGLSurface; */
+	void  *context;   /* EGLContext or OSMesaContext; */
+	void  *pixels;    /* OSMesa color buffer; */
+};
+
+DaoxHeadless* DaoxHeadless_New( int width, int height );
+void DaoxHeadless_Delete( DaoxHeadless *self );
+
+int DaoxHeadless_MakeCurrent( DaoxHeadless *self );
+
+const char* DaoxHeadless_GetBackendName( DaoxHeadless *self );
+
+#endif
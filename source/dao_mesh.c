@@ -75,6 +75,8 @@ DaoxMeshUnit* DaoxMeshUnit_New()
 	self->skinParams = DArray_New( sizeof(DaoxSkinParam) );
 	self->vertices = DArray_New( sizeof(DaoxVertex) );
 	self->triangles = DArray_New( sizeof(DaoxTriangle) );
+	self->lods = DList_New( DAO_DATA_VALUE );
+	self->lodError = 0.0;
 	self->tree = NULL;
 	self->mesh = NULL;
 	self->material = NULL;
@@ -86,11 +88,22 @@ void DaoxMeshUnit_Delete( DaoxMeshUnit *self )
 	DArray_Delete( self->skinParams );
 	DArray_Delete( self->vertices );
 	DArray_Delete( self->triangles );
+	DList_Delete( self->lods );
 	DaoGC_DecRC( (DaoValue*) self->mesh );
 	DaoGC_DecRC( (DaoValue*) self->material );
 	DaoCstruct_Free( (DaoCstruct*) self );
 	dao_free( self );
 }
+/*
+// The simplified levels are transformed in the same way as the unit,
+// so they remain valid if they were:
+*/
+static void DaoxMeshUnit_MarkTransformed( DaoxMeshUnit *self )
+{
+	int valid = self->lodVersion == self->version;
+	self->version += 1;
+	if( valid ) self->lodVersion = self->version;
+}
 void DaoxMeshUnit_MoveBy( DaoxMeshUnit *self, float dx, float dy, float dz )
 {
 	int i;
@@ -101,6 +114,10 @@ void DaoxMeshUnit_MoveBy( DaoxMeshUnit *self, float dx, float dy, float dz )
 		pos->y += dy;
 		pos->z += dz;
 	}
+	for(i=0; i<self->lods->size; ++i){
+		DaoxMeshUnit_MoveBy( (DaoxMeshUnit*) self->lods->items.pVoid[i], dx, dy, dz );
+	}
+	DaoxMeshUnit_MarkTransformed( self );
 }
 void DaoxMeshUnit_ScaleBy( DaoxMeshUnit *self, float fx, float fy, float fz )
 {
@@ -112,6 +129,12 @@ void DaoxMeshUnit_ScaleBy( DaoxMeshUnit *self, float fx, float fy, float fz )
 		pos->y *= fy;
 		pos->z *= fz;
 	}
+	for(i=0; i<self->lods->size; ++i){
+		DaoxMeshUnit_ScaleBy( (DaoxMeshUnit*) self->lods->items.pVoid[i], fx, fy, fz );
+	}
+	fx = fabs( fx ) > fabs( fy ) ? fabs( fx ) : fabs( fy );
+	self->lodError *= fabs( fz ) > fx ? fabs( fz ) : fx;
+	DaoxMeshUnit_MarkTransformed( self );
 }
 void DaoxMeshUnit_UpdateNormTangents( DaoxMeshUnit *self, int donormal, int dotangent )
 {
@@ -138,10 +161,21 @@ void DaoxMeshUnit_UpdateNormTangents( DaoxMeshUnit *self, int donormal, int dota
 		if( donormal ) *norm = DaoxVector3D_Normalize( norm );
 		if( dotangent ) *tan = DaoxVector3D_Normalize( tan );
 	}
+	DaoxMeshUnit_MarkDirty( self );
+}
+void DaoxMeshUnit_MarkDirty( DaoxMeshUnit *self )
+{
+	self->version += 1;
+	/* The simplified levels no longer match the geometry: */
+	DList_Clear( self->lods );
 }
 void DaoxMeshUnit_SetMaterial( DaoxMeshUnit *self, DaoxMaterial *material )
 {
+	daoint i;
 	GC_Assign( & self->material, material );
+	for(i=0; i<self->lods->size; ++i){
+		DaoxMeshUnit_SetMaterial( (DaoxMeshUnit*) self->lods->items.pVoid[i], material );
+	}
 }
 
 typedef struct TriangleInfo TriangleInfo;
@@ -190,6 +224,23 @@ void TriangleInfo_QuickSort( TriangleInfo items[], int first, int last )
 
 #define MIN_MESH_CHUNK  128
 
+/*
+// Assign the offsets of the leaf chunks, such that the triangles of the leaves
+// can be stored contiguously in depth-first order. The leaf test is the same
+// as the one used by the renderer to collect visible chunks.
+*/
+static uint_t DaoxMeshChunk_SetOffsets( DaoxMeshChunk *self, uint_t offset )
+{
+	int left = self->left && self->left->triangles->size;
+	int right = self->right && self->right->triangles->size;
+
+	self->offset = offset;
+	if( left ) offset = DaoxMeshChunk_SetOffsets( self->left, offset );
+	if( right ) offset = DaoxMeshChunk_SetOffsets( self->right, offset );
+	if( left || right ) return offset;
+	return offset + self->triangles->size;
+}
+
 void DaoxMeshUnit_UpdateTree( DaoxMeshUnit *self, int maxtriangles )
 {
 	TriangleInfo *sorting = NULL;
@@ -267,12 +318,372 @@ void DaoxMeshUnit_UpdateTree( DaoxMeshUnit *self, int maxtriangles )
 		DList_Append( nodes, node->left );
 		DList_Append( nodes, node->right );
 	}
+	DaoxMeshChunk_SetOffsets( self->tree, 0 );
+	DaoxMeshUnit_MarkDirty( self );
 	DArray_Delete( points );
 	DList_Delete( nodes );
 }
 
 
 
+/*
+// Mesh simplification by half-edge collapses with quadric error metrics.
+//
+// A vertex is only ever collapsed into one of its neighbors, so the simplified
+// levels reuse the original vertices with their attributes and skinning
+// parameters. Vertices on open boundaries or on attribute seams (vertices
+// sharing the same position) are never removed, to avoid cracks.
+//
+// Each pass chooses the cheapest collapse for every removable vertex, sorts
+// them by cost and applies the collapses that do not touch the neighborhoods
+// of the collapses already applied in the same pass.
+*/
+
+typedef struct DaoxQuadric       DaoxQuadric;
+typedef struct DaoxLODCollapse   DaoxLODCollapse;
+typedef struct DaoxLODPosition   DaoxLODPosition;
+
+struct DaoxQuadric
+{
+	double  a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	double  count;  /* number of planes; */
+};
+
+struct DaoxLODCollapse
+{
+	int     source;
+	int     target;
+	double  cost;
+};
+
+struct DaoxLODPosition
+{
+	DaoxVector3D  pos;
+	int           index;
+};
+
+static void DaoxQuadric_AddTriangle( DaoxQuadric *self, DaoxVector3D *A, DaoxVector3D *B, DaoxVector3D *C )
+{
+	DaoxVector3D AB = DaoxVector3D_Sub( B, A );
+	DaoxVector3D AC = DaoxVector3D_Sub( C, A );
+	DaoxVector3D N = DaoxVector3D_Cross( & AB, & AC );
+	double norm = sqrt( DaoxVector3D_Norm2( & N ) );
+	double a, b, c, d;
+
+	if( norm < 1E-12 ) return;
+	a = N.x / norm;
+	b = N.y / norm;
+	c = N.z / norm;
+	d = - (a * A->x + b * A->y + c * A->z);
+	self->a2 += a*a;  self->ab += a*b;  self->ac += a*c;  self->ad += a*d;
+	self->b2 += b*b;  self->bc += b*c;  self->bd += b*d;
+	self->c2 += c*c;  self->cd += c*d;
+	self->d2 += d*d;
+	self->count += 1.0;
+}
+static void DaoxQuadric_Add( DaoxQuadric *self, DaoxQuadric *other )
+{
+	self->a2 += other->a2;  self->ab += other->ab;  self->ac += other->ac;
+	self->ad += other->ad;  self->b2 += other->b2;  self->bc += other->bc;
+	self->bd += other->bd;  self->c2 += other->c2;  self->cd += other->cd;
+	self->d2 += other->d2;  self->count += other->count;
+}
+static double DaoxQuadric_Error( DaoxQuadric *self, DaoxVector3D *P )
+{
+	double x = P->x, y = P->y, z = P->z;
+	double error = self->a2*x*x + 2.0*self->ab*x*y + 2.0*self->ac*x*z + 2.0*self->ad*x
+		+ self->b2*y*y + 2.0*self->bc*y*z + 2.0*self->bd*y
+		+ self->c2*z*z + 2.0*self->cd*z + self->d2;
+	return error > 0.0 ? error : 0.0;
+}
+
+static int DaoxLODCollapse_Compare( const void *one, const void *another )
+{
+	const DaoxLODCollapse *A = (const DaoxLODCollapse*) one;
+	const DaoxLODCollapse *B = (const DaoxLODCollapse*) another;
+	if( A->cost != B->cost ) return A->cost < B->cost ? -1 : 1;
+	return A->source - B->source;
+}
+static int DaoxLODPosition_Compare( const void *one, const void *another )
+{
+	const DaoxLODPosition *A = (const DaoxLODPosition*) one;
+	const DaoxLODPosition *B = (const DaoxLODPosition*) another;
+	if( A->pos.x != B->pos.x ) return A->pos.x < B->pos.x ? -1 : 1;
+	if( A->pos.y != B->pos.y ) return A->pos.y < B->pos.y ? -1 : 1;
+	if( A->pos.z != B->pos.z ) return A->pos.z < B->pos.z ? -1 : 1;
+	return A->index - B->index;
+}
+
+/*
+// Mean squared distance from the point to the planes of the quadric:
+*/
+static double DaoxQuadric_MeanError( DaoxQuadric *self, DaoxVector3D *P )
+{
+	if( self->count < 1.0 ) return 0.0;
+	return DaoxQuadric_Error( self, P ) / self->count;
+}
+
+/*
+// Check if moving the vertex "source" onto "target" keeps the orientation
+// of the remaining triangles around "source" (no folding over);
+*/
+static int DaoxMeshUnit_CheckCollapse( DaoxMeshUnit *self, DaoxTriangle *triangles,
+		int *adjacency, int count, int source, int target )
+{
+	DaoxVertex *vertices = self->vertices->data.vertices;
+	int i, k;
+
+	for(i=0; i<count; ++i){
+		DaoxTriangle *triangle = triangles + adjacency[i];
+		DaoxVector3D P[3], Q[3], AB, AC, N1, N2;
+		double dot, norm;
+		for(k=0; k<3; ++k) if( triangle->index[k] == target ) break;
+		if( k < 3 ) continue; /* Degenerated by the collapse; */
+		for(k=0; k<3; ++k){
+			int id = triangle->index[k];
+			P[k] = vertices[id].pos;
+			Q[k] = id == source ? vertices[target].pos : P[k];
+		}
+		AB = DaoxVector3D_Sub( P+1, P );
+		AC = DaoxVector3D_Sub( P+2, P );
+		N1 = DaoxVector3D_Cross( & AB, & AC );
+		AB = DaoxVector3D_Sub( Q+1, Q );
+		AC = DaoxVector3D_Sub( Q+2, Q );
+		N2 = DaoxVector3D_Cross( & AB, & AC );
+		dot = DaoxVector3D_Dot( & N1, & N2 );
+		norm = sqrt( DaoxVector3D_Norm2( & N1 ) * DaoxVector3D_Norm2( & N2 ) );
+		if( dot <= 0.25 * norm ) return 0;
+	}
+	return 1;
+}
+
+/*
+// Simplify "triangles" (indexing the vertices of "self") until there are
+// no more than "target" triangles or no collapse can be applied.
+// Return the maximum mean squared plane distance of the applied collapses;
+*/
+static double DaoxMeshUnit_Simplify( DaoxMeshUnit *self, DArray *triangles,
+		DaoxQuadric *quadrics, uchar_t *locked, int target, double error )
+{
+	DaoxVertex *vertices = self->vertices->data.vertices;
+	DArray *collapses = DArray_New( sizeof(DaoxLODCollapse) );
+	int N = self->vertices->size;
+	int *offsets = (int*) dao_malloc( (N+1)*sizeof(int) );
+	int *cursors = (int*) dao_malloc( N*sizeof(int) );
+	uchar_t *touched = (uchar_t*) dao_malloc( N*sizeof(uchar_t) );
+	uchar_t *removed = NULL;
+	int *adjacency = NULL;
+	daoint i, j, k, m;
+
+	while( triangles->size > target ){
+		DaoxTriangle *tris = triangles->data.triangles;
+		int T = triangles->size, count = T, applied = 0;
+
+		/* Vertex to triangle adjacency in compressed rows: */
+		adjacency = (int*) dao_realloc( adjacency, 3*T*sizeof(int) );
+		removed = (uchar_t*) dao_realloc( removed, T*sizeof(uchar_t) );
+		memset( offsets, 0, (N+1)*sizeof(int) );
+		memset( touched, 0, N*sizeof(uchar_t) );
+		memset( removed, 0, T*sizeof(uchar_t) );
+		for(i=0; i<T; ++i){
+			for(k=0; k<3; ++k) offsets[ tris[i].index[k] + 1 ] += 1;
+		}
+		for(i=0; i<N; ++i) offsets[i+1] += offsets[i];
+		memcpy( cursors, offsets, N*sizeof(int) );
+		for(i=0; i<T; ++i){
+			for(k=0; k<3; ++k) adjacency[ cursors[ tris[i].index[k] ]++ ] = i;
+		}
+
+		collapses->size = 0;
+		for(i=0; i<N; ++i){
+			int *adj = adjacency + offsets[i];
+			int deg = offsets[i+1] - offsets[i];
+			DaoxLODCollapse best = { -1, -1, 0.0 };
+			int boundary = 0;
+
+			if( deg == 0 || locked[i] ) continue;
+			/*
+			// An edge (i,w) is interior if it is shared by exactly two triangles.
+			// Also check the candidate collapses along the way:
+			*/
+			for(j=0; j<deg && boundary == 0; ++j){
+				DaoxTriangle *triangle = tris + adj[j];
+				for(k=0; k<3; ++k){
+					int w = triangle->index[k], shared = 0;
+					if( w == i ) continue;
+					for(m=0; m<deg; ++m){
+						DaoxTriangle *other = tris + adj[m];
+						shared += other->index[0] == w || other->index[1] == w || other->index[2] == w;
+					}
+					if( shared != 2 ){
+						boundary = 1;
+						break;
+					}
+					{
+						DaoxQuadric Q = quadrics[i];
+						double cost;
+						DaoxQuadric_Add( & Q, quadrics + w );
+						cost = DaoxQuadric_MeanError( & Q, & vertices[w].pos );
+						if( best.target < 0 || cost < best.cost ){
+							best.source = i;
+							best.target = w;
+							best.cost = cost;
+						}
+					}
+				}
+			}
+			if( boundary || best.target < 0 ) continue;
+			*(DaoxLODCollapse*) DArray_Push( collapses ) = best;
+		}
+		if( collapses->size == 0 ) break;
+		qsort( collapses->data.base, collapses->size, sizeof(DaoxLODCollapse), DaoxLODCollapse_Compare );
+
+		for(i=0; i<collapses->size && count > target; ++i){
+			DaoxLODCollapse *collapse = ((DaoxLODCollapse*) collapses->data.base) + i;
+			int source = collapse->source, dest = collapse->target;
+			int *adj = adjacency + offsets[source];
+			int deg = offsets[source+1] - offsets[source];
+
+			if( touched[source] || touched[dest] ) continue;
+			if( DaoxMeshUnit_CheckCollapse( self, tris, adj, deg, source, dest ) == 0 ) continue;
+			for(j=0; j<deg; ++j){
+				DaoxTriangle *triangle = tris + adj[j];
+				int degenerated = 0;
+				for(k=0; k<3; ++k){
+					touched[ triangle->index[k] ] = 1;
+					degenerated |= triangle->index[k] == dest;
+				}
+				if( degenerated ){
+					removed[ adj[j] ] = 1;
+					count -= 1;
+					continue;
+				}
+				for(k=0; k<3; ++k){
+					if( triangle->index[k] == source ) triangle->index[k] = dest;
+				}
+			}
+			DaoxQuadric_Add( quadrics + dest, quadrics + source );
+			if( collapse->cost > error ) error = collapse->cost;
+			applied += 1;
+		}
+		for(i=0, j=0; i<T; ++i){
+			if( removed[i] == 0 ) tris[j++] = tris[i];
+		}
+		triangles->size = j;
+		if( applied == 0 ) break;
+	}
+	DArray_Delete( collapses );
+	dao_free( offsets );
+	dao_free( cursors );
+	dao_free( touched );
+	dao_free( removed );
+	dao_free( adjacency );
+	return error;
+}
+
+/*
+// Generate up to "levels" simplified levels, each with about half of the
+// triangles of the previous level. The generation stops early when the
+// mesh becomes too coarse or cannot be simplified any further.
+// Nothing is done if the levels have been generated for the current geometry
+// (including units that are too small to be simplified).
+*/
+void DaoxMeshUnit_MakeLODs( DaoxMeshUnit *self, int levels )
+{
+	DaoxVertex *vertices = self->vertices->data.vertices;
+	DaoxTriangle *tris = self->triangles->data.triangles;
+	DArray *triangles;
+	DaoxLODPosition *positions;
+	DaoxQuadric *quadrics;
+	uchar_t *locked;
+	int *remap, skinned;
+	int N = self->vertices->size;
+	double error = 0.0;
+	daoint i, k, level;
+
+	if( self->lodVersion == self->version && self->lodLevels == levels ) return;
+	self->lodVersion = self->version;
+	self->lodLevels = levels;
+
+	DList_Clear( self->lods );
+	if( self->triangles->size < 2*DAOX_MIN_LOD_TRIANGLES ) return;
+
+	quadrics = (DaoxQuadric*) dao_calloc( N, sizeof(DaoxQuadric) );
+	positions = (DaoxLODPosition*) dao_malloc( N*sizeof(DaoxLODPosition) );
+	locked = (uchar_t*) dao_calloc( N, sizeof(uchar_t) );
+	remap = (int*) dao_malloc( N*sizeof(int) );
+	skinned = self->skinParams->size == N;
+
+	for(i=0; i<self->triangles->size; ++i){
+		DaoxVector3D *A = & vertices[ tris[i].index[0] ].pos;
+		DaoxVector3D *B = & vertices[ tris[i].index[1] ].pos;
+		DaoxVector3D *C = & vertices[ tris[i].index[2] ].pos;
+		DaoxQuadric Q;
+		memset( & Q, 0, sizeof(DaoxQuadric) );
+		DaoxQuadric_AddTriangle( & Q, A, B, C );
+		for(k=0; k<3; ++k) DaoxQuadric_Add( quadrics + tris[i].index[k], & Q );
+	}
+
+	/* Lock the vertices on attribute seams: */
+	for(i=0; i<N; ++i){
+		positions[i].pos = vertices[i].pos;
+		positions[i].index = i;
+	}
+	qsort( positions, N, sizeof(DaoxLODPosition), DaoxLODPosition_Compare );
+	for(i=1; i<N; ++i){
+		DaoxVector3D *P1 = & positions[i-1].pos;
+		DaoxVector3D *P2 = & positions[i].pos;
+		if( P1->x != P2->x || P1->y != P2->y || P1->z != P2->z ) continue;
+		locked[ positions[i-1].index ] = 1;
+		locked[ positions[i].index ] = 1;
+	}
+
+	triangles = DArray_New( sizeof(DaoxTriangle) );
+	DArray_Resize( triangles, self->triangles->size );
+	memcpy( triangles->data.base, tris, self->triangles->size*sizeof(DaoxTriangle) );
+
+	for(level=1; level<=levels; ++level){
+		DaoxMeshUnit *lod;
+		int count = triangles->size;
+		int target = self->triangles->size >> level;
+
+		if( target < DAOX_MIN_LOD_TRIANGLES ) break;
+		error = DaoxMeshUnit_Simplify( self, triangles, quadrics, locked, target, error );
+		if( triangles->size > 0.8 * count ) break;
+
+		lod = DaoxMeshUnit_New();
+		for(i=0; i<N; ++i) remap[i] = -1;
+		for(i=0; i<triangles->size; ++i){
+			DaoxTriangle *triangle = triangles->data.triangles + i;
+			DaoxTriangle *triangle2 = DArray_PushTriangle( lod->triangles, triangle );
+			for(k=0; k<3; ++k){
+				int id = triangle->index[k];
+				if( remap[id] < 0 ){
+					remap[id] = lod->vertices->size;
+					*(DaoxVertex*) DArray_Push( lod->vertices ) = vertices[id];
+					if( skinned ){
+						DaoxSkinParam *param = (DaoxSkinParam*) DArray_Push( lod->skinParams );
+						*param = self->skinParams->data.skinparams[id];
+					}
+				}
+				triangle2->index[k] = remap[id];
+			}
+		}
+		lod->lodError = sqrt( error );
+		lod->index = self->index;
+		DaoxMeshUnit_SetMaterial( lod, self->material );
+		DaoxMeshUnit_UpdateTree( lod, 0 );
+		DList_Append( self->lods, lod );
+	}
+	DArray_Delete( triangles );
+	dao_free( quadrics );
+	dao_free( positions );
+	dao_free( locked );
+	dao_free( remap );
+}
+
+
+
 
 DaoxMesh* DaoxMesh_New()
 {
@@ -312,6 +723,14 @@ void DaoxMesh_UpdateTree( DaoxMesh *self, int maxtriangles )
 		DaoxMeshUnit_UpdateTree( unit, maxtriangles );
 	}
 }
+void DaoxMesh_MakeLODs( DaoxMesh *self, int levels )
+{
+	daoint i;
+	for(i=0; i<self->units->size; ++i){
+		DaoxMeshUnit *unit = (DaoxMeshUnit*) self->units->items.pVoid[i];
+		DaoxMeshUnit_MakeLODs( unit, levels );
+	}
+}
 void DaoxMesh_UpdateNormTangents( DaoxMesh *self, int norm, int tan )
 {
 	int i;
@@ -32,6 +32,9 @@
 #include "dao_common.h"
 
 
+#define DAOX_MESH_LODS         3
+#define DAOX_MIN_LOD_TRIANGLES 32
+
 typedef struct DaoxSkinParam  DaoxSkinParam;
 typedef struct DaoxMeshChunk  DaoxMeshChunk;
 typedef struct DaoxMeshUnit   DaoxMeshUnit;
@@ -59,6 +62,8 @@ struct DaoxMeshChunk
 	DaoxOBBox3D     obbox;      /* with local coordinates in the mesh; */
 	DArray         *triangles;  /* <int>: with triangle indices in DaoxMeshUnit; */
 
+	uint_t          offset;     /* triangle offset in the leaf-ordered triangles of the unit; */
+
 	DaoxMeshUnit   *unit;
 	DaoxMeshChunk  *parent;
 	DaoxMeshChunk  *left;
@@ -79,8 +84,13 @@ struct DaoxMeshUnit
 	DArray          *skinParams;
 	DArray          *vertices;  /* <DaoxVertex>: local coordinates; */
 	DArray          *triangles; /* <DaoxTriangle>: local coordinates (for face norms); */
+	DList           *lods;      /* <DaoxMeshUnit*>: simplified levels, from fine to coarse; */
 	DaoxOBBox3D      obbox;     /* local coordinates; */
+	float            lodError;  /* estimated geometric error of this level (local units); */
 	uint_t           index;     /* unit index in the mesh; */
+	uint_t           version;   /* increased whenever the vertices or triangles are changed; */
+	uint_t           lodVersion;  /* version of the geometry for the simplified levels; */
+	int              lodLevels;   /* levels requested for the simplified levels; */
 };
 extern DaoType *daox_type_mesh_unit;
 
@@ -91,6 +101,8 @@ void DaoxMeshUnit_MoveBy( DaoxMeshUnit *self, float dx, float dy, float dz );
 void DaoxMeshUnit_ScaleBy( DaoxMeshUnit *self, float fx, float fy, float fz );
 void DaoxMeshUnit_SetMaterial( DaoxMeshUnit *self, DaoxMaterial *material );
 void DaoxMeshUnit_UpdateNormTangents( DaoxMeshUnit *self, int donormal, int dotangent );
+void DaoxMeshUnit_MarkDirty( DaoxMeshUnit *self );
+void DaoxMeshUnit_MakeLODs( DaoxMeshUnit *self, int levels );
 
 
 
@@ -112,6 +124,7 @@ void DaoxMesh_SetMaterial( DaoxMesh *self, DaoxMaterial *material );
 void DaoxMesh_ResetBoundingBox( DaoxMesh *self );
 void DaoxMesh_UpdateNormTangents( DaoxMesh *self, int norm, int tan );
 void DaoxMesh_UpdateTree( DaoxMesh *self, int maxtriangles );
+void DaoxMesh_MakeLODs( DaoxMesh *self, int levels );
 void DaoxMesh_MakeViewFrustumCorners( DaoxMesh *self, float fov, float ratio, float near );
 
 DaoxMeshUnit* DaoxMesh_MakeBox( DaoxMesh *self, float wx, float wy, float wz );
@@ -0,0 +1,298 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "dao_occlusion.h"
+
+
+
+DaoxOcclusionBuffer* DaoxOcclusionBuffer_New( int width, int height )
+{
+	DaoxOcclusionBuffer *self = (DaoxOcclusionBuffer*) dao_calloc( 1, sizeof(DaoxOcclusionBuffer) );
+	self->width = (width + 3) & ~3;
+	self->height = height;
+	self->depths = (float*) dao_calloc( self->width * self->height, sizeof(float) );
+	self->points = DArray_New( sizeof(DaoxVector3D) );
+	self->worldToView = DaoxMatrix4D_Identity();
+	return self;
+}
+void DaoxOcclusionBuffer_Delete( DaoxOcclusionBuffer *self )
+{
+	DArray_Delete( self->points );
+	dao_free( self->depths );
+	dao_free( self );
+}
+
+void DaoxOcclusionBuffer_Reset( DaoxOcclusionBuffer *self, DaoxViewFrustum *frustum, DaoxMatrix4D *worldToView )
+{
+	float width = frustum->right - frustum->left;
+	float height = frustum->top - frustum->bottom;
+
+	self->worldToView = *worldToView;
+	self->near = frustum->near;
+	self->scaleX = self->width * frustum->near / width;
+	self->offsetX = - self->width * frustum->left / width;
+	self->scaleY = - self->height * frustum->near / height;
+	self->offsetY = self->height * frustum->top / height;
+	self->occluders = 0;
+	memset( self->depths, 0, self->width * self->height * sizeof(float) );
+}
+
+/*
+// Project a point in view coordinates to the buffer.
+// The z coordinate of the result is the inverse depth, or zero if the point
+// is not in front of the near plane;
+*/
+static DaoxVector3D DaoxOcclusionBuffer_Project( DaoxOcclusionBuffer *self, DaoxVector3D point )
+{
+	DaoxVector3D result = {0.0, 0.0, 0.0};
+	float w = - point.z;
+
+	if( w < self->near ) return result;
+	result.x = self->offsetX + self->scaleX * point.x / w;
+	result.y = self->offsetY + self->scaleY * point.y / w;
+	result.z = 1.0 / w;
+	return result;
+}
+
+typedef struct DaoxEdgeFunction DaoxEdgeFunction;
+struct DaoxEdgeFunction
+{
+	float  a, b, c;
+};
+
+/*
+// The edge function of PQ, evaluated at the pixel corners that are the
+// farthest inside the edge, so that it is non-negative only for the pixels
+// entirely inside the edge (conservative coverage for the occluders):
+*/
+static DaoxEdgeFunction DaoxEdgeFunction_Init( DaoxVector3D *P, DaoxVector3D *Q )
+{
+	DaoxEdgeFunction edge;
+	edge.a = P->y - Q->y;
+	edge.b = Q->x - P->x;
+	edge.c = - edge.a * P->x - edge.b * P->y;
+	edge.c += 0.5 * (edge.a + edge.b);
+	edge.c -= 0.5 * (fabs( edge.a ) + fabs( edge.b ));
+	return edge;
+}
+
+/* Rasterize the triangle in the rows [first,last): */
+static void DaoxOcclusionBuffer_Rasterize( DaoxOcclusionBuffer *self, DaoxVector3D *A, DaoxVector3D *B, DaoxVector3D *C, int first, int last )
+{
+	DaoxEdgeFunction E0, E1, E2;
+	DaoxVector3D *T;
+	float area = (B->x - A->x)*(C->y - A->y) - (B->y - A->y)*(C->x - A->x);
+	float dzdx, dzdy, z0, xmin, xmax, ymin, ymax;
+	int x, y, x0, x1, y0, y1;
+
+	if( area < 0.0 ){
+		T = B;  B = C;  C = T;
+		area = - area;
+	}
+	if( area < 1E-6 ) return;
+
+	xmin = xmax = A->x;
+	ymin = ymax = A->y;
+	if( B->x < xmin ) xmin = B->x; else if( B->x > xmax ) xmax = B->x;
+	if( C->x < xmin ) xmin = C->x; else if( C->x > xmax ) xmax = C->x;
+	if( B->y < ymin ) ymin = B->y; else if( B->y > ymax ) ymax = B->y;
+	if( C->y < ymin ) ymin = C->y; else if( C->y > ymax ) ymax = C->y;
+	x0 = xmin < 0.0 ? 0 : (int) xmin;
+	y0 = ymin < first ? first : (int) ymin;
+	x1 = xmax >= self->width ? self->width - 1 : (int) xmax;
+	y1 = ymax >= last ? last - 1 : (int) ymax;
+	if( x0 > x1 || y0 > y1 ) return;
+
+	/*
+	// Each edge function is zero along its edge, and equals "area" (twice the
+	// triangle area) at the opposite vertex, before the pixel offsets:
+	*/
+	E0 = DaoxEdgeFunction_Init( A, B );  /* zero on AB, area at C; */
+	E1 = DaoxEdgeFunction_Init( B, C );  /* zero on BC, area at A; */
+	E2 = DaoxEdgeFunction_Init( C, A );  /* zero on CA, area at B; */
+
+	/* Inverse depth at the pixel centers, then adjusted to the farthest in the pixels: */
+	dzdx = (E1.a * A->z + E2.a * B->z + E0.a * C->z) / area;
+	dzdy = (E1.b * A->z + E2.b * B->z + E0.b * C->z) / area;
+	z0 = A->z - dzdx * (A->x - 0.5) - dzdy * (A->y - 0.5);
+	z0 -= 0.5 * (fabs( dzdx ) + fabs( dzdy ));
+
+	x0 &= ~3;
+	for(y=y0; y<=y1; ++y){
+		float *row = self->depths + y * self->width;
+		x = x0;
+#ifdef __SSE2__
+		{
+			__m128 steps = _mm_setr_ps( 0.0, 1.0, 2.0, 3.0 );
+			__m128 zero = _mm_setzero_ps();
+			for(; x<=x1; x+=4){
+				__m128 X = _mm_add_ps( _mm_set1_ps( x ), steps );
+				__m128 e0 = _mm_add_ps( _mm_mul_ps( X, _mm_set1_ps( E0.a ) ), _mm_set1_ps( E0.b * y + E0.c ) );
+				__m128 e1 = _mm_add_ps( _mm_mul_ps( X, _mm_set1_ps( E1.a ) ), _mm_set1_ps( E1.b * y + E1.c ) );
+				__m128 e2 = _mm_add_ps( _mm_mul_ps( X, _mm_set1_ps( E2.a ) ), _mm_set1_ps( E2.b * y + E2.c ) );
+				__m128 z = _mm_add_ps( _mm_mul_ps( X, _mm_set1_ps( dzdx ) ), _mm_set1_ps( dzdy * y + z0 ) );
+				__m128 mask = _mm_and_ps( _mm_cmpge_ps( e0, zero ), _mm_cmpge_ps( e1, zero ) );
+				__m128 old = _mm_loadu_ps( row + x );
+				mask = _mm_and_ps( mask, _mm_cmpge_ps( e2, zero ) );
+				mask = _mm_and_ps( mask, _mm_cmpgt_ps( z, old ) );
+				_mm_storeu_ps( row + x, _mm_or_ps( _mm_and_ps( mask, z ), _mm_andnot_ps( mask, old ) ) );
+			}
+		}
+#endif
+		for(; x<=x1; ++x){
+			float e0 = E0.a * x + E0.b * y + E0.c;
+			float e1 = E1.a * x + E1.b * y + E1.c;
+			float e2 = E2.a * x + E2.b * y + E2.c;
+			float z = dzdx * x + dzdy * y + z0;
+			if( e0 >= 0.0 && e1 >= 0.0 && e2 >= 0.0 && z > row[x] ) row[x] = z;
+		}
+	}
+}
+
+typedef struct DaoxOcclusionJob DaoxOcclusionJob;
+struct DaoxOcclusionJob
+{
+	DaoxOcclusionBuffer  *buffer;
+	DaoxMeshUnit         *unit;
+	DaoxMatrix4D          objectToView;
+};
+
+static void DaoxOcclusionJob_Project( void *data, int first, int last )
+{
+	DaoxOcclusionJob *job = (DaoxOcclusionJob*) data;
+	DaoxVector3D *points = job->buffer->points->data.vectors3d;
+	int i;
+
+	for(i=first; i<last; ++i){
+		DaoxVertex *vertex = job->unit->vertices->data.vertices + i;
+		DaoxVector3D point = DaoxMatrix4D_MulVector( & job->objectToView, & vertex->pos, 1.0 );
+		points[i] = DaoxOcclusionBuffer_Project( job->buffer, point );
+	}
+}
+/* Rasterize all the triangles in a band of rows: */
+static void DaoxOcclusionJob_Rasterize( void *data, int first, int last )
+{
+	DaoxOcclusionJob *job = (DaoxOcclusionJob*) data;
+	DaoxVector3D *points = job->buffer->points->data.vectors3d;
+	daoint i;
+
+	for(i=0; i<job->unit->triangles->size; ++i){
+		DaoxTriangle *triangle = job->unit->triangles->data.triangles + i;
+		DaoxVector3D *A = points + triangle->index[0];
+		DaoxVector3D *B = points + triangle->index[1];
+		DaoxVector3D *C = points + triangle->index[2];
+		/* Triangles crossing the near plane are simply skipped: */
+		if( A->z == 0.0 || B->z == 0.0 || C->z == 0.0 ) continue;
+		DaoxOcclusionBuffer_Rasterize( job->buffer, A, B, C, first, last );
+	}
+}
+
+#define DAOX_OCCLUSION_PARALLEL  1024  /* triangles; */
+
+void DaoxOcclusionBuffer_RenderMesh( DaoxOcclusionBuffer *self, DaoxMeshUnit *unit, DaoxMatrix4D *objectToWorld, DaoxThreadPool *workers )
+{
+	DaoxOcclusionJob job;
+
+	job.buffer = self;
+	job.unit = unit;
+	job.objectToView = DaoxMatrix4D_Product( & self->worldToView, objectToWorld );
+	DArray_Resize( self->points, unit->vertices->size );
+	self->occluders += unit->triangles->size;
+
+	if( workers == NULL || workers->workerCount <= 1 || unit->triangles->size < DAOX_OCCLUSION_PARALLEL ){
+		DaoxOcclusionJob_Project( & job, 0, unit->vertices->size );
+		DaoxOcclusionJob_Rasterize( & job, 0, self->height );
+		return;
+	}
+	DaoxThreadPool_RunRanges( workers, DaoxOcclusionJob_Project, & job, unit->vertices->size, 256 );
+	DaoxThreadPool_RunRanges( workers, DaoxOcclusionJob_Rasterize, & job, self->height, 8 );
+}
+int DaoxOcclusionBuffer_Visible( DaoxOcclusionBuffer *self, DaoxOBBox3D *box )
+{
+	DaoxVector3D corners[8];
+	DaoxVector3D dY, dZ, XY;
+	float xmin, xmax, ymin, ymax, zmax = 0.0;
+	int i, x, y, x0, x1, y0, y1;
+
+	if( self->occluders == 0 ) return 1;
+
+	dY = DaoxVector3D_Sub( & box->Y, & box->O );
+	dZ = DaoxVector3D_Sub( & box->Z, & box->O );
+	XY = DaoxVector3D_Add( & box->X, & dY );
+	corners[0] = box->O;
+	corners[1] = box->X;
+	corners[2] = box->Y;
+	corners[3] = box->Z;
+	corners[4] = XY;
+	corners[5] = DaoxVector3D_Add( & box->X, & dZ );
+	corners[6] = DaoxVector3D_Add( & box->Y, & dZ );
+	corners[7] = DaoxVector3D_Add( & XY, & dZ );
+	for(i=0; i<8; ++i){
+		DaoxVector3D point = DaoxMatrix4D_MulVector( & self->worldToView, corners + i, 1.0 );
+		DaoxVector3D P = DaoxOcclusionBuffer_Project( self, point );
+		if( P.z == 0.0 ) return 1; /* Crossing the near plane; */
+		if( i == 0 ){
+			xmin = xmax = P.x;
+			ymin = ymax = P.y;
+		}
+		if( P.x < xmin ) xmin = P.x; else if( P.x > xmax ) xmax = P.x;
+		if( P.y < ymin ) ymin = P.y; else if( P.y > ymax ) ymax = P.y;
+		if( P.z > zmax ) zmax = P.z;
+	}
+	if( xmax < 0.0 || ymax < 0.0 || xmin >= self->width || ymin >= self->height ) return 1;
+
+	x0 = xmin < 0.0 ? 0 : (int) xmin;
+	y0 = ymin < 0.0 ? 0 : (int) ymin;
+	x1 = xmax >= self->width ? self->width - 1 : (int) xmax;
+	y1 = ymax >= self->height ? self->height - 1 : (int) ymax;
+
+	/* Visible if any pixel in the projected rectangle is not closer than the box: */
+	for(y=y0; y<=y1; ++y){
+		float *row = self->depths + y * self->width;
+		x = x0;
+#ifdef __SSE2__
+		{
+			__m128 Z = _mm_set1_ps( zmax );
+			for(; (x+4)<=(x1+1); x+=4){
+				if( _mm_movemask_ps( _mm_cmple_ps( _mm_loadu_ps( row + x ), Z ) ) ) return 1;
+			}
+		}
+#endif
+		for(; x<=x1; ++x){
+			if( row[x] <= zmax ) return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __DAO_OCCLUSION__
+#define __DAO_OCCLUSION__
+
+#include "dao_mesh.h"
+#include "dao_scene.h"
+#include "dao_parallel.h"
+
+
+typedef struct DaoxOcclusionBuffer  DaoxOcclusionBuffer;
+
+
+/*
+// DaoxOcclusionBuffer:
+// -- Low resolution depth buffer for occlusion culling on the CPU;
+// -- The occluders are rasterized with the inverse of the view depths,
+//    so that the depths can be interpolated linearly in screen space;
+// -- Pixels are only covered by the triangles covering them entirely, and the
+//    depths written to the pixels are the farthest ones of the triangles in the
+//    pixels, so that a box partially behind an occluder edge, or intersecting
+//    an occluder, is never hidden by the occluder;
+// -- Large meshes are rasterized in parallel by bands of rows;
+*/
+struct DaoxOcclusionBuffer
+{
+	int     width;     /* multiple of 4; */
+	int     height;
+	int     occluders; /* number of triangles submitted since the last reset; */
+	float  *depths;    /* inverse view depths, zero for empty pixels; */
+	float   near;
+	float   scaleX;
+	float   scaleY;
+	float   offsetX;
+	float   offsetY;
+	DArray *points;    /* <DaoxVector3D>: projected vertices; */
+
+	DaoxMatrix4D  worldToView;
+};
+
+DaoxOcclusionBuffer* DaoxOcclusionBuffer_New( int width, int height );
+void DaoxOcclusionBuffer_Delete( DaoxOcclusionBuffer *self );
+
+void DaoxOcclusionBuffer_Reset( DaoxOcclusionBuffer *self, DaoxViewFrustum *frustum, DaoxMatrix4D *worldToView );
+/* With workers not NULL, large meshes are rasterized in parallel: */
+void DaoxOcclusionBuffer_RenderMesh( DaoxOcclusionBuffer *self, DaoxMeshUnit *unit, DaoxMatrix4D *objectToWorld, DaoxThreadPool *workers );
+
+/*
+// Test a bounding box in world coordinates, return zero if it is fully hidden
+// behind the occluders:
+*/
+int DaoxOcclusionBuffer_Visible( DaoxOcclusionBuffer *self, DaoxOBBox3D *box );
+
+#endif
@@ -30,6 +30,13 @@
 #include <string.h>
 #include "dao_opengl.h"
 #include "dao_painter.h"
+#include "dao_cluster.h"
+#include "dao_headless.h"
+#include "dao_streaming.h"
+
+
+#define DAOX_STRING2( x )  #x
+#define DAOX_STRING( x )   DAOX_STRING2( x )
 
 
 #ifdef DAO_GRAPHICS_USE_GLES
@@ -41,6 +48,8 @@ precision highp float;\n\
 static const char *const daox_fragment_shader_header =
 "#version 300 es\n\
 precision highp float;\n\
+precision highp int;\n\
+precision highp sampler2D;\n\
 ";
 
 #else
@@ -56,10 +65,21 @@ static const char *const daox_fragment_shader_header =
 
 
 
+/*
+// The uniforms that select the shading branches are replaced by constants
+// in the specialized variants of the 3D shader (see DaoxShader_InitVariant()),
+// so that the compiler can remove the unused branches:
+*/
 static const char *const daox_vector_graphics_shader_body =
-"uniform int   hasDiffuseTexture; \n\
+"#ifdef DAOX_VARIANT\n\
+const int     hasDiffuseTexture = DAOX_HAS_DIFFUSE; \n\
+const int     hasEmissionTexture = DAOX_HAS_EMISSION; \n\
+const int     hasBumpTexture = DAOX_HAS_BUMP; \n\
+#else\n\
+uniform int   hasDiffuseTexture; \n\
 uniform int   hasEmissionTexture; \n\
 uniform int   hasBumpTexture; \n\
+#endif\n\
 uniform int   hasDepthTexture; \n\
 uniform float alphaBlending; \n\
 uniform vec4  brushColor; \n\
@@ -313,16 +333,61 @@ void main(void) \n\
 
 
 
+/*
+// Uniform blocks shared by the 3D vertex and fragment shaders,
+// see DaoxFrameBlock, DaoxMaterialBlock and DaoxObjectBlock:
+*/
+static const char *const daox_uniform_blocks3d =
+"layout(std140) uniform FrameData\n\
+{\n\
+	mat4  projMatrix;\n\
+	mat4  viewMatrix;\n\
+	vec3  cameraPosition;\n\
+	float time;\n\
+	vec4  clusterParams; // tiles per pixel in x and y; slices per log depth; near; \n\
+	int   lightCount;\n\
+	float clusterOffsetX; // viewport origin in tiles; \n\
+	float clusterOffsetY;\n\
+};\n\
+layout(std140) uniform MaterialData\n\
+{\n\
+	vec4  ambientColor;\n\
+	vec4  diffuseColor;\n\
+	vec4  specularColor;\n\
+	vec4  emissionColor;\n\
+	float shininess;\n\
+};\n\
+layout(std140) uniform ObjectData\n\
+{\n\
+	mat4  modelMatrix;\n\
+};\n\
+\n";
+
+
 static const char *const daox_vertex_shader3d_body =
-"uniform int  vectorGraphics;\n\
-uniform int  lightCount;\n\
+"const int boneRow = " DAOX_STRING( DAOX_BONE_ROW ) ";\n"
+"#ifdef DAOX_VARIANT\n\
+const int    vectorGraphics = 0;\n\
+const int    skinning = DAOX_SKINNING;\n\
+#else\n\
+uniform int  vectorGraphics;\n\
 uniform int  skinning;\n\
-uniform vec3 cameraPosition;\n\
-uniform mat4 projMatrix;\n\
-uniform mat4 viewMatrix;\n\
-uniform mat4 modelMatrix;\n\
+#endif\n\
+uniform int  instancing;\n\
 uniform float graphScale; \n\
-uniform mat4 skinMatrices[128];\n\
+uniform int  boneOffset; // first skinning matrix of the skeleton in the palette; \n\
+uniform highp sampler2D boneTexture; // skinning matrices, 3 texels (rows) per matrix; \n\
+\n\
+mat4 BoneMatrix( float joint )\n\
+{\n\
+	int k = boneOffset + int(joint);\n\
+	int x = 3 * (k % boneRow);\n\
+	int y = k / boneRow;\n\
+	vec4 row0 = texelFetch( boneTexture, ivec2( x, y ), 0 );\n\
+	vec4 row1 = texelFetch( boneTexture, ivec2( x + 1, y ), 0 );\n\
+	vec4 row2 = texelFetch( boneTexture, ivec2( x + 2, y ), 0 );\n\
+	return transpose( mat4( row0, row1, row2, vec4( 0.0, 0.0, 0.0, 1.0 ) ) );\n\
+}\n\
 \n\
 in vec3 position;\n\
 in vec3 normal;\n\
@@ -331,6 +396,9 @@ in vec2 texCoord;\n\
 in vec2 texMO;\n\
 in vec4 joints;\n\
 in vec4 weights;\n\
+in vec4 instanceRow0; // rows of the object to world matrix of the instance; \n\
+in vec4 instanceRow1;\n\
+in vec4 instanceRow2;\n\
 \n\
 out vec3  bezierKLM; \n\
 out float pathOffset; \n\
@@ -349,13 +417,18 @@ void main(void)\n\
 		localPosition.x = position.x * graphScale;\n\
 		localPosition.y = position.y * graphScale;\n\
 	}\n\
-	vec4 worldPos = modelMatrix * vec4( localPosition, 1.0 );\n\
+	mat4 objectToWorld = modelMatrix;\n\
+	if( instancing != 0 ){\n\
+		vec4 row3 = vec4( 0.0, 0.0, 0.0, 1.0 );\n\
+		objectToWorld = transpose( mat4( instanceRow0, instanceRow1, instanceRow2, row3 ) );\n\
+	}\n\
+	vec4 worldPos = objectToWorld * vec4( localPosition, 1.0 );\n\
 	varNormal = normal;\n\
 	if( skinning != 0 ){ \n\
-		mat4 skmat0 = skinMatrices[int(joints[0])];\n\
-		mat4 skmat1 = skinMatrices[int(joints[1])];\n\
-		mat4 skmat2 = skinMatrices[int(joints[2])];\n\
-		mat4 skmat3 = skinMatrices[int(joints[3])];\n\
+		mat4 skmat0 = BoneMatrix( joints[0] );\n\
+		mat4 skmat1 = BoneMatrix( joints[1] );\n\
+		mat4 skmat2 = BoneMatrix( joints[2] );\n\
+		mat4 skmat3 = BoneMatrix( joints[3] );\n\
 		float w0 = weights[0], w1 = weights[1];\n\
 		float w2 = weights[2], w3 = weights[3];\n\
 		worldPos = skmat0 * worldPos * w0 + skmat1 * worldPos * w1\n\
@@ -380,21 +453,28 @@ void main(void)\n\
 
 
 static const char *const daox_fragment_shader3d_body =
-"uniform int  vectorGraphics;\n\
+"#ifdef DAOX_VARIANT\n\
+const int    vectorGraphics = 0;\n\
+const int    terrainTileType = DAOX_TERRAIN_TILE_TYPE;\n\
+const int    particleType = DAOX_PARTICLE_TYPE;\n\
+#else\n\
+uniform int  vectorGraphics;\n\
 uniform int  terrainTileType; // 0: none; 1: square; 2: hexagon; \n\
 uniform int  particleType; \n\
-uniform int  lightCount;\n\
-uniform vec4 ambientColor;\n\
-uniform vec4 diffuseColor;\n\
-uniform vec4 specularColor;\n\
-uniform vec4 emissionColor;\n\
-uniform float shininess;\n\
-uniform float time;\n\
+#endif\n\
+uniform int  depthOnly;    // depth pre-pass; \n\
 \n\
-uniform vec3 lightSource[32];\n\
-uniform vec4 lightIntensity[32];\n\
-uniform vec3 cameraPosition;\n\
-uniform mat4 modelMatrix;\n\
+// Clustered lights (see DaoxLightClusters):\n\
+uniform sampler2D lightTexture;\n\
+uniform sampler2D clusterTexture;\n\
+uniform sampler2D lightIndexTexture;\n\
+"
+"const int clusterX = " DAOX_STRING( DAOX_CLUSTER_X ) ";\n"
+"const int clusterY = " DAOX_STRING( DAOX_CLUSTER_Y ) ";\n"
+"const int clusterZ = " DAOX_STRING( DAOX_CLUSTER_Z ) ";\n"
+"const int lightRow = " DAOX_STRING( DAOX_LIGHT_ROW ) ";\n"
+"const int lightIndexRow = " DAOX_STRING( DAOX_LIGHT_INDEX_ROW ) ";\n"
+"\n\
 \n\
 uniform int   tileTextureCount;\n\
 uniform float tileTextureScale;\n\
@@ -556,6 +636,7 @@ vec3 ComputeLight( vec3 lightDir, vec3 lightIntensity, vec3 diffColor )\n\
 		vec3 camDir2 = normalize( vec3( cdx, cdy, cdz ) );\n\
 		vec3 normal2 = vec3( texture( bumpTexture, varTexCoord ) );\n\
 		normal2 = (normal2 - 0.5) * 2.0;\n\
+		if( hasBumpTexture > 1 ) normal2.z = sqrt( max( 0.0, 1.0 - dot( normal2.xy, normal2.xy ) ) );\n\
 		normal = normal2;\n\
 		lightDir = lightDir2;\n\
 		camDir = camDir2;\n\
@@ -569,13 +650,36 @@ vec3 ComputeLight( vec3 lightDir, vec3 lightIntensity, vec3 diffColor )\n\
 	vertexColor += lightIntensity * vec3(specularColor) * pow( dotvalue, shininess );\n\
 	return vertexColor;\n\
 }\n\
+ivec2 LocateCluster()\n\
+{\n\
+	float depth = - (viewMatrix * vec4( worldPosition, 1.0 )).z;\n\
+	float slice = log( max( depth, clusterParams.w ) / clusterParams.w ) * clusterParams.z;\n\
+	int cx = clamp( int( gl_FragCoord.x * clusterParams.x - clusterOffsetX ), 0, clusterX - 1 );\n\
+	int cy = clamp( int( gl_FragCoord.y * clusterParams.y - clusterOffsetY ), 0, clusterY - 1 );\n\
+	int cz = clamp( int( slice ), 0, clusterZ - 1 );\n\
+	return ivec2( texelFetch( clusterTexture, ivec2( cx + cy * clusterX, cz ), 0 ).xy );\n\
+}\n\
 vec4 ComputeAllLights( vec4 diffColor, vec4 emiColor )\n\
 {\n\
 	vec3 litColor = vec3( 0.0, 0.0, 0.0 );\n\
+	ivec2 cluster = LocateCluster();\n\
 	//diffColor = vec4( 0.5, 0.5, 0.5, 1.0 ); // for convenient checking;\n\
-	for(int i=0; i<lightCount; ++i){\n\
-		vec3 lightDir = normalize( lightSource[i] - worldPosition );\n\
-		litColor += ComputeLight( lightDir, vec3(lightIntensity[i]), vec3(diffColor) );\n\
+	for(int i=0; i<cluster.y; ++i){\n\
+		int k = cluster.x + i;\n\
+		int id = int( texelFetch( lightIndexTexture, ivec2( k % lightIndexRow, k / lightIndexRow ), 0 ).r );\n\
+		ivec2 texel = ivec2( 2 * (id % lightRow), id / lightRow );\n\
+		vec4 source = texelFetch( lightTexture, texel, 0 );\n\
+		vec4 intensity = texelFetch( lightTexture, texel + ivec2( 1, 0 ), 0 );\n\
+		vec3 lightVec = vec3( source ) - worldPosition;\n\
+		float attenuation = 1.0;\n\
+		if( source.w > 0.0 ){ // Smooth falloff to zero at the range;\n\
+			float ratio = length( lightVec ) / source.w;\n\
+			attenuation = clamp( 1.0 - ratio*ratio*ratio*ratio, 0.0, 1.0 );\n\
+			attenuation *= attenuation;\n\
+		}\n\
+		if( attenuation <= 0.0 ) continue;\n\
+		vec3 light = ComputeLight( normalize( lightVec ), vec3(intensity), vec3(diffColor) );\n\
+		litColor += attenuation * light;\n\
 	}\n\
 	float alpha2 = diffColor[3];\n\
 	float alpha = emiColor[3];\n\
@@ -661,6 +765,10 @@ vec4 ParticleColor( float factor )\n\
 \n\
 void main(void)\n\
 {\n\
+	if( depthOnly > 0 ){\n\
+		fragColor = vec4( 0.0 );\n\
+		return;\n\
+	}\n\
 	vec4 diffColor = diffuseColor;\n\
 	vec4 emiColor = emissionColor;\n\
 	if( terrainTileType == 1 ) tileTextureInfo = RectLocateTex( varTexCoord );\n\
@@ -687,8 +795,8 @@ void main(void)\n\
 	//fragColor = diffColor;\n\
 	if( particleType > 0 ){\n\
 		if( hasDepthTexture > 0 ){\n\
-			vec2 sv = vec2( gl_FragCoord.x/960.0, gl_FragCoord.y/800.0 );\n\
-			float depth = texture( depthTexture, sv).r;\n\
+			// The depth texture has the same size as the render target:\n\
+			float depth = texelFetch( depthTexture, ivec2( gl_FragCoord.xy ), 0 ).r;\n\
 			if( gl_FragCoord.z > depth ) discard;\n\
 		}\n\
 		float alpha = ParticleFactor( varTexCoord.x, varTexCoord.y ); \n\
@@ -704,6 +812,80 @@ void main(void)\n\
 
 
 
+/*
+// Screen space passes with a full screen triangle (no vertex attributes):
+*/
+static const char *const daox_vertex_shader_screen_body =
+"void main(void)\n\
+{\n\
+	vec2 pos = vec2( float(gl_VertexID & 1) * 4.0 - 1.0, float(gl_VertexID >> 1) * 4.0 - 1.0 );\n\
+	gl_Position = vec4( pos, 0.0, 1.0 );\n\
+}\n";
+
+/*
+// Downsample the scene depth by taking the farthest depth of each block:
+*/
+static const char *const daox_fragment_shader_downsample_body =
+"uniform sampler2D depthTexture;\n\
+uniform int screenScale;\n\
+out vec4 fragColor;\n\
+\n\
+void main(void)\n\
+{\n\
+	ivec2 base = ivec2( gl_FragCoord.xy ) * screenScale;\n\
+	ivec2 size = textureSize( depthTexture, 0 ) - 1;\n\
+	float depth = 0.0;\n\
+	for(int j=0; j<screenScale; ++j){\n\
+		for(int i=0; i<screenScale; ++i){\n\
+			ivec2 pos = min( base + ivec2( i, j ), size );\n\
+			depth = max( depth, texelFetch( depthTexture, pos, 0 ).r );\n\
+		}\n\
+	}\n\
+	gl_FragDepth = depth;\n\
+	fragColor = vec4( depth );\n\
+}\n";
+
+/*
+// Composite the scene and the reduced resolution (premultiplied) particles,
+// with an upsampling that favors the low resolution samples of similar depth:
+*/
+static const char *const daox_fragment_shader_composite_body =
+"uniform sampler2D diffuseTexture;   // scene color; \n\
+uniform sampler2D depthTexture;     // scene depth; \n\
+uniform sampler2D particleTexture;  // reduced resolution particles; \n\
+uniform sampler2D lowDepthTexture;  // reduced resolution depth; \n\
+uniform int screenScale;\n\
+out vec4 fragColor;\n\
+\n\
+void main(void)\n\
+{\n\
+	ivec2 pixel = ivec2( gl_FragCoord.xy );\n\
+	ivec2 size = textureSize( particleTexture, 0 ) - 1;\n\
+	vec2 pos = gl_FragCoord.xy / float( screenScale ) - 0.5;\n\
+	ivec2 base = ivec2( floor( pos ) );\n\
+	vec2 frac = pos - floor( pos );\n\
+	float depth = texelFetch( depthTexture, pixel, 0 ).r;\n\
+	vec4 scene = texelFetch( diffuseTexture, pixel, 0 );\n\
+	vec4 particle = vec4( 0.0 );\n\
+	float weights = 0.0;\n\
+	for(int j=0; j<2; ++j){\n\
+		for(int i=0; i<2; ++i){\n\
+			ivec2 low = clamp( base + ivec2( i, j ), ivec2( 0 ), size );\n\
+			float wx = i == 0 ? 1.0 - frac.x : frac.x;\n\
+			float wy = j == 0 ? 1.0 - frac.y : frac.y;\n\
+			float dz = abs( depth - texelFetch( lowDepthTexture, low, 0 ).r );\n\
+			float weight = (wx * wy + 1e-3) / (dz + 1e-4);\n\
+			particle += weight * texelFetch( particleTexture, low, 0 );\n\
+			weights += weight;\n\
+		}\n\
+	}\n\
+	particle /= weights;\n\
+	fragColor = vec4( particle.rgb + (1.0 - particle.a) * scene.rgb, scene.a );\n\
+	gl_FragDepth = depth;\n\
+}\n";
+
+
+
 DaoxShader* DaoxShader_New()
 {
 	DaoxShader *self = (DaoxShader*) dao_calloc(1,sizeof(DaoxShader));
@@ -714,6 +896,13 @@ DaoxShader* DaoxShader_New()
 }
 void DaoxShader_Delete( DaoxShader *self )
 {
+	int i;
+	if( self->variants ){
+		for(i=0; i<self->variants->size; ++i){
+			DaoxShader_Delete( (DaoxShader*) self->variants->items.pVoid[i] );
+		}
+		DList_Delete( self->variants );
+	}
 	DList_Delete( self->vertexSources );
 	DList_Delete( self->fragmentSources );
 	DaoCstruct_Free( (DaoCstruct*) self );
@@ -731,17 +920,64 @@ void DaoxShader_Init2D( DaoxShader *self )
 	DaoxShader_AppendShader( self, GL_FRAGMENT_SHADER, daox_vector_graphics_shader_body );
 	DaoxShader_AppendShader( self, GL_FRAGMENT_SHADER, daox_fragment_shader2d_body );
 }
-void DaoxShader_Init3D( DaoxShader *self )
+static void DaoxShader_Init3DSources( DaoxShader *self, const char *defines )
 {
 	self->mode = DAOX_GRAPHICS_3D;
 
 	DaoxShader_AddShader( self, GL_VERTEX_SHADER, daox_vertex_shader_header );
+	DaoxShader_AppendShader( self, GL_VERTEX_SHADER, defines );
+	DaoxShader_AppendShader( self, GL_VERTEX_SHADER, daox_uniform_blocks3d );
 	DaoxShader_AppendShader( self, GL_VERTEX_SHADER, daox_vertex_shader3d_body );
 
 	DaoxShader_AddShader( self, GL_FRAGMENT_SHADER, daox_fragment_shader_header );
+	DaoxShader_AppendShader( self, GL_FRAGMENT_SHADER, defines );
+	DaoxShader_AppendShader( self, GL_FRAGMENT_SHADER, daox_uniform_blocks3d );
 	DaoxShader_AppendShader( self, GL_FRAGMENT_SHADER, daox_vector_graphics_shader_body );
 	DaoxShader_AppendShader( self, GL_FRAGMENT_SHADER, daox_fragment_shader3d_body );
 }
+void DaoxShader_Init3D( DaoxShader *self )
+{
+	DaoxShader_Init3DSources( self, "" );
+}
+/*
+// Specialized variant of the 3D shader for mesh drawing, with the features
+// of the variant key (DAOX_VARIANT_*) defined as constants:
+*/
+void DaoxShader_InitVariant( DaoxShader *self, uint_t variant )
+{
+	char defines[256];
+
+	sprintf( defines, "#define DAOX_VARIANT %u\n#define DAOX_SKINNING %i\n"
+			"#define DAOX_HAS_DIFFUSE %i\n#define DAOX_HAS_EMISSION %i\n"
+			"#define DAOX_HAS_BUMP %i\n#define DAOX_TERRAIN_TILE_TYPE %u\n"
+			"#define DAOX_PARTICLE_TYPE %u\n", variant,
+			(variant & DAOX_VARIANT_SKINNING) != 0,
+			(variant & DAOX_VARIANT_DIFFUSE) != 0,
+			(variant & DAOX_VARIANT_EMISSION) != 0,
+			(variant & DAOX_VARIANT_BUMP) ? 1 + ((variant & DAOX_VARIANT_BUMP_RG) != 0) : 0,
+			(variant >> DAOX_VARIANT_TILE_SHIFT) & 0x3,
+			variant >> DAOX_VARIANT_PARTICLE_SHIFT );
+	self->variant = variant;
+	self->specialized = 1;
+	DaoxShader_Init3DSources( self, defines );
+}
+void DaoxShader_InitScreen( DaoxShader *self, int pass )
+{
+	self->mode = DAOX_GRAPHICS_SCREEN;
+
+	DaoxShader_AddShader( self, GL_VERTEX_SHADER, daox_vertex_shader_header );
+	DaoxShader_AppendShader( self, GL_VERTEX_SHADER, daox_vertex_shader_screen_body );
+
+	DaoxShader_AddShader( self, GL_FRAGMENT_SHADER, daox_fragment_shader_header );
+	switch( pass ){
+	case DAOX_SCREEN_DOWNSAMPLE :
+		DaoxShader_AppendShader( self, GL_FRAGMENT_SHADER, daox_fragment_shader_downsample_body );
+		break;
+	case DAOX_SCREEN_COMPOSITE :
+		DaoxShader_AppendShader( self, GL_FRAGMENT_SHADER, daox_fragment_shader_composite_body );
+		break;
+	}
+}
 void DaoxShader_AddShader( DaoxShader *self, int type, const char *codes )
 {
 	DString *source = DString_NewChars( codes );
@@ -822,15 +1058,167 @@ void DaoxShader_CompileShader( DaoxShader *self, int type, DList *strings )
 	if( shader && self->program ) glAttachShader( self->program, shader );
 }
 
+/*
+// Program binary cache:
+// The linked programs are saved in the cache directory of the context,
+// in files named by a hash (FNV-1a) of the shader sources and the driver
+// strings (vendor, renderer and version). A binary that is rejected by the
+// driver is simply rebuilt from the sources and saved again.
+*/
+#ifdef GL_PROGRAM_BINARY_LENGTH
+
+#define DAOX_PROGRAM_BINARY_MAGIC  "DAOXPBIN"
+
+static void DaoxShader_HashString( unsigned long long *hash, const char *chars )
+{
+	if( chars == NULL ) return;
+	for(; *chars; ++chars){
+		*hash ^= (uchar_t) *chars;
+		*hash *= 1099511628211ULL;
+	}
+}
+static int DaoxShader_GetCacheFile( DaoxShader *self, DString *file )
+{
+	DaoxContext *ctx = (DaoxContext*) self->ctx;
+	unsigned long long hash = 14695981039346656037ULL;
+	char name[32];
+	int i;
+
+	if( ctx == NULL || ctx->shaderCache == NULL || ctx->shaderCache->size == 0 ) return 0;
+	for(i=0; i<self->vertexSources->size; ++i){
+		DaoxShader_HashString( & hash, DString_GetData( self->vertexSources->items.pString[i] ) );
+	}
+	DaoxShader_HashString( & hash, "\n//fragment\n" );
+	for(i=0; i<self->fragmentSources->size; ++i){
+		DaoxShader_HashString( & hash, DString_GetData( self->fragmentSources->items.pString[i] ) );
+	}
+	DaoxShader_HashString( & hash, (const char*) glGetString( GL_VENDOR ) );
+	DaoxShader_HashString( & hash, (const char*) glGetString( GL_RENDERER ) );
+	DaoxShader_HashString( & hash, (const char*) glGetString( GL_VERSION ) );
+	sprintf( name, "/%016llx.bin", hash );
+	DString_Assign( file, ctx->shaderCache );
+	DString_AppendChars( file, name );
+	return 1;
+}
+static int DaoxShader_LoadBinary( DaoxShader *self )
+{
+	DString *file = DString_New();
+	char magic[8];
+	GLint format = 0, length = 0, status = 0;
+	void *data;
+	FILE *fin;
+
+	if( DaoxShader_GetCacheFile( self, file ) == 0 ) goto Done;
+	fin = fopen( DString_GetData( file ), "rb" );
+	if( fin == NULL ) goto Done;
+	if( fread( magic, 1, 8, fin ) == 8 && memcmp( magic, DAOX_PROGRAM_BINARY_MAGIC, 8 ) == 0
+			&& fread( & format, sizeof(GLint), 1, fin ) == 1
+			&& fread( & length, sizeof(GLint), 1, fin ) == 1 && length > 0 ){
+		data = dao_malloc( length );
+		if( fread( data, 1, length, fin ) == (size_t) length ){
+			glProgramBinary( self->program, format, data, length );
+			glGetProgramiv( self->program, GL_LINK_STATUS, & status );
+		}
+		dao_free( data );
+	}
+	fclose( fin );
+Done:
+	DString_Delete( file );
+	return status;
+}
+static void DaoxShader_SaveBinary( DaoxShader *self )
+{
+	DString *file = DString_New();
+	DString *temp = DString_New();
+	GLint format = 0, length = 0;
+	void *data = NULL;
+	FILE *fout;
+
+	if( DaoxShader_GetCacheFile( self, file ) == 0 ) goto Done;
+	glGetProgramiv( self->program, GL_PROGRAM_BINARY_LENGTH, & length );
+	if( length <= 0 ) goto Done;
+	data = dao_malloc( length );
+	glGetProgramBinary( self->program, length, & length, (GLenum*) & format, data );
+	if( length <= 0 ) goto Done;
+
+	/* Write to a temporary file first, so that no partial file is loaded: */
+	DString_Assign( temp, file );
+	DString_AppendChars( temp, ".tmp" );
+	fout = fopen( DString_GetData( temp ), "wb" );
+	if( fout == NULL ) goto Done;
+	fwrite( DAOX_PROGRAM_BINARY_MAGIC, 1, 8, fout );
+	fwrite( & format, sizeof(GLint), 1, fout );
+	fwrite( & length, sizeof(GLint), 1, fout );
+	fwrite( data, 1, length, fout );
+	if( fclose( fout ) == 0 ){
+		remove( DString_GetData( file ) );
+		rename( DString_GetData( temp ), DString_GetData( file ) );
+	}else{
+		remove( DString_GetData( temp ) );
+	}
+Done:
+	if( data ) dao_free( data );
+	DString_Delete( file );
+	DString_Delete( temp );
+}
+
+#else
+
+static int DaoxShader_LoadBinary( DaoxShader *self ){ return 0; }
+static void DaoxShader_SaveBinary( DaoxShader *self ){}
+
+#endif
+
+/*
+// The vertex arrays are set up for the attribute locations of the 3D shader,
+// so its variants are linked with the same locations (copied in attributes):
+*/
+static void DaoxShader_BindAttribute( DaoxShader *self, uint_t location, const char *name )
+{
+	if( location != (uint_t) -1 ) glBindAttribLocation( self->program, location, name );
+}
+static void DaoxShader_BindAttributes( DaoxShader *self )
+{
+	DaoxShader_BindAttribute( self, self->attributes.position, "position" );
+	DaoxShader_BindAttribute( self, self->attributes.normal, "normal" );
+	DaoxShader_BindAttribute( self, self->attributes.tangent, "tangent" );
+	DaoxShader_BindAttribute( self, self->attributes.texCoord, "texCoord" );
+	DaoxShader_BindAttribute( self, self->attributes.texMO, "texMO" );
+	DaoxShader_BindAttribute( self, self->attributes.joints, "joints" );
+	DaoxShader_BindAttribute( self, self->attributes.weights, "weights" );
+	DaoxShader_BindAttribute( self, self->attributes.instanceRows[0], "instanceRow0" );
+	DaoxShader_BindAttribute( self, self->attributes.instanceRows[1], "instanceRow1" );
+	DaoxShader_BindAttribute( self, self->attributes.instanceRows[2], "instanceRow2" );
+}
+
+/*
+// Create the program, and load it from the binary cache, or compile it:
+*/
+static void DaoxShader_CreateProgram( DaoxShader *self )
+{
+	self->program = glCreateProgram();
+	self->cached = self->program && DaoxShader_LoadBinary( self );
+	if( self->cached ) return;
+
+	DaoxShader_CompileShader( self, GL_VERTEX_SHADER, self->vertexSources );
+	DaoxShader_CompileShader( self, GL_FRAGMENT_SHADER, self->fragmentSources );
+}
+
 void DaoxShader_Finalize( DaoxShader *self )
 {
 	GLint length, program_ok;
 	int shaderAttribute = 0;
 
-	if( self->program == 0 ) return;
+	if( self->program == 0 || self->cached ) return;
 
 #ifndef DAO_GRAPHICS_USE_GLES
 	glBindFragDataLocation( self->program, 0, "fragColor");
+#endif
+	if( self->specialized ) DaoxShader_BindAttributes( self );
+#ifdef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+	if( self->ctx && ((DaoxContext*)self->ctx)->shaderCache ){
+		glProgramParameteri( self->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+	}
 #endif
 	glLinkProgram( self->program );
 	glGetProgramiv( self->program, GL_LINK_STATUS, &program_ok );
@@ -844,7 +1232,9 @@ void DaoxShader_Finalize( DaoxShader *self )
 		fprintf(stderr, "Failed to link shader program with error message: %s\n", log2 );
 		glDeleteProgram(self->program);
 		self->program = 0;
+		return;
 	}
+	DaoxShader_SaveBinary( self );
 }
 void DaoxShader_GetVectorGraphicsUniforms( DaoxShader *self )
 {
@@ -885,22 +1275,25 @@ void DaoxShader_Finalize3D( DaoxShader *self )
 	DaoxShader_Finalize( self );
 	if( self->program == 0 ) return;
 	DaoxShader_GetVectorGraphicsUniforms( self );
-	self->uniforms.time = glGetUniformLocation(self->program, "time");
 	self->uniforms.vectorGraphics = glGetUniformLocation(self->program, "vectorGraphics");
-	self->uniforms.projMatrix = glGetUniformLocation(self->program, "projMatrix");
-	self->uniforms.viewMatrix = glGetUniformLocation(self->program, "viewMatrix");
-	self->uniforms.modelMatrix = glGetUniformLocation(self->program, "modelMatrix");
-	self->uniforms.cameraPosition = glGetUniformLocation(self->program, "cameraPosition");
-	self->uniforms.lightCount = glGetUniformLocation(self->program, "lightCount");
-	self->uniforms.lightSource = glGetUniformLocation(self->program, "lightSource");
-	self->uniforms.lightIntensity = glGetUniformLocation(self->program, "lightIntensity");
+	self->uniforms.lightTexture = glGetUniformLocation(self->program, "lightTexture");
+	self->uniforms.clusterTexture = glGetUniformLocation(self->program, "clusterTexture");
+	self->uniforms.lightIndexTexture = glGetUniformLocation(self->program, "lightIndexTexture");
 	self->uniforms.skinning = glGetUniformLocation(self->program, "skinning");
-	self->uniforms.skinMatrices = glGetUniformLocation(self->program, "skinMatrices");
-	self->uniforms.ambientColor = glGetUniformLocation(self->program, "ambientColor");
-	self->uniforms.diffuseColor = glGetUniformLocation(self->program, "diffuseColor");
-	self->uniforms.specularColor = glGetUniformLocation(self->program, "specularColor");
-	self->uniforms.emissionColor = glGetUniformLocation(self->program, "emissionColor");
-	self->uniforms.shininess = glGetUniformLocation(self->program, "shininess");
+	self->uniforms.boneOffset = glGetUniformLocation(self->program, "boneOffset");
+	self->uniforms.boneTexture = glGetUniformLocation(self->program, "boneTexture");
+	self->uniforms.instancing = glGetUniformLocation(self->program, "instancing");
+	self->uniforms.depthOnly = glGetUniformLocation(self->program, "depthOnly");
+
+	glUniformBlockBinding( self->program, glGetUniformBlockIndex( self->program, "FrameData" ), DAOX_FRAME_BLOCK );
+	glUniformBlockBinding( self->program, glGetUniformBlockIndex( self->program, "MaterialData" ), DAOX_MATERIAL_BLOCK );
+	glUniformBlockBinding( self->program, glGetUniformBlockIndex( self->program, "ObjectData" ), DAOX_OBJECT_BLOCK );
+	if( self->blocks.frame == NULL && self->specialized == 0 ){
+		/* Block 1: the frame data of the reduced particle pass; */
+		self->blocks.frame = DaoxUniformBuffer_New( DAOX_FRAME_BLOCK, sizeof(DaoxFrameBlock), 2 );
+		self->blocks.material = DaoxUniformBuffer_New( DAOX_MATERIAL_BLOCK, sizeof(DaoxMaterialBlock), 64 );
+		self->blocks.object = DaoxUniformBuffer_New( DAOX_OBJECT_BLOCK, sizeof(DaoxObjectBlock), 256 );
+	}
 	self->uniforms.hasDiffuseTexture = glGetUniformLocation(self->program, "hasDiffuseTexture");
 	self->uniforms.hasEmissionTexture = glGetUniformLocation(self->program, "hasEmissionTexture");
 	self->uniforms.hasBumpTexture = glGetUniformLocation(self->program, "hasBumpTexture");
@@ -927,6 +1320,9 @@ void DaoxShader_Finalize3D( DaoxShader *self )
 	self->attributes.texMO = glGetAttribLocation(self->program, "texMO");
 	self->attributes.joints = glGetAttribLocation(self->program, "joints");
 	self->attributes.weights = glGetAttribLocation(self->program, "weights");
+	self->attributes.instanceRows[0] = glGetAttribLocation(self->program, "instanceRow0");
+	self->attributes.instanceRows[1] = glGetAttribLocation(self->program, "instanceRow1");
+	self->attributes.instanceRows[2] = glGetAttribLocation(self->program, "instanceRow2");
 }
 void DaoxShader_InitVGSamplers( DaoxShader *self )
 {
@@ -958,28 +1354,65 @@ void DaoxShader_InitVGSamplers( DaoxShader *self )
 }
 void DaoxShader_Build2D( DaoxShader *self )
 {
-	self->program = glCreateProgram();
-
-	DaoxShader_CompileShader( self, GL_VERTEX_SHADER, self->vertexSources );
-	DaoxShader_CompileShader( self, GL_FRAGMENT_SHADER, self->fragmentSources );
-
+	DaoxShader_CreateProgram( self );
 	DaoxShader_InitVGSamplers( self );
 
 	DaoxShader_Finalize2D( self );
 }
 void DaoxShader_Build3D( DaoxShader *self )
 {
-	self->program = glCreateProgram();
-
-	DaoxShader_CompileShader( self, GL_VERTEX_SHADER, self->vertexSources );
-	DaoxShader_CompileShader( self, GL_FRAGMENT_SHADER, self->fragmentSources );
-
-	DaoxShader_InitVGSamplers( self );
+	DaoxShader_CreateProgram( self );
+	/* The variants are only used for mesh drawing: */
+	if( self->specialized == 0 ) DaoxShader_InitVGSamplers( self );
 
 	DaoxShader_Finalize3D( self );
 }
+void DaoxShader_BuildScreen( DaoxShader *self )
+{
+	DaoxShader_CreateProgram( self );
+	DaoxShader_Finalize( self );
+	if( self->program == 0 ) return;
+	self->uniforms.diffuseTexture = glGetUniformLocation(self->program, "diffuseTexture");
+	self->uniforms.depthTexture = glGetUniformLocation(self->program, "depthTexture");
+	self->uniforms.particleTexture = glGetUniformLocation(self->program, "particleTexture");
+	self->uniforms.lowDepthTexture = glGetUniformLocation(self->program, "lowDepthTexture");
+	self->uniforms.screenScale = glGetUniformLocation(self->program, "screenScale");
+}
+/*
+// Get the specialized variant of the 3D shader, and build it if necessary.
+// The variants are freed together with this shader, and rebuilt on demand.
+// Return NULL if the variant cannot be built.
+*/
+DaoxShader* DaoxShader_GetVariant( DaoxShader *self, uint_t variant )
+{
+	DaoxShader *shader;
+	int i;
+
+	if( self->program == 0 || self->mode != DAOX_GRAPHICS_3D ) return NULL;
+	if( self->variants == NULL ) self->variants = DList_New(0);
+	for(i=0; i<self->variants->size; ++i){
+		shader = (DaoxShader*) self->variants->items.pVoid[i];
+		if( shader->variant == variant ) return shader->program ? shader : NULL;
+	}
+	shader = DaoxShader_New();
+	shader->ctx = self->ctx;
+	shader->attributes = self->attributes;
+	DaoxShader_InitVariant( shader, variant );
+	DaoxShader_Build3D( shader );
+	DList_Append( self->variants, shader );
+	return shader->program ? shader : NULL;
+}
 void DaoxShader_Free( DaoxShader *self )
 {
+	int i;
+	if( self->variants ){
+		for(i=0; i<self->variants->size; ++i){
+			DaoxShader *shader = (DaoxShader*) self->variants->items.pVoid[i];
+			DaoxShader_Free( shader );
+			DaoxShader_Delete( shader );
+		}
+		DList_Clear( self->variants );
+	}
 	if( self->vertexShader ) glDeleteShader( self->vertexShader );
 	if( self->fragmentShader ) glDeleteShader( self->fragmentShader );
 	if( self->program ) glDeleteProgram( self->program );
@@ -990,6 +1423,12 @@ void DaoxShader_Free( DaoxShader *self )
 	self->fragmentShader = 0;
 	self->textures.dashSampler = 0;
 	self->textures.gradientSampler = 0;
+	if( self->blocks.frame ) DaoxUniformBuffer_Delete( self->blocks.frame );
+	if( self->blocks.material ) DaoxUniformBuffer_Delete( self->blocks.material );
+	if( self->blocks.object ) DaoxUniformBuffer_Delete( self->blocks.object );
+	self->blocks.frame = NULL;
+	self->blocks.material = NULL;
+	self->blocks.object = NULL;
 }
 
 void DaoxShader_MakeGradientSampler( DaoxShader *self, DaoxGradient *gradient, int fill )
@@ -1053,6 +1492,110 @@ void DaoxShader_MakeDashSampler( DaoxShader *self, DaoxBrush *brush )
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, n, 1, GL_RED, GL_FLOAT, dash);
 	glUniform1i(self->uniforms.dashSampler, DAOX_DASH_SAMPLER );
 }
+void DaoxShader_SetViewMatrices( DaoxShader *self, GLfloat projMatrix[16], GLfloat viewMatrix[16] )
+{
+	DaoxUniformBuffer *frame = self->blocks.frame;
+	if( frame == NULL ){
+		glUniformMatrix4fv( self->uniforms.projMatrix, 1, 0, projMatrix );
+		glUniformMatrix4fv( self->uniforms.viewMatrix, 1, 0, viewMatrix );
+		return;
+	}
+	DaoxUniformBuffer_Update( frame, 0, 0, 16*sizeof(GLfloat), projMatrix );
+	DaoxUniformBuffer_Update( frame, 0, 16*sizeof(GLfloat), 16*sizeof(GLfloat), viewMatrix );
+	DaoxUniformBuffer_Bind( frame, 0 );
+}
+void DaoxShader_SetModelMatrix( DaoxShader *self, GLfloat modelMatrix[16] )
+{
+	if( self->blocks.object == NULL ){
+		glUniformMatrix4fv( self->uniforms.modelMatrix, 1, 0, modelMatrix );
+		return;
+	}
+	DaoxUniformBuffer_Push( self->blocks.object, modelMatrix, sizeof(DaoxObjectBlock) );
+}
+void DaoxShader_SetMaterial( DaoxShader *self, DaoxMaterialBlock *material )
+{
+	if( self->blocks.material == NULL ) return;
+	DaoxUniformBuffer_Push( self->blocks.material, material, sizeof(DaoxMaterialBlock) );
+}
+
+
+
+
+DaoxUniformBuffer* DaoxUniformBuffer_New( int binding, int blockSize, int capacity )
+{
+	DaoxUniformBuffer *self = (DaoxUniformBuffer*) dao_calloc( 1, sizeof(DaoxUniformBuffer) );
+	GLint alignment = 256;
+
+	glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, & alignment );
+	if( alignment < 16 ) alignment = 16;
+	self->binding = binding;
+	self->blockSize = blockSize;
+	self->stride = alignment * ((blockSize + alignment - 1) / alignment);
+	glGenBuffers( 1, & self->buffer );
+	DaoxUniformBuffer_Reserve( self, capacity );
+	return self;
+}
+void DaoxUniformBuffer_Delete( DaoxUniformBuffer *self )
+{
+	if( self->buffer ) glDeleteBuffers( 1, & self->buffer );
+	dao_free( self );
+}
+int DaoxUniformBuffer_Reserve( DaoxUniformBuffer *self, int count )
+{
+	if( count <= self->capacity ) return 0;
+	self->capacity = count > 1 ? 1.5 * count : 1;
+	self->next = 0;
+	glBindBuffer( GL_UNIFORM_BUFFER, self->buffer );
+	glBufferData( GL_UNIFORM_BUFFER, self->capacity * self->stride, NULL, GL_DYNAMIC_DRAW );
+	glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+	return 1;
+}
+/*
+// Map the first "count" blocks for writing, the previous data is discarded.
+// Block i starts at (char*)data + i*stride;
+*/
+void* DaoxUniformBuffer_Map( DaoxUniformBuffer *self, int count )
+{
+	DaoxUniformBuffer_Reserve( self, count );
+	glBindBuffer( GL_UNIFORM_BUFFER, self->buffer );
+	return glMapBufferRange( GL_UNIFORM_BUFFER, 0, count * self->stride, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT );
+}
+void DaoxUniformBuffer_Unmap( DaoxUniformBuffer *self )
+{
+	glUnmapBuffer( GL_UNIFORM_BUFFER );
+	glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+}
+void DaoxUniformBuffer_Update( DaoxUniformBuffer *self, int index, int offset, int size, void *data )
+{
+	glBindBuffer( GL_UNIFORM_BUFFER, self->buffer );
+	glBufferSubData( GL_UNIFORM_BUFFER, index * self->stride + offset, size, data );
+	glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+}
+void DaoxUniformBuffer_Bind( DaoxUniformBuffer *self, int index )
+{
+	glBindBufferRange( GL_UNIFORM_BUFFER, self->binding, self->buffer, index * self->stride, self->blockSize );
+}
+void DaoxUniformBuffer_Push( DaoxUniformBuffer *self, void *data, int size )
+{
+	GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+	void *block;
+
+	glBindBuffer( GL_UNIFORM_BUFFER, self->buffer );
+	if( self->next >= self->capacity ){
+		/* Orphaning: the old storage is kept by the driver until its draws are done; */
+		glBufferData( GL_UNIFORM_BUFFER, self->capacity * self->stride, NULL, GL_DYNAMIC_DRAW );
+		self->next = 0;
+	}
+	/* The block has not been used since the orphaning, no synchronization is needed: */
+	block = glMapBufferRange( GL_UNIFORM_BUFFER, self->next * self->stride, self->stride, access );
+	if( block != NULL ){
+		memcpy( block, data, size );
+		glUnmapBuffer( GL_UNIFORM_BUFFER );
+	}
+	glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+	DaoxUniformBuffer_Bind( self, self->next );
+	self->next += 1;
+}
 
 
 
@@ -1067,10 +1610,13 @@ void DaoxShader_MakeDashSampler( DaoxShader *self, DaoxBrush *brush )
 // https://www.opengl.org/wiki/Array_Texture
 */
 
+static uint_t daox_buffer_ids = 0;
+
 DaoxBuffer* DaoxBuffer_New()
 {
 	DaoxBuffer *self = (DaoxBuffer*) dao_calloc(1,sizeof(DaoxBuffer));
 	DaoCstruct_Init( (DaoCstruct*) self, daox_type_buffer );
+	self->id = ++ daox_buffer_ids;
 	self->vertexCapacity = 16*1024;
 	self->triangleCapacity = 16*1024;
 	return self;
@@ -1087,6 +1633,7 @@ void DaoxBuffer_Init2D( DaoxBuffer *self, int pos, int klmo )
 
 	self->mode = DAOX_GRAPHICS_2D;
 
+	memset( self->traits, 0, sizeof(self->traits) );
 	self->traitCount = 2;
 	self->vertexSize = sizeof(DaoGLVertex2D);
 	self->triangleSize = sizeof(DaoGLTriangle);
@@ -1097,12 +1644,20 @@ void DaoxBuffer_Init2D( DaoxBuffer *self, int pos, int klmo )
 	self->traits[0].offset = NULL;
 	self->traits[1].offset = (void*) & vertex->texKLMO;
 }
+/*
+// With compact layout, the packed normals and tangents are passed as normalized
+// four component attributes (the shader only uses the first three), and the
+// half float texture coordinates as they are; the joint indices are converted
+// to floats and the weights are normalized, so the same shader applies.
+*/
 void DaoxBuffer_Init3D( DaoxBuffer *self, int pos, int norm, int tan, int texuv )
 {
 	DaoGLVertex3D *vertex = NULL;
+	DaoGLPackedVertex3D *packed = NULL;
 
 	self->mode = DAOX_GRAPHICS_3D;
 
+	memset( self->traits, 0, sizeof(self->traits) );
 	self->traitCount = 4;
 	self->vertexSize = sizeof(DaoGLVertex3D);
 	self->triangleSize = sizeof(DaoGLTriangle);
@@ -1118,6 +1673,20 @@ void DaoxBuffer_Init3D( DaoxBuffer *self, int pos, int norm, int tan, int texuv
 	self->traits[1].offset = (void*) & vertex->norm;
 	self->traits[2].offset = (void*) & vertex->tan;
 	self->traits[3].offset = (void*) & vertex->tex;
+	if( self->shortIndices ) self->triangleSize = sizeof(DaoGLShortTriangle);
+	if( self->packed == 0 ) return;
+
+	self->vertexSize = sizeof(DaoGLPackedVertex3D);
+	self->traits[1].count = 4;
+	self->traits[2].count = 4;
+	self->traits[1].type = GL_INT_2_10_10_10_REV;
+	self->traits[2].type = GL_INT_2_10_10_10_REV;
+	self->traits[3].type = GL_HALF_FLOAT;
+	self->traits[1].normalized = 1;
+	self->traits[2].normalized = 1;
+	self->traits[1].offset = (void*) & packed->norm;
+	self->traits[2].offset = (void*) & packed->tan;
+	self->traits[3].offset = (void*) & packed->tex;
 }
 void DaoxBuffer_Init3DSK( DaoxBuffer *self, int pos, int norm, int tan, int texuv, int joints, int weights )
 {
@@ -1135,6 +1704,15 @@ void DaoxBuffer_Init3DSK( DaoxBuffer *self, int pos, int norm, int tan, int texu
 	self->traits[5].uniform = weights;
 	self->traits[5].count = 4;
 	self->traits[5].offset = (void*) & vertex->weights;
+	if( self->packed ){
+		DaoGLPackedSkinVertex3D *packed = NULL;
+		self->vertexSize = sizeof(DaoGLPackedSkinVertex3D);
+		self->traits[4].type = GL_UNSIGNED_BYTE;
+		self->traits[5].type = GL_UNSIGNED_BYTE;
+		self->traits[5].normalized = 1;
+		self->traits[4].offset = (void*) & packed->joints;
+		self->traits[5].offset = (void*) & packed->weights;
+	}
 }
 void DaoxBuffer_Init3DVG( DaoxBuffer *self, int pos, int norm, int texuv, int texmo )
 {
@@ -1142,6 +1720,7 @@ void DaoxBuffer_Init3DVG( DaoxBuffer *self, int pos, int norm, int texuv, int te
 
 	self->mode = DAOX_GRAPHICS_3DVG;
 
+	memset( self->traits, 0, sizeof(self->traits) );
 	self->traitCount = 4;
 	self->vertexSize = sizeof(DaoGLVertex3DVG);
 	self->triangleSize = sizeof(DaoGLTriangle);
@@ -1160,9 +1739,21 @@ void DaoxBuffer_Init3DVG( DaoxBuffer *self, int pos, int norm, int texuv, int te
 }
 void DaoxBuffer_Free( DaoxBuffer *self )
 {
+	int i;
+	for(i=0; i<DAOX_BUFFER_REGIONS; ++i){
+		if( self->fences[i] ) glDeleteSync( self->fences[i] );
+		self->fences[i] = NULL;
+	}
 	if( self->vertexVAO ) glDeleteVertexArrays( 1, & self->vertexVAO );
 	if( self->vertexVBO ) glDeleteBuffers( 1, & self->vertexVBO );
 	if( self->triangleVBO ) glDeleteBuffers( 1, & self->triangleVBO );
+	if( self->instanceVBO ) glDeleteBuffers( 1, & self->instanceVBO );
+	if( self->indirectVBO ) glDeleteBuffers( 1, & self->indirectVBO );
+	self->vertexVAO = self->vertexVBO = self->triangleVBO = self->instanceVBO = 0;
+	self->indirectVBO = 0;
+	self->vertexOffset = self->triangleOffset = 0;
+	self->vertexData = self->triangleData = NULL;
+	self->streaming = self->region = 0;
 }
 
 void DaoxBuffer_SetVertexBufferAttributes( DaoxBuffer *self )
@@ -1172,31 +1763,172 @@ void DaoxBuffer_SetVertexBufferAttributes( DaoxBuffer *self )
 	for(i=0; i<self->traitCount; ++i){
 		int uniform = self->traits[i].uniform;
 		int count = self->traits[i].count;
+		int type = self->traits[i].type ? self->traits[i].type : GL_FLOAT;
+		int normalized = self->traits[i].normalized ? GL_TRUE : GL_FALSE;
 		void *offset = self->traits[i].offset;
 		glEnableVertexAttribArray( uniform );
-		glVertexAttribPointer( uniform, count, GL_FLOAT, GL_FALSE, stride, offset );
+		glVertexAttribPointer( uniform, count, type, normalized, stride, offset );
+	}
+}
+
+/* Used by the persistent streaming and the indirect drawing: */
+#if !defined(DAO_GRAPHICS_USE_GLES) && (defined(GL_MAP_PERSISTENT_BIT) || defined(GL_DRAW_INDIRECT_BUFFER))
+static int DaoxBuffer_GLVersion()
+{
+	static int version = -1;
+	if( version < 0 ){
+		GLint major = 0, minor = 0;
+		glGetIntegerv( GL_MAJOR_VERSION, & major );
+		glGetIntegerv( GL_MINOR_VERSION, & minor );
+		version = 10*major + minor;
 	}
+	return version;
+}
+#endif
+
+/*
+// Persistent streaming (GL 4.4):
+// The streaming buffers are created once with immutable storage for
+// DAOX_BUFFER_REGIONS frames, and stay mapped. Each frame writes to its own
+// region, which is reused only after the fence set at the end of the frame
+// that used it last has been signaled. There is no orphaning or implicit sync.
+*/
+#if defined(GL_MAP_PERSISTENT_BIT) && !defined(DAO_GRAPHICS_USE_GLES)
+#define DAOX_PERSISTENT_FLAGS  (GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT)
+
+static int DaoxBuffer_HasStorage()
+{
+	return DaoxBuffer_GLVersion() >= 44;
+}
+static void* DaoxBuffer_CreateStorage( uint_t *buffer, int target, int size )
+{
+	glGenBuffers( 1, buffer );
+	glBindBuffer( target, *buffer );
+	glBufferStorage( target, DAOX_BUFFER_REGIONS * size, NULL, DAOX_PERSISTENT_FLAGS );
+	return glMapBufferRange( target, 0, DAOX_BUFFER_REGIONS * size, DAOX_PERSISTENT_FLAGS );
+}
+#else
+static int DaoxBuffer_HasStorage(){ return 0; }
+static void* DaoxBuffer_CreateStorage( uint_t *buffer, int target, int size ){ return NULL; }
+#endif
+
+/* Must be called before the buffer is bound to the context; */
+void DaoxBuffer_InitStreaming( DaoxBuffer *self )
+{
+	if( self->retained || self->vertexVBO ) return;
+	self->streaming = DaoxBuffer_HasStorage();
+}
+static void DaoxBuffer_WaitRegion( DaoxBuffer *self, int region )
+{
+	GLsync fence = self->fences[region];
+	if( fence == NULL ) return;
+	/* Normally signaled already, the region was used DAOX_BUFFER_REGIONS-1 frames ago: */
+	while( glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 ) == GL_TIMEOUT_EXPIRED );
+	glDeleteSync( fence );
+	self->fences[region] = NULL;
+}
+void DaoxBuffer_BeginFrame( DaoxBuffer *self )
+{
+	if( self->streaming == 0 ) return;
+	self->region = (self->region + 1) % DAOX_BUFFER_REGIONS;
+	DaoxBuffer_WaitRegion( self, self->region );
+	self->vertexOffset = self->region * self->vertexCapacity;
+	self->triangleOffset = self->region * self->triangleCapacity;
+}
+void DaoxBuffer_EndFrame( DaoxBuffer *self )
+{
+	if( self->streaming == 0 ) return;
+	if( self->fences[self->region] ) glDeleteSync( self->fences[self->region] );
+	self->fences[self->region] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+}
+/*
+// Growing never waits for the GPU: a larger buffer is created and the old one
+// is deleted, which is kept alive by the driver until its pending draws finish.
+// All the regions of the new buffer are free, so the current region is kept,
+// and the fences remain valid for the other buffer.
+*/
+static void DaoxBuffer_GrowVertices( DaoxBuffer *self, int count )
+{
+	GLint vao = 0;
+	int capacity = count > self->vertexCapacity ? count : self->vertexCapacity;
+
+	glGetIntegerv( GL_VERTEX_ARRAY_BINDING, & vao );
+	glBindVertexArray( self->vertexVAO );
+	glDeleteBuffers( 1, & self->vertexVBO );
+	self->vertexCapacity = 1.5 * capacity;
+	self->vertexData = DaoxBuffer_CreateStorage( & self->vertexVBO, GL_ARRAY_BUFFER, self->vertexCapacity*self->vertexSize );
+	DaoxBuffer_SetVertexBufferAttributes( self );
+	glBindVertexArray( vao );
+	self->vertexOffset = self->region * self->vertexCapacity;
 }
+static void DaoxBuffer_GrowTriangles( DaoxBuffer *self, int count )
+{
+	GLint vao = 0;
+	int capacity = count > self->triangleCapacity ? count : self->triangleCapacity;
+
+	glGetIntegerv( GL_VERTEX_ARRAY_BINDING, & vao );
+	glBindVertexArray( self->vertexVAO );
+	glDeleteBuffers( 1, & self->triangleVBO );
+	self->triangleCapacity = 1.5 * capacity;
+	self->triangleData = DaoxBuffer_CreateStorage( & self->triangleVBO, GL_ELEMENT_ARRAY_BUFFER, self->triangleCapacity*self->triangleSize );
+	glBindVertexArray( vao );
+	self->triangleOffset = self->region * self->triangleCapacity;
+}
+
 void DaoxBuffer_BindBuffers( DaoxBuffer *self )
 {
-	glGenVertexArrays( 1, & self->vertexVAO );
-	glGenBuffers( 1, & self->vertexVBO );
-	glGenBuffers( 1, & self->triangleVBO );
+	int usage = self->retained ? GL_STATIC_DRAW : GL_STREAM_DRAW;
 
+	glGenVertexArrays( 1, & self->vertexVAO );
 	glBindVertexArray( self->vertexVAO );
-	glBindBuffer( GL_ARRAY_BUFFER, self->vertexVBO );
-	glBufferData( GL_ARRAY_BUFFER, self->vertexCapacity*self->vertexSize, NULL, GL_STREAM_DRAW );
+	if( self->streaming ){
+		int size = self->vertexCapacity*self->vertexSize;
+		self->vertexData = DaoxBuffer_CreateStorage( & self->vertexVBO, GL_ARRAY_BUFFER, size );
+	}else{
+		glGenBuffers( 1, & self->vertexVBO );
+		glBindBuffer( GL_ARRAY_BUFFER, self->vertexVBO );
+		glBufferData( GL_ARRAY_BUFFER, self->vertexCapacity*self->vertexSize, NULL, usage );
+	}
 	DaoxBuffer_SetVertexBufferAttributes( self );
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->triangleVBO );
-	glBufferData( GL_ELEMENT_ARRAY_BUFFER, self->triangleCapacity*self->triangleSize, NULL, GL_STREAM_DRAW );
+	if( self->streaming ){
+		int size = self->triangleCapacity*self->triangleSize;
+		self->triangleData = DaoxBuffer_CreateStorage( & self->triangleVBO, GL_ELEMENT_ARRAY_BUFFER, size );
+	}else{
+		glGenBuffers( 1, & self->triangleVBO );
+		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->triangleVBO );
+		glBufferData( GL_ELEMENT_ARRAY_BUFFER, self->triangleCapacity*self->triangleSize, NULL, usage );
+	}
 	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+
+	if( self->instanceCapacity ){
+		glGenBuffers( 1, & self->instanceVBO );
+		glBindBuffer( GL_ARRAY_BUFFER, self->instanceVBO );
+		glBufferData( GL_ARRAY_BUFFER, self->instanceCapacity*12*sizeof(GLfloat), NULL, GL_STREAM_DRAW );
+		DaoxBuffer_SetInstanceOffset( self, 0 );
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	}
 	glBindVertexArray(0);
+
+	if( self->indirectCapacity ){
+		/* Not part of the vertex array state: */
+		glGenBuffers( 1, & self->indirectVBO );
+		glBindBuffer( GL_DRAW_INDIRECT_BUFFER, self->indirectVBO );
+		glBufferData( GL_DRAW_INDIRECT_BUFFER, self->indirectCapacity*sizeof(DaoGLDrawCommand), NULL, GL_STREAM_DRAW );
+		glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+	}
 }
 void* DaoxBuffer_MapVertices( DaoxBuffer *self, int count )
 {
 	int dataSize = count * self->vertexSize;
+	if( self->streaming ){
+		if( self->vertexOffset + count > (self->region + 1) * self->vertexCapacity ){
+			DaoxBuffer_GrowVertices( self, count );
+		}
+		glBindBuffer( GL_ARRAY_BUFFER, self->vertexVBO );
+		return (char*) self->vertexData + self->vertexOffset * self->vertexSize;
+	}
 	glBindBuffer( GL_ARRAY_BUFFER, self->vertexVBO );
 	if( self->vertexOffset + count > self->vertexCapacity ){
 		if( (self->vertexOffset + count) > self->vertexCapacity ) self->vertexCapacity = 1.5 * count;
@@ -1221,6 +1953,13 @@ DaoGLVertex3DVG* DaoxBuffer_MapVertices3DVG( DaoxBuffer *self, int count )
 DaoGLTriangle* DaoxBuffer_MapTriangles( DaoxBuffer *self, int count )
 {
 	int dataSize = count * self->triangleSize;
+	if( self->streaming ){
+		if( self->triangleOffset + count > (self->region + 1) * self->triangleCapacity ){
+			DaoxBuffer_GrowTriangles( self, count );
+		}
+		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->triangleVBO );
+		return (DaoGLTriangle*) ((char*) self->triangleData + self->triangleOffset * self->triangleSize);
+	}
 	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->triangleVBO );
 	if( self->triangleOffset + count > self->triangleCapacity ){
 		if( (self->triangleOffset + count) > self->triangleCapacity ) self->triangleCapacity = 1.5 * count;
@@ -1229,6 +1968,169 @@ DaoGLTriangle* DaoxBuffer_MapTriangles( DaoxBuffer *self, int count )
 	}
 	return (DaoGLTriangle*) glMapBufferRange( GL_ELEMENT_ARRAY_BUFFER, self->triangleOffset*self->triangleSize, dataSize, GL_MAP_WRITE_BIT|GL_MAP_UNSYNCHRONIZED_BIT|GL_MAP_INVALIDATE_BUFFER_BIT );
 }
+/*
+// Unmap the vertices and triangles mapped by the last calls of DaoxBuffer_MapVertices()
+// and DaoxBuffer_MapTriangles(), whose buffers are still bound;
+*/
+void DaoxBuffer_Unmap( DaoxBuffer *self )
+{
+	if( self->streaming ) return;  /* Coherent mapping, nothing to flush; */
+	glUnmapBuffer( GL_ARRAY_BUFFER );
+	glUnmapBuffer( GL_ELEMENT_ARRAY_BUFFER );
+}
+
+
+/*
+// Retained storage:
+// Regions are allocated from the front of the buffers (tracked by vertexOffset
+// and triangleOffset), and must stay valid across frames. So growing the buffers
+// must preserve their existing data, which is done by copying on the server side.
+*/
+static uint_t DaoxBuffer_Regrow( uint_t buffer, int size, int newsize )
+{
+	uint_t buffer2 = 0;
+
+	glGenBuffers( 1, & buffer2 );
+	glBindBuffer( GL_COPY_WRITE_BUFFER, buffer2 );
+	glBufferData( GL_COPY_WRITE_BUFFER, newsize, NULL, GL_STATIC_DRAW );
+	if( size ){
+		glBindBuffer( GL_COPY_READ_BUFFER, buffer );
+		glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size );
+		glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+	}
+	glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+	glDeleteBuffers( 1, & buffer );
+	return buffer2;
+}
+void DaoxBuffer_Reserve( DaoxBuffer *self, int vertexCount, int triangleCount )
+{
+	int vertexCapacity = self->vertexCapacity;
+	int triangleCapacity = self->triangleCapacity;
+
+	if( self->vertexOffset + vertexCount > vertexCapacity ){
+		vertexCapacity = 1.5 * (self->vertexOffset + vertexCount);
+	}
+	if( self->triangleOffset + triangleCount > triangleCapacity ){
+		triangleCapacity = 1.5 * (self->triangleOffset + triangleCount);
+	}
+	if( vertexCapacity == self->vertexCapacity && triangleCapacity == self->triangleCapacity ){
+		return;
+	}
+
+	glBindVertexArray( self->vertexVAO );
+	if( vertexCapacity != self->vertexCapacity ){
+		int size = self->vertexOffset * self->vertexSize;
+		int newsize = vertexCapacity * self->vertexSize;
+		self->vertexVBO = DaoxBuffer_Regrow( self->vertexVBO, size, newsize );
+		self->vertexCapacity = vertexCapacity;
+		DaoxBuffer_SetVertexBufferAttributes( self );
+	}
+	if( triangleCapacity != self->triangleCapacity ){
+		int size = self->triangleOffset * self->triangleSize;
+		int newsize = triangleCapacity * self->triangleSize;
+		self->triangleVBO = DaoxBuffer_Regrow( self->triangleVBO, size, newsize );
+		self->triangleCapacity = triangleCapacity;
+	}
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->triangleVBO );
+	glBindVertexArray(0);
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+}
+void* DaoxBuffer_MapVertexRange( DaoxBuffer *self, int offset, int count )
+{
+	glBindBuffer( GL_ARRAY_BUFFER, self->vertexVBO );
+	return glMapBufferRange( GL_ARRAY_BUFFER, offset*self->vertexSize, count*self->vertexSize, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_RANGE_BIT );
+}
+DaoGLTriangle* DaoxBuffer_MapTriangleRange( DaoxBuffer *self, int offset, int count )
+{
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->triangleVBO );
+	return (DaoGLTriangle*) glMapBufferRange( GL_ELEMENT_ARRAY_BUFFER, offset*self->triangleSize, count*self->triangleSize, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_RANGE_BIT );
+}
+
+
+
+/*
+// Instancing:
+// The object to world matrices of the instances are stored as three rows
+// of four floats (the same layout as DaoxMatrix4D), and passed to the shader
+// as per-instance attributes. Without base instance support (GL 4.2),
+// the attributes are re-pointed to the first instance of each draw call.
+*/
+void DaoxBuffer_InitInstancing( DaoxBuffer *self, int row0, int row1, int row2 )
+{
+#ifdef GL_VERTEX_ATTRIB_ARRAY_DIVISOR
+	if( row0 < 0 || row1 < 0 || row2 < 0 ) return;
+	self->instanceRows[0] = row0;
+	self->instanceRows[1] = row1;
+	self->instanceRows[2] = row2;
+	self->instanceCapacity = 1024;
+#endif
+}
+void DaoxBuffer_SetInstanceOffset( DaoxBuffer *self, int offset )
+{
+#ifdef GL_VERTEX_ATTRIB_ARRAY_DIVISOR
+	int i, stride = 12*sizeof(GLfloat);
+	glBindBuffer( GL_ARRAY_BUFFER, self->instanceVBO );
+	for(i=0; i<3; ++i){
+		daoint K = (offset*12 + i*4) * sizeof(GLfloat);
+		glEnableVertexAttribArray( self->instanceRows[i] );
+		glVertexAttribPointer( self->instanceRows[i], 4, GL_FLOAT, GL_FALSE, stride, (void*)K );
+		glVertexAttribDivisor( self->instanceRows[i], 1 );
+	}
+#endif
+}
+GLfloat* DaoxBuffer_MapInstances( DaoxBuffer *self, int count )
+{
+	int dataSize = count * 12 * sizeof(GLfloat);
+	glBindBuffer( GL_ARRAY_BUFFER, self->instanceVBO );
+	if( count > self->instanceCapacity ){
+		self->instanceCapacity = 1.5 * count;
+		glBufferData( GL_ARRAY_BUFFER, self->instanceCapacity*12*sizeof(GLfloat), NULL, GL_STREAM_DRAW );
+	}
+	return (GLfloat*) glMapBufferRange( GL_ARRAY_BUFFER, 0, dataSize, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT );
+}
+
+
+
+/*
+// Indirect drawing (GL 4.3):
+// Each command draws a range of triangles, and takes the object to world matrix
+// (or the matrices of the instances) from the instance buffer by its base instance.
+// So it requires instancing, and the instance attributes must point to the first
+// instance (see DaoxBuffer_SetInstanceOffset()).
+*/
+void DaoxBuffer_InitIndirect( DaoxBuffer *self )
+{
+#if defined(GL_DRAW_INDIRECT_BUFFER) && !defined(DAO_GRAPHICS_USE_GLES)
+	if( self->instanceCapacity == 0 || self->vertexVBO ) return;
+	if( DaoxBuffer_GLVersion() < 43 ) return;
+	self->indirectCapacity = 256;
+#endif
+}
+DaoGLDrawCommand* DaoxBuffer_MapCommands( DaoxBuffer *self, int count )
+{
+#if defined(GL_DRAW_INDIRECT_BUFFER) && !defined(DAO_GRAPHICS_USE_GLES)
+	int dataSize = count * sizeof(DaoGLDrawCommand);
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, self->indirectVBO );
+	if( count > self->indirectCapacity ){
+		self->indirectCapacity = 1.5 * count;
+		glBufferData( GL_DRAW_INDIRECT_BUFFER, self->indirectCapacity*sizeof(DaoGLDrawCommand), NULL, GL_STREAM_DRAW );
+	}
+	return (DaoGLDrawCommand*) glMapBufferRange( GL_DRAW_INDIRECT_BUFFER, 0, dataSize, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT );
+#else
+	return NULL;
+#endif
+}
+void DaoxBuffer_DrawCommands( DaoxBuffer *self, int shape, int offset, int count )
+{
+#if defined(GL_DRAW_INDIRECT_BUFFER) && !defined(DAO_GRAPHICS_USE_GLES)
+	daoint K = offset * sizeof(DaoGLDrawCommand);
+	int type = self->shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, self->indirectVBO );
+	glMultiDrawElementsIndirect( shape, type, (void*)K, count, 0 );
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+#endif
+}
 
 
 
@@ -1241,18 +2143,38 @@ DaoxContext* DaoxContext_New()
 	self->textures = DList_New(DAO_DATA_VALUE);
 	self->deviceWidth  = 300;
 	self->deviceHeight = 200;
+	DaoxContext_SetShaderCache( self, getenv( "DAO_GRAPHICS_SHADER_CACHE" ) );
+	DaoxContext_SetTextureCache( self, getenv( "DAO_GRAPHICS_TEXTURE_CACHE" ) );
+	self->streamer = DaoxTextureStreamer_New( self );
 	return self;
 }
 void DaoxContext_Delete( DaoxContext *self )
 {
+	if( self->headless ) DaoxHeadless_MakeCurrent( self->headless );
 	DaoxContext_Clear( self );
+	DaoxTextureStreamer_Delete( self->streamer );
+	if( self->headless ) DaoxHeadless_Delete( self->headless );
+	if( self->shaderCache ) DString_Delete( self->shaderCache );
+	if( self->textureCache ) DString_Delete( self->textureCache );
+	if( self->workers ) DaoxThreadPool_Delete( self->workers );
 	DaoCstruct_Free( (DaoCstruct*) self );
 	dao_free( self );
 }
-void DaoxTexture_Free( DaoxTexture *self );
+static void DaoxContext_FreeReducedBuffers( DaoxContext *self )
+{
+	if( self->particleTexture ) glDeleteTextures( 1, & self->particleTexture );
+	if( self->lowDepthTexture ) glDeleteTextures( 1, & self->lowDepthTexture );
+	if( self->particleBuffer ) glDeleteFramebuffers( 1, & self->particleBuffer );
+	if( self->lowDepthBuffer ) glDeleteFramebuffers( 1, & self->lowDepthBuffer );
+	self->particleTexture = self->lowDepthTexture = 0;
+	self->particleBuffer = self->lowDepthBuffer = 0;
+	self->reducedScale = 0;
+	self->reducedWidth = self->reducedHeight = 0;
+}
 void DaoxContext_Clear( DaoxContext *self )
 {
 	int i;
+	DaoxTextureStreamer_Clear( self->streamer );
 	for(i=0; i<self->shaders->size; ++i){
 		DaoxShader *shader = (DaoxShader*) self->shaders->items.pValue[i];
 		DaoxShader_Free( shader );
@@ -1271,6 +2193,40 @@ void DaoxContext_Clear( DaoxContext *self )
 	if( self->colorTexture ) glDeleteTextures( 1, & self->colorTexture );
 	if( self->depthTexture ) glDeleteTextures( 1, & self->depthTexture );
 	if( self->frameBuffer ) glDeleteFramebuffers( 1, & self->frameBuffer );
+	DaoxContext_FreeReducedBuffers( self );
+	if( self->screenVAO ) glDeleteVertexArrays( 1, & self->screenVAO );
+	self->colorTexture = self->depthTexture = self->frameBuffer = 0;
+	self->screenVAO = 0;
+	self->offscreen = 0;
+}
+
+/*
+// Set the directory (which must exist) for the program binary cache,
+// NULL or empty to disable the cache:
+*/
+void DaoxContext_SetShaderCache( DaoxContext *self, const char *path )
+{
+	if( path == NULL || *path == '\0' ){
+		if( self->shaderCache ) DString_Delete( self->shaderCache );
+		self->shaderCache = NULL;
+		return;
+	}
+	if( self->shaderCache == NULL ) self->shaderCache = DString_New();
+	DString_SetChars( self->shaderCache, path );
+}
+/*
+// Set the directory (which must exist) for the compressed texture cache,
+// NULL or empty to disable the cache:
+*/
+void DaoxContext_SetTextureCache( DaoxContext *self, const char *path )
+{
+	if( path == NULL || *path == '\0' ){
+		if( self->textureCache ) DString_Delete( self->textureCache );
+		self->textureCache = NULL;
+		return;
+	}
+	if( self->textureCache == NULL ) self->textureCache = DString_New();
+	DString_SetChars( self->textureCache, path );
 }
 
 int DaoxContext_BindShader( DaoxContext *self, DaoxShader *shader )
@@ -1280,6 +2236,7 @@ int DaoxContext_BindShader( DaoxContext *self, DaoxShader *shader )
 	switch( shader->mode ){
 	case DAOX_GRAPHICS_2D : DaoxShader_Build2D( shader ); break;
 	case DAOX_GRAPHICS_3D : DaoxShader_Build3D( shader ); break;
+	case DAOX_GRAPHICS_SCREEN : DaoxShader_BuildScreen( shader ); break;
 	}
 	return 1;
 }
@@ -1292,11 +2249,41 @@ int DaoxContext_BindBuffer( DaoxContext *self, DaoxBuffer *buffer )
 }
 void DaoxTexture_Free( DaoxTexture *self )
 {
+	DaoxContext *ctx = (DaoxContext*) self->ctx;
 	GLuint tid = self->tid;
 	if( tid == 0 ) return;
+	if( ctx && ctx->streamer ) ctx->streamer->usage -= self->memory;
 	glDeleteTextures( 1, & tid );
+	self->memory = 0;
+	self->format = 0;
 	self->tid = 0;
 }
+/*
+// Set the GPU memory budget of the textures and the bytes uploaded
+// per frame by the texture streaming (budget = 0: no budget):
+*/
+void DaoxContext_SetTextureBudget( DaoxContext *self, daoint budget, daoint upload )
+{
+	self->streamer->budget = budget;
+	self->streamer->upload = upload > 0 ? upload : DAOX_TEXTURE_UPLOAD;
+}
+DaoxThreadPool* DaoxContext_GetWorkers( DaoxContext *self )
+{
+	if( self->workers == NULL ) self->workers = DaoxThreadPool_New(0);
+	return self->workers;
+}
+/*
+// Enable or disable the block compression of the streamed textures
+// (for the textures queued from now on):
+*/
+void DaoxContext_SetTextureCompression( DaoxContext *self, int enable )
+{
+	self->streamer->compression = enable != 0;
+}
+/*
+// Synchronous uploading, with the mip chain generated by the driver;
+// See DaoxTextureStreamer_Request() for the asynchronous one.
+*/
 int DaoxContext_BindTexture( DaoxContext *self, DaoxTexture *texture )
 {
 	uchar_t *data;
@@ -1311,7 +2298,13 @@ int DaoxContext_BindTexture( DaoxContext *self, DaoxTexture *texture )
 
 	if( W == 0 || H == 0 ) return 0;
 
-	if( texture->ctx == self && texture->tid ) return 1;
+	texture->lastUse = self->streamer->frameIndex;
+	if( texture->ctx == self && texture->tid && texture->changed == 0 ) return 1;
+	if( texture->job && texture->changed == 0 ) return texture->tid != 0; /* Streaming; */
+	if( texture->job ){
+		/* Deleted by the streamer once it is no longer used by the streaming thread: */
+		DaoxTextureStreamer_Cancel( self->streamer, (DaoxTextureJob*) texture->job );
+	}
 	if( texture->tid ) DaoxTexture_Free( texture );
 
 	if( texture->ctx != self ){
@@ -1321,18 +2314,33 @@ int DaoxContext_BindTexture( DaoxContext *self, DaoxTexture *texture )
 
 	glGenTextures( 1, & tid );
 	texture->tid = tid;
+	texture->format = 0;  /* DAOX_TEXTURE_RGBA8; */
+
+	texture->changed = 0;
 
 	glBindTexture(GL_TEXTURE_2D, texture->tid);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	if( texture->image->depth == DAOX_IMAGE_BIT24 ){
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, W, H, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
 	}else if( texture->image->depth == DAOX_IMAGE_BIT32 ){
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, W, H, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
 	}
+	glGenerateMipmap(GL_TEXTURE_2D);
 	glBindTexture(GL_TEXTURE_2D, 0);
+	texture->memory = 4 * (daoint) W * H * 4 / 3;
+	self->streamer->usage += texture->memory;
 	return 1;
 }
+/*
+// Create a window-less context of the device size and make it current:
+*/
+int DaoxContext_InitHeadless( DaoxContext *self )
+{
+	if( self->headless ) return DaoxHeadless_MakeCurrent( self->headless );
+	self->headless = DaoxHeadless_New( self->deviceWidth, self->deviceHeight );
+	return self->headless != NULL;
+}
 void DaoxContext_InitOffscreenBuffer( DaoxContext *self )
 {
 	int ret;
@@ -1387,6 +2395,68 @@ void DaoxContext_InitOffscreenBuffer( DaoxContext *self )
 	self->offscreen = ret == GL_FRAMEBUFFER_COMPLETE;
 	printf( "offscreen = %i\n", self->offscreen );
 }
+static GLuint DaoxContext_MakeTexture( int width, int height, int internalFormat, int format, int type )
+{
+	GLuint tid = 0;
+	glGenTextures( 1, & tid );
+	glBindTexture( GL_TEXTURE_2D, tid );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexImage2D( GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, 0 );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	return tid;
+}
+/*
+// Create the reduced resolution render targets for the particles:
+// one with the particle color texture, the other with the downsampled depth.
+// They are separated, so that the depth can be sampled in the particle pass;
+*/
+int DaoxContext_InitReducedBuffers( DaoxContext *self, int scale )
+{
+	int width = (self->deviceWidth + scale - 1) / scale;
+	int height = (self->deviceHeight + scale - 1) / scale;
+	int ok1, ok2;
+
+	/* Reallocated when the scale or the device size has changed: */
+	if( self->reducedScale == scale && self->reducedWidth == width && self->reducedHeight == height ){
+		return self->particleBuffer != 0;
+	}
+
+	DaoxContext_FreeReducedBuffers( self );
+	if( self->screenVAO == 0 ) glGenVertexArrays( 1, & self->screenVAO );
+
+	self->reducedScale = scale;
+	self->reducedWidth = width;
+	self->reducedHeight = height;
+	self->particleTexture = DaoxContext_MakeTexture( width, height, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE );
+	/* Sized format, GLES 3.0 has no unsized depth format for GL_FLOAT: */
+	self->lowDepthTexture = DaoxContext_MakeTexture( width, height, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT );
+
+	glGenFramebuffers( 1, & self->particleBuffer );
+	glBindFramebuffer( GL_FRAMEBUFFER, self->particleBuffer );
+	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, self->particleTexture, 0 );
+	ok1 = glCheckFramebufferStatus( GL_FRAMEBUFFER ) == GL_FRAMEBUFFER_COMPLETE;
+
+	glGenFramebuffers( 1, & self->lowDepthBuffer );
+	glBindFramebuffer( GL_FRAMEBUFFER, self->lowDepthBuffer );
+	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, self->lowDepthTexture, 0 );
+#ifndef DAO_GRAPHICS_USE_GLES
+	glDrawBuffer( GL_NONE );
+	glReadBuffer( GL_NONE );
+#endif
+	ok2 = glCheckFramebufferStatus( GL_FRAMEBUFFER ) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+	if( ok1 && ok2 ) return 1;
+	DaoxContext_FreeReducedBuffers( self );
+	/* Do not try again for the same size: */
+	self->reducedScale = scale;
+	self->reducedWidth = width;
+	self->reducedHeight = height;
+	return 0;
+}
 
 
 
@@ -51,6 +51,7 @@
 
 
 #include "dao_canvas.h"
+#include "dao_parallel.h"
 
 
 
@@ -61,16 +62,39 @@ typedef struct DaoGLTriangle    DaoGLTriangle;
 
 typedef struct DaoGLSkinVertex3D  DaoGLSkinVertex3D;
 
+typedef struct DaoGLPackedVertex3D      DaoGLPackedVertex3D;
+typedef struct DaoGLPackedSkinVertex3D  DaoGLPackedSkinVertex3D;
+typedef struct DaoGLShortTriangle       DaoGLShortTriangle;
+typedef struct DaoGLDrawCommand         DaoGLDrawCommand;
+
 typedef struct DaoxContext      DaoxContext;
 typedef struct DaoxShader       DaoxShader;
 typedef struct DaoxBuffer       DaoxBuffer;
+typedef struct DaoxHeadless     DaoxHeadless;
+typedef struct DaoxTextureStreamer  DaoxTextureStreamer;
+
+typedef struct DaoxUniformBuffer  DaoxUniformBuffer;
+typedef struct DaoxFrameBlock     DaoxFrameBlock;
+typedef struct DaoxMaterialBlock  DaoxMaterialBlock;
+typedef struct DaoxObjectBlock    DaoxObjectBlock;
+
+
+#define DAOX_BONE_ROW  256  /* skinning matrices per row of the bone palette texture; */
+#define DAOX_BUFFER_REGIONS  3  /* frame regions of the streaming buffers; */
 
 
 enum DaoxGraphicsMode
 {
 	DAOX_GRAPHICS_2D ,
 	DAOX_GRAPHICS_3D ,
-	DAOX_GRAPHICS_3DVG
+	DAOX_GRAPHICS_3DVG ,
+	DAOX_GRAPHICS_SCREEN   /* screen space passes; */
+};
+
+enum DaoxScreenPass
+{
+	DAOX_SCREEN_DOWNSAMPLE ,  /* depth downsampling; */
+	DAOX_SCREEN_COMPOSITE     /* depth-aware compositing of upsampled particles; */
 };
 
 
@@ -87,10 +111,36 @@ enum DaoxSamplerID
 	DAOX_TILE_TEXTURE3 ,
 	DAOX_TILE_TEXTURE4 ,
 	DAOX_TILE_TEXTURE5 ,
-	DAOX_TILE_TEXTURE6
+	DAOX_TILE_TEXTURE6 ,
+	DAOX_LIGHT_TEXTURE ,
+	DAOX_CLUSTER_TEXTURE ,
+	DAOX_LIGHT_INDEX_TEXTURE ,
+	DAOX_BONE_TEXTURE
+};
+
+
+/* Binding points of the uniform blocks of the 3D shader: */
+enum DaoxUniformBlockID
+{
+	DAOX_FRAME_BLOCK = 0,
+	DAOX_MATERIAL_BLOCK ,
+	DAOX_OBJECT_BLOCK
 };
 
 
+/*
+// Keys of the specialized variants of the 3D shader, in which the uniforms
+// for these features are replaced by constants:
+*/
+#define DAOX_VARIANT_SKINNING        0x1
+#define DAOX_VARIANT_DIFFUSE         0x2
+#define DAOX_VARIANT_EMISSION        0x4
+#define DAOX_VARIANT_BUMP            0x8
+#define DAOX_VARIANT_BUMP_RG         0x10  /* two channel bump texture (BC5); */
+#define DAOX_VARIANT_TILE_SHIFT      5   /* terrain tile type, 2 bits; */
+#define DAOX_VARIANT_PARTICLE_SHIFT  7   /* particle type; */
+
+
 
 
 struct DaoGLVertex2D
@@ -129,6 +179,73 @@ struct DaoGLTriangle
 	GLint index[3];
 };
 
+/*
+// Compact layouts: normals and tangents in snorm 10-10-10-2 (GL_INT_2_10_10_10_REV),
+// texture coordinates in half floats, joint indices and weights in bytes,
+// and 16-bit indices relative to the first vertex of the unit;
+*/
+struct DaoGLPackedVertex3D
+{
+	struct { GLfloat   x, y, z; }  pos;
+	GLuint                         norm;
+	GLuint                         tan;
+	struct { GLushort  x, y; }     tex;
+};
+
+struct DaoGLPackedSkinVertex3D
+{
+	struct { GLfloat   x, y, z; }  pos;
+	GLuint                         norm;
+	GLuint                         tan;
+	struct { GLushort  x, y; }     tex;
+	struct { GLubyte   j[4]; }     joints;
+	struct { GLubyte   w[4]; }     weights;
+};
+
+struct DaoGLShortTriangle
+{
+	GLushort index[3];
+};
+
+/* Layout of the commands for glMultiDrawElementsIndirect(): */
+struct DaoGLDrawCommand
+{
+	GLuint  count;
+	GLuint  instanceCount;
+	GLuint  firstIndex;
+	GLint   baseVertex;
+	GLuint  baseInstance;
+};
+
+
+/*
+// The std140 layouts of the uniform blocks of the 3D shader:
+*/
+struct DaoxFrameBlock
+{
+	GLfloat  projMatrix[16];
+	GLfloat  viewMatrix[16];
+	GLfloat  cameraPosition[3];
+	GLfloat  time;
+	GLfloat  clusterParams[4];
+	GLint    lightCount;
+	GLfloat  clusterOffsetX;  /* viewport origin in tiles; */
+	GLfloat  clusterOffsetY;
+	GLint    padding;
+};
+
+struct DaoxMaterialBlock
+{
+	DaoxColor  colors[4];  /* ambient, diffuse, specular and emission; */
+	GLfloat    shininess;
+	GLfloat    padding[3];
+};
+
+struct DaoxObjectBlock
+{
+	GLfloat  modelMatrix[16];
+};
+
 
 
 
@@ -142,27 +259,25 @@ struct DaoxShader
 	DList  *fragmentSources;
 
 	uint_t  mode;
+	uint_t  variant;       /* key of a specialized variant; */
+	uchar_t specialized;   /* specialized variant of the 3D shader; */
+	uchar_t cached;        /* program loaded from the binary cache; */
+	DList  *variants;      /* specialized variants, built on demand; */
 	uint_t  vertexShader;
 	uint_t  fragmentShader;
 	uint_t  program;
 
 	struct {
-		uint_t  time;
 		uint_t  vectorGraphics;
-		uint_t  projMatrix;
-		uint_t  viewMatrix;
-		uint_t  modelMatrix;
-		uint_t  cameraPosition;
-		uint_t  lightCount;
-		uint_t  lightSource;
-		uint_t  lightIntensity;
+		uint_t  projMatrix;   /* 2D shader only; */
+		uint_t  viewMatrix;   /* 2D shader only; */
+		uint_t  modelMatrix;  /* 2D shader only; */
+		uint_t  lightTexture;
+		uint_t  clusterTexture;
+		uint_t  lightIndexTexture;
 		uint_t  skinning;
-		uint_t  skinMatrices;
-		uint_t  ambientColor;
-		uint_t  diffuseColor;
-		uint_t  specularColor;
-		uint_t  emissionColor;
-		uint_t  shininess;
+		uint_t  boneOffset;
+		uint_t  boneTexture;
 		uint_t  material;
 		uint_t  hasDiffuseTexture;
 		uint_t  hasEmissionTexture;
@@ -189,6 +304,11 @@ struct DaoxShader
 		uint_t  tileTextureCount;
 		uint_t  tileTextureScale;
 		uint_t  tileTextures[6];
+		uint_t  instancing;
+		uint_t  depthOnly;
+		uint_t  particleTexture;   /* screen shader only; */
+		uint_t  lowDepthTexture;   /* screen shader only; */
+		uint_t  screenScale;       /* screen shader only; */
 	} uniforms;
 
 	struct {
@@ -200,12 +320,20 @@ struct DaoxShader
 		uint_t  texKLMO;
 		uint_t  joints;
 		uint_t  weights;
+		uint_t  instanceRows[3];
 	} attributes;
 
 	struct {
 		uint_t  dashSampler;
 		uint_t  gradientSampler;
 	} textures;
+
+	/* Single block uniform buffers of the 3D shader (NULL for the 2D shader): */
+	struct {
+		DaoxUniformBuffer  *frame;
+		DaoxUniformBuffer  *material;
+		DaoxUniformBuffer  *object;
+	} blocks;
 };
 extern DaoType *daox_type_shader;
 
@@ -214,16 +342,63 @@ void DaoxShader_Delete( DaoxShader *self );
 
 void DaoxShader_Init2D( DaoxShader *self );
 void DaoxShader_Init3D( DaoxShader *self );
+void DaoxShader_InitVariant( DaoxShader *self, uint_t variant );
+void DaoxShader_InitScreen( DaoxShader *self, int pass );
 void DaoxShader_AddShader( DaoxShader *self, int type, const char *source );
 void DaoxShader_AppendShader( DaoxShader *self, int type, const char *source );
 
 void DaoxShader_Build2D( DaoxShader *self );
 void DaoxShader_Build3D( DaoxShader *self );
+void DaoxShader_BuildScreen( DaoxShader *self );
+
+DaoxShader* DaoxShader_GetVariant( DaoxShader *self, uint_t variant );
 void DaoxShader_Free( DaoxShader *self );
 
 void DaoxShader_MakeGradientSampler( DaoxShader *self, DaoxGradient *gradient, int fill );
 void DaoxShader_MakeDashSampler( DaoxShader *self, DaoxBrush *brush );
 
+/*
+// Set the matrices and the material of the shader, using the uniform blocks
+// for the 3D shader and the plain uniforms for the 2D shader:
+*/
+void DaoxShader_SetViewMatrices( DaoxShader *self, GLfloat projMatrix[16], GLfloat viewMatrix[16] );
+void DaoxShader_SetModelMatrix( DaoxShader *self, GLfloat modelMatrix[16] );
+void DaoxShader_SetMaterial( DaoxShader *self, DaoxMaterialBlock *material );
+
+
+
+/*
+// Uniform buffer holding an array of blocks of the same size, which are
+// aligned such that each of them can be bound to the binding point of the
+// buffer by itself:
+*/
+struct DaoxUniformBuffer
+{
+	uint_t  buffer;
+	int     binding;
+	int     blockSize;
+	int     stride;    /* block size rounded up to the offset alignment; */
+	int     capacity;  /* number of blocks; */
+	int     next;      /* next free block for DaoxUniformBuffer_Push(); */
+};
+
+DaoxUniformBuffer* DaoxUniformBuffer_New( int binding, int blockSize, int capacity );
+void DaoxUniformBuffer_Delete( DaoxUniformBuffer *self );
+
+/* Return non-zero if the buffer is reallocated and its data is lost: */
+int DaoxUniformBuffer_Reserve( DaoxUniformBuffer *self, int count );
+void* DaoxUniformBuffer_Map( DaoxUniformBuffer *self, int count );
+void DaoxUniformBuffer_Unmap( DaoxUniformBuffer *self );
+void DaoxUniformBuffer_Update( DaoxUniformBuffer *self, int index, int offset, int size, void *data );
+void DaoxUniformBuffer_Bind( DaoxUniformBuffer *self, int index );
+
+/*
+// Write the data into the next free block and bind the block, for blocks that
+// change per draw: the blocks are suballocated from the buffer, which is only
+// orphaned when it is full, so that the writes never wait for the draws;
+*/
+void DaoxUniformBuffer_Push( DaoxUniformBuffer *self, void *data, int size );
+
 
 
 
@@ -232,6 +407,7 @@ struct DaoxBuffer
 	DAO_CSTRUCT_COMMON;
 
 	void    *ctx;
+	uint_t   id;            /* in creation order, a stable key for sorting; */
 
 	uint_t   mode;
 	uint_t   vertexVAO;
@@ -243,6 +419,24 @@ struct DaoxBuffer
 	uint_t   triangleOffset;
 	uint_t   triangleCapacity;
 
+	uint_t   retained;      /* retained storage: data kept valid across frames; */
+
+	uint_t   streaming;     /* persistently mapped ring of frame regions; */
+	uint_t   region;        /* the frame region in use; */
+	void    *vertexData;    /* persistent mappings of the whole buffers; */
+	void    *triangleData;
+	GLsync   fences[DAOX_BUFFER_REGIONS];  /* set when the frames of the regions are submitted; */
+
+	uint_t   instanceVBO;       /* per-instance object to world matrices; */
+	uint_t   instanceCapacity;  /* zero if instancing is not supported; */
+	uint_t   instanceRows[3];   /* attributes for the matrix rows; */
+
+	uint_t   indirectVBO;       /* commands for glMultiDrawElementsIndirect(); */
+	uint_t   indirectCapacity;  /* zero if indirect drawing is not supported; */
+
+	uint_t   packed;        /* compact vertex layout, set before DaoxBuffer_Init3D(); */
+	uint_t   shortIndices;  /* 16-bit triangles for retained units of at most 65536 vertices; */
+
 	uint_t   vertexSize;    /* size of each vertex; */
 	uint_t   triangleSize;  /* size of each triangle; */
 	uint_t   traitCount;
@@ -250,6 +444,8 @@ struct DaoxBuffer
 	struct {
 		uint_t  uniform;
 		uint_t  count;
+		uint_t  type;       /* GL_FLOAT if zero; */
+		uint_t  normalized;
 		void   *offset;
 	} traits[7];
 };
@@ -264,11 +460,28 @@ void DaoxBuffer_Init3DSK( DaoxBuffer *self, int pos, int norm, int tan, int texu
 void DaoxBuffer_Init3DVG( DaoxBuffer *self, int pos, int norm, int texuv, int texmo );
 void DaoxBuffer_Free( DaoxBuffer *self );
 
+void DaoxBuffer_InitStreaming( DaoxBuffer *self );
+void DaoxBuffer_BeginFrame( DaoxBuffer *self );
+void DaoxBuffer_EndFrame( DaoxBuffer *self );
+
 void* DaoxBuffer_MapVertices( DaoxBuffer *self, int count );
 DaoGLVertex2D*   DaoxBuffer_MapVertices2D( DaoxBuffer *self, int count );
 DaoGLVertex3D*   DaoxBuffer_MapVertices3D( DaoxBuffer *self, int count );
 DaoGLVertex3DVG* DaoxBuffer_MapVertices3DVG( DaoxBuffer *self, int count );
 DaoGLTriangle*   DaoxBuffer_MapTriangles( DaoxBuffer *self, int count );
+void DaoxBuffer_Unmap( DaoxBuffer *self );
+
+void DaoxBuffer_Reserve( DaoxBuffer *self, int vertexCount, int triangleCount );
+void* DaoxBuffer_MapVertexRange( DaoxBuffer *self, int offset, int count );
+DaoGLTriangle* DaoxBuffer_MapTriangleRange( DaoxBuffer *self, int offset, int count );
+
+void DaoxBuffer_InitInstancing( DaoxBuffer *self, int row0, int row1, int row2 );
+GLfloat* DaoxBuffer_MapInstances( DaoxBuffer *self, int count );
+
+void DaoxBuffer_InitIndirect( DaoxBuffer *self );
+DaoGLDrawCommand* DaoxBuffer_MapCommands( DaoxBuffer *self, int count );
+void DaoxBuffer_DrawCommands( DaoxBuffer *self, int shape, int offset, int count );
+void DaoxBuffer_SetInstanceOffset( DaoxBuffer *self, int offset );
 
 
 
@@ -292,6 +505,25 @@ struct DaoxContext
 	GLuint  colorTexture;
 	GLuint  depthTexture;
 	GLuint  frameBuffer;
+
+	/* Reduced resolution targets for the particles: */
+	int     reducedScale;
+	int     reducedWidth;     /* size of the reduced targets; */
+	int     reducedHeight;
+	GLuint  particleTexture;
+	GLuint  lowDepthTexture;
+	GLuint  particleBuffer;   /* with particleTexture; */
+	GLuint  lowDepthBuffer;   /* with lowDepthTexture; */
+	GLuint  screenVAO;        /* empty vertex array for screen passes; */
+
+	DaoxHeadless  *headless;  /* context without window, NULL for window context; */
+
+	DString  *shaderCache;    /* directory of the program binary cache, or NULL; */
+	DString  *textureCache;   /* directory of the compressed texture cache, or NULL; */
+
+	DaoxTextureStreamer  *streamer;  /* asynchronous texture streaming; */
+
+	DaoxThreadPool  *workers;  /* shared by the painters and renderers of the context; */
 };
 extern DaoType *daox_type_context;
 
@@ -303,6 +535,20 @@ int DaoxContext_BindShader( DaoxContext *self, DaoxShader *shader );
 int DaoxContext_BindBuffer( DaoxContext *self, DaoxBuffer *buffer );
 int DaoxContext_BindTexture( DaoxContext *self, DaoxTexture *texture );
 void DaoxContext_InitOffscreenBuffer( DaoxContext *self );
+int DaoxContext_InitHeadless( DaoxContext *self );
+int DaoxContext_InitReducedBuffers( DaoxContext *self, int scale );
+void DaoxContext_SetShaderCache( DaoxContext *self, const char *path );
+void DaoxContext_SetTextureBudget( DaoxContext *self, daoint budget, daoint upload );
+void DaoxContext_SetTextureCache( DaoxContext *self, const char *path );
+void DaoxContext_SetTextureCompression( DaoxContext *self, int enable );
+
+/*
+// Get the worker pool of the context, created on the first use. The painters and
+// renderers of a context draw in the same thread, so they can share the pool:
+*/
+DaoxThreadPool* DaoxContext_GetWorkers( DaoxContext *self );
+
+void DaoxTexture_Free( DaoxTexture *self );
 
 
 void DaoxMatrix4D_Export( DaoxMatrix4D *self, GLfloat matrix[16] );
@@ -28,6 +28,10 @@
 #include <math.h>
 #include "dao_painter.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 DaoxPainter* DaoxPainter_New( DaoxContext *ctx )
 {
 	DaoxPainter *self = (DaoxPainter*)dao_calloc(1,sizeof(DaoxPainter));
@@ -38,6 +42,7 @@ DaoxPainter* DaoxPainter_New( DaoxContext *ctx )
 	self->buffer = DaoxBuffer_New( ctx );
 	GC_IncRC( self->shader );
 	GC_IncRC( self->buffer );
+	self->workers = DaoxContext_GetWorkers( ctx );
 	DaoxPainter_InitShaders( self );
 	DaoxPainter_InitBuffers( self );
 	return self;
@@ -60,6 +65,7 @@ void DaoxPainter_InitBuffers( DaoxPainter *self )
 	int pos  = self->shader->attributes.position;
 	int texKLMO = self->shader->attributes.texKLMO;
 	DaoxBuffer_Init2D( self->buffer, pos, texKLMO );
+	DaoxBuffer_InitStreaming( self->buffer );
 	DaoxContext_BindBuffer( self->context, self->buffer );
 }
 float DaoxPainter_CanvasScale( DaoxPainter *self, DaoxCanvas *canvas )
@@ -160,16 +166,22 @@ void DaoxVG_BufferBeziers( DaoxBuffer *buffer, void *glvertices, DArray *points
 		DaoxVG_BufferBeziers3D( (DaoGLVertex3DVG*) glvertices, points );
 	}
 }
+/*
+// The indices are rebased as flat arrays, four at a time with SSE2;
+*/
 void DaoxVG_BufferTriangles( DaoGLTriangle *gltriangles, DArray *triangles, int offset )
 {
-	int i, triangleCount = triangles->size;
-	for(i=0; i<triangleCount; ++i){
-		DaoGLTriangle *triangle = gltriangles + i;
-		uint_t *indices = triangles->data.triangles[i].index;
-		triangle->index[0] = indices[0] + offset;
-		triangle->index[1] = indices[1] + offset;
-		triangle->index[2] = indices[2] + offset;
+	uint_t *indices = (uint_t*) triangles->data.triangles;
+	GLint *glindices = (GLint*) gltriangles;
+	int i = 0, count = 3 * triangles->size;
+#ifdef __SSE2__
+	__m128i delta = _mm_set1_epi32( offset );
+	for(; i+4<=count; i+=4){
+		__m128i index = _mm_loadu_si128( (__m128i*) (indices + i) );
+		_mm_storeu_si128( (__m128i*) (glindices + i), _mm_add_epi32( index, delta ) );
 	}
+#endif
+	for(; i<count; ++i) glindices[i] = indices[i] + offset;
 }
 void DaoxVG_BufferImageRect( DaoxBuffer *buffer, DaoxBrush *brush, void *glvertices, DaoGLTriangle *gltriangles )
 {
@@ -319,9 +331,8 @@ void DaoxPainter_PaintImageItem( DaoxPainter *self, DaoxCanvasNode *item )
 
 	if( item->brush->texture == NULL ) return;
 
-	if( item->brush->texture->changed || item->brush->texture->tid == 0 ){
-		DaoxContext_BindTexture( self->context, item->brush->texture );
-	}
+	/* Also marks the texture as used (for the eviction): */
+	DaoxContext_BindTexture( self->context, item->brush->texture );
 	//printf( "DaoxPainter_PaintImageItem %i\n", item->brush->texture->tid );
 	if( item->brush->texture->tid == 0 ) return;
 
@@ -374,7 +385,7 @@ void DaoxPainter_UpdateItem( DaoxPainter *self, DaoxCanvas *canvas, DaoxCanvasNo
 	if( DaoxOBBox2D_Intersect( & self->obbox, & obbox ) < 0 ) goto HandleChildrenItems;
 
 	DaoxGraphics_TransfromMatrix( transform, modelMatrix );
-	glUniformMatrix4fv( self->shader->uniforms.modelMatrix, 1, 0, modelMatrix );
+	DaoxShader_SetModelMatrix( self->shader, modelMatrix );
 	if( item->visible && item->ctype == daox_type_canvas_image && item->brush->texture ){
 		item->brush->offset1 = self->vertexCount;
 		item->brush->offset2 = self->triangleCount;
@@ -412,39 +423,14 @@ HandleChildrenItems:
 	}
 }
 
-void DaoxPainter_BufferItem( DaoxPainter *self, DaoxCanvas *canvas, DaoxCanvasNode *item, DaoxMatrix3D transform )
+static void DaoxPainter_BufferItemData( DaoxPainter *self, DaoxCanvasNode *item )
 {
-	DaoxOBBox2D obbox;
-	DaoxMatrix3D inverse;
-	DaoxVector3D itempos = {0.0,0.0,0.0};
-	DaoxMatrix3D transform2 = DaoxCanvasNode_GetLocalTransform( item );
 	DaoxBuffer *buffer = self->buffer;
-	GLfloat modelMatrix[16] = {0};
-	float distance, diameter;
-	float scale = DaoxPainter_CanvasScale( self, canvas );
-	float stroke = item->brush->strokeStyle.width / (scale + 1E-16);
-	int n = item->children ? item->children->size : 0;
-	int k = stroke >= 1.0;
-	int m = stroke >= 1E-3;
-	int i, triangles;
-
-	DaoxMatrix3D_Multiply( & transform, transform2 );
-	obbox = DaoxOBBox2D_Transform( & item->obbox, & transform );
-	itempos.x = obbox.O.x;
-	itempos.y = obbox.O.y;
-	distance = DaoxVector3D_Dist( & self->campos, & itempos );
-	diameter = DaoxVector2D_Dist( obbox.X, obbox.Y );
-
-	if( diameter < 1E-5 * distance * scale ) goto HandleChildrenItems;
-	if( DaoxOBBox2D_Intersect( & self->obbox, & obbox ) < 0 ) goto HandleChildrenItems;
-
-	DaoxGraphics_TransfromMatrix( transform, modelMatrix );
-	glUniformMatrix4fv( self->shader->uniforms.modelMatrix, 1, 0, modelMatrix );
-	if( item->visible && item->ctype == daox_type_canvas_image && item->brush->texture ){
+	if( item->ctype == daox_type_canvas_image ){
 		DaoGLTriangle *fillTriangles = self->triangleBuffer + item->brush->offset2;
 		void *fillVertices = self->vertexBuffer + item->brush->offset1 * buffer->vertexSize;
 		DaoxVG_BufferImageRect( buffer, item->brush, fillVertices, fillTriangles );
-	}else if( item->visible && item->path && item->mesh->bufferred == 0 ){
+	}else{
 		DaoxPathMesh *mesh = item->mesh;
 		DaoxBrush *brush = item->brush;
 		DaoGLTriangle *fillTriangles = self->triangleBuffer + mesh->fillTriangleOffset;
@@ -454,7 +440,6 @@ void DaoxPainter_BufferItem( DaoxPainter *self, DaoxCanvas *canvas, DaoxCanvasNo
 		void *strokeVertices = self->vertexBuffer + mesh->strokeVertexOffset * buffer->vertexSize;
 		void *strokeVertices2 = self->vertexBuffer + mesh->strokeVertexOffset2 * buffer->vertexSize;
 		int fill = brush->fillColor.alpha > EPSILON || brush->fillGradient != NULL;
-		float scale = item->scale;
 		fill &= mesh->fillPoints->size > 0;
 		if( fill ){
 			DaoxVG_BufferVertices( buffer, fillVertices, mesh->fillPoints );
@@ -466,15 +451,76 @@ void DaoxPainter_BufferItem( DaoxPainter *self, DaoxCanvas *canvas, DaoxCanvasNo
 			DaoxVG_BufferBeziers( buffer, strokeVertices2, mesh->strokeBeziers );
 			DaoxVG_BufferTriangles( strokeTriangles, mesh->strokeTriangles, buffer->vertexOffset + mesh->strokeVertexOffset );
 		}
-		mesh->bufferred = 1;
+	}
+}
+/*
+// Collect the visible items that need buffering. Their offsets in the mapped
+// buffers have been computed by DaoxPainter_UpdateItem(), so they can be
+// buffered independently by DaoxPainter_BufferItems();
+*/
+void DaoxPainter_BufferItem( DaoxPainter *self, DaoxCanvas *canvas, DaoxCanvasNode *item, DaoxMatrix3D transform, DList *items )
+{
+	DaoxOBBox2D obbox;
+	DaoxVector3D itempos = {0.0,0.0,0.0};
+	DaoxMatrix3D transform2 = DaoxCanvasNode_GetLocalTransform( item );
+	float distance, diameter;
+	float scale = DaoxPainter_CanvasScale( self, canvas );
+	int n = item->children ? item->children->size : 0;
+	int i;
+
+	DaoxMatrix3D_Multiply( & transform, transform2 );
+	obbox = DaoxOBBox2D_Transform( & item->obbox, & transform );
+	itempos.x = obbox.O.x;
+	itempos.y = obbox.O.y;
+	distance = DaoxVector3D_Dist( & self->campos, & itempos );
+	diameter = DaoxVector2D_Dist( obbox.X, obbox.Y );
+
+	if( diameter < 1E-5 * distance * scale ) goto HandleChildrenItems;
+	if( DaoxOBBox2D_Intersect( & self->obbox, & obbox ) < 0 ) goto HandleChildrenItems;
+
+	if( item->visible && item->ctype == daox_type_canvas_image && item->brush->texture ){
+		DList_Append( items, item );
+	}else if( item->visible && item->path && item->mesh->bufferred == 0 ){
+		/* Path meshes may be shared by items, and must be buffered only once: */
+		item->mesh->bufferred = 1;
+		DList_Append( items, item );
 	}
 
 HandleChildrenItems:
 	for(i=0; i<n; i++){
 		DaoxCanvasNode *it = item->children->items.pCanvasNode[i];
-		DaoxPainter_BufferItem( self, canvas, it, transform );
+		DaoxPainter_BufferItem( self, canvas, it, transform, items );
+	}
+}
+typedef struct DaoxPainterJob DaoxPainterJob;
+struct DaoxPainterJob
+{
+	DaoxPainter  *painter;
+	DList        *items;
+};
+static void DaoxPainter_BufferingJob( void *data, int first, int last )
+{
+	DaoxPainterJob *job = (DaoxPainterJob*) data;
+	int i;
+	for(i=first; i<last; ++i){
+		DaoxPainter_BufferItemData( job->painter, job->items->items.pCanvasNode[i] );
 	}
 }
+void DaoxPainter_BufferItems( DaoxPainter *self, DaoxCanvas *canvas )
+{
+	DaoxPainterJob job;
+	DList *items = DList_New(0);
+	int i;
+
+	for(i=0; i<canvas->nodes->size; i++){
+		DaoxCanvasNode *it = canvas->nodes->items.pCanvasNode[i];
+		DaoxPainter_BufferItem( self, canvas, it, canvas->transform, items );
+	}
+	job.painter = self;
+	job.items = items;
+	DaoxThreadPool_RunRanges( self->workers, DaoxPainter_BufferingJob, & job, items->size, 32 );
+	DList_Delete( items );
+}
 
 void DaoxPainter_PaintItem( DaoxPainter *self, DaoxCanvas *canvas, DaoxCanvasNode *item, DaoxMatrix3D transform )
 {
@@ -503,7 +549,7 @@ void DaoxPainter_PaintItem( DaoxPainter *self, DaoxCanvas *canvas, DaoxCanvasNod
 	if( DaoxOBBox2D_Intersect( & self->obbox, & obbox ) < 0 ) goto HandleChildrenItems;
 
 	DaoxGraphics_TransfromMatrix( transform, modelMatrix );
-	glUniformMatrix4fv( self->shader->uniforms.modelMatrix, 1, 0, modelMatrix );
+	DaoxShader_SetModelMatrix( self->shader, modelMatrix );
 	if( item->visible ){
 		if( item->ctype == daox_type_canvas_image && item->brush->texture ){
 			DaoxPainter_PaintImageItem( self, item );
@@ -577,8 +623,7 @@ void DaoxPainter_PaintCanvas( DaoxPainter *self, DaoxCanvas *canvas, DaoxCamera
 	self->campos = DaoxMatrix4D_Transform( & worldToCanvas, & frustum.cameraPosition );
 
 	glUseProgram( self->shader->program );
-	glUniformMatrix4fv( self->shader->uniforms.projMatrix, 1, 0, matrix2 );
-	glUniformMatrix4fv( self->shader->uniforms.viewMatrix, 1, 0, matrix3 );
+	DaoxShader_SetViewMatrices( self->shader, matrix2, matrix3 );
 	glUniform1i(self->shader->uniforms.hasDiffuseTexture, 0 );
 	glUniform1i(self->shader->uniforms.dashCount, 0 );
 	glUniform1i(self->shader->uniforms.gradientType, 2 );
@@ -613,7 +658,7 @@ void DaoxPainter_PaintCanvas( DaoxPainter *self, DaoxCanvas *canvas, DaoxCamera
 	DaoxMatrix3D transform = DaoxMatrix3D_Identity();
 	GLfloat modelMatrix[16] = {0};
 	DaoxGraphics_TransfromMatrix( transform, modelMatrix );
-	glUniformMatrix4fv( self->shader->uniforms.modelMatrix, 1, 0, modelMatrix );
+	DaoxShader_SetModelMatrix( self->shader, modelMatrix );
 
 	self->vertexCount = self->triangleCount = 0;
 	//printf( "1>> data count: %i %i\n", self->vertexCount, self->triangleCount );
@@ -626,10 +671,7 @@ void DaoxPainter_PaintCanvas( DaoxPainter *self, DaoxCanvas *canvas, DaoxCamera
 	self->vertexBuffer = DaoxBuffer_MapVertices( self->buffer, self->vertexCount );
 	self->triangleBuffer = DaoxBuffer_MapTriangles( self->buffer, self->triangleCount );
 
-	for(i=0; i<n; i++){
-		DaoxCanvasNode *it = canvas->nodes->items.pCanvasNode[i];
-		DaoxPainter_BufferItem( self, canvas, it, canvas->transform );
-	}
+	DaoxPainter_BufferItems( self, canvas );
 
 	for(i=0; i<n; i++){
 		DaoxCanvasNode *it = canvas->nodes->items.pCanvasNode[i];
@@ -638,8 +680,7 @@ void DaoxPainter_PaintCanvas( DaoxPainter *self, DaoxCanvas *canvas, DaoxCamera
 
 	self->buffer->vertexOffset += self->vertexCount;
 	self->buffer->triangleOffset += self->triangleCount;
-	glUnmapBuffer(GL_ARRAY_BUFFER);
-	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+	DaoxBuffer_Unmap( self->buffer );
 	glBindVertexArray(0);
 }
 void DaoxPainter_Paint( DaoxPainter *self, DaoxCanvas *canvas, DaoxAABBox2D viewport )
@@ -680,7 +721,9 @@ void DaoxPainter_Paint( DaoxPainter *self, DaoxCanvas *canvas, DaoxAABBox2D view
 		glClearColor( bgcolor.red, bgcolor.green, bgcolor.blue, bgcolor.alpha );
 	}
 
+	DaoxBuffer_BeginFrame( self->buffer );
 	DaoxPainter_PaintCanvas( self, canvas, & camera );
+	DaoxBuffer_EndFrame( self->buffer );
 }
 void DaoxPainter_Render( DaoxPainter *self, DaoxCanvas *canvas, DaoxCamera *camera )
 {
@@ -709,7 +752,8 @@ void DaoxPainter_PaintSubSceneImage( DaoxPainter *self, DaoxCanvas *canvas, Daox
 	int xmoreWin = 0, ymoreWin = 0;
 	int xwin = 0, ywin = 0;
 
-	glReadBuffer( GL_BACK );
+	/* Headless contexts may be single buffered: */
+	if( self->context->headless == NULL ) glReadBuffer( GL_BACK );
 	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
 	glPixelStorei( GL_PACK_ROW_LENGTH, image->width );
 
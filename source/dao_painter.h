@@ -30,6 +30,7 @@
 
 #include "dao_canvas.h"
 #include "dao_opengl.h"
+#include "dao_parallel.h"
 
 typedef struct DaoxPainter  DaoxPainter;
 
@@ -48,6 +49,8 @@ struct DaoxPainter
 	DaoxShader   *shader;
 	DaoxBuffer   *buffer;
 
+	DaoxThreadPool  *workers;
+
 	void          *vertexBuffer;
 	DaoGLTriangle *triangleBuffer;
 
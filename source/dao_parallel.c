@@ -0,0 +1,205 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "dao_parallel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+#ifdef DAO_WITH_THREAD
+
+struct DaoxWorker
+{
+	DaoxThreadPool  *pool;
+	DThread          thread;
+	int              index;
+};
+
+static void DaoxThreadPool_RunJobs( DaoxThreadPool *self, int worker )
+{
+	/* The mutex is locked by the caller: */
+	while( self->nextJob < self->jobCount ){
+		int index = self->nextJob ++;
+		DMutex_Unlock( & self->mutex );
+		self->job( self->data, index, worker );
+		DMutex_Lock( & self->mutex );
+		self->finished += 1;
+	}
+	if( self->finished == self->jobCount ) DCondVar_BroadCast( & self->condv2 );
+}
+static void DaoxWorker_Loop( void *p )
+{
+	DaoxWorker *worker = (DaoxWorker*) p;
+	DaoxThreadPool *pool = worker->pool;
+	uint_t generation = 0;
+
+	DMutex_Lock( & pool->mutex );
+	while( pool->quit == 0 ){
+		if( pool->generation == generation ){
+			DCondVar_Wait( & pool->condv, & pool->mutex );
+			continue;
+		}
+		generation = pool->generation;
+		DaoxThreadPool_RunJobs( pool, worker->index );
+	}
+	DMutex_Unlock( & pool->mutex );
+}
+
+#endif
+
+
+DaoxThreadPool* DaoxThreadPool_New( int workerCount )
+{
+	DaoxThreadPool *self = (DaoxThreadPool*) dao_calloc( 1, sizeof(DaoxThreadPool) );
+#ifdef DAO_WITH_THREAD
+	int i;
+#endif
+
+	if( workerCount <= 0 ){
+		workerCount = DaoxThreadPool_GetProcessorCount();
+		if( workerCount > 8 ) workerCount = 8;
+	}
+	if( workerCount <= 0 ) workerCount = 1;
+	self->workerCount = 1;
+
+#ifdef DAO_WITH_THREAD
+	DMutex_Init( & self->mutex );
+	DCondVar_Init( & self->condv );
+	DCondVar_Init( & self->condv2 );
+	self->workers = (DaoxWorker*) dao_calloc( workerCount, sizeof(DaoxWorker) );
+	for(i=1; i<workerCount; ++i){
+		DaoxWorker *worker = self->workers + i;
+		worker->pool = self;
+		worker->index = i;
+		DThread_Init( & worker->thread );
+		if( DThread_Start( & worker->thread, DaoxWorker_Loop, worker ) == 0 ){
+			DThread_Destroy( & worker->thread );
+			break;
+		}
+		self->workerCount += 1;
+	}
+#endif
+	return self;
+}
+void DaoxThreadPool_Delete( DaoxThreadPool *self )
+{
+#ifdef DAO_WITH_THREAD
+	int i;
+	DMutex_Lock( & self->mutex );
+	self->quit = 1;
+	DCondVar_BroadCast( & self->condv );
+	DMutex_Unlock( & self->mutex );
+	for(i=1; i<self->workerCount; ++i){
+		DThread_Join( & self->workers[i].thread );
+		DThread_Destroy( & self->workers[i].thread );
+	}
+	DMutex_Destroy( & self->mutex );
+	DCondVar_Destroy( & self->condv );
+	DCondVar_Destroy( & self->condv2 );
+	dao_free( self->workers );
+#endif
+	dao_free( self );
+}
+
+void DaoxThreadPool_Run( DaoxThreadPool *self, DaoxParallelJob job, void *data, int count )
+{
+	int i;
+
+	if( self == NULL || self->workerCount <= 1 || count <= 1 ){
+		for(i=0; i<count; ++i) job( data, i, 0 );
+		return;
+	}
+#ifdef DAO_WITH_THREAD
+	DMutex_Lock( & self->mutex );
+	self->job = job;
+	self->data = data;
+	self->jobCount = count;
+	self->nextJob = 0;
+	self->finished = 0;
+	self->generation += 1;
+	DCondVar_BroadCast( & self->condv );
+
+	DaoxThreadPool_RunJobs( self, 0 );
+	while( self->finished < self->jobCount ){
+		DCondVar_Wait( & self->condv2, & self->mutex );
+	}
+	self->job = NULL;
+	self->data = NULL;
+	DMutex_Unlock( & self->mutex );
+#endif
+}
+
+typedef struct DaoxRangeJobs DaoxRangeJobs;
+struct DaoxRangeJobs
+{
+	DaoxRangeJob  job;
+	void         *data;
+	int           count;
+	int           ranges;
+};
+static void DaoxThreadPool_RangeJob( void *data, int index, int worker )
+{
+	DaoxRangeJobs *jobs = (DaoxRangeJobs*) data;
+	int first = (daoint) index * jobs->count / jobs->ranges;
+	int last = (daoint) (index + 1) * jobs->count / jobs->ranges;
+	if( first < last ) jobs->job( jobs->data, first, last );
+}
+void DaoxThreadPool_RunRanges( DaoxThreadPool *self, DaoxRangeJob job, void *data, int count, int grain )
+{
+	DaoxRangeJobs jobs;
+	int workerCount = self ? self->workerCount : 1;
+	int ranges = grain > 0 ? count / grain : count;
+
+	if( ranges > 4*workerCount ) ranges = 4*workerCount;
+	if( ranges <= 1 ){
+		if( count > 0 ) job( data, 0, count );
+		return;
+	}
+	jobs.job = job;
+	jobs.data = data;
+	jobs.count = count;
+	jobs.ranges = ranges;
+	DaoxThreadPool_Run( self, DaoxThreadPool_RangeJob, & jobs, ranges );
+}
+
+int DaoxThreadPool_GetProcessorCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo( & info );
+	return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	return sysconf( _SC_NPROCESSORS_ONLN );
+#else
+	return 1;
+#endif
+}
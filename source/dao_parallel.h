@@ -0,0 +1,94 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __DAO_PARALLEL__
+#define __DAO_PARALLEL__
+
+#include "dao_common.h"
+
+#ifdef DAO_WITH_THREAD
+#include "daoThread.h"
+#endif
+
+
+typedef struct DaoxWorker      DaoxWorker;
+typedef struct DaoxThreadPool  DaoxThreadPool;
+
+/*
+// Parallel job: "index" is the index of the job in a run,
+// and "worker" is the index of the worker (0 for the calling thread);
+*/
+typedef void (*DaoxParallelJob)( void *data, int index, int worker );
+
+/* Range job: process the items in [first,last); */
+typedef void (*DaoxRangeJob)( void *data, int first, int last );
+
+
+/*
+// DaoxThreadPool:
+// -- A pool of worker threads to run a batch of independent jobs;
+// -- The calling thread participates in the run, and waits for all the jobs;
+// -- Jobs are fetched dynamically, so the results of a job should only
+//    depend on its index, not on the worker that runs it;
+// -- Without thread support, the jobs are run serially by the calling thread;
+*/
+struct DaoxThreadPool
+{
+	int  workerCount;  /* including the calling thread; */
+
+#ifdef DAO_WITH_THREAD
+	DaoxWorker  *workers;
+	DMutex       mutex;
+	DCondVar     condv;   /* new jobs or quit; */
+	DCondVar     condv2;  /* all jobs finished; */
+
+	DaoxParallelJob  job;
+	void            *data;
+
+	int     jobCount;
+	int     nextJob;
+	int     finished;
+	int     quit;
+	uint_t  generation;
+#endif
+};
+
+/* With workerCount <= 0, use the number of processors (up to 8); */
+DaoxThreadPool* DaoxThreadPool_New( int workerCount );
+void DaoxThreadPool_Delete( DaoxThreadPool *self );
+
+void DaoxThreadPool_Run( DaoxThreadPool *self, DaoxParallelJob job, void *data, int count );
+
+/*
+// Split [0,count) into contiguous ranges of at least "grain" items (if possible),
+// and run the range job on them in parallel;
+*/
+void DaoxThreadPool_RunRanges( DaoxThreadPool *self, DaoxRangeJob job, void *data, int count, int grain );
+
+int DaoxThreadPool_GetProcessorCount();
+
+#endif
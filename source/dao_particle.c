@@ -46,6 +46,7 @@ void DaoxParticles_Reset( DaoxParticles *self )
 	self->particles->size = 0;
 	self->data->vertices->size = 0;
 	self->data->triangles->size = 0;
+	DaoxMeshUnit_MarkDirty( self->data );
 }
 
 
@@ -223,6 +224,7 @@ void DaoxEmitter_UpdateView( DaoxEmitter *self, DaoxVector3D campos )
 	int i, j, k;
 	for(i=0; i<self->active; ++i){
 		DaoxParticles *cluster = (DaoxParticles*) self->clusters->items.pVoid[i];
+		DaoxMeshUnit_MarkDirty( cluster->data );
 		for(j=0; j<cluster->particles->size; ++j){
 			DaoxParticle *particle = cluster->particles->data.particles + j;
 			DaoxVertex *vertices = cluster->data->vertices->data.vertices + 4*j;
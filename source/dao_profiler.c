@@ -0,0 +1,158 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include <string.h>
+#include "dao_profiler.h"
+
+
+#if defined(GL_TIME_ELAPSED) && !defined(DAO_GRAPHICS_USE_GLES)
+#define DAOX_GPU_TIMER
+#endif
+
+
+static const char *const daox_profile_phases[] =
+{
+	"update", "prepare", "upload", "draw", "canvas"
+};
+
+const char* DaoxProfiler_GetPhaseName( int phase )
+{
+	if( phase < 0 || phase >= DAOX_PROFILE_PHASES ) return "";
+	return daox_profile_phases[phase];
+}
+
+
+DaoxProfiler* DaoxProfiler_New()
+{
+	DaoxProfiler *self = (DaoxProfiler*) dao_calloc( 1, sizeof(DaoxProfiler) );
+	self->phase = -1;
+	self->gpuTime = -1.0;
+	self->current.gpuTime = -1.0;
+	self->last.gpuTime = -1.0;
+	return self;
+}
+void DaoxProfiler_Delete( DaoxProfiler *self )
+{
+#ifdef DAOX_GPU_TIMER
+	if( self->queries[0] ) glDeleteQueries( DAOX_PROFILE_QUERIES, self->queries );
+#endif
+	dao_free( self );
+}
+
+void DaoxProfiler_BeginPhase( DaoxProfiler *self, int phase )
+{
+	if( self->enabled == 0 ) return;
+	DaoxProfiler_EndPhase( self );
+	self->phase = phase;
+	self->phaseStart = Dao_GetCurrentTime();
+}
+void DaoxProfiler_EndPhase( DaoxProfiler *self )
+{
+	if( self->phase < 0 ) return;
+	DaoxProfiler_AddTime( self, self->phase, Dao_GetCurrentTime() - self->phaseStart );
+	self->phase = -1;
+}
+void DaoxProfiler_AddTime( DaoxProfiler *self, int phase, double seconds )
+{
+	if( self->enabled == 0 ) return;
+	self->current.cpuTimes[phase] += 1000.0 * seconds;
+}
+
+#ifdef DAOX_GPU_TIMER
+static void DaoxProfiler_ReadQueries( DaoxProfiler *self )
+{
+	int i;
+	for(i=0; i<DAOX_PROFILE_QUERIES; ++i){
+		/* The oldest pending query first: */
+		int k = (self->queryIndex + i) % DAOX_PROFILE_QUERIES;
+		GLuint64 elapsed = 0;
+		GLint available = 0;
+		if( self->pending[k] == 0 ) continue;
+		glGetQueryObjectiv( self->queries[k], GL_QUERY_RESULT_AVAILABLE, & available );
+		if( available == 0 ) continue;
+		glGetQueryObjectui64v( self->queries[k], GL_QUERY_RESULT, & elapsed );
+		self->gpuTime = 1E-6 * elapsed;
+		self->pending[k] = 0;
+	}
+}
+#endif
+
+/*
+// The scene update happens before the rendering, so the frame statistics
+// are collected until DaoxProfiler_EndFrame() and then reset:
+*/
+void DaoxProfiler_BeginFrame( DaoxProfiler *self )
+{
+	if( self->enabled == 0 ) return;
+#ifdef DAOX_GPU_TIMER
+	if( self->queries[0] == 0 ) glGenQueries( DAOX_PROFILE_QUERIES, self->queries );
+	/* Skip the frame if all the queries are still pending: */
+	if( self->pending[self->queryIndex] == 0 ){
+		glBeginQuery( GL_TIME_ELAPSED, self->queries[self->queryIndex] );
+		self->pending[self->queryIndex] = 2;
+	}
+#endif
+}
+void DaoxProfiler_EndFrame( DaoxProfiler *self )
+{
+	self->frameIndex += 1;
+	self->current.frame = self->frameIndex;
+	if( self->enabled ){
+		DaoxProfiler_EndPhase( self );
+#ifdef DAOX_GPU_TIMER
+		if( self->pending[self->queryIndex] == 2 ){
+			glEndQuery( GL_TIME_ELAPSED );
+			self->pending[self->queryIndex] = 1;
+			self->queryIndex = (self->queryIndex + 1) % DAOX_PROFILE_QUERIES;
+		}
+		DaoxProfiler_ReadQueries( self );
+#endif
+	}
+	self->current.gpuTime = self->gpuTime;
+	self->last = self->current;
+	memset( & self->current, 0, sizeof(DaoxFrameStats) );
+	if( self->enabled && self->dump ) DaoxProfiler_Print( & self->last, stdout );
+}
+
+void DaoxProfiler_Print( DaoxFrameStats *stats, FILE *fout )
+{
+	int i;
+	fprintf( fout, "frame %u:", stats->frame );
+	for(i=0; i<DAOX_PROFILE_PHASES; ++i){
+		fprintf( fout, " %s %.3fms,", daox_profile_phases[i], stats->cpuTimes[i] );
+	}
+	if( stats->gpuTime >= 0.0 ){
+		fprintf( fout, " gpu %.3fms,", stats->gpuTime );
+	}else{
+		fprintf( fout, " gpu n/a," );
+	}
+	fprintf( fout, " draws %u, triangles %u, uploaded %u bytes, culled %u, occluded %u\n",
+			stats->drawCalls, stats->triangles, stats->uploadedBytes,
+			stats->culledChunks, stats->occludedChunks );
+}
@@ -0,0 +1,106 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#ifndef __DAO_PROFILER__
+#define __DAO_PROFILER__
+
+#include <stdio.h>
+#include "dao_opengl.h"
+
+
+#define DAOX_PROFILE_QUERIES  4   /* GPU timer queries in flight; */
+
+
+enum DaoxProfilePhase
+{
+	DAOX_PROFILE_UPDATE ,   /* scene update (animations, particles etc.); */
+	DAOX_PROFILE_PREPARE ,  /* draw task preparation and culling; */
+	DAOX_PROFILE_UPLOAD ,   /* buffer, texture and uniform block uploading; */
+	DAOX_PROFILE_DRAW ,     /* draw call submission; */
+	DAOX_PROFILE_CANVAS ,   /* canvas painting; */
+	DAOX_PROFILE_PHASES
+};
+
+
+typedef struct DaoxFrameStats  DaoxFrameStats;
+typedef struct DaoxProfiler    DaoxProfiler;
+
+
+struct DaoxFrameStats
+{
+	uint_t  frame;
+	double  cpuTimes[DAOX_PROFILE_PHASES];  /* in milliseconds; */
+	double  gpuTime;   /* in milliseconds, negative if not available; */
+	uint_t  drawCalls;
+	uint_t  triangles;
+	uint_t  uploadedBytes;
+	uint_t  culledChunks;    /* chunks culled by the view frustum; */
+	uint_t  occludedChunks;  /* chunks culled by the occlusion buffer; */
+};
+
+
+/*
+// DaoxProfiler:
+// -- The CPU time of a phase is measured from DaoxProfiler_BeginPhase() to the
+//    beginning of the next phase or the end of the frame;
+// -- The counters are updated by the renderer regardless of "enabled";
+// -- The GPU time of a frame is measured with a GL_TIME_ELAPSED query, and is
+//    read back without blocking a few frames later. So "gpuTime" of the last
+//    frame statistics is the latest available GPU time;
+*/
+struct DaoxProfiler
+{
+	uchar_t  enabled;
+	uchar_t  dump;     /* print the statistics of each frame; */
+	int      phase;    /* the current phase, -1 for none; */
+	double   phaseStart;
+	double   gpuTime;
+	uint_t   frameIndex;
+
+	DaoxFrameStats  current;
+	DaoxFrameStats  last;   /* statistics of the last finished frame; */
+
+	uint_t   queries[DAOX_PROFILE_QUERIES];
+	uchar_t  pending[DAOX_PROFILE_QUERIES];
+	uint_t   queryIndex;
+};
+
+DaoxProfiler* DaoxProfiler_New();
+void DaoxProfiler_Delete( DaoxProfiler *self );
+
+void DaoxProfiler_BeginFrame( DaoxProfiler *self );
+void DaoxProfiler_EndFrame( DaoxProfiler *self );
+void DaoxProfiler_BeginPhase( DaoxProfiler *self, int phase );
+void DaoxProfiler_EndPhase( DaoxProfiler *self );
+void DaoxProfiler_AddTime( DaoxProfiler *self, int phase, double seconds );
+
+const char* DaoxProfiler_GetPhaseName( int phase );
+void DaoxProfiler_Print( DaoxFrameStats *stats, FILE *fout );
+
+#endif
@@ -28,10 +28,16 @@
 
 
 #include <math.h>
+#include <float.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "dao_terrain.h"
 #include "dao_particle.h"
 #include "dao_renderer.h"
 #include "dao_painter.h"
+#include "dao_bvh.h"
+#include "dao_streaming.h"
 
 
 
@@ -39,18 +45,546 @@
 DaoxDrawTask* DaoxDrawTask_New()
 {
 	DaoxDrawTask *self = (DaoxDrawTask*) dao_calloc( 1, sizeof(DaoxDrawTask) );
+	self->ranges = DArray_New( sizeof(int) );
+	self->instances = DArray_New( sizeof(DaoxMatrix4D) );
+	self->instanceCounts = DArray_New( sizeof(int) );
 	return self;
 }
 void DaoxDrawTask_Delete( DaoxDrawTask *self )
 {
 	DList_Clear( & self->units );
 	DList_Clear( & self->chunks );
+	DArray_Delete( self->ranges );
+	DArray_Delete( self->instances );
+	DArray_Delete( self->instanceCounts );
 	dao_free( self );
 }
 
 
 
 
+DaoxDrawList* DaoxDrawList_New()
+{
+	DaoxDrawList *self = (DaoxDrawList*) dao_calloc( 1, sizeof(DaoxDrawList) );
+	self->tasks = DList_New(0);
+	self->tasks2 = DList_New(0);
+	self->canvases = DList_New(0);
+	self->emitters = DList_New(0);
+	self->skeletons = DList_New(0);
+	self->taskCache = DList_New(0);
+	self->map = DMap_New(0,0);
+	self->instanceTasks = DMap_New(0,0);
+	self->chunks = DList_New(0);
+	self->chunks2 = DList_New(0);
+	self->boxes = DArray_New( sizeof(DaoxOBBox3D) );
+	self->checks = DArray_New( sizeof(int) );
+	return self;
+}
+void DaoxDrawList_Delete( DaoxDrawList *self )
+{
+	int i;
+	for(i=0; i<self->taskCache->size; ++i){
+		DaoxDrawTask_Delete( self->taskCache->items.pDrawTask[i] );
+	}
+	DList_Delete( self->tasks );
+	DList_Delete( self->tasks2 );
+	DList_Delete( self->canvases );
+	DList_Delete( self->emitters );
+	DList_Delete( self->skeletons );
+	DList_Delete( self->taskCache );
+	DMap_Delete( self->map );
+	DMap_Delete( self->instanceTasks );
+	DList_Delete( self->chunks );
+	DList_Delete( self->chunks2 );
+	DArray_Delete( self->boxes );
+	DArray_Delete( self->checks );
+	dao_free( self );
+}
+
+
+
+
+DaoxMeshStorage* DaoxMeshStorage_New( DaoxBuffer *buffer )
+{
+	DaoxMeshStorage *self = (DaoxMeshStorage*) dao_calloc( 1, sizeof(DaoxMeshStorage) );
+	self->regions = DMap_New(0,0);
+	self->buffer = buffer;
+	return self;
+}
+static void DaoxMeshStorage_Clear( DaoxMeshStorage *self )
+{
+	DNode *it;
+	for(it=DMap_First(self->regions); it; it=DMap_Next(self->regions,it)){
+		DaoxMeshRegion *region = (DaoxMeshRegion*) it->value.pVoid;
+		GC_DecRC( region->unit );
+		dao_free( region );
+	}
+	DMap_Reset( self->regions );
+}
+void DaoxMeshStorage_Reset( DaoxMeshStorage *self )
+{
+	DaoxMeshStorage_Clear( self );
+	self->buffer->vertexOffset = 0;
+	self->buffer->triangleOffset = 0;
+	self->wastedVertices = 0;
+	self->wastedTriangles = 0;
+}
+void DaoxMeshStorage_Delete( DaoxMeshStorage *self )
+{
+	DaoxMeshStorage_Clear( self );
+	DMap_Delete( self->regions );
+	dao_free( self );
+}
+/*
+// Release the regions that have not been used for a while.
+// Their space is reclaimed when the storage is compacted.
+*/
+void DaoxMeshStorage_Sweep( DaoxMeshStorage *self, uint_t frame, uint_t maxAge )
+{
+	DList *units = DList_New(0);
+	DNode *it;
+	daoint i;
+
+	for(it=DMap_First(self->regions); it; it=DMap_Next(self->regions,it)){
+		DaoxMeshRegion *region = (DaoxMeshRegion*) it->value.pVoid;
+		if( (frame - region->frame) > maxAge ) DList_Append( units, region->unit );
+	}
+	for(i=0; i<units->size; ++i){
+		DaoxMeshUnit *unit = units->items.pMeshUnit[i];
+		DaoxMeshRegion *region = (DaoxMeshRegion*) DMap_Find( self->regions, unit )->value.pVoid;
+		self->wastedVertices += region->vertexCapacity;
+		self->wastedTriangles += region->triangleCapacity;
+		DMap_Erase( self->regions, unit );
+		GC_DecRC( unit );
+		dao_free( region );
+	}
+	DList_Delete( units );
+	/* Compact by uploading the used regions again: */
+	if( 2*self->wastedVertices > self->buffer->vertexOffset ){
+		DaoxMeshStorage_Reset( self );
+	}else if( 2*self->wastedTriangles > self->buffer->triangleOffset ){
+		DaoxMeshStorage_Reset( self );
+	}
+}
+/*
+// The units are released by the GC when "remove" is set,
+// so the regions are dropped without decreasing their references:
+*/
+void DaoxMeshStorage_HandleGC( DaoxMeshStorage *self, DList *values, int remove )
+{
+	DNode *it;
+	for(it=DMap_First(self->regions); it; it=DMap_Next(self->regions,it)){
+		DaoxMeshRegion *region = (DaoxMeshRegion*) it->value.pVoid;
+		DList_Append( values, region->unit );
+		if( remove ) dao_free( region );
+	}
+	if( remove ){
+		DMap_Reset( self->regions );
+		self->buffer->vertexOffset = 0;
+		self->buffer->triangleOffset = 0;
+		self->wastedVertices = 0;
+		self->wastedTriangles = 0;
+	}
+}
+
+static int DaoxMeshChunk_CountTriangles( DaoxMeshChunk *self )
+{
+	int left = self->left && self->left->triangles->size;
+	int right = self->right && self->right->triangles->size;
+	int count = 0;
+
+	if( left ) count += DaoxMeshChunk_CountTriangles( self->left );
+	if( right ) count += DaoxMeshChunk_CountTriangles( self->right );
+	if( left || right ) return count;
+	return self->triangles->size;
+}
+static void DaoxMeshChunk_ExportTriangles( DaoxMeshChunk *self, DaoGLTriangle *gltriangles, int vertexOffset )
+{
+	DaoxTriangle *triangles = self->unit->triangles->data.triangles;
+	int left = self->left && self->left->triangles->size;
+	int right = self->right && self->right->triangles->size;
+	int i;
+
+	if( left ) DaoxMeshChunk_ExportTriangles( self->left, gltriangles, vertexOffset );
+	if( right ) DaoxMeshChunk_ExportTriangles( self->right, gltriangles, vertexOffset );
+	if( left || right ) return;
+
+	gltriangles += self->offset;
+	for(i=0; i<self->triangles->size; ++i){
+		DaoxTriangle *triangle = triangles + self->triangles->data.ints[i];
+		gltriangles[i].index[0] = triangle->index[0] + vertexOffset;
+		gltriangles[i].index[1] = triangle->index[1] + vertexOffset;
+		gltriangles[i].index[2] = triangle->index[2] + vertexOffset;
+	}
+}
+static void DaoxMeshChunk_ExportShortTriangles( DaoxMeshChunk *self, DaoGLShortTriangle *gltriangles )
+{
+	DaoxTriangle *triangles = self->unit->triangles->data.triangles;
+	int left = self->left && self->left->triangles->size;
+	int right = self->right && self->right->triangles->size;
+	int i;
+
+	if( left ) DaoxMeshChunk_ExportShortTriangles( self->left, gltriangles );
+	if( right ) DaoxMeshChunk_ExportShortTriangles( self->right, gltriangles );
+	if( left || right ) return;
+
+	gltriangles += self->offset;
+	for(i=0; i<self->triangles->size; ++i){
+		DaoxTriangle *triangle = triangles + self->triangles->data.ints[i];
+		gltriangles[i].index[0] = triangle->index[0];
+		gltriangles[i].index[1] = triangle->index[1];
+		gltriangles[i].index[2] = triangle->index[2];
+	}
+}
+/*
+// Packing of the compact vertex layout:
+*/
+static GLushort DaoxHalfFloat( float value )
+{
+	union { float f; uint_t u; } bits;
+	uint_t sign, exponent, mantissa;
+
+	bits.f = value;
+	sign = (bits.u >> 16) & 0x8000;
+	exponent = (bits.u >> 23) & 0xff;
+	mantissa = bits.u & 0x7fffff;
+	if( exponent == 0xff ) return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+	if( exponent > 142 ) return sign | 0x7c00;  /* Overflow to infinity; */
+	if( exponent < 103 ) return sign;  /* Underflow to zero; */
+	if( exponent < 113 ) return sign | ((mantissa | 0x800000) >> (126 - exponent));
+	/* Rounded to nearest, a carry to the exponent is still correct: */
+	return (sign | ((exponent - 112) << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1);
+}
+static GLuint DaoxSnorm10( float value )
+{
+	if( value > 1.0 ) value = 1.0;
+	if( value < -1.0 ) value = -1.0;
+	return (GLuint)(GLint)( value * 511.0 + (value >= 0.0 ? 0.5 : -0.5) ) & 0x3ff;
+}
+static GLuint DaoxSnorm10x3( DaoxVector3D *vector )
+{
+	return DaoxSnorm10( vector->x ) | (DaoxSnorm10( vector->y ) << 10) | (DaoxSnorm10( vector->z ) << 20);
+}
+static void DaoxVertex_Pack( DaoxVertex *self, DaoGLPackedVertex3D *packed )
+{
+	packed->pos.x = self->pos.x;
+	packed->pos.y = self->pos.y;
+	packed->pos.z = self->pos.z;
+	packed->norm = DaoxSnorm10x3( & self->norm );
+	packed->tan = DaoxSnorm10x3( & self->tan );
+	packed->tex.x = DaoxHalfFloat( self->tex.x );
+	packed->tex.y = DaoxHalfFloat( self->tex.y );
+}
+/*
+// Skeletons are limited to 256 joints in the compact layout. The quantized
+// weights are adjusted on the largest one, so that they still sum up to one.
+*/
+static void DaoxSkinParam_Pack( DaoxSkinParam *self, DaoGLPackedSkinVertex3D *packed )
+{
+	int s, max = 0, sum = 0;
+	for(s=0; s<4; ++s){
+		float weight = self->weights[s] < 0.0 ? 0.0 : self->weights[s];
+		int w = (int)( 255.0 * weight + 0.5 );
+		if( w > 255 ) w = 255;
+		packed->joints.j[s] = self->joints[s] < 255 ? self->joints[s] : 255;
+		packed->weights.w[s] = w;
+		if( w > packed->weights.w[max] ) max = s;
+		sum += w;
+	}
+	if( sum == 0 ) return;
+	sum = packed->weights.w[max] + 255 - sum;
+	packed->weights.w[max] = sum < 0 ? 0 : (sum > 255 ? 255 : sum);
+}
+static void DaoxMeshUnit_ExportPackedVertices( DaoxMeshUnit *self, DaoGLPackedVertex3D *glvertices, DaoGLPackedSkinVertex3D *glskvertices )
+{
+	int k, count = self->vertices->size;
+
+	for(k=0; k<count; ++k){
+		DaoxVertex *vertex = self->vertices->data.vertices + k;
+		if( glvertices == NULL ){
+			DaoxSkinParam *param = self->skinParams->data.skinparams + k;
+			DaoxSkinParam_Pack( param, glskvertices + k );
+			DaoxVertex_Pack( vertex, (DaoGLPackedVertex3D*) (glskvertices + k) );
+		}else{
+			DaoxVertex_Pack( vertex, glvertices + k );
+		}
+	}
+}
+/*
+// DaoxVertex and DaoGLVertex3D have the same layout, so the vertices
+// can be copied in block. The joint indices of skinned vertices are
+// converted to floats four at a time with SSE2.
+*/
+static void DaoxMeshUnit_ExportFullVertices( DaoxMeshUnit *self, DaoGLVertex3D *glvertices, DaoGLSkinVertex3D *glskvertices )
+{
+	int k, count = self->vertices->size;
+	int samelayout = sizeof(DaoxVertex) == sizeof(DaoGLVertex3D);
+#ifndef __SSE2__
+	int s;
+#endif
+
+	if( glvertices != NULL && samelayout ){
+		memcpy( glvertices, self->vertices->data.vertices, count*sizeof(DaoGLVertex3D) );
+		return;
+	}
+	for(k=0; k<count; ++k){
+		DaoxVertex *vertex = self->vertices->data.vertices + k;
+		DaoGLSkinVertex3D *skvertex = glskvertices + k;
+		DaoGLVertex3D *glvertex = glvertices + k;
+		if( glvertices == NULL ){
+			DaoxSkinParam *param = self->skinParams->data.skinparams + k;
+			glvertex = (DaoGLVertex3D*) skvertex;
+#ifdef __SSE2__
+			_mm_storeu_ps( skvertex->joints.j, _mm_cvtepi32_ps( _mm_loadu_si128( (__m128i*) param->joints ) ) );
+			_mm_storeu_ps( skvertex->weights.w, _mm_loadu_ps( param->weights ) );
+#else
+			for(s=0; s<4; ++s){
+				skvertex->joints.j[s] = param->joints[s];
+				skvertex->weights.w[s] = param->weights[s];
+			}
+#endif
+			if( samelayout ){
+				memcpy( glvertex, vertex, sizeof(DaoGLVertex3D) );
+				continue;
+			}
+		}
+		glvertex->pos.x = vertex->pos.x;
+		glvertex->pos.y = vertex->pos.y;
+		glvertex->pos.z = vertex->pos.z;
+		glvertex->norm.x = vertex->norm.x;
+		glvertex->norm.y = vertex->norm.y;
+		glvertex->norm.z = vertex->norm.z;
+		glvertex->tan.x = vertex->tan.x;
+		glvertex->tan.y = vertex->tan.y;
+		glvertex->tan.z = vertex->tan.z;
+		glvertex->tex.x = vertex->tex.x;
+		glvertex->tex.y = vertex->tex.y;
+	}
+}
+static int DaoxBuffer_IsSkinning( DaoxBuffer *self )
+{
+	return self->traitCount == 6;
+}
+/*
+// Export the vertices of the unit in the layout of the buffer:
+*/
+static void DaoxMeshUnit_ExportVertices( DaoxMeshUnit *self, DaoxBuffer *buffer, void *glvertices )
+{
+	int skinning = DaoxBuffer_IsSkinning( buffer );
+	if( buffer->packed && skinning ){
+		DaoxMeshUnit_ExportPackedVertices( self, NULL, (DaoGLPackedSkinVertex3D*) glvertices );
+	}else if( buffer->packed ){
+		DaoxMeshUnit_ExportPackedVertices( self, (DaoGLPackedVertex3D*) glvertices, NULL );
+	}else if( skinning ){
+		DaoxMeshUnit_ExportFullVertices( self, NULL, (DaoGLSkinVertex3D*) glvertices );
+	}else{
+		DaoxMeshUnit_ExportFullVertices( self, (DaoGLVertex3D*) glvertices, NULL );
+	}
+}
+/*
+// With 16-bit indices, the units of more than 65536 vertices keep 32-bit
+// indices (still relative to their first vertices), and each of their
+// triangles takes two slots of the buffer:
+*/
+static int DaoxMeshStorage_TriangleSlots( DaoxMeshStorage *self, int vertexCount )
+{
+	return self->buffer->shortIndices && vertexCount > 0x10000 ? 2 : 1;
+}
+/*
+// Get the region of the unit in the storage, allocate and/or upload it if necessary:
+*/
+DaoxMeshRegion* DaoxMeshStorage_Update( DaoxMeshStorage *self, DaoxMeshUnit *unit, uint_t frame )
+{
+	DaoxBuffer *buffer = self->buffer;
+	DaoxMeshRegion *region = NULL;
+	DaoGLTriangle *gltriangles;
+	void *glvertices;
+	DNode *it = DMap_Find( self->regions, unit );
+	int vertexCount, triangleCount, slotCount, slots;
+
+	if( it != NULL ){
+		region = (DaoxMeshRegion*) it->value.pVoid;
+		region->frame = frame;
+		if( region->version == unit->version ) return region;
+	}
+
+	vertexCount = unit->vertices->size;
+	triangleCount = DaoxMeshChunk_CountTriangles( unit->tree );
+	slots = DaoxMeshStorage_TriangleSlots( self, vertexCount );
+	slotCount = slots * triangleCount;
+	if( region == NULL ){
+		region = (DaoxMeshRegion*) dao_calloc( 1, sizeof(DaoxMeshRegion) );
+		region->unit = unit;
+		region->frame = frame;
+		GC_IncRC( unit );
+		DMap_Insert( self->regions, unit, region );
+	}
+	if( vertexCount > region->vertexCapacity || slotCount > region->triangleCapacity
+			|| (slots == 2 && (region->triangleOffset & 1)) ){
+		self->wastedVertices += region->vertexCapacity;
+		self->wastedTriangles += region->triangleCapacity;
+		DaoxBuffer_Reserve( buffer, vertexCount, slotCount + 1 );
+		/* 32-bit indices are aligned to four bytes: */
+		if( slots == 2 && (buffer->triangleOffset & 1) ) buffer->triangleOffset += 1;
+		region->vertexOffset = buffer->vertexOffset;
+		region->vertexCapacity = vertexCount;
+		region->triangleOffset = buffer->triangleOffset;
+		region->triangleCapacity = slotCount;
+		buffer->vertexOffset += vertexCount;
+		buffer->triangleOffset += slotCount;
+	}
+	region->version = unit->version;
+	region->vertexCount = vertexCount;
+	region->triangleCount = triangleCount;
+	if( vertexCount == 0 || triangleCount == 0 ) return region;
+
+	self->uploadedBytes += vertexCount * buffer->vertexSize + slotCount * buffer->triangleSize;
+	glvertices = DaoxBuffer_MapVertexRange( buffer, region->vertexOffset, vertexCount );
+	DaoxMeshUnit_ExportVertices( unit, buffer, glvertices );
+	glUnmapBuffer( GL_ARRAY_BUFFER );
+
+	gltriangles = DaoxBuffer_MapTriangleRange( buffer, region->triangleOffset, slotCount );
+	if( buffer->shortIndices == 0 ){
+		DaoxMeshChunk_ExportTriangles( unit->tree, gltriangles, region->vertexOffset );
+	}else if( slots == 2 ){
+		DaoxMeshChunk_ExportTriangles( unit->tree, gltriangles, 0 );
+	}else{
+		DaoxMeshChunk_ExportShortTriangles( unit->tree, (DaoGLShortTriangle*) gltriangles );
+	}
+	glUnmapBuffer( GL_ELEMENT_ARRAY_BUFFER );
+
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+	return region;
+}
+
+
+
+
+static void DaoxMaterial_ExportBlock( DaoxMaterial *self, DaoxMaterialBlock *block )
+{
+	DaoxColor dark = {0.2, 0.2, 0.2, 1.0};
+
+	memset( block, 0, sizeof(DaoxMaterialBlock) );
+	block->colors[0] = self ? self->ambient : dark;
+	block->colors[1] = self ? self->diffuse : dark;
+	block->colors[2] = self ? self->specular : dark;
+	block->colors[3] = self ? self->emission : daox_black_color;
+	block->shininess = self ? self->shininess : 2;
+}
+
+DaoxMaterialCache* DaoxMaterialCache_New()
+{
+	DaoxMaterialCache *self = (DaoxMaterialCache*) dao_calloc( 1, sizeof(DaoxMaterialCache) );
+	DaoxMaterialSlot *slot;
+
+	self->buffer = DaoxUniformBuffer_New( DAOX_MATERIAL_BLOCK, sizeof(DaoxMaterialBlock), 64 );
+	self->slots = DMap_New(0,0);
+	self->entries = DArray_New( sizeof(DaoxMaterialSlot) );
+	self->freeSlots = DArray_New( sizeof(int) );
+
+	slot = (DaoxMaterialSlot*) DArray_Push( self->entries );
+	memset( slot, 0, sizeof(DaoxMaterialSlot) );
+	DaoxMaterial_ExportBlock( NULL, & slot->block );
+	DaoxUniformBuffer_Update( self->buffer, 0, 0, sizeof(DaoxMaterialBlock), & slot->block );
+	return self;
+}
+void DaoxMaterialCache_Delete( DaoxMaterialCache *self )
+{
+	DNode *it;
+	for(it=DMap_First(self->slots); it; it=DMap_Next(self->slots,it)){
+		GC_DecRC( it->key.pVoid );
+	}
+	DaoxUniformBuffer_Delete( self->buffer );
+	DMap_Delete( self->slots );
+	DArray_Delete( self->entries );
+	DArray_Delete( self->freeSlots );
+	dao_free( self );
+}
+/*
+// Get the slot of the material, and upload its block if it has changed:
+*/
+int DaoxMaterialCache_Update( DaoxMaterialCache *self, DaoxMaterial *material, uint_t frame )
+{
+	DaoxMaterialSlot *slots;
+	DaoxMaterialBlock block;
+	DNode *it;
+	int i, index = 0;
+
+	if( material != NULL ){
+		it = DMap_Find( self->slots, material );
+		if( it != NULL ){
+			index = it->value.pInt;
+		}else{
+			if( self->freeSlots->size ){
+				index = self->freeSlots->data.ints[ self->freeSlots->size - 1 ];
+				DArray_Pop( self->freeSlots );
+			}else{
+				index = self->entries->size;
+				DArray_Push( self->entries );
+			}
+			slots = (DaoxMaterialSlot*) self->entries->data.base;
+			memset( slots + index, 0, sizeof(DaoxMaterialSlot) );
+			slots[index].material = material;
+			slots[index].block.shininess = -1.0;  /* not uploaded yet; */
+			DMap_Insert( self->slots, material, IntToPointer( index ) );
+			GC_IncRC( material );
+			/* The uploaded blocks are lost when the buffer is reallocated: */
+			if( DaoxUniformBuffer_Reserve( self->buffer, self->entries->size ) ){
+				for(i=0; i<self->entries->size; ++i){
+					if( i == index ) continue;
+					DaoxUniformBuffer_Update( self->buffer, i, 0, sizeof(DaoxMaterialBlock), & slots[i].block );
+				}
+			}
+		}
+	}
+	slots = (DaoxMaterialSlot*) self->entries->data.base;
+	slots[index].frame = frame;
+	if( index == 0 ) return 0;
+
+	DaoxMaterial_ExportBlock( material, & block );
+	if( memcmp( & slots[index].block, & block, sizeof(DaoxMaterialBlock) ) != 0 ){
+		slots[index].block = block;
+		DaoxUniformBuffer_Update( self->buffer, index, 0, sizeof(DaoxMaterialBlock), & block );
+	}
+	return index;
+}
+/*
+// Release the slots that have not been used for a while:
+*/
+void DaoxMaterialCache_Sweep( DaoxMaterialCache *self, uint_t frame, uint_t maxAge )
+{
+	DaoxMaterialSlot *slots = (DaoxMaterialSlot*) self->entries->data.base;
+	int i;
+
+	for(i=1; i<self->entries->size; ++i){
+		DaoxMaterialSlot *slot = slots + i;
+		if( slot->material == NULL || (frame - slot->frame) <= maxAge ) continue;
+		DMap_Erase( self->slots, slot->material );
+		GC_DecRC( slot->material );
+		slot->material = NULL;
+		DArray_PushInt( self->freeSlots, i );
+	}
+}
+void DaoxMaterialCache_HandleGC( DaoxMaterialCache *self, DList *values, int remove )
+{
+	DaoxMaterialSlot *slots = (DaoxMaterialSlot*) self->entries->data.base;
+	int i;
+
+	for(i=1; i<self->entries->size; ++i){
+		DaoxMaterialSlot *slot = slots + i;
+		if( slot->material == NULL ) continue;
+		DList_Append( values, slot->material );
+		if( remove == 0 ) continue;
+		slot->material = NULL;
+		DArray_PushInt( self->freeSlots, i );
+	}
+	if( remove ) DMap_Reset( self->slots );
+}
+
+
+
+
 
 DaoxRenderer* DaoxRenderer_New( DaoxContext *ctx )
 {
@@ -70,15 +604,43 @@ DaoxRenderer* DaoxRenderer_New( DaoxContext *ctx )
 	self->taskCache = DList_New(0);
 	self->canvases = DList_New(0);
 	self->map = DMap_New(0,0);
+	self->instanceTasks = DMap_New(0,0);
+	self->drawLists = DList_New(0);
+	self->visibleNodes = DList_New(0);
+	self->occlusionBuffer = DaoxOcclusionBuffer_New( 256, 128 );
+	self->lightClusters = DaoxLightClusters_New();
+	self->profiler = DaoxProfiler_New();
+	self->boneOffsets = DMap_New(0,0);
+	self->skinningPieces = DArray_New( sizeof(DaoxSkinningPiece) );
+	self->bonePalette = DArray_New( sizeof(float) );
+	self->lod = 1;
+	self->lodTolerance = 1.0;
+	self->frontToBack = 1;
+	self->particleScale = 1;
+	self->indirect = 1;
+	self->variants = 1;
+	self->streamTextures = 1;
+	self->workers = DaoxContext_GetWorkers( ctx );
 
 	self->shader = DaoxShader_New( ctx );
 	self->buffer = DaoxBuffer_New( ctx );
 	self->bufferSK = DaoxBuffer_New( ctx );
 	self->bufferVG = DaoxBuffer_New( ctx );
+	self->bufferRT = DaoxBuffer_New( ctx );
 	GC_IncRC( self->shader );
 	GC_IncRC( self->buffer );
 	GC_IncRC( self->bufferSK );
 	GC_IncRC( self->bufferVG );
+	GC_IncRC( self->bufferRT );
+
+	/* The skinning buffer holds retained units only in the retained mode: */
+	self->bufferSK->retained = 1;
+	self->bufferRT->retained = 1;
+	self->storage = DaoxMeshStorage_New( self->bufferRT );
+	self->storageSK = DaoxMeshStorage_New( self->bufferSK );
+	self->retainMeshes = 1;
+	self->instancing = 1;
+	self->parallel = 1;
 
 	DaoxRenderer_InitShaders( self );
 	DaoxRenderer_InitBuffers( self );
@@ -142,16 +704,39 @@ void DaoxRenderer_Delete( DaoxRenderer *self )
 	}
 	if( self->scene ) GC_DecRC( self->scene );
 	if( self->camera ) GC_DecRC( self->camera );
+	DaoxMeshStorage_Delete( self->storage );
+	DaoxMeshStorage_Delete( self->storageSK );
 	GC_DecRC( self->shader );
+	if( self->downsampleShader ) GC_DecRC( self->downsampleShader );
+	if( self->compositeShader ) GC_DecRC( self->compositeShader );
 	GC_DecRC( self->buffer );
 	GC_DecRC( self->bufferVG );
 	GC_DecRC( self->bufferSK );
+	GC_DecRC( self->bufferRT );
 	GC_DecRC( self->context );
 	DList_Delete( self->taskCache );
 	DList_Delete( self->tasks );
 	DList_Delete( self->tasks2 );
 	DList_Delete( self->canvases );
 	DMap_Delete( self->map );
+	DMap_Delete( self->instanceTasks );
+	for(i=0; i<self->drawLists->size; ++i){
+		DaoxDrawList_Delete( (DaoxDrawList*) self->drawLists->items.pVoid[i] );
+	}
+	DList_Delete( self->drawLists );
+	DList_Delete( self->visibleNodes );
+	DaoxOcclusionBuffer_Delete( self->occlusionBuffer );
+	DaoxLightClusters_Delete( self->lightClusters );
+	DaoxProfiler_Delete( self->profiler );
+	DMap_Delete( self->boneOffsets );
+	DArray_Delete( self->skinningPieces );
+	DArray_Delete( self->bonePalette );
+	if( self->boneTexture ) glDeleteTextures( 1, & self->boneTexture );
+	if( self->lightTextures.lights ) glDeleteTextures( 1, & self->lightTextures.lights );
+	if( self->lightTextures.clusters ) glDeleteTextures( 1, & self->lightTextures.clusters );
+	if( self->lightTextures.indices ) glDeleteTextures( 1, & self->lightTextures.indices );
+	if( self->materials ) DaoxMaterialCache_Delete( self->materials );
+	if( self->objectBuffer ) DaoxUniformBuffer_Delete( self->objectBuffer );
 	GC_DecRC( self->axisMesh );
 	GC_DecRC( self->worldAxis );
 	GC_DecRC( self->localAxis );
@@ -171,34 +756,99 @@ DaoxCamera* DaoxRenderer_GetCurrentCamera( DaoxRenderer *self )
 	DaoGC_IncRC( (DaoValue*) self->camera );
 	return self->camera;
 }
+static void DaoxRenderer_InitSkinningBuffer( DaoxRenderer *self )
+{
+	int pos  = self->shader->attributes.position;
+	int norm = self->shader->attributes.normal;
+	int tan = self->shader->attributes.tangent;
+	int texuv  = self->shader->attributes.texCoord;
+	int joints  = self->shader->attributes.joints;
+	int weights = self->shader->attributes.weights;
+
+	self->bufferSK->packed = self->compact;
+	DaoxBuffer_Init3DSK( self->bufferSK, pos, norm, tan, texuv, joints, weights );
+	DaoxContext_BindBuffer( self->context, self->bufferSK );
+}
+void DaoxRenderer_RetainMeshes( DaoxRenderer *self, int retain )
+{
+	if( self->retainMeshes == (retain != 0) ) return;
+	self->retainMeshes = retain != 0;
+	DaoxMeshStorage_Reset( self->storage );
+	DaoxMeshStorage_Reset( self->storageSK );
+	/*
+	// The skinning buffer is shared by both modes, it is recreated with the
+	// storage usage that matches how its data is updated:
+	*/
+	self->bufferSK->retained = self->retainMeshes;
+	if( self->bufferSK->vertexVAO == 0 ) return;
+	DaoxBuffer_Free( self->bufferSK );
+	DaoxRenderer_InitSkinningBuffer( self );
+}
 
 void DaoxRenderer_InitShaders( DaoxRenderer *self )
 {
 	DaoxShader_Init3D( self->shader );
 	DaoxContext_BindShader( self->context, self->shader );
+	if( self->materials == NULL ) self->materials = DaoxMaterialCache_New();
+	if( self->objectBuffer == NULL ){
+		self->objectBuffer = DaoxUniformBuffer_New( DAOX_OBJECT_BLOCK, sizeof(DaoxObjectBlock), 256 );
+	}
 }
-void DaoxRenderer_InitBuffers( DaoxRenderer *self )
+static void DaoxRenderer_InitMeshBuffers( DaoxRenderer *self )
 {
 	int pos  = self->shader->attributes.position;
 	int norm = self->shader->attributes.normal;
 	int tan = self->shader->attributes.tangent;
 	int texuv  = self->shader->attributes.texCoord;
-	int texmo  = self->shader->attributes.texMO;
-	int joints  = self->shader->attributes.joints;
-	int weights = self->shader->attributes.weights;
+	int *rows = (int*) self->shader->attributes.instanceRows;
+
+	self->buffer->packed = self->compact;
+	self->bufferRT->packed = self->compact;
+#ifndef DAO_GRAPHICS_USE_GLES
+	/* Drawn with base vertices (GL 3.2), and only the static meshes are retained as units: */
+	self->bufferRT->shortIndices = self->compact;
+#endif
 	DaoxBuffer_Init3D( self->buffer, pos, norm, tan, texuv );
-	DaoxBuffer_Init3DVG( self->bufferVG, pos, norm, texuv, texmo );
-	DaoxBuffer_Init3DSK( self->bufferSK, pos, norm, tan, texuv, joints, weights );
+	DaoxBuffer_Init3D( self->bufferRT, pos, norm, tan, texuv );
+	DaoxBuffer_InitInstancing( self->bufferRT, rows[0], rows[1], rows[2] );
+	DaoxBuffer_InitIndirect( self->bufferRT );
+	DaoxBuffer_InitStreaming( self->buffer );
 	DaoxContext_BindBuffer( self->context, self->buffer );
+	DaoxContext_BindBuffer( self->context, self->bufferRT );
+	DaoxRenderer_InitSkinningBuffer( self );
+}
+void DaoxRenderer_InitBuffers( DaoxRenderer *self )
+{
+	int pos  = self->shader->attributes.position;
+	int norm = self->shader->attributes.normal;
+	int texuv  = self->shader->attributes.texCoord;
+	int texmo  = self->shader->attributes.texMO;
+	DaoxBuffer_Init3DVG( self->bufferVG, pos, norm, texuv, texmo );
+	DaoxBuffer_InitStreaming( self->bufferVG );
 	DaoxContext_BindBuffer( self->context, self->bufferVG );
-	DaoxContext_BindBuffer( self->context, self->bufferSK );
+	DaoxRenderer_InitMeshBuffers( self );
+}
+/*
+// Switching the vertex layout recreates the mesh buffers, and the retained
+// units are uploaded again in the new layout:
+*/
+void DaoxRenderer_UseCompactLayout( DaoxRenderer *self, int compact )
+{
+	if( self->compact == (compact != 0) ) return;
+	self->compact = compact != 0;
+	DaoxMeshStorage_Reset( self->storage );
+	DaoxMeshStorage_Reset( self->storageSK );
+	DaoxBuffer_Free( self->buffer );
+	DaoxBuffer_Free( self->bufferSK );
+	DaoxBuffer_Free( self->bufferRT );
+	DaoxRenderer_InitMeshBuffers( self );
 }
 
-DaoxDrawTask* DaoxRenderer_MakeDrawTask( DaoxRenderer *self )
+DaoxDrawTask* DaoxRenderer_MakeDrawTask( DaoxRenderer *self, DaoxDrawList *list )
 {
 	DaoxDrawTask *task = NULL;
-	if( self->taskCache->size ){
-		task = (DaoxDrawTask*) DList_PopBack( self->taskCache );
+	if( list->taskCache->size ){
+		task = (DaoxDrawTask*) DList_PopBack( list->taskCache );
 	}else{
 		task = DaoxDrawTask_New();
 	}
@@ -207,42 +857,242 @@ DaoxDrawTask* DaoxRenderer_MakeDrawTask( DaoxRenderer *self )
 	task->vcount = 0;
 	task->terrainTileType = 0;
 	task->particleType = 0;
+	task->blending = 0;
+	task->batched = 0;
+	task->commandOffset = 0;
+	task->commandCount = 0;
+	task->batchTriangles = 0;
+	task->depthLayer = 0;
 	task->units.size = 0;
 	task->chunks.size = 0;
+	task->ranges->size = 0;
+	task->instances->size = 0;
+	task->instanceCounts->size = 0;
+	task->instanceOffset = 0;
+	task->objectSlot = -1;
+	task->materialSlot = 0;
+	task->boneOffset = 0;
+	task->skinning = NULL;
 	task->material = NULL;
+	task->buffer = NULL;
 	task->hexTile = NULL;
 	task->hexTerrain = NULL;
 	return task;
 }
 
-void DaoxRenderer_PrepareMeshChunk( DaoxRenderer *self, DaoxMeshChunk *chunk, DaoxDrawTask *task )
+static void DaoxRenderer_AddMeshChunk( DaoxMeshChunk *chunk, DaoxDrawTask *task )
 {
-	DaoxOBBox3D obbox;
-	daoint i, m, check;
+	int left = chunk->left && chunk->left->triangles->size;
+	int right = chunk->right && chunk->right->triangles->size;
+
+	if( left ) DaoxRenderer_AddMeshChunk( chunk->left, task );
+	if( right ) DaoxRenderer_AddMeshChunk( chunk->right, task );
+	if( left || right ) return;
+
+	task->tcount += chunk->triangles->size;
+	DList_Append( & task->chunks, chunk );
+}
+/*
+// The chunk tree is culled level by level, and the chunks of the same level
+// are checked in batch. The leaves of a chunk that is fully inside the frustum
+// are added without further checking;
+*/
+void DaoxRenderer_PrepareMeshChunk( DaoxRenderer *self, DaoxDrawList *list, DaoxMeshChunk *chunk, DaoxDrawTask *task )
+{
+	DList *chunks = list->chunks;
+	DList *chunks2 = list->chunks2;
+	DaoxOBBox3D *boxes;
+	daoint i;
+	int *checks;
 
 	if( chunk->triangles->size == 0 ) return;
 
-	obbox = DaoxOBBox3D_Transform( & chunk->obbox, & task->matrix );
-	if( task->skeleton != NULL ){
-		obbox = DaoxOBBox3D_Scale( & obbox, 8.0 );
+	chunks->size = 0;
+	DList_Append( chunks, chunk );
+	while( chunks->size ){
+		DList *tmp = chunks;
+
+		DArray_Resize( list->boxes, chunks->size );
+		DArray_Resize( list->checks, chunks->size );
+		boxes = list->boxes->data.obboxes3d;
+		checks = list->checks->data.ints;
+		for(i=0; i<chunks->size; ++i){
+			chunk = chunks->items.pMeshChunk[i];
+			boxes[i] = DaoxOBBox3D_Transform( & chunk->obbox, & task->matrix );
+			if( task->skeleton != NULL ) boxes[i] = DaoxOBBox3D_Scale( boxes + i, 8.0 );
+		}
+		DaoxViewFrustum_CheckBoxes( & self->frustum, boxes, checks, chunks->size );
+
+		chunks2->size = 0;
+		for(i=0; i<chunks->size; ++i){
+			int left, right;
+			chunk = chunks->items.pMeshChunk[i];
+			left = chunk->left && chunk->left->triangles->size;
+			right = chunk->right && chunk->right->triangles->size;
+			if( checks[i] < 0 ){
+				list->culledChunks += 1;
+				continue;
+			}
+			if( self->occlusion && DaoxOcclusionBuffer_Visible( self->occlusionBuffer, boxes + i ) == 0 ){
+				list->occludedChunks += 1;
+				continue;
+			}
+			if( checks[i] > 0 || (left == 0 && right == 0) ){
+				DaoxRenderer_AddMeshChunk( chunk, task );
+				continue;
+			}
+			if( left ) DList_Append( chunks2, chunk->left );
+			if( right ) DList_Append( chunks2, chunk->right );
+		}
+		chunks = chunks2;
+		chunks2 = tmp;
 	}
-	check = DaoxViewFrustum_Visible( & self->frustum, & obbox );
-	if( check < 0 ) return;
+}
+/*
+// Models without skeleton share the draw tasks of their mesh units,
+// and each visible unit adds an instance to the task of the unit.
+// The tasks with single instance are culled by chunks as usual
+// in DaoxRenderer_FinishInstances();
+*/
+int DaoxRenderer_CanInstance( DaoxRenderer *self, DaoxModel *model )
+{
+	if( self->instancing == 0 || self->retainMeshes == 0 ) return 0;
+	if( self->bufferRT->instanceCapacity == 0 ) return 0;
+	if( model->skeleton != NULL ) return 0;
+	if( DaoType_ChildOf( model->base.ctype, daox_type_emitter ) ) return 0;
+	return 1;
+}
+/*
+// Select the coarsest level of detail of the unit, whose geometric error
+// projects to no more than "lodTolerance" pixels on the screen.
+// The unit is at distance "distance" to the camera, at which each unit of
+// the world coordinates spans "ratio*near/distance" pixels;
+*/
+static DaoxMeshUnit* DaoxRenderer_SelectLOD( DaoxRenderer *self, DaoxMeshUnit *unit, DaoxOBBox3D *obbox )
+{
+	DaoxViewFrustum *frustum = & self->frustum;
+	DaoxVector3D offset;
+	float distance, pixels;
+	daoint i;
 
-	if( chunk->left && chunk->left->triangles->size ){
-		DaoxRenderer_PrepareMeshChunk( self, chunk->left, task );
+	if( self->lod == 0 || unit->lods->size == 0 ) return unit;
+	offset = DaoxVector3D_Sub( & obbox->C, & frustum->cameraPosition );
+	distance = sqrt( DaoxVector3D_Norm2( & offset ) ) - obbox->R;
+	if( distance <= frustum->near ) return unit;
+
+	/* Pixels per unit of the local coordinates: */
+	pixels = frustum->ratio * frustum->near / distance;
+	if( unit->obbox.R > 1E-9 ) pixels *= obbox->R / unit->obbox.R;
+	for(i=unit->lods->size-1; i>=0; --i){
+		DaoxMeshUnit *lod = unit->lods->items.pMeshUnit[i];
+		if( lod->lodError * pixels <= self->lodTolerance ) return lod;
 	}
-	if( chunk->right && chunk->right->triangles->size ){
-		DaoxRenderer_PrepareMeshChunk( self, chunk->right, task );
+	return unit;
+}
+void DaoxRenderer_PrepareInstances( DaoxRenderer *self, DaoxDrawList *list, DaoxModel *model, DaoxMatrix4D *objectToWorld )
+{
+	DaoxMesh *mesh = model->mesh;
+	DaoxDrawTask *task = NULL;
+	DNode *it;
+	daoint i, k = 0;
+
+	DArray_Resize( list->boxes, mesh->units->size );
+	DArray_Resize( list->checks, mesh->units->size );
+	for(i=0; i<mesh->units->size; ++i){
+		DaoxMeshUnit *unit = mesh->units->items.pMeshUnit[i];
+		if( unit->tree == NULL || unit->tree->triangles->size == 0 ) continue;
+		list->boxes->data.obboxes3d[k++] = DaoxOBBox3D_Transform( & unit->tree->obbox, objectToWorld );
 	}
+	DaoxViewFrustum_CheckBoxes( & self->frustum, list->boxes->data.obboxes3d, list->checks->data.ints, k );
 
-	if( chunk->left && chunk->left->triangles->size ) return;
-	if( chunk->right && chunk->right->triangles->size ) return;
+	for(i=0, k=0; i<mesh->units->size; ++i){
+		DaoxMeshUnit *unit = mesh->units->items.pMeshUnit[i];
+		DaoxOBBox3D *obbox = list->boxes->data.obboxes3d + k;
+		if( unit->tree == NULL || unit->tree->triangles->size == 0 ) continue;
+		if( list->checks->data.ints[k++] < 0 ) continue;
+		if( self->occlusion ){
+			if( DaoxOcclusionBuffer_Visible( self->occlusionBuffer, obbox ) == 0 ) continue;
+		}
+		unit = DaoxRenderer_SelectLOD( self, unit, obbox );
 
-	task->tcount += chunk->triangles->size;
-	DList_Append( & task->chunks, chunk );
+		it = DMap_Find( list->instanceTasks, unit );
+		if( it ){
+			task = (DaoxDrawTask*) it->value.pVoid;
+		}else{
+			task = DaoxRenderer_MakeDrawTask( self, list );
+			task->matrix = *objectToWorld;
+			task->material = unit->material;
+			task->skeleton = NULL;
+			task->vcount = unit->vertices->size;
+			task->tcount = unit->tree->triangles->size;
+			DList_Append( & task->units, unit );
+			DList_Append( list->tasks, task );
+			DMap_Insert( list->instanceTasks, unit, task );
+		}
+		*(DaoxMatrix4D*) DArray_Push( task->instances ) = *objectToWorld;
+	}
+}
+/*
+// Merge the instanced tasks of the units that share the same material into
+// the first of them, since they are all drawn from the retained buffer.
+// The instances of each unit are kept contiguous, and the units are drawn
+// with the same state, by a single multi-draw if indirect drawing is used:
+*/
+static void DaoxRenderer_MergeInstances( DaoxRenderer *self )
+{
+	DList *tasks = self->tasks;
+	DMap *firsts = self->instanceTasks;
+	DNode *it;
+	int i, j, k;
+
+	for(i=0,k=0; i<tasks->size; ++i){
+		DaoxDrawTask *task = tasks->items.pDrawTask[i];
+		DaoxDrawTask *first;
+		tasks->items.pDrawTask[k++] = task;
+		if( task->instances->size <= 1 ) continue;
+
+		it = DMap_Find( firsts, task->material );
+		if( it == NULL ){
+			DMap_Insert( firsts, task->material, task );
+			continue;
+		}
+		first = (DaoxDrawTask*) it->value.pVoid;
+		if( first->instanceCounts->size == 0 ){
+			DArray_PushInt( first->instanceCounts, first->instances->size );
+		}
+		for(j=0; j<task->units.size; ++j) DList_Append( & first->units, task->units.items.pVoid[j] );
+		for(j=0; j<task->instances->size; ++j){
+			DaoxMatrix4D *mat = task->instances->data.matrices4d + j;
+			*(DaoxMatrix4D*) DArray_Push( first->instances ) = *mat;
+		}
+		DArray_PushInt( first->instanceCounts, task->instances->size );
+		DList_Append( self->taskCache, task );
+		k -= 1;
+	}
+	tasks->size = k;
+	DMap_Reset( firsts );
 }
-void DaoxRenderer_PrepareModel( DaoxRenderer *self, DaoxModel *model, DaoxMatrix4D *objectToWorld )
+void DaoxRenderer_FinishInstances( DaoxRenderer *self )
+{
+	DaoxDrawList *list = (DaoxDrawList*) self->drawLists->items.pVoid[0];
+	DNode *it;
+	for(it=DMap_First(self->instanceTasks); it; it=DMap_Next(self->instanceTasks,it)){
+		DaoxMeshUnit *unit = (DaoxMeshUnit*) it->key.pVoid;
+		DaoxDrawTask *task = (DaoxDrawTask*) it->value.pVoid;
+		if( task->instances->size > 1 ) continue;
+		task->matrix = task->instances->data.matrices4d[0];
+		task->instances->size = 0;
+		task->tcount = 0;
+		DaoxRenderer_PrepareMeshChunk( self, list, unit->tree, task );
+		if( task->tcount == 0 ){
+			task->units.size = 0;
+			task->vcount = 0;
+		}
+	}
+	DMap_Reset( self->instanceTasks );
+	DaoxRenderer_MergeInstances( self );
+}
+void DaoxRenderer_PrepareModel( DaoxRenderer *self, DaoxDrawList *list, DaoxModel *model, DaoxMatrix4D *objectToWorld )
 {
 	DaoxMesh *mesh = model->mesh;
 	DaoxDrawTask *task = NULL;
@@ -251,37 +1101,45 @@ void DaoxRenderer_PrepareModel( DaoxRenderer *self, DaoxModel *model, DaoxMatrix
 	daoint i;
 
 	//printf( "DaoxRenderer_PrepareModel:\n" );
-	DMap_Reset( self->map );
+	if( DaoxRenderer_CanInstance( self, model ) ){
+		DaoxRenderer_PrepareInstances( self, list, model, objectToWorld );
+		return;
+	}
+	DMap_Reset( list->map );
 	for(i=0; i<mesh->units->size; ++i){
 		DaoxMeshUnit *unit = mesh->units->items.pMeshUnit[i];
 		int currentCount = 0;
 		if( unit->tree == NULL ) continue;
-		it = DMap_Find( self->map, unit->material );
+		if( unit->lods->size ){
+			DaoxOBBox3D obbox = DaoxOBBox3D_Transform( & unit->obbox, objectToWorld );
+			unit = DaoxRenderer_SelectLOD( self, unit, & obbox );
+		}
+		it = DMap_Find( list->map, unit->material );
 		if( it ){
 			task = (DaoxDrawTask*) it->value.pVoid;
 			task->skeleton = model->skeleton;
 			currentCount = task->tcount;
 		}else{
-			task = DaoxRenderer_MakeDrawTask( self );
+			task = DaoxRenderer_MakeDrawTask( self, list );
 			task->matrix = *objectToWorld;
 			task->material = unit->material;
 			task->skeleton = model->skeleton;
 			task->particleType = 0;
-			DList_Append( model->skeleton ? self->tasks2 : self->tasks, task );
-			DMap_Insert( self->map, task->material, task );
+			DList_Append( model->skeleton ? list->tasks2 : list->tasks, task );
+			DMap_Insert( list->map, task->material, task );
 			if( DaoType_ChildOf( model->base.ctype, daox_type_emitter ) ){
 				task->particleType = 1;
 			}
 		}
-		DaoxRenderer_PrepareMeshChunk( self, unit->tree, task );
+		DaoxRenderer_PrepareMeshChunk( self, list, unit->tree, task );
 		if( task->tcount > currentCount ){
 			DList_Append( & task->units, unit );
 			task->vcount += unit->vertices->size;
 		}
 	}
-	if( model->skeleton ) DaoxSkeleton_UpdateSkinningMatrices( model->skeleton );
+	if( model->skeleton ) DList_Append( list->skeletons, model->skeleton );
 }
-void DaoxRenderer_PrepareTerrain( DaoxRenderer *self, DaoxTerrain *terrain, DaoxMatrix4D *objectToWorld )
+void DaoxRenderer_PrepareTerrain( DaoxRenderer *self, DaoxDrawList *list, DaoxTerrain *terrain, DaoxMatrix4D *objectToWorld )
 {
 	DaoxMesh *mesh = terrain->mesh;
 	DaoxDrawTask *task = NULL;
@@ -296,15 +1154,15 @@ void DaoxRenderer_PrepareTerrain( DaoxRenderer *self, DaoxTerrain *terrain, Daox
 		int currentCount = 0;
 		if( unit->tree == NULL ) continue;
 
-		task = DaoxRenderer_MakeDrawTask( self );
+		task = DaoxRenderer_MakeDrawTask( self, list );
 		task->matrix = *objectToWorld;
 		task->material = unit->material;
-		DList_Append( self->tasks, task );
+		DList_Append( list->tasks, task );
 		task->terrainTileType = terrain->shape + 1;
 		task->hexTile = tile;
 		task->hexTerrain = terrain;
 
-		DaoxRenderer_PrepareMeshChunk( self, unit->tree, task );
+		DaoxRenderer_PrepareMeshChunk( self, list, unit->tree, task );
 
 		if( task->tcount > currentCount ){
 			DList_Append( & task->units, unit );
@@ -313,30 +1171,17 @@ void DaoxRenderer_PrepareTerrain( DaoxRenderer *self, DaoxTerrain *terrain, Daox
 	}
 }
 
-void DaoxRenderer_PrepareCanvas( DaoxRenderer *self, DaoxCanvas *canvas )
+void DaoxRenderer_PrepareCanvas( DaoxRenderer *self, DaoxDrawList *list, DaoxCanvas *canvas )
 {
-	DList_Append( self->canvases, canvas );
+	DList_Append( list->canvases, canvas );
 }
 
-void DaoxRenderer_PrepareNode( DaoxRenderer *self, DaoxSceneNode *node )
+static void DaoxRenderer_PrepareNodes( DaoxRenderer *self, DaoxDrawList *list, DaoxSceneNode **nodes, int count );
+
+static void DaoxRenderer_PrepareVisibleNode( DaoxRenderer *self, DaoxDrawList *list, DaoxSceneNode *node, DaoxMatrix4D objectToWorld )
 {
 	DaoType *ctype = node->ctype;
 	DaoxModel *model = (DaoxModel*) node;
-	DaoxMatrix4D objectToWorld;
-	DaoxOBBox3D obbox;
-	daoint i;
-
-	if( node->renderable == 0 ) goto PrepareChildren;
-
-	objectToWorld = DaoxSceneNode_GetWorldTransform( node );
-	obbox = DaoxOBBox3D_Transform( & node->obbox, & objectToWorld );
-
-	if( ctype == daox_type_model && model->skeleton != NULL ){
-		obbox = DaoxOBBox3D_Scale( & obbox, 8.0 );
-	}
-
-	// Check if the obbox box of the object intersect with the frustum;
-	if( DaoxViewFrustum_Visible( & self->frustum, & obbox ) < 0 ) return;
 
 	if( ctype == daox_type_canvas ){
 		/* The canvas is locally placed on the xy-plane facing z-axis: */
@@ -344,14 +1189,20 @@ void DaoxRenderer_PrepareNode( DaoxRenderer *self, DaoxSceneNode *node )
 		DaoxVector3D canvasNorm = DaoxMatrix4D_MulVector( & objectToWorld, & canvasNorm0, 0.0 );
 		double dot = DaoxVector3D_Dot( & canvasNorm, & self->frustum.cameraPosition );
 		if( dot < 0.0 ) return;
-		DaoxRenderer_PrepareCanvas( self, (DaoxCanvas*) node );
+		DaoxRenderer_PrepareCanvas( self, list, (DaoxCanvas*) node );
 		return;
 	}
 
 	if( DaoType_ChildOf( node->ctype, daox_type_emitter ) ){
 		DaoxEmitter *emitter = (DaoxEmitter*) node;
-		DaoxMatrix4D worldToObj = DaoxMatrix4D_Inverse( & objectToWorld );
+		DaoxMatrix4D worldToObj;
 		DaoxVector3D campos;
+		if( list->serial == 0 ){
+			/* Emitters use the random generator of the scene: */
+			DList_Append( list->emitters, node );
+			return;
+		}
+		worldToObj = DaoxMatrix4D_Inverse( & objectToWorld );
 		campos = DaoxMatrix4D_Transform( & worldToObj, & self->frustum.cameraPosition);
 		emitter->randGenerator = self->scene->randGenerator;
 		DaoxEmitter_UpdateView( emitter, campos );
@@ -359,16 +1210,211 @@ void DaoxRenderer_PrepareNode( DaoxRenderer *self, DaoxSceneNode *node )
 	}
 
 	if( ctype == daox_type_terrain ){
-		DaoxRenderer_PrepareTerrain( self, (DaoxTerrain*) node, & objectToWorld );
+		DaoxRenderer_PrepareTerrain( self, list, (DaoxTerrain*) node, & objectToWorld );
 	}else{
-		DaoxRenderer_PrepareModel( self, model, & objectToWorld );
+		DaoxRenderer_PrepareModel( self, list, model, & objectToWorld );
+	}
+	DaoxRenderer_PrepareNodes( self, list, node->children->items.pSceneNode, node->children->size );
+}
+/*
+// Prepare sibling nodes in blocks, where the bounding boxes of the renderable
+// nodes in a block are checked against the frustum in batch;
+*/
+#define DAOX_NODE_BLOCK  8
+
+static void DaoxRenderer_PrepareNodes( DaoxRenderer *self, DaoxDrawList *list, DaoxSceneNode **nodes, int count )
+{
+	DaoxMatrix4D transforms[DAOX_NODE_BLOCK];
+	DaoxOBBox3D boxes[DAOX_NODE_BLOCK];
+	int checks[DAOX_NODE_BLOCK];
+	int i, j, k, n;
+
+	for(i=0; i<count; i+=DAOX_NODE_BLOCK){
+		n = count - i;
+		if( n > DAOX_NODE_BLOCK ) n = DAOX_NODE_BLOCK;
+		for(j=0, k=0; j<n; ++j){
+			DaoxSceneNode *node = nodes[i+j];
+			DaoxModel *model = (DaoxModel*) node;
+			if( node->renderable == 0 ) continue;
+			transforms[j] = DaoxSceneNode_GetWorldTransform( node );
+			boxes[k] = DaoxOBBox3D_Transform( & node->obbox, transforms + j );
+			if( node->ctype == daox_type_model && model->skeleton != NULL ){
+				boxes[k] = DaoxOBBox3D_Scale( boxes + k, 8.0 );
+			}
+			k += 1;
+		}
+		DaoxViewFrustum_CheckBoxes( & self->frustum, boxes, checks, k );
+		for(j=0, k=0; j<n; ++j){
+			DaoxSceneNode *node = nodes[i+j];
+			if( node->renderable == 0 ){
+				DList *children = node->children;
+				DaoxRenderer_PrepareNodes( self, list, children->items.pSceneNode, children->size );
+			}else if( checks[k++] >= 0 ){
+				DaoxRenderer_PrepareVisibleNode( self, list, node, transforms[j] );
+			}
+		}
+	}
+}
+void DaoxRenderer_PrepareNode( DaoxRenderer *self, DaoxDrawList *list, DaoxSceneNode *node )
+{
+	DaoxRenderer_PrepareNodes( self, list, & node, 1 );
+}
+static void DaoxRenderer_PrepareJob( void *data, int index, int worker )
+{
+	DaoxRenderer *self = (DaoxRenderer*) data;
+	DaoxDrawList *list = (DaoxDrawList*) self->drawLists->items.pVoid[index];
+	DaoxSceneNode **nodes = self->visibleNodes->items.pSceneNode + list->first;
+
+	DaoxRenderer_PrepareNodes( self, list, nodes, list->last - list->first );
+}
+/*
+// Append the draw tasks of the list to the renderer, and merge the instances
+// of the same mesh units into the first instanced task of the units:
+*/
+static void DaoxRenderer_MergeDrawList( DaoxRenderer *self, DaoxDrawList *list, DList *emitters )
+{
+	DNode *it;
+	int i, j;
+
+	for(i=0; i<list->tasks->size; ++i){
+		DaoxDrawTask *task = list->tasks->items.pDrawTask[i];
+		DaoxDrawTask *task2;
+		if( task->instances->size == 0 ){
+			DList_Append( self->tasks, task );
+			continue;
+		}
+		it = DMap_Find( self->instanceTasks, task->units.items.pMeshUnit[0] );
+		if( it == NULL ){
+			DMap_Insert( self->instanceTasks, task->units.items.pMeshUnit[0], task );
+			DList_Append( self->tasks, task );
+			continue;
+		}
+		task2 = (DaoxDrawTask*) it->value.pVoid;
+		for(j=0; j<task->instances->size; ++j){
+			DaoxMatrix4D *mat = task->instances->data.matrices4d + j;
+			*(DaoxMatrix4D*) DArray_Push( task2->instances ) = *mat;
+		}
+		DList_Append( self->taskCache, task );
+	}
+	for(i=0; i<list->tasks2->size; ++i){
+		DaoxDrawTask *task = list->tasks2->items.pDrawTask[i];
+		if( self->cpuSkinning ){
+			/* Skinned on the CPU into the streaming buffer of the static meshes: */
+			task->skinning = task->skeleton;
+			task->skeleton = NULL;
+			DList_Append( self->tasks, task );
+			continue;
+		}
+		DList_Append( self->tasks2, task );
 	}
+	for(i=0; i<list->canvases->size; ++i) DList_Append( self->canvases, list->canvases->items.pVoid[i] );
+	for(i=0; i<list->emitters->size; ++i) DList_Append( emitters, list->emitters->items.pVoid[i] );
+	for(i=0; i<list->skeletons->size; ++i){
+		DaoxSkeleton_UpdateSkinningMatrices( (DaoxSkeleton*) list->skeletons->items.pVoid[i] );
+	}
+	for(i=0; i<list->taskCache->size; ++i) DList_Append( self->taskCache, list->taskCache->items.pVoid[i] );
+	list->tasks->size = 0;
+	list->tasks2->size = 0;
+	list->canvases->size = 0;
+	list->emitters->size = 0;
+	list->skeletons->size = 0;
+	list->taskCache->size = 0;
+	self->profiler->current.culledChunks += list->culledChunks;
+	self->profiler->current.occludedChunks += list->occludedChunks;
+	list->culledChunks = 0;
+	list->occludedChunks = 0;
+	DMap_Reset( list->instanceTasks );
+}
+/*
+// Rasterize the visible terrains and the models flagged as occluders
+// into the occlusion buffer (large meshes such as terrains are rasterized
+// by the worker pool). Skinned models are not used as occluders;
+*/
+static void DaoxRenderer_RenderOccluders( DaoxRenderer *self, DaoxSceneNode *node )
+{
+	DaoxThreadPool *workers = self->parallel ? self->workers : NULL;
+	DaoxModel *model = (DaoxModel*) node;
+	DaoxMesh *mesh = NULL;
+	daoint i;
 
-PrepareChildren:
+	if( node->ctype == daox_type_terrain ){
+		mesh = ((DaoxTerrain*) node)->mesh;
+	}else if( node->ctype == daox_type_model && model->occluder && model->skeleton == NULL ){
+		mesh = model->mesh;
+	}
+	if( mesh != NULL ){
+		DaoxMatrix4D objectToWorld = DaoxSceneNode_GetWorldTransform( node );
+		DaoxOBBox3D obbox = DaoxOBBox3D_Transform( & node->obbox, & objectToWorld );
+		if( DaoxViewFrustum_Visible( & self->frustum, & obbox ) >= 0 ){
+			for(i=0; i<mesh->units->size; ++i){
+				DaoxMeshUnit *unit = mesh->units->items.pMeshUnit[i];
+				obbox = DaoxOBBox3D_Transform( & unit->obbox, & objectToWorld );
+				if( DaoxViewFrustum_Visible( & self->frustum, & obbox ) < 0 ) continue;
+				DaoxOcclusionBuffer_RenderMesh( self->occlusionBuffer, unit, & objectToWorld, workers );
+			}
+		}
+	}
 	for(i=0; i<node->children->size; ++i){
-		DaoxSceneNode *node2 = node->children->items.pSceneNode[i];
-		DaoxRenderer_PrepareNode( self, node2 );
+		DaoxRenderer_RenderOccluders( self, node->children->items.pSceneNode[i] );
+	}
+}
+/*
+// Prepare the draw tasks for the top level nodes of the scene that pass
+// the culling by the scene BVH. With enough nodes, they are partitioned
+// into a number of contiguous ranges, which are prepared by the worker pool
+// in parallel;
+*/
+void DaoxRenderer_PrepareScene( DaoxRenderer *self, DaoxScene *scene )
+{
+	DaoxDrawList *list;
+	DList *emitters = DList_New(0);
+	int i, j, k, nodeCount, count = 1;
+
+	if( scene->bvh == NULL ) scene->bvh = DaoxSceneBVH_New();
+	DaoxSceneBVH_Update( scene->bvh, scene );
+	self->visibleNodes->size = 0;
+	DaoxSceneBVH_Cull( scene->bvh, & self->frustum, self->visibleNodes );
+	nodeCount = self->visibleNodes->size;
+
+	if( self->occlusion ){
+		DaoxMatrix4D objectToWorld = DaoxSceneNode_GetWorldTransform( & self->camera->base );
+		DaoxMatrix4D worldToView = DaoxMatrix4D_Inverse( & objectToWorld );
+		DaoxOcclusionBuffer_Reset( self->occlusionBuffer, & self->frustum, & worldToView );
+		for(i=0; i<nodeCount; ++i){
+			DaoxRenderer_RenderOccluders( self, self->visibleNodes->items.pSceneNode[i] );
+		}
 	}
+
+	if( self->parallel && self->workers->workerCount > 1 && nodeCount >= 64 ){
+		count = 4 * self->workers->workerCount;
+		if( count > nodeCount / 16 ) count = nodeCount / 16;
+	}
+	while( self->drawLists->size < count ) DList_Append( self->drawLists, DaoxDrawList_New() );
+
+	k = self->taskCache->size / count;
+	for(i=0; i<count; ++i){
+		list = (DaoxDrawList*) self->drawLists->items.pVoid[i];
+		list->serial = count == 1;
+		list->first = i * nodeCount / count;
+		list->last = (i + 1) * nodeCount / count;
+		for(j=0; j<k; ++j) DList_Append( list->taskCache, DList_PopBack( self->taskCache ) );
+	}
+
+	DaoxThreadPool_Run( self->workers, DaoxRenderer_PrepareJob, self, count );
+
+	for(i=0; i<count; ++i){
+		list = (DaoxDrawList*) self->drawLists->items.pVoid[i];
+		DaoxRenderer_MergeDrawList( self, list, emitters );
+	}
+
+	list = (DaoxDrawList*) self->drawLists->items.pVoid[0];
+	list->serial = 1;
+	for(i=0; i<emitters->size; ++i){
+		DaoxRenderer_PrepareNode( self, list, emitters->items.pSceneNode[i] );
+	}
+	if( self->showAxis ) DaoxRenderer_PrepareNode( self, list, (DaoxSceneNode*) self->worldAxis );
+	DaoxRenderer_MergeDrawList( self, list, emitters );
+	DList_Delete( emitters );
 }
 void MakeProjectionMatrix( DaoxViewFrustum *frustum, DaoxCamera *cam, GLfloat matrix[16] )
 {
@@ -414,27 +1460,171 @@ void DaoxScene_EstimateBoundingBox( DaoxScene *self, DaoxOBBox3D *obbox )
 		DArray_PushVector3D( points, & obbox.Z );
 		DArray_PushVector3D( points, & P );
 	}
-	DaoxOBBox3D_ComputeBoundingBox( obbox, points->data.vectors3d, points->size );
-	DArray_Delete( points );
+	DaoxOBBox3D_ComputeBoundingBox( obbox, points->data.vectors3d, points->size );
+	DArray_Delete( points );
+}
+/*
+// Streaming buffer update:
+// The offsets of the draw tasks in the mapped buffers are computed first,
+// then the tasks are exported in independent ranges by the worker pool;
+*/
+typedef struct DaoxBufferingJob DaoxBufferingJob;
+struct DaoxBufferingJob
+{
+	DList              *drawtasks;
+	DaoxBuffer         *buffer;
+	void               *glvertices;  /* in the layout of the buffer; */
+	DaoGLTriangle      *gltriangles;
+	DArray             *pieces;  /* <DaoxSkinningPiece>; */
+};
+static void DaoxDrawTask_ExportData( DaoxDrawTask *self, DaoxBufferingJob *job )
+{
+	DList *chunks = & self->chunks;
+	DList *units = & self->units;
+	DaoGLTriangle *gltriangles = job->gltriangles + (self->offset - job->buffer->triangleOffset);
+	int vertexCount = self->voffset;
+	int vertexOffset = job->buffer->vertexOffset + self->voffset;
+	int i, j, k;
+
+	for(j=0; j<units->size; ++j){
+		DaoxMeshUnit *unit = units->items.pMeshUnit[j];
+		if( self->skinning != NULL ){
+			/* Exported by DaoxRenderer_SkinningJob(); */
+		}else{
+			char *glvertices = (char*) job->glvertices + vertexCount * job->buffer->vertexSize;
+			DaoxMeshUnit_ExportVertices( unit, job->buffer, glvertices );
+		}
+		vertexCount += unit->vertices->size;
+	}
+	/* The chunks are ordered by their units in the same order as the units: */
+	for(i=0, j=0; i<chunks->size; ++i){
+		DaoxMeshChunk *chunk = chunks->items.pMeshChunk[i];
+		DaoxMeshUnit *unit = chunk->unit;
+		int *triangles = chunk->triangles->data.ints;
+		while( j < units->size && units->items.pMeshUnit[j] != unit ){
+			vertexOffset += units->items.pMeshUnit[j]->vertices->size;
+			j += 1;
+		}
+		if( j >= units->size ){
+			j = 0;
+			vertexOffset = job->buffer->vertexOffset + self->voffset;
+			while( units->items.pMeshUnit[j] != unit ){
+				vertexOffset += units->items.pMeshUnit[j]->vertices->size;
+				j += 1;
+			}
+		}
+		for(k=0; k<chunk->triangles->size; ++k){
+			DaoxTriangle *triangle = & unit->triangles->data.triangles[triangles[k]];
+			DaoGLTriangle *gltriangle = gltriangles + k;
+			gltriangle->index[0] = triangle->index[0] + vertexOffset;
+			gltriangle->index[1] = triangle->index[1] + vertexOffset;
+			gltriangle->index[2] = triangle->index[2] + vertexOffset;
+		}
+		gltriangles += chunk->triangles->size;
+	}
+}
+static void DaoxRenderer_BufferingJob( void *data, int first, int last )
+{
+	DaoxBufferingJob *job = (DaoxBufferingJob*) data;
+	int i;
+	for(i=first; i<last; ++i){
+		DaoxDrawTask *drawtask = job->drawtasks->items.pDrawTask[i];
+		if( drawtask->chunks.size == 0 || drawtask->buffer != job->buffer ) continue;
+		DaoxDrawTask_ExportData( drawtask, job );
+	}
+}
+static void DaoxRenderer_SkinningJob( void *data, int first, int last )
+{
+	DaoxBufferingJob *job = (DaoxBufferingJob*) data;
+	DaoxSkinningPiece *pieces = (DaoxSkinningPiece*) job->pieces->data.base;
+	DaoxVertex vertices[64];
+	int i, j, k;
+
+	for(i=first; i<last; ++i){
+		DaoxSkinningPiece *piece = pieces + i;
+		DaoxSkeleton *skeleton = piece->task->skinning;
+		DaoxMatrix4D *objectToWorld = & piece->task->matrix;
+		if( job->buffer->packed ){
+			DaoGLPackedVertex3D *packed = (DaoGLPackedVertex3D*) piece->glvertices;
+			for(j=piece->first; j<piece->last; j+=64){
+				int count = piece->last - j < 64 ? piece->last - j : 64;
+				DaoxSkeleton_SkinVertices( skeleton, piece->unit, objectToWorld, j, j + count, vertices );
+				for(k=0; k<count; ++k) DaoxVertex_Pack( vertices + k, packed + (j - piece->first) + k );
+			}
+			continue;
+		}
+		if( sizeof(DaoxVertex) == sizeof(DaoGLVertex3D) ){
+			DaoxVertex *output = (DaoxVertex*) piece->glvertices;
+			DaoxSkeleton_SkinVertices( skeleton, piece->unit, objectToWorld, piece->first, piece->last, output );
+			continue;
+		}
+		for(j=piece->first; j<piece->last; j+=64){
+			int count = piece->last - j < 64 ? piece->last - j : 64;
+			DaoxSkeleton_SkinVertices( skeleton, piece->unit, objectToWorld, j, j + count, vertices );
+			for(k=0; k<count; ++k){
+				DaoGLVertex3D *glvertex = (DaoGLVertex3D*) piece->glvertices + (j - piece->first) + k;
+				glvertex->pos.x = vertices[k].pos.x;
+				glvertex->pos.y = vertices[k].pos.y;
+				glvertex->pos.z = vertices[k].pos.z;
+				glvertex->norm.x = vertices[k].norm.x;
+				glvertex->norm.y = vertices[k].norm.y;
+				glvertex->norm.z = vertices[k].norm.z;
+				glvertex->tan.x = vertices[k].tan.x;
+				glvertex->tan.y = vertices[k].tan.y;
+				glvertex->tan.z = vertices[k].tan.z;
+				glvertex->tex.x = vertices[k].tex.x;
+				glvertex->tex.y = vertices[k].tex.y;
+			}
+		}
+	}
+}
+/*
+// Split the units of the CPU skinned tasks into pieces of vertices,
+// so that a single large skinned mesh can also be skinned in parallel:
+*/
+static void DaoxRenderer_PrepareSkinning( DaoxRenderer *self, DaoxBufferingJob *job )
+{
+	int i, j, k;
+
+	job->pieces->size = 0;
+	for(i=0; i<job->drawtasks->size; ++i){
+		DaoxDrawTask *task = job->drawtasks->items.pDrawTask[i];
+		char *glvertices = (char*) job->glvertices + task->voffset * job->buffer->vertexSize;
+		if( task->skinning == NULL || task->chunks.size == 0 || task->buffer != job->buffer ) continue;
+		for(j=0; j<task->units.size; ++j){
+			DaoxMeshUnit *unit = task->units.items.pMeshUnit[j];
+			for(k=0; k<unit->vertices->size; k+=DAOX_SKINNING_PIECE){
+				DaoxSkinningPiece *piece = (DaoxSkinningPiece*) DArray_Push( job->pieces );
+				piece->task = task;
+				piece->unit = unit;
+				piece->first = k;
+				piece->last = k + DAOX_SKINNING_PIECE;
+				if( piece->last > unit->vertices->size ) piece->last = unit->vertices->size;
+				piece->glvertices = glvertices + k * job->buffer->vertexSize;
+			}
+			glvertices += unit->vertices->size * job->buffer->vertexSize;
+		}
+	}
 }
 void DaoxRenderer_UpdateBuffer( DaoxRenderer *self, DList *drawtasks, DaoxBuffer *buffer )
 {
-	int i, j, k, vertexCount = 0, triangleCount = 0;
-	DaoGLVertex3D *glvertices = NULL;
-	DaoGLSkinVertex3D *glskvertices = NULL;
-	DaoGLTriangle *gltriangles;
+	int i, vertexCount = 0, triangleCount = 0;
+	DaoxBufferingJob job;
 
 	for(i=0; i<drawtasks->size; ++i){
 		DaoxDrawTask *drawtask = drawtasks->items.pDrawTask[i];
+		if( drawtask->buffer != NULL ) continue; /* Retained; */
 		vertexCount += drawtask->vcount;
 		triangleCount += drawtask->tcount;
 	}
-	glvertices = DaoxBuffer_MapVertices3D( buffer, vertexCount );
-	gltriangles = DaoxBuffer_MapTriangles( buffer, triangleCount );
-	if( buffer == self->bufferSK ){
-		glskvertices = (DaoGLSkinVertex3D*) glvertices;
-		glvertices = NULL;
-	}
+	if( vertexCount == 0 || triangleCount == 0 ) return;
+
+	memset( & job, 0, sizeof(DaoxBufferingJob) );
+	job.drawtasks = drawtasks;
+	job.buffer = buffer;
+	job.pieces = self->skinningPieces;
+	job.glvertices = DaoxBuffer_MapVertices( buffer, vertexCount );
+	job.gltriangles = DaoxBuffer_MapTriangles( buffer, triangleCount );
 
 #ifdef DEBUG
 	//printf( "DaoxRenderer_UpdateBuffer: %i %i, %p %p\n", vertexCount, triangleCount, glvertices, gltriangles );
@@ -442,133 +1632,422 @@ void DaoxRenderer_UpdateBuffer( DaoxRenderer *self, DList *drawtasks, DaoxBuffer
 
 	vertexCount = 0;
 	triangleCount = 0;
+	for(i=0; i<drawtasks->size; ++i){
+		DaoxDrawTask *drawtask = drawtasks->items.pDrawTask[i];
+		if( drawtask->chunks.size == 0 || drawtask->buffer != NULL ) continue;
+		drawtask->shape = GL_TRIANGLES;
+		drawtask->voffset = vertexCount;
+		drawtask->offset = buffer->triangleOffset + triangleCount;
+		drawtask->buffer = buffer;
+		vertexCount += drawtask->vcount;
+		triangleCount += drawtask->tcount;
+	}
+	DaoxThreadPool_RunRanges( self->workers, DaoxRenderer_BufferingJob, & job, drawtasks->size, 16 );
+	if( self->cpuSkinning && buffer != self->bufferSK ){
+		DaoxRenderer_PrepareSkinning( self, & job );
+		DaoxThreadPool_RunRanges( self->workers, DaoxRenderer_SkinningJob, & job, job.pieces->size, 1 );
+	}
+
+	//printf( "DaoxRenderer_UpdateBuffer: %i %i\n", vertexCount, triangleCount );
+	//printf( "buffering: %15p %15p\n", glvertices, gltriangles );
+	buffer->vertexOffset += vertexCount;
+	buffer->triangleOffset += triangleCount;
+	self->profiler->current.uploadedBytes += vertexCount * buffer->vertexSize + triangleCount * buffer->triangleSize;
+	DaoxBuffer_Unmap( buffer );
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+/*
+// Upload the dirty units of the retained draw tasks, and compute the triangle ranges
+// of the visible chunks in the retained buffer. Adjacent ranges are merged, so that
+// a fully visible unit is drawn with a single call.
+*/
+void DaoxRenderer_UpdateRegions( DaoxRenderer *self, DList *drawtasks, DaoxMeshStorage *storage )
+{
+	DaoxMeshRegion *region = NULL;
+	int i, j;
+
+	if( self->frameIndex % 64 == 0 ) DaoxMeshStorage_Sweep( storage, self->frameIndex, 256 );
+
+	storage->uploadedBytes = 0;
 	for(i=0; i<drawtasks->size; ++i){
 		DaoxDrawTask *drawtask = drawtasks->items.pDrawTask[i];
 		DList *chunks = & drawtask->chunks;
 		DList *units = & drawtask->units;
-		int triangleOffset = triangleCount;
+		DArray *ranges = drawtask->ranges;
+
+		if( drawtask->particleType || drawtask->skinning ) continue;
+		if( chunks->size == 0 && drawtask->instances->size == 0 ) continue;
 
-		if( chunks->size == 0 ) continue;
 		DMap_Reset( self->map );
 		for(j=0; j<units->size; ++j){
 			DaoxMeshUnit *unit = units->items.pMeshUnit[j];
-			int s, vertexOffset = buffer->vertexOffset + vertexCount;
-			DMap_Insert( self->map, unit, (void*)(size_t) vertexOffset );
-			for(k=0; k<unit->vertices->size; ++k){
-				DaoxVertex *vertex = unit->vertices->data.vertices + k;
-				DaoGLSkinVertex3D *skvertex = glskvertices + vertexCount + k;
-				DaoGLVertex3D *glvertex = glvertices + vertexCount + k;
-				if( glvertices == NULL ){
-					DaoxSkinParam *param = unit->skinParams->data.skinparams + k;
-					glvertex = (DaoGLVertex3D*) skvertex;
-					for(s=0; s<4; ++s){
-						skvertex->joints.j[s] = param->joints[s];
-						skvertex->weights.w[s] = param->weights[s];
-					}
-				}
-				glvertex->pos.x = vertex->pos.x;
-				glvertex->pos.y = vertex->pos.y;
-				glvertex->pos.z = vertex->pos.z;
-				glvertex->norm.x = vertex->norm.x;
-				glvertex->norm.y = vertex->norm.y;
-				glvertex->norm.z = vertex->norm.z;
-				glvertex->tan.x = vertex->tan.x;
-				glvertex->tan.y = vertex->tan.y;
-				glvertex->tan.z = vertex->tan.z;
-				glvertex->tex.x = vertex->tex.x;
-				glvertex->tex.y = vertex->tex.y;
+			region = DaoxMeshStorage_Update( storage, unit, self->frameIndex );
+			DMap_Insert( self->map, unit, region );
+		}
+		ranges->size = 0;
+		if( drawtask->instances->size ){
+			/* Instances are culled as whole units, one range per (merged) unit: */
+			for(j=0; j<units->size; ++j){
+				region = (DaoxMeshRegion*) DMap_Find( self->map, units->items.pVoid[j] )->value.pVoid;
+				DArray_PushInt( ranges, region->triangleOffset );
+				DArray_PushInt( ranges, region->triangleCount );
+				DArray_PushInt( ranges, region->vertexOffset );
+				DArray_PushInt( ranges, region->vertexOffset + region->vertexCount - 1 );
 			}
-			vertexCount += unit->vertices->size;
+			drawtask->shape = GL_TRIANGLES;
+			drawtask->buffer = storage->buffer;
+			continue;
 		}
+		region = NULL;
 		for(j=0; j<chunks->size; ++j){
 			DaoxMeshChunk *chunk = chunks->items.pMeshChunk[j];
-			DaoxMeshUnit *unit = chunk->unit;
-			DNode *it = DMap_Find( self->map, unit );
-			int vertexOffset = it->value.pInt;
-			for(k=0; k<chunk->triangles->size; ++k){
-				int m = chunk->triangles->data.ints[k];
-				DaoxTriangle *triangle = & unit->triangles->data.triangles[m];
-				DaoGLTriangle *gltriangle = gltriangles + triangleCount + k;
-				gltriangle->index[0] = triangle->index[0] + vertexOffset;
-				gltriangle->index[1] = triangle->index[1] + vertexOffset;
-				gltriangle->index[2] = triangle->index[2] + vertexOffset;
+			int *last = ranges->size ? ranges->data.ints + ranges->size - 4 : NULL;
+			int first, slots, count = chunk->triangles->size;
+			int vfirst, vlast;
+
+			if( region == NULL || region->unit != chunk->unit ){
+				region = (DaoxMeshRegion*) DMap_Find( self->map, chunk->unit )->value.pVoid;
+			}
+			slots = DaoxMeshStorage_TriangleSlots( storage, region->vertexCount );
+			first = region->triangleOffset + slots * chunk->offset;
+			vfirst = region->vertexOffset;
+			vlast = region->vertexOffset + region->vertexCount - 1;
+			/* Relative indices can only be drawn unit by unit: */
+			if( storage->buffer->shortIndices && last != NULL && last[2] != vfirst ) last = NULL;
+			if( last != NULL && last[0] + slots * last[1] == first ){
+				last[1] += count;
+				if( last[2] > vfirst ) last[2] = vfirst;
+				if( last[3] < vlast ) last[3] = vlast;
+				continue;
 			}
-			triangleCount += chunk->triangles->size;
+			DArray_PushInt( ranges, first );
+			DArray_PushInt( ranges, count );
+			DArray_PushInt( ranges, vfirst );
+			DArray_PushInt( ranges, vlast );
 		}
 		drawtask->shape = GL_TRIANGLES;
-		drawtask->offset = buffer->triangleOffset + triangleOffset;
+		drawtask->buffer = storage->buffer;
 	}
+	self->profiler->current.uploadedBytes += storage->uploadedBytes;
+}
+/*
+// Upload the instance matrices of all the instanced tasks in one mapping.
+// The batched tasks without instances are drawn as single instances:
+*/
+static int DaoxDrawTask_InstanceCount( DaoxDrawTask *self )
+{
+	if( self->instances->size ) return self->instances->size;
+	return self->batched;
+}
+void DaoxRenderer_UpdateInstances( DaoxRenderer *self, DList *drawtasks, DaoxBuffer *buffer )
+{
+	GLfloat *glmatrices;
+	int i, count = 0;
 
-	//printf( "DaoxRenderer_UpdateBuffer: %i %i\n", vertexCount, triangleCount );
-	//printf( "buffering: %15p %15p\n", glvertices, gltriangles );
-	buffer->vertexOffset += vertexCount;
-	buffer->triangleOffset += triangleCount;
-	glUnmapBuffer(GL_ARRAY_BUFFER);
-	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	for(i=0; i<drawtasks->size; ++i){
+		DaoxDrawTask *drawtask = drawtasks->items.pDrawTask[i];
+		if( drawtask->buffer == buffer ) count += DaoxDrawTask_InstanceCount( drawtask );
+	}
+	if( count == 0 ) return;
+
+	glmatrices = DaoxBuffer_MapInstances( buffer, count );
+	count = 0;
+	for(i=0; i<drawtasks->size; ++i){
+		DaoxDrawTask *drawtask = drawtasks->items.pDrawTask[i];
+		DArray *instances = drawtask->instances;
+		if( drawtask->buffer != buffer || DaoxDrawTask_InstanceCount( drawtask ) == 0 ) continue;
+		drawtask->instanceOffset = count;
+		if( instances->size == 0 ){
+			memcpy( glmatrices + 12*count, & drawtask->matrix, sizeof(DaoxMatrix4D) );
+			count += 1;
+			continue;
+		}
+		memcpy( glmatrices + 12*count, instances->data.matrices4d, instances->size*sizeof(DaoxMatrix4D) );
+		count += instances->size;
+	}
+	self->profiler->current.uploadedBytes += count * sizeof(DaoxMatrix4D);
+	glUnmapBuffer( GL_ARRAY_BUFFER );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+/*
+// Multi-draw indirect batching:
+// The consecutive retained tasks (after sorting) that share the same material,
+// textures and uniforms are drawn by a single glMultiDrawElementsIndirect().
+// The object to world matrices are taken from the instance buffer by the base
+// instances of the commands, so they do not need the object blocks.
+*/
+static int DaoxDrawTask_IsBatchable( DaoxDrawTask *self, DaoxBuffer *buffer )
+{
+	int i, *ranges = self->ranges->data.ints;
+
+	if( self->buffer != buffer || self->ranges->size == 0 ) return 0;
+	if( self->skeleton != NULL || self->particleType != 0 ) return 0;
+	if( buffer->shortIndices == 0 ) return 1;
+	/* A multi-draw has a single index type: */
+	for(i=0; i<self->ranges->size; i+=4){
+		if( ranges[i+3] - ranges[i+2] >= 0x10000 ) return 0;
+	}
+	return 1;
+}
+static DaoxTexture* DaoxDrawTask_GetTileTexture( DaoxDrawTask *self, int side )
+{
+	DaoxTerrainBlock *neighbor = self->hexTile->neighbors[side];
+	DaoxMaterial *material = self->hexTile->mesh->material;
+	DaoxMaterial *material2 = neighbor ? neighbor->mesh->material : material;
+	if( material2 == NULL ) material2 = material;
+	return material2 ? material2->diffuseTexture : NULL;
+}
+static int DaoxDrawTask_HasSameState( DaoxDrawTask *self, DaoxDrawTask *other )
+{
+	int i;
+
+	if( self->material != other->material || self->shape != other->shape ) return 0;
+	if( self->blending != other->blending ) return 0;
+	if( self->terrainTileType != other->terrainTileType ) return 0;
+	if( self->hexTile == NULL && other->hexTile == NULL ) return 1;
+	if( self->hexTile == NULL || other->hexTile == NULL ) return 0;
+	if( self->hexTerrain != other->hexTerrain ) return 0;
+	if( self->hexTile->sides != other->hexTile->sides ) return 0;
+	for(i=0; i<self->hexTile->sides; ++i){
+		DaoxTexture *texture1 = DaoxDrawTask_GetTileTexture( self, i );
+		DaoxTexture *texture2 = DaoxDrawTask_GetTileTexture( other, i );
+		if( texture1 != texture2 ) return 0;
+	}
+	return 1;
 }
-int DaoxRenderer_SetupTexture( DaoxRenderer *self, DaoxTexture *texture, int id, int uniform )
+static void DaoxRenderer_BatchTasks( DaoxRenderer *self, DList *drawtasks, DaoxBuffer *buffer )
 {
+	DaoxDrawTask *first = NULL;
+	int i;
+
+	if( self->indirect == 0 || buffer->indirectCapacity == 0 ) return;
+	for(i=0; i<drawtasks->size; ++i){
+		DaoxDrawTask *drawtask = drawtasks->items.pDrawTask[i];
+		if( DaoxDrawTask_IsBatchable( drawtask, buffer ) == 0 ){
+			first = NULL;
+			continue;
+		}
+		if( first == NULL || DaoxDrawTask_HasSameState( first, drawtask ) == 0 ){
+			first = drawtask;
+			continue;
+		}
+		if( first->batched == 0 ) first->commandCount = first->ranges->size / 4;
+		first->commandCount += drawtask->ranges->size / 4;
+		first->batched = 1;
+		drawtask->batched = 1;
+	}
+}
+static void DaoxRenderer_UpdateCommands( DaoxRenderer *self, DList *drawtasks, DaoxBuffer *buffer )
+{
+	DaoxDrawTask *first = NULL;
+	DaoGLDrawCommand *commands;
+	int i, j, count = 0;
+
+	for(i=0; i<drawtasks->size; ++i){
+		DaoxDrawTask *drawtask = drawtasks->items.pDrawTask[i];
+		count += drawtask->commandCount;
+	}
+	if( count == 0 ) return;
+
+	commands = DaoxBuffer_MapCommands( buffer, count );
+	if( commands == NULL ) return;
+	count = 0;
+	for(i=0; i<drawtasks->size; ++i){
+		DaoxDrawTask *drawtask = drawtasks->items.pDrawTask[i];
+		int *ranges = drawtask->ranges->data.ints;
+		int *counts = drawtask->instanceCounts->data.ints;
+		int instanceCount = DaoxDrawTask_InstanceCount( drawtask );
+		int instanceOffset = drawtask->instanceOffset;
+		if( drawtask->batched == 0 ) continue;
+		if( drawtask->commandCount ){
+			first = drawtask;
+			first->commandOffset = count;
+		}
+		for(j=0; j<drawtask->ranges->size; j+=4){
+			DaoGLDrawCommand *command = commands + count;
+			if( drawtask->instanceCounts->size ) instanceCount = counts[j/4];
+			command->count = 3 * ranges[j+1];
+			command->instanceCount = instanceCount;
+			command->firstIndex = 3 * ranges[j];
+			command->baseVertex = buffer->shortIndices ? ranges[j+2] : 0;
+			command->baseInstance = instanceOffset;
+			first->batchTriangles += ranges[j+1] * instanceCount;
+			if( drawtask->instanceCounts->size ) instanceOffset += instanceCount;
+			count += 1;
+		}
+	}
+	self->profiler->current.uploadedBytes += count * sizeof(DaoGLDrawCommand);
+	glUnmapBuffer( GL_DRAW_INDIRECT_BUFFER );
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+}
+void DaoxRenderer_BindTexture( DaoxRenderer *self, int id, uint_t tid )
+{
+	if( self->state.valid && self->state.textures[id] == tid ) return;
+	self->state.textures[id] = tid;
+	glActiveTexture( GL_TEXTURE0 + id );
+	glBindTexture( GL_TEXTURE_2D, tid );
+}
+/*
+// Get the GL texture of the texture: with streaming, the texture is queued
+// for uploading, and it is drawn without the texture until a level is ready;
+*/
+static uint_t DaoxRenderer_PrepareTexture( DaoxRenderer *self, DaoxTexture *texture )
+{
+	if( self->streamTextures ) return DaoxTextureStreamer_Request( self->context->streamer, texture );
 	if( texture->changed || texture->tid == 0 ){
 		DaoxContext_BindTexture( self->context, texture );
+		/* The binding of the active texture unit is no longer known: */
+		memset( self->state.textures, 0, sizeof(self->state.textures) );
 	}
-	if( texture->tid ){
-		glActiveTexture( GL_TEXTURE0 + id );
-		glBindTexture( GL_TEXTURE_2D, texture->tid );
-		glUniform1i( uniform, id );
+	texture->lastUse = self->context->streamer->frameIndex;
+	return texture->tid;
+}
+int DaoxRenderer_SetupTexture( DaoxRenderer *self, DaoxTexture *texture, int id )
+{
+	if( id == DAOX_BUMP_TEXTURE ) texture->normalMap = 1;
+	if( DaoxRenderer_PrepareTexture( self, texture ) ){
+		DaoxRenderer_BindTexture( self, id, texture->tid );
 		return 1;
 	}
 	return 0;
 }
+static void DaoxRenderer_SetUniform1i( DaoxRenderer *self, int *shadow, int uniform, int value )
+{
+	if( self->state.valid && *shadow == value ) return;
+	*shadow = value;
+	glUniform1i( uniform, value );
+}
+/*
+// Draw a range (first triangle slot, triangle count, first and last vertex)
+// of the retained buffer. With 16-bit indices, each range covers a single unit,
+// and its indices are relative to the first vertex of the unit.
+*/
+static void DaoxRenderer_DrawRange( DaoxRenderer *self, DaoxDrawTask *drawtask, int *range, int instanceCount )
+{
+	DaoxBuffer *buffer = drawtask->buffer;
+	daoint offset = 3 * range[0] * sizeof(GLint);
+	int count = 3 * range[1];
+
+	if( buffer->shortIndices ){
+#ifndef DAO_GRAPHICS_USE_GLES
+		int type = range[3] - range[2] < 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		offset = range[0] * buffer->triangleSize;
+		if( instanceCount ){
+			glDrawElementsInstancedBaseVertex( drawtask->shape, count, type, (void*)offset, instanceCount, range[2] );
+		}else{
+			glDrawRangeElementsBaseVertex( drawtask->shape, 0, range[3] - range[2], count, type, (void*)offset, range[2] );
+		}
+#endif
+	}else if( instanceCount ){
+		glDrawElementsInstanced( drawtask->shape, count, GL_UNSIGNED_INT, (void*)offset, instanceCount );
+	}else{
+		glDrawRangeElements( drawtask->shape, range[2], range[3], count, GL_UNSIGNED_INT, (void*)offset );
+	}
+}
+/*
+// Set the fixed texture units of the samplers and the default uniforms
+// of the 3D shader or its variants:
+*/
+static void DaoxRenderer_InitProgram( DaoxRenderer *self, DaoxShader *shader )
+{
+	int i;
+
+	glUniform1i( shader->uniforms.vectorGraphics, 0 );
+	glUniform1i( shader->uniforms.instancing, 0 );
+	glUniform1i( shader->uniforms.hasDiffuseTexture, 0 );
+	glUniform1i( shader->uniforms.hasBumpTexture, 0 );
+	glUniform1i( shader->uniforms.dashCount, 0 );
+	glUniform1i( shader->uniforms.gradientType, 0 );
+	glUniform1i( shader->uniforms.gradientStops, 0 );
+	glUniform1f( shader->uniforms.gradientRadius, 0 );
+	glUniform1i( shader->uniforms.terrainTileType, 0 );
+	glUniform1i( shader->uniforms.tileTextureCount, 0 );
+
+	glUniform1i( shader->uniforms.gradientSampler, DAOX_GRADIENT_SAMPLER );
+	glUniform1i( shader->uniforms.dashSampler, DAOX_DASH_SAMPLER );
+	glUniform1i( shader->uniforms.diffuseTexture, DAOX_DIFFUSE_TEXTURE );
+	glUniform1i( shader->uniforms.emissionTexture, DAOX_EMISSION_TEXTURE );
+	glUniform1i( shader->uniforms.bumpTexture, DAOX_BUMP_TEXTURE );
+	glUniform1i( shader->uniforms.depthTexture, DAOX_DEPTH_TEXTURE );
+	for(i=0; i<6; ++i){
+		glUniform1i( shader->uniforms.tileTextures[i], DAOX_TILE_TEXTURE1 + i );
+	}
+	glUniform1i( shader->uniforms.boneTexture, DAOX_BONE_TEXTURE );
+	glUniform1i( shader->uniforms.lightTexture, DAOX_LIGHT_TEXTURE );
+	glUniform1i( shader->uniforms.clusterTexture, DAOX_CLUSTER_TEXTURE );
+	glUniform1i( shader->uniforms.lightIndexTexture, DAOX_LIGHT_INDEX_TEXTURE );
+}
+/*
+// Switch the program; for the 3D shader and its variants, the uniforms of
+// the current pass are set, and the shadowed uniforms are invalidated:
+*/
+static void DaoxRenderer_UseShader( DaoxRenderer *self, DaoxShader *shader )
+{
+	if( self->current == shader ) return;
+	self->current = shader;
+	glUseProgram( shader->program );
+	if( shader->mode != DAOX_GRAPHICS_3D ) return;
+	glUniform1i( shader->uniforms.hasDepthTexture, self->hasDepthTexture );
+	glUniform1i( shader->uniforms.depthOnly, self->depthOnly );
+	self->state.valid = 0;
+}
+static void DaoxRenderer_SetPassUniforms( DaoxRenderer *self, int hasDepthTexture, int depthOnly )
+{
+	self->hasDepthTexture = hasDepthTexture;
+	self->depthOnly = depthOnly;
+	glUniform1i( self->current->uniforms.hasDepthTexture, hasDepthTexture );
+	glUniform1i( self->current->uniforms.depthOnly, depthOnly );
+}
+static uint_t DaoxRenderer_VariantKey( int skinning, int terrainTileType, int particleType, int hasTextures[3] )
+{
+	uint_t variant = (terrainTileType << DAOX_VARIANT_TILE_SHIFT) | (particleType << DAOX_VARIANT_PARTICLE_SHIFT);
+	if( skinning ) variant |= DAOX_VARIANT_SKINNING;
+	if( hasTextures[0] ) variant |= DAOX_VARIANT_DIFFUSE;
+	if( hasTextures[1] ) variant |= DAOX_VARIANT_EMISSION;
+	if( hasTextures[2] ) variant |= DAOX_VARIANT_BUMP;
+	if( hasTextures[2] > 1 ) variant |= DAOX_VARIANT_BUMP_RG;
+	return variant;
+}
+/*
+// Get the shader variant, or the 3D shader if the variant cannot be built:
+*/
+static DaoxShader* DaoxRenderer_GetVariant( DaoxRenderer *self, uint_t variant )
+{
+	DList *variants = self->shader->variants;
+	daoint count = variants ? variants->size : 0;
+	DaoxShader *shader = DaoxShader_GetVariant( self->shader, variant );
+
+	if( shader == NULL ) return self->shader;
+	if( self->shader->variants->size > count ){ /* Newly built: */
+		glUseProgram( shader->program );
+		DaoxRenderer_InitProgram( self, shader );
+		if( self->current ) glUseProgram( self->current->program );
+	}
+	return shader;
+}
 void DaoxRenderer_DrawTask( DaoxRenderer *self, DaoxDrawTask *drawtask )
 {
-	DaoxColor dark = {0.2, 0.2, 0.2, 1.0};
+	DaoxFrameStats *stats = & self->profiler->current;
+	DaoxRenderState *state = & self->state;
+	DaoxShader *shader = self->shader;
 	DaoxTexture *bumpTexture = NULL;
 	DaoxTexture *diffuseTexture = NULL;
 	DaoxTexture *emissionTexture = NULL;
 	DaoxMaterial *material = drawtask->material;
-	DaoxColor ambient = material ? material->ambient : dark;
-	DaoxColor diffuse = material ? material->diffuse : dark;
-	DaoxColor specular = material ? material->specular : dark;
-	DaoxColor emission = material ? material->emission : daox_black_color;
 	daoint K = drawtask->offset * sizeof(GLint);
 	daoint M = drawtask->tcount;
-	GLfloat matrix[16] = {0};
 	int terrainTileType = 0;
 	int tileTextureCount = 0;
 	int tileTextureScale = 0;
-	int hasDiffuseTexture = 0;
-	int hasEmissionTexture = 0;
-	int hasBumpTexture = 0;
-	int i, j, k;
+	int hasTextures[3] = {0};  /* diffuse, emission and bump; */
+	int i;
 
 	if( drawtask->shape == GL_TRIANGLES ){
 		K *= 3;
 		M *= 3;
 	}
 
-	DaoxMatrix4D_Export( & drawtask->matrix, matrix );
-	glUniformMatrix4fv( self->shader->uniforms.modelMatrix, 1, 0, matrix );
-
-	glUniform4fv( self->shader->uniforms.ambientColor, 1, & ambient.red );
-	glUniform4fv( self->shader->uniforms.diffuseColor, 1, & diffuse.red );
-	glUniform4fv( self->shader->uniforms.specularColor, 1, & specular.red );
-	glUniform4fv( self->shader->uniforms.emissionColor, 1, & emission.red );
-	glUniform1f( self->shader->uniforms.shininess, material ? material->shininess : 2 );
-
-	if( drawtask->skeleton ){
-		GLfloat matRows[128][16];
-		k = drawtask->skeleton->skinMats2->size;
-		if( k > 128 ) k = 128;
-		for(i=0; i<k; ++i){
-			DaoxMatrix4D *mat = drawtask->skeleton->skinMats2->data.matrices4d + i;
-			DaoxMatrix4D_Export( mat, matRows[i] );
-		}
-		glUniformMatrix4fv( self->shader->uniforms.skinMatrices, k, 0, matRows[0] );
-	}
-	glUniform1i( self->shader->uniforms.skinning, drawtask->skeleton != NULL );
-
 	if( drawtask->hexTile && drawtask->hexTile->mesh->material && drawtask->hexTile->mesh->material->diffuseTexture ){
 		DaoxMaterial *material = drawtask->hexTile->mesh->material;
 		terrainTileType = drawtask->terrainTileType;
@@ -577,48 +2056,532 @@ void DaoxRenderer_DrawTask( DaoxRenderer *self, DaoxDrawTask *drawtask )
 		for(i=0; i<drawtask->hexTile->sides; ++i){
 			DaoxTerrainBlock *neighbor = drawtask->hexTile->neighbors[i];
 			DaoxMaterial *material2 = neighbor ? neighbor->mesh->material : material;
-			if( material2 == NULL ) material2 = material;
-			if( material->diffuseTexture->changed || material->diffuseTexture->tid == 0 ){
-				DaoxContext_BindTexture( self->context, material->diffuseTexture );
-			}
-			glActiveTexture(GL_TEXTURE0 + DAOX_TILE_TEXTURE1 + i);
-			glBindTexture(GL_TEXTURE_2D, material2->diffuseTexture->tid);
-			glUniform1i(self->shader->uniforms.tileTextures[i], DAOX_TILE_TEXTURE1 + i );
+			if( material2 == NULL || material2->diffuseTexture == NULL ) material2 = material;
+			DaoxRenderer_BindTexture( self, DAOX_TILE_TEXTURE1 + i, DaoxRenderer_PrepareTexture( self, material2->diffuseTexture ) );
 		}
 	}
-	glUniform1i( self->shader->uniforms.particleType, drawtask->particleType );
-	glUniform1i( self->shader->uniforms.terrainTileType, terrainTileType );
-	glUniform1i( self->shader->uniforms.tileTextureCount, tileTextureCount );
-	glUniform1f( self->shader->uniforms.tileTextureScale, tileTextureScale );
 
 	if( material != NULL ) diffuseTexture = material->diffuseTexture;
 	if( diffuseTexture ){
-		int uniform = self->shader->uniforms.diffuseTexture;
-		hasDiffuseTexture = 
-			DaoxRenderer_SetupTexture( self, diffuseTexture, DAOX_DIFFUSE_TEXTURE, uniform );
+		hasTextures[0] = DaoxRenderer_SetupTexture( self, diffuseTexture, DAOX_DIFFUSE_TEXTURE );
 	}
 	if( material != NULL ) emissionTexture = material->emissionTexture;
 	if( emissionTexture ){
-		int uniform = self->shader->uniforms.emissionTexture;
-		hasEmissionTexture = 
-			DaoxRenderer_SetupTexture( self, emissionTexture, DAOX_EMISSION_TEXTURE, uniform );
+		hasTextures[1] = DaoxRenderer_SetupTexture( self, emissionTexture, DAOX_EMISSION_TEXTURE );
 	}
 	if( material != NULL ) bumpTexture = material->bumpTexture;
 	if( bumpTexture ){
-		int uniform = self->shader->uniforms.bumpTexture;
-		hasBumpTexture = 
-			DaoxRenderer_SetupTexture( self, bumpTexture, DAOX_BUMP_TEXTURE, uniform );
-	}
-	//printf( "hasBumpTexture = %i\n", hasBumpTexture );
-	glUniform1i(self->shader->uniforms.hasDiffuseTexture, hasDiffuseTexture );
-	glUniform1i(self->shader->uniforms.hasEmissionTexture, hasEmissionTexture );
-	glUniform1i(self->shader->uniforms.hasBumpTexture, hasBumpTexture );
-	glDrawRangeElements( drawtask->shape, 0, M, M, GL_UNSIGNED_INT, (void*)K );
-	glUniform1i(self->shader->uniforms.hasDiffuseTexture, 0 );
-	glUniform1i(self->shader->uniforms.hasEmissionTexture, 0 );
-	glUniform1i(self->shader->uniforms.hasBumpTexture, 0 );
+		hasTextures[2] = DaoxRenderer_SetupTexture( self, bumpTexture, DAOX_BUMP_TEXTURE );
+		/* Two channel normals, with Z reconstructed in the shader: */
+		if( hasTextures[2] && bumpTexture->format == DAOX_TEXTURE_BC5 ) hasTextures[2] = 2;
+	}
+
+	/* The variant is selected by the textures that are actually available: */
+	if( self->variants ){
+		uint_t variant = DaoxRenderer_VariantKey( drawtask->skeleton != NULL, terrainTileType, drawtask->particleType, hasTextures );
+		shader = DaoxRenderer_GetVariant( self, variant );
+	}
+	DaoxRenderer_UseShader( self, shader );
+
+	/* Instances take their matrices from the instance attributes: */
+	if( drawtask->objectSlot >= 0 && (state->valid == 0 || state->objectSlot != drawtask->objectSlot) ){
+		state->objectSlot = drawtask->objectSlot;
+		DaoxUniformBuffer_Bind( self->objectBuffer, drawtask->objectSlot );
+	}
+	if( state->valid == 0 || state->materialSlot != drawtask->materialSlot ){
+		state->materialSlot = drawtask->materialSlot;
+		DaoxUniformBuffer_Bind( self->materials->buffer, drawtask->materialSlot );
+	}
+
+	/* The skinning matrices have been uploaded in the bone palette: */
+	if( drawtask->skeleton ){
+		DaoxRenderer_SetUniform1i( self, & state->boneOffset, shader->uniforms.boneOffset, drawtask->boneOffset );
+	}
+	DaoxRenderer_SetUniform1i( self, & state->skinning, shader->uniforms.skinning, drawtask->skeleton != NULL );
+	DaoxRenderer_SetUniform1i( self, & state->particleType, shader->uniforms.particleType, drawtask->particleType );
+	DaoxRenderer_SetUniform1i( self, & state->terrainTileType, shader->uniforms.terrainTileType, terrainTileType );
+	DaoxRenderer_SetUniform1i( self, & state->tileTextureCount, shader->uniforms.tileTextureCount, tileTextureCount );
+	if( state->valid == 0 || state->tileTextureScale != tileTextureScale ){
+		state->tileTextureScale = tileTextureScale;
+		glUniform1f( shader->uniforms.tileTextureScale, tileTextureScale );
+	}
+	DaoxRenderer_SetUniform1i( self, & state->hasTextures[0], shader->uniforms.hasDiffuseTexture, hasTextures[0] );
+	DaoxRenderer_SetUniform1i( self, & state->hasTextures[1], shader->uniforms.hasEmissionTexture, hasTextures[1] );
+	DaoxRenderer_SetUniform1i( self, & state->hasTextures[2], shader->uniforms.hasBumpTexture, hasTextures[2] );
+	state->valid = 1;
+
+	if( drawtask->commandCount ){
+		DaoxBuffer_SetInstanceOffset( drawtask->buffer, 0 );
+		glUniform1i( shader->uniforms.instancing, 1 );
+		DaoxBuffer_DrawCommands( drawtask->buffer, drawtask->shape, drawtask->commandOffset, drawtask->commandCount );
+		glUniform1i( shader->uniforms.instancing, 0 );
+		stats->triangles += drawtask->batchTriangles;
+		stats->drawCalls += 1;
+	}else if( drawtask->instances->size ){
+		int *ranges = drawtask->ranges->data.ints;
+		int *counts = drawtask->instanceCounts->data.ints;
+		int instanceCount = drawtask->instances->size;
+		int instanceOffset = drawtask->instanceOffset;
+		glUniform1i( shader->uniforms.instancing, 1 );
+		for(i=0; i<drawtask->ranges->size; i+=4){
+			/* The units of a merged task have their own instances: */
+			if( drawtask->instanceCounts->size ) instanceCount = counts[i/4];
+			DaoxBuffer_SetInstanceOffset( drawtask->buffer, instanceOffset );
+			DaoxRenderer_DrawRange( self, drawtask, ranges + i, instanceCount );
+			stats->triangles += ranges[i+1] * instanceCount;
+			stats->drawCalls += 1;
+			instanceOffset += instanceCount;
+		}
+		glUniform1i( shader->uniforms.instancing, 0 );
+	}else if( drawtask->ranges->size ){
+		int *ranges = drawtask->ranges->data.ints;
+		for(i=0; i<drawtask->ranges->size; i+=4){
+			DaoxRenderer_DrawRange( self, drawtask, ranges + i, 0 );
+			stats->triangles += ranges[i+1];
+			stats->drawCalls += 1;
+		}
+	}else{
+		glDrawRangeElements( drawtask->shape, 0, M, M, GL_UNSIGNED_INT, (void*)K );
+		stats->triangles += drawtask->tcount;
+		stats->drawCalls += 1;
+	}
 	/* TODO: better hint for glDrawRangeElements(); */
 }
+/*
+// Sort the draw tasks: opaque tasks first, and the blending tasks last
+// from back to front. The opaque tasks are sorted by coarse depth layers
+// (if enabled) to reduce overdraw, and then to minimize the state changes
+// between them: by particle type, shader variant, buffer, texture and
+// material, and then from front to back;
+*/
+/*
+// The state keys are the creation ids of the objects, instead of their addresses,
+// so that the order (and the state changes) do not vary from run to run:
+*/
+static int DaoxDrawTask_Compare( const void *p1, const void *p2 )
+{
+	DaoxDrawTask *task1 = *(DaoxDrawTask**) p1;
+	DaoxDrawTask *task2 = *(DaoxDrawTask**) p2;
+	DaoxTexture *texture1 = task1->material ? task1->material->diffuseTexture : NULL;
+	DaoxTexture *texture2 = task2->material ? task2->material->diffuseTexture : NULL;
+	uint_t buffer1 = task1->buffer ? task1->buffer->id : 0;
+	uint_t buffer2 = task2->buffer ? task2->buffer->id : 0;
+	uint_t tex1 = texture1 ? texture1->id : 0;
+	uint_t tex2 = texture2 ? texture2->id : 0;
+	uint_t mat1 = task1->material ? task1->material->id : 0;
+	uint_t mat2 = task2->material ? task2->material->id : 0;
+	uint_t unit1 = task1->units.size ? task1->units.items.pMeshUnit[0]->index : 0;
+	uint_t unit2 = task2->units.size ? task2->units.items.pMeshUnit[0]->index : 0;
+	int instanced1 = task1->instances->size != 0;
+	int instanced2 = task2->instances->size != 0;
+
+	if( task1->blending != task2->blending ) return task1->blending < task2->blending ? -1 : 1;
+	if( task1->blending && task1->depth != task2->depth ) return task1->depth > task2->depth ? -1 : 1;
+	if( task1->depthLayer != task2->depthLayer ) return task1->depthLayer < task2->depthLayer ? -1 : 1;
+	if( task1->particleType != task2->particleType ) return task1->particleType < task2->particleType ? -1 : 1;
+	if( task1->terrainTileType != task2->terrainTileType ) return task1->terrainTileType < task2->terrainTileType ? -1 : 1;
+	if( task1->variant != task2->variant ) return task1->variant < task2->variant ? -1 : 1;
+	if( instanced1 != instanced2 ) return instanced1 < instanced2 ? -1 : 1;
+	if( buffer1 != buffer2 ) return buffer1 < buffer2 ? -1 : 1;
+	if( tex1 != tex2 ) return tex1 < tex2 ? -1 : 1;
+	if( mat1 != mat2 ) return mat1 < mat2 ? -1 : 1;
+	if( task1->depth != task2->depth ) return task1->depth < task2->depth ? -1 : 1;
+	if( unit1 != unit2 ) return unit1 < unit2 ? -1 : 1;
+	return 0;
+}
+/* The largest axis scale of the transformation: */
+static float DaoxMatrix4D_MaxScale( DaoxMatrix4D *self )
+{
+	float sx = self->A11 * self->A11 + self->A21 * self->A21 + self->A31 * self->A31;
+	float sy = self->A12 * self->A12 + self->A22 * self->A22 + self->A32 * self->A32;
+	float sz = self->A13 * self->A13 + self->A23 * self->A23 + self->A33 * self->A33;
+	if( sy > sx ) sx = sy;
+	if( sz > sx ) sx = sz;
+	return sqrt( sx );
+}
+void DaoxRenderer_SortTasks( DaoxRenderer *self, DList *tasks )
+{
+	DaoxVector3D campos = self->frustum.cameraPosition;
+	float dist;
+	int i, j;
+
+	for(i=0; i<tasks->size; ++i){
+		DaoxDrawTask *task = tasks->items.pDrawTask[i];
+		DaoxMatrix4D *mat = & task->matrix;
+		DaoxMaterial *material = task->material;
+		DaoxVector3D pos;
+		int hasTextures[3] = {0};
+		if( material ){
+			hasTextures[0] = material->diffuseTexture != NULL;
+			hasTextures[1] = material->emissionTexture != NULL;
+			hasTextures[2] = material->bumpTexture != NULL;
+		}
+		task->variant = DaoxRenderer_VariantKey( task->skeleton != NULL, task->terrainTileType, task->particleType, hasTextures );
+		task->blending = task->particleType != 0;
+		if( task->material && DaoxMaterial_IsTranslucent( task->material ) ) task->blending = 1;
+		if( task->instances->size ) mat = task->instances->data.matrices4d;
+		if( task->chunks.size && task->instances->size == 0 && task->skinning == NULL ){
+			/* Distance to the nearest bounding sphere of the chunks: */
+			float scale = DaoxMatrix4D_MaxScale( mat );
+			task->depth = FLT_MAX;
+			for(j=0; j<task->chunks.size; ++j){
+				DaoxMeshChunk *chunk = (DaoxMeshChunk*) task->chunks.items.pVoid[j];
+				pos = DaoxMatrix4D_MulVector( mat, & chunk->obbox.C, 1.0 );
+				dist = DaoxVector3D_Dist( & pos, & campos ) - scale * chunk->obbox.R;
+				if( dist < task->depth ) task->depth = dist;
+			}
+			if( task->depth < 0.0 ) task->depth = 0.0;
+		}else{
+			pos.x = mat->B1;
+			pos.y = mat->B2;
+			pos.z = mat->B3;
+			task->depth = DaoxVector3D_Dist( & pos, & campos );
+		}
+		/* Layers with a depth ratio of sqrt(2): */
+		task->depthLayer = self->frontToBack ? (int)(2.0 * log2( 1.0 + task->depth )) : 0;
+	}
+	qsort( tasks->items.pVoid, tasks->size, sizeof(void*), DaoxDrawTask_Compare );
+}
+static void DaoxRenderer_DrawTask2( DaoxRenderer *self, DaoxDrawTask *task, DaoxBuffer **buffer, int particles )
+{
+	if( task->buffer == NULL ) return;
+	if( particles == 0 && task->particleType != 0 ) return;
+	if( particles > 0 && task->particleType == 0 ) return;
+	if( task->batched && task->commandCount == 0 ) return; /* Drawn in the batch; */
+	if( task->buffer != *buffer ){
+		*buffer = task->buffer;
+		glBindVertexArray( task->buffer->vertexVAO );
+		glBindBuffer( GL_ARRAY_BUFFER, task->buffer->vertexVBO );
+		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, task->buffer->triangleVBO );
+	}
+	DaoxRenderer_DrawTask( self, task );
+}
+/*
+// Draw the tasks of the skinned and the other list with buffer switching:
+// the opaque tasks of both lists first, and then the blending tasks of both
+// lists, merged from back to front (the lists are sorted with the blending
+// tasks last and from back to front);
+// particles < 0: all tasks; particles = 0: non-particle tasks; particles > 0: particle tasks;
+*/
+void DaoxRenderer_DrawTasks( DaoxRenderer *self, int particles )
+{
+	DaoxBuffer *buffer = NULL;
+	DList *tasks = self->tasks;
+	DList *tasks2 = self->tasks2;
+	int i = 0, j = 0;
+
+	glDisable( GL_BLEND );
+	for(; i<tasks2->size && tasks2->items.pDrawTask[i]->blending == 0; ++i){
+		DaoxRenderer_DrawTask2( self, tasks2->items.pDrawTask[i], & buffer, particles );
+	}
+	for(; j<tasks->size && tasks->items.pDrawTask[j]->blending == 0; ++j){
+		DaoxRenderer_DrawTask2( self, tasks->items.pDrawTask[j], & buffer, particles );
+	}
+	glEnable( GL_BLEND );
+	while( i < tasks2->size || j < tasks->size ){
+		DaoxDrawTask *task2 = i < tasks2->size ? tasks2->items.pDrawTask[i] : NULL;
+		DaoxDrawTask *task = j < tasks->size ? tasks->items.pDrawTask[j] : NULL;
+		if( task == NULL || (task2 != NULL && task2->depth >= task->depth) ){
+			DaoxRenderer_DrawTask2( self, task2, & buffer, particles );
+			i += 1;
+		}else{
+			DaoxRenderer_DrawTask2( self, task, & buffer, particles );
+			j += 1;
+		}
+	}
+	glBindVertexArray(0);
+}
+/*
+// Depth-only pass for the opaque tasks, so that the following shading pass
+// (with GL_LEQUAL depth test) only shades the visible fragments;
+*/
+static void DaoxRenderer_DrawDepthPrepass( DaoxRenderer *self )
+{
+	DList *lists[2];
+	DaoxBuffer *buffer = NULL;
+	int i, j;
+
+	if( self->depthPrepass == 0 ) return;
+
+	lists[0] = self->tasks2;
+	lists[1] = self->tasks;
+	glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+	glDisable( GL_BLEND );
+	glDepthFunc( GL_LESS );
+	DaoxRenderer_SetPassUniforms( self, self->hasDepthTexture, 1 );
+	for(j=0; j<2; ++j){
+		for(i=0; i<lists[j]->size; ++i){
+			DaoxDrawTask *task = lists[j]->items.pDrawTask[i];
+			if( task->buffer == NULL || task->blending ) continue;
+			if( task->batched && task->commandCount == 0 ) continue;
+			if( task->buffer != buffer ){
+				buffer = task->buffer;
+				glBindVertexArray( buffer->vertexVAO );
+				glBindBuffer( GL_ARRAY_BUFFER, buffer->vertexVBO );
+				glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, buffer->triangleVBO );
+			}
+			DaoxRenderer_DrawTask( self, task );
+		}
+	}
+	glBindVertexArray(0);
+	DaoxRenderer_SetPassUniforms( self, self->hasDepthTexture, 0 );
+	glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+	glDepthFunc( GL_LEQUAL );
+}
+static int DaoxRenderer_InitReducedPass( DaoxRenderer *self )
+{
+	DaoxContext *ctx = self->context;
+
+	if( DaoxContext_InitReducedBuffers( ctx, self->particleScale ) == 0 ) return 0;
+	if( self->downsampleShader == NULL ){
+		self->downsampleShader = DaoxShader_New();
+		self->compositeShader = DaoxShader_New();
+		GC_IncRC( self->downsampleShader );
+		GC_IncRC( self->compositeShader );
+		DaoxShader_InitScreen( self->downsampleShader, DAOX_SCREEN_DOWNSAMPLE );
+		DaoxShader_InitScreen( self->compositeShader, DAOX_SCREEN_COMPOSITE );
+		DaoxContext_BindShader( ctx, self->downsampleShader );
+		DaoxContext_BindShader( ctx, self->compositeShader );
+	}
+	return self->downsampleShader->program && self->compositeShader->program;
+}
+/*
+// Map the light clusters to the viewport of the pass that computes the lights
+// (gl_FragCoord is relative to the window, not to the viewport):
+*/
+static void DaoxFrameBlock_SetClusterGrid( DaoxFrameBlock *self, int x, int y, int width, int height )
+{
+	self->clusterParams[0] = DAOX_CLUSTER_X / (float) width;
+	self->clusterParams[1] = DAOX_CLUSTER_Y / (float) height;
+	self->clusterOffsetX = x * self->clusterParams[0];
+	self->clusterOffsetY = y * self->clusterParams[1];
+}
+/*
+// Draw the particles at a reduced resolution:
+// 1. Draw the non-particle tasks into the offscreen buffer at full resolution;
+// 2. Downsample the depth (farthest of each block) into the reduced depth buffer;
+// 3. Draw the particles into the reduced color buffer with premultiplied alpha,
+//    discarding the fragments behind the downsampled depth;
+// 4. Composite the scene and the upsampled particles into the default buffer,
+//    weighting the reduced samples by depth similarity to avoid halos on edges.
+//    This pass also writes the scene depth, and replaces the full screen blits;
+*/
+static void DaoxRenderer_DrawReducedParticles( DaoxRenderer *self, DaoxFrameBlock *frame, DaoxColor bgcolor )
+{
+	DaoxFrameBlock reduced = *frame;
+	DaoxContext *ctx = self->context;
+	DaoxShader *downsample = self->downsampleShader;
+	DaoxShader *composite = self->compositeShader;
+	int scale = self->particleScale;
+	int width = (ctx->deviceWidth + scale - 1) / scale;
+	int height = (ctx->deviceHeight + scale - 1) / scale;
+
+	glBindFramebuffer( GL_FRAMEBUFFER, ctx->frameBuffer );
+	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+	DaoxRenderer_SetPassUniforms( self, 0, 0 );
+	DaoxRenderer_DrawDepthPrepass( self );
+	DaoxRenderer_DrawTasks( self, 0 );
+
+	glBindFramebuffer( GL_FRAMEBUFFER, ctx->lowDepthBuffer );
+	glViewport( 0, 0, width, height );
+	glBindVertexArray( ctx->screenVAO );
+	glDisable( GL_BLEND );
+	glDepthFunc( GL_ALWAYS );
+	glDepthMask( GL_TRUE );
+	DaoxRenderer_UseShader( self, downsample );
+	glActiveTexture( GL_TEXTURE0 + DAOX_DEPTH_TEXTURE );
+	glBindTexture( GL_TEXTURE_2D, ctx->depthTexture );
+	glUniform1i( downsample->uniforms.depthTexture, DAOX_DEPTH_TEXTURE );
+	glUniform1i( downsample->uniforms.screenScale, scale );
+	glDrawArrays( GL_TRIANGLES, 0, 3 );
+	glBindVertexArray( 0 );
+
+	/* The particles are lit with the clusters mapped to the reduced viewport: */
+	DaoxFrameBlock_SetClusterGrid( & reduced, 0, 0, width, height );
+	DaoxUniformBuffer_Update( self->shader->blocks.frame, 1, 0, sizeof(DaoxFrameBlock), & reduced );
+	DaoxUniformBuffer_Bind( self->shader->blocks.frame, 1 );
+
+	glBindFramebuffer( GL_FRAMEBUFFER, ctx->particleBuffer );
+	glClearColor( 0.0, 0.0, 0.0, 0.0 );
+	glClear( GL_COLOR_BUFFER_BIT );
+	glClearColor( bgcolor.red, bgcolor.green, bgcolor.blue, bgcolor.alpha );
+	glDisable( GL_DEPTH_TEST );
+	glDepthMask( GL_FALSE );
+	DaoxRenderer_UseShader( self, self->shader );
+	glBindTexture( GL_TEXTURE_2D, ctx->lowDepthTexture );
+	DaoxRenderer_SetPassUniforms( self, 1, 0 );
+	glBlendFuncSeparate( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+	DaoxRenderer_DrawTasks( self, 1 );
+	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+	DaoxUniformBuffer_Bind( self->shader->blocks.frame, 0 );
+
+	/* The sampler units of the 3D shader are reused: */
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	glViewport( 0, 0, ctx->deviceWidth, ctx->deviceHeight );
+	glEnable( GL_DEPTH_TEST );
+	glDepthFunc( GL_ALWAYS );
+	glDepthMask( GL_TRUE );
+	glDisable( GL_BLEND );
+	DaoxRenderer_UseShader( self, composite );
+	glActiveTexture( GL_TEXTURE0 + DAOX_DEPTH_TEXTURE );
+	glBindTexture( GL_TEXTURE_2D, ctx->depthTexture );
+	glActiveTexture( GL_TEXTURE0 + DAOX_DIFFUSE_TEXTURE );
+	glBindTexture( GL_TEXTURE_2D, ctx->colorTexture );
+	glActiveTexture( GL_TEXTURE0 + DAOX_EMISSION_TEXTURE );
+	glBindTexture( GL_TEXTURE_2D, ctx->particleTexture );
+	glActiveTexture( GL_TEXTURE0 + DAOX_BUMP_TEXTURE );
+	glBindTexture( GL_TEXTURE_2D, ctx->lowDepthTexture );
+	glUniform1i( composite->uniforms.depthTexture, DAOX_DEPTH_TEXTURE );
+	glUniform1i( composite->uniforms.diffuseTexture, DAOX_DIFFUSE_TEXTURE );
+	glUniform1i( composite->uniforms.particleTexture, DAOX_EMISSION_TEXTURE );
+	glUniform1i( composite->uniforms.lowDepthTexture, DAOX_BUMP_TEXTURE );
+	glUniform1i( composite->uniforms.screenScale, scale );
+	glBindVertexArray( ctx->screenVAO );
+	glDrawArrays( GL_TRIANGLES, 0, 3 );
+	glBindVertexArray( 0 );
+
+	glActiveTexture( GL_TEXTURE0 + DAOX_BUMP_TEXTURE );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	glActiveTexture( GL_TEXTURE0 + DAOX_EMISSION_TEXTURE );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	glActiveTexture( GL_TEXTURE0 + DAOX_DIFFUSE_TEXTURE );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	glActiveTexture( GL_TEXTURE0 + DAOX_DEPTH_TEXTURE );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+	glDepthFunc( GL_LESS );
+	DaoxRenderer_UseShader( self, self->shader );
+	self->state.valid = 0;
+}
+/*
+// Write the object blocks of the draw tasks into the object buffer,
+// and assign the material slots to the draw tasks:
+*/
+static void DaoxRenderer_UpdateBlocks( DaoxRenderer *self )
+{
+	DaoxMatrix4D identity = DaoxMatrix4D_Identity();
+	DList *lists[2];
+	char *blocks = NULL;
+	int i, j, count = 0;
+
+	lists[0] = self->tasks;
+	lists[1] = self->tasks2;
+	if( self->frameIndex % 64 == 0 ) DaoxMaterialCache_Sweep( self->materials, self->frameIndex, 256 );
+	for(j=0; j<2; ++j){
+		for(i=0; i<lists[j]->size; ++i){
+			DaoxDrawTask *task = lists[j]->items.pDrawTask[i];
+			task->materialSlot = DaoxMaterialCache_Update( self->materials, task->material, self->frameIndex );
+			task->objectSlot = (task->instances->size || task->batched) ? -1 : count++;
+		}
+	}
+	if( count == 0 ) return;
+
+	blocks = (char*) DaoxUniformBuffer_Map( self->objectBuffer, count );
+	if( blocks == NULL ) return;
+	for(j=0; j<2; ++j){
+		for(i=0; i<lists[j]->size; ++i){
+			DaoxDrawTask *task = lists[j]->items.pDrawTask[i];
+			DaoxObjectBlock *block;
+			if( task->objectSlot < 0 ) continue;
+			block = (DaoxObjectBlock*) (blocks + task->objectSlot * self->objectBuffer->stride);
+			/* The CPU skinned vertices are already in the world space: */
+			DaoxMatrix4D_Export( task->skinning ? & identity : & task->matrix, block->modelMatrix );
+		}
+	}
+	DaoxUniformBuffer_Unmap( self->objectBuffer );
+	self->profiler->current.uploadedBytes += count * self->objectBuffer->stride;
+}
+/*
+// Upload float data to a texture, which is created on first use:
+*/
+static void DaoxRenderer_UploadTexture( DaoxRenderer *self, uint_t *tid, int sampler,
+		int internalFormat, int format, int width, int height, float *data )
+{
+	int channels = format == GL_RGBA ? 4 : (format == GL_RG ? 2 : 1);
+
+	self->profiler->current.uploadedBytes += width * height * channels * sizeof(float);
+	glActiveTexture( GL_TEXTURE0 + sampler );
+	if( *tid == 0 ){
+		glGenTextures( 1, tid );
+		glBindTexture( GL_TEXTURE_2D, *tid );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	}else{
+		glBindTexture( GL_TEXTURE_2D, *tid );
+	}
+	glTexImage2D( GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, data );
+}
+/*
+// Upload the skinning matrices of the skeletons used in the frame as a palette,
+// so that each skeleton is uploaded once, and its draw tasks only set its offset:
+*/
+static void DaoxRenderer_UpdateBones( DaoxRenderer *self )
+{
+	DArray *palette = self->bonePalette;
+	DMap *offsets = self->boneOffsets;
+	DNode *it;
+	int i, rows, count = 0;
+
+	DMap_Reset( offsets );
+	for(i=0; i<self->tasks2->size; ++i){
+		DaoxDrawTask *task = self->tasks2->items.pDrawTask[i];
+		DaoxSkeleton *skeleton = task->skeleton;
+		if( skeleton == NULL ) continue;
+		it = DMap_Find( offsets, skeleton );
+		if( it == NULL ){
+			it = DMap_Insert( offsets, skeleton, IntToPointer( count ) );
+			count += skeleton->skinMats2->size;
+		}
+		task->boneOffset = it->value.pInt;
+	}
+	if( count == 0 ) return;
+
+	rows = (count + DAOX_BONE_ROW - 1) / DAOX_BONE_ROW;
+	DArray_Resize( palette, 12 * DAOX_BONE_ROW * rows );
+	for(it=DMap_First(offsets); it; it=DMap_Next(offsets,it)){
+		DaoxSkeleton *skeleton = (DaoxSkeleton*) it->key.pVoid;
+		float *dest = palette->data.floats + 12 * it->value.pInt;
+		/* The rows of DaoxMatrix4D are exactly the rows stored in the palette: */
+		memcpy( dest, skeleton->skinMats2->data.matrices4d, skeleton->skinMats2->size * sizeof(DaoxMatrix4D) );
+	}
+	DaoxRenderer_UploadTexture( self, & self->boneTexture, DAOX_BONE_TEXTURE, GL_RGBA32F, GL_RGBA,
+			3*DAOX_BONE_ROW, rows, palette->data.floats );
+	glUniform1i( self->shader->uniforms.boneTexture, DAOX_BONE_TEXTURE );
+}
+/*
+// Assign the lights to the view space clusters, and upload the lights and
+// the clusters with their light index lists as textures:
+*/
+static void DaoxRenderer_UpdateLights( DaoxRenderer *self, DaoxMatrix4D *worldToView, DaoxFrameBlock *frame )
+{
+	DaoxLightClusters *clusters = self->lightClusters;
+	GLint viewport[4] = { 0, 0, 0, 0 };
+
+	/* The viewport set for the frame, or the whole device if none is set: */
+	glGetIntegerv( GL_VIEWPORT, viewport );
+	if( viewport[2] <= 0 || viewport[3] <= 0 ){
+		viewport[0] = viewport[1] = 0;
+		viewport[2] = self->context->deviceWidth;
+		viewport[3] = self->context->deviceHeight;
+	}
+
+	DaoxLightClusters_Build( clusters, & self->frustum, worldToView, self->scene->lights );
+
+	DaoxRenderer_UploadTexture( self, & self->lightTextures.lights, DAOX_LIGHT_TEXTURE, GL_RGBA32F, GL_RGBA,
+			2*DAOX_LIGHT_ROW, clusters->lightRows, clusters->lights->data.floats );
+	DaoxRenderer_UploadTexture( self, & self->lightTextures.clusters, DAOX_CLUSTER_TEXTURE, GL_RG32F, GL_RG,
+			DAOX_CLUSTER_X*DAOX_CLUSTER_Y, DAOX_CLUSTER_Z, clusters->clusters->data.floats );
+	DaoxRenderer_UploadTexture( self, & self->lightTextures.indices, DAOX_LIGHT_INDEX_TEXTURE, GL_R32F, GL_RED,
+			DAOX_LIGHT_INDEX_ROW, clusters->indexRows, clusters->indices->data.floats );
+
+	DaoxFrameBlock_SetClusterGrid( frame, viewport[0], viewport[1], viewport[2], viewport[3] );
+	frame->clusterParams[2] = clusters->logScale;
+	frame->clusterParams[3] = clusters->near;
+	frame->lightCount = clusters->lightCount;
+	glUniform1i( self->shader->uniforms.lightTexture, DAOX_LIGHT_TEXTURE );
+	glUniform1i( self->shader->uniforms.clusterTexture, DAOX_CLUSTER_TEXTURE );
+	glUniform1i( self->shader->uniforms.lightIndexTexture, DAOX_LIGHT_INDEX_TEXTURE );
+}
+
 extern DaoxTexture *test_texture;
 void DaoxRenderer_Render( DaoxRenderer *self, DaoxScene *scene, DaoxCamera *cam )
 {
@@ -627,15 +2590,14 @@ void DaoxRenderer_Render( DaoxRenderer *self, DaoxScene *scene, DaoxCamera *cam
 	DaoxMatrix4D viewMatrix;
 	DaoxMatrix4D objectToWorld;
 	DaoxVector3D cameraPosition;
-	DaoxVector3D lightSource[32];
-	DaoxColor lightIntensity[32];
 	DaoxVector3D zaxis = {0.0,0.0,1.0};
 	DaoxColor bgcolor = scene->background;
-	DaoxColor dark = {0.2, 0.2, 0.2, 1.0};
+	DaoxFrameBlock frame;
+	DaoxMaterialBlock canvasMaterial;
 	GLfloat matrix[16] = {0};
 	GLfloat matrix2[16] = {0};
 	GLfloat matrix3[9] = {0};
-	daoint i, j, lightCount = scene->lights->size;
+	daoint i, j;
 	float cosine, sine;
 	int particles = 0;
 
@@ -687,16 +2649,31 @@ void DaoxRenderer_Render( DaoxRenderer *self, DaoxScene *scene, DaoxCamera *cam
 	if( self->showAxis ) DaoxSceneNode_Move( (DaoxSceneNode*) self->worldAxis, fm.axisOrigin );
 
 	self->frustum = fm;
+	DaoxProfiler_BeginFrame( self->profiler );
+	DaoxProfiler_BeginPhase( self->profiler, DAOX_PROFILE_PREPARE );
 	DList_Clear( self->canvases );
 	DaoxRenderer_ClearDrawTasks( self, self->tasks );
 	DaoxRenderer_ClearDrawTasks( self, self->tasks2 );
-	for(i=0; i<scene->nodes->size; ++i){
-		DaoxSceneNode *node = scene->nodes->items.pSceneNode[i];
-		DaoxRenderer_PrepareNode( self, node );
+	DaoxRenderer_PrepareScene( self, scene );
+	DaoxRenderer_FinishInstances( self );
+	DaoxProfiler_BeginPhase( self->profiler, DAOX_PROFILE_UPLOAD );
+	if( self->retainMeshes ){
+		DaoxRenderer_UpdateRegions( self, self->tasks, self->storage );
+		DaoxRenderer_UpdateRegions( self, self->tasks2, self->storageSK );
 	}
-	if( self->showAxis ) DaoxRenderer_PrepareNode( self, (DaoxSceneNode*) self->worldAxis );
+	self->frameIndex += 1;
+	DaoxBuffer_BeginFrame( self->buffer );
+	DaoxBuffer_BeginFrame( self->bufferVG );
 	if( self->tasks->size ) DaoxRenderer_UpdateBuffer( self, self->tasks, self->buffer );
 	if( self->tasks2->size ) DaoxRenderer_UpdateBuffer( self, self->tasks2, self->bufferSK );
+	DaoxRenderer_SortTasks( self, self->tasks );
+	DaoxRenderer_SortTasks( self, self->tasks2 );
+	if( self->retainMeshes ){
+		/* The base instances of the batches depend on the sorted order: */
+		DaoxRenderer_BatchTasks( self, self->tasks, self->bufferRT );
+		DaoxRenderer_UpdateInstances( self, self->tasks, self->bufferRT );
+		DaoxRenderer_UpdateCommands( self, self->tasks, self->bufferRT );
+	}
 	for(i=0; i<self->tasks->size; ++i){
 		if( self->tasks->items.pDrawTask[i]->particleType ){
 			particles = 1;
@@ -710,13 +2687,6 @@ void DaoxRenderer_Render( DaoxRenderer *self, DaoxScene *scene, DaoxCamera *cam
 
 	MakeProjectionMatrix( & fm, cam, matrix2 );
 
-	if( lightCount > 32 ) lightCount = 32;
-	for(i=0; i<lightCount; ++i){
-		DaoxLight *light = self->scene->lights->items.pLight[i];
-		lightSource[i] = DaoxSceneNode_GetWorldPosition( (DaoxSceneNode*) light );
-		lightIntensity[i] = light->intensity;
-	}
-
 	glDepthMask(GL_TRUE);
 	glEnable(GL_DEPTH_TEST);
 #ifdef GL_LIGHTING
@@ -725,9 +2695,9 @@ void DaoxRenderer_Render( DaoxRenderer *self, DaoxScene *scene, DaoxCamera *cam
 	glEnable(GL_CULL_FACE);
 	glDisable(GL_CULL_FACE); /* Not effective for canvas? */
 
-#ifndef DAO_GRAPHICS_USE_GLES
-	glEnable(GL_BLEND);
+	/* Blending is enabled only for the tasks that need it: */
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+#ifndef DAO_GRAPHICS_USE_GLES
 	if( self->showMesh ){
 		glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
 	}else{
@@ -740,80 +2710,49 @@ void DaoxRenderer_Render( DaoxRenderer *self, DaoxScene *scene, DaoxCamera *cam
 		glClearColor( bgcolor.red, bgcolor.green, bgcolor.blue, bgcolor.alpha );
 	}
 
-	glUseProgram( self->shader->program );
-
-	glUniform1f(self->shader->uniforms.time, Dao_GetCurrentTime() );
-	glUniform1i(self->shader->uniforms.vectorGraphics, 0 );
-	glUniform1i(self->shader->uniforms.hasDiffuseTexture, 0 );
-	glUniform1i(self->shader->uniforms.hasBumpTexture, 0 );
-	glUniform1i(self->shader->uniforms.dashCount, 0 );
-	glUniform1i(self->shader->uniforms.gradientType, 0 );
-	glUniform1i(self->shader->uniforms.gradientStops, 0 );
-	glUniform1f(self->shader->uniforms.gradientRadius, 0 );
-	glUniform1i(self->shader->uniforms.terrainTileType, 0 );
-	glUniform1i(self->shader->uniforms.tileTextureCount, 0 );
-
-	glUniform4fv( self->shader->uniforms.ambientColor, 1, & dark.red );
-	glUniform4fv( self->shader->uniforms.diffuseColor, 1, & dark.red );
-	glUniform4fv( self->shader->uniforms.specularColor, 1, & dark.red );
-	glUniform4fv( self->shader->uniforms.emissionColor, 1, & daox_black_color.red );
-	glUniform1f( self->shader->uniforms.shininess, 2 );
+	/* Other programs may have been used since the last frame: */
+	self->current = NULL;
+	DaoxRenderer_UseShader( self, self->shader );
+	DaoxRenderer_InitProgram( self, self->shader );
 
 	glActiveTexture( GL_TEXTURE0 + DAOX_GRADIENT_SAMPLER);
 	glBindTexture( GL_TEXTURE_2D, self->shader->textures.gradientSampler );
-	glUniform1i( self->shader->uniforms.gradientSampler, DAOX_GRADIENT_SAMPLER );
 
 	glActiveTexture( GL_TEXTURE0 + DAOX_DASH_SAMPLER);
 	glBindTexture( GL_TEXTURE_2D, self->shader->textures.dashSampler );
-	glUniform1i( self->shader->uniforms.dashSampler, DAOX_DASH_SAMPLER );
-
-	glUniformMatrix4fv( self->shader->uniforms.projMatrix, 1, 0, matrix2 );
-	glUniformMatrix4fv( self->shader->uniforms.viewMatrix, 1, 0, matrix );
-	glUniform3fv( self->shader->uniforms.cameraPosition, 1, & cameraPosition.x );
-	glUniform1i( self->shader->uniforms.lightCount, lightCount );
-	glUniform3fv( self->shader->uniforms.lightSource, lightCount, & lightSource[0].x );
-	glUniform4fv( self->shader->uniforms.lightIntensity, lightCount, & lightIntensity[0].red );
+	self->state.valid = 0;
+
+	memset( & frame, 0, sizeof(DaoxFrameBlock) );
+	memcpy( frame.projMatrix, matrix2, sizeof(frame.projMatrix) );
+	memcpy( frame.viewMatrix, matrix, sizeof(frame.viewMatrix) );
+	frame.cameraPosition[0] = cameraPosition.x;
+	frame.cameraPosition[1] = cameraPosition.y;
+	frame.cameraPosition[2] = cameraPosition.z;
+	frame.time = Dao_GetCurrentTime();
+	DaoxRenderer_UpdateLights( self, & viewMatrix, & frame );
+	DaoxUniformBuffer_Update( self->shader->blocks.frame, 0, 0, sizeof(DaoxFrameBlock), & frame );
+	DaoxUniformBuffer_Bind( self->shader->blocks.frame, 0 );
+	DaoxRenderer_UpdateBlocks( self );
+	DaoxRenderer_UpdateBones( self );
+	self->profiler->current.uploadedBytes += DaoxTextureStreamer_Update( self->context->streamer );
+	memset( self->state.textures, 0, sizeof(self->state.textures) );
+	DaoxProfiler_BeginPhase( self->profiler, DAOX_PROFILE_DRAW );
 
 	if( self->context->offscreen == 0 || particles == 0 ){
-		glUniform1i(self->shader->uniforms.hasDepthTexture, 0 );
+		DaoxRenderer_SetPassUniforms( self, 0, 0 );
 
-		glBindVertexArray( self->bufferSK->vertexVAO );
-		glBindBuffer( GL_ARRAY_BUFFER, self->bufferSK->vertexVBO );
-		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->bufferSK->triangleVBO );
-		for(i=0; i<self->tasks2->size; ++i){
-			DaoxRenderer_DrawTask( self, self->tasks2->items.pDrawTask[i] );
-		}
-		glBindVertexArray(0);
-
-		glBindVertexArray( self->buffer->vertexVAO );
-		glBindBuffer( GL_ARRAY_BUFFER, self->buffer->vertexVBO );
-		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->buffer->triangleVBO );
-		for(i=0; i<self->tasks->size; ++i){
-			DaoxRenderer_DrawTask( self, self->tasks->items.pDrawTask[i] );
-		}
-		glBindVertexArray(0);
+		DaoxRenderer_DrawDepthPrepass( self );
+		DaoxRenderer_DrawTasks( self, -1 );
+	}else if( self->particleScale > 1 && DaoxRenderer_InitReducedPass( self ) ){
+		DaoxRenderer_DrawReducedParticles( self, & frame, bgcolor );
 	}else{
 		glBindFramebuffer(GL_FRAMEBUFFER, self->context->frameBuffer);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glUniform1i(self->shader->uniforms.hasDepthTexture, 1 );
-
-		glBindVertexArray( self->bufferSK->vertexVAO );
-		glBindBuffer( GL_ARRAY_BUFFER, self->bufferSK->vertexVBO );
-		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->bufferSK->triangleVBO );
-		for(i=0; i<self->tasks2->size; ++i){
-			DaoxRenderer_DrawTask( self, self->tasks2->items.pDrawTask[i] );
-		}
-		glBindVertexArray(0);
+		DaoxRenderer_SetPassUniforms( self, 1, 0 );
 
-		glBindVertexArray( self->buffer->vertexVAO );
-		glBindBuffer( GL_ARRAY_BUFFER, self->buffer->vertexVBO );
-		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->buffer->triangleVBO );
-		for(i=0; i<self->tasks->size; ++i){
-			if( self->tasks->items.pDrawTask[i]->particleType ) continue;
-			DaoxRenderer_DrawTask( self, self->tasks->items.pDrawTask[i] );
-		}
-		glBindVertexArray(0);
+		DaoxRenderer_DrawDepthPrepass( self );
+		DaoxRenderer_DrawTasks( self, 0 );
 
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -829,20 +2768,19 @@ void DaoxRenderer_Render( DaoxRenderer *self, DaoxScene *scene, DaoxCamera *cam
 
 		glActiveTexture( GL_TEXTURE0 + DAOX_DEPTH_TEXTURE );
 		glBindTexture( GL_TEXTURE_2D, self->context->depthTexture );
-		glUniform1i( self->shader->uniforms.depthTexture, DAOX_DEPTH_TEXTURE );
 
-		glBindVertexArray( self->buffer->vertexVAO );
-		glBindBuffer( GL_ARRAY_BUFFER, self->buffer->vertexVBO );
-		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, self->buffer->triangleVBO );
-		for(i=0; i<self->tasks->size; ++i){
-			if( self->tasks->items.pDrawTask[i]->particleType == 0 ) continue;
-			DaoxRenderer_DrawTask( self, self->tasks->items.pDrawTask[i] );
-		}
-		glBindVertexArray(0);
+		DaoxRenderer_DrawTasks( self, 1 );
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
+	DaoxRenderer_UseShader( self, self->shader );
+	glUniform1i(self->shader->uniforms.hasDiffuseTexture, 0 );
+	glUniform1i(self->shader->uniforms.hasEmissionTexture, 0 );
+	glUniform1i(self->shader->uniforms.hasBumpTexture, 0 );
+	self->state.valid = 0;
 
-
+	DaoxProfiler_BeginPhase( self->profiler, DAOX_PROFILE_CANVAS );
+	glDepthFunc(GL_LESS);
+	glEnable(GL_BLEND);
 	glDepthMask(GL_FALSE);
 	glBindVertexArray( self->bufferVG->vertexVAO );
 	glBindBuffer( GL_ARRAY_BUFFER, self->bufferVG->vertexVBO );
@@ -857,11 +2795,17 @@ void DaoxRenderer_Render( DaoxRenderer *self, DaoxScene *scene, DaoxCamera *cam
 		painter.shader = self->shader;
 		painter.buffer = self->bufferVG;
 		painter.context = self->context;
-		glUniform4fv( self->shader->uniforms.diffuseColor, 1, & canvas->background.red );
+		painter.workers = self->workers;
+		DaoxMaterial_ExportBlock( NULL, & canvasMaterial );
+		canvasMaterial.colors[1] = canvas->background;
+		DaoxShader_SetMaterial( self->shader, & canvasMaterial );
 		DaoxPainter_PaintCanvas( & painter, canvas, cam );
 	}
 	glUniform1i(self->shader->uniforms.vectorGraphics, 0 );
 	glBindVertexArray(0);
+	DaoxBuffer_EndFrame( self->buffer );
+	DaoxBuffer_EndFrame( self->bufferVG );
+	DaoxProfiler_EndFrame( self->profiler );
 }
 
 
@@ -32,9 +32,20 @@
 #include "dao_scene.h"
 #include "dao_opengl.h"
 #include "dao_terrain.h"
+#include "dao_parallel.h"
+#include "dao_occlusion.h"
+#include "dao_cluster.h"
+#include "dao_profiler.h"
 
 
 typedef struct DaoxDrawTask DaoxDrawTask; 
+typedef struct DaoxMeshRegion DaoxMeshRegion;
+typedef struct DaoxMeshStorage DaoxMeshStorage;
+typedef struct DaoxSkinningPiece DaoxSkinningPiece;
+typedef struct DaoxMaterialSlot DaoxMaterialSlot;
+typedef struct DaoxMaterialCache DaoxMaterialCache;
+typedef struct DaoxRenderState DaoxRenderState;
+typedef struct DaoxDrawList DaoxDrawList;
 typedef struct DaoxRenderer DaoxRenderer;
 
 
@@ -42,17 +53,160 @@ struct DaoxDrawTask
 {
 	uint_t         shape;
 	uint_t         offset;
+	uint_t         voffset;  /* Vertex offset in the mapped streaming buffer; */
 	uint_t         vcount;
 	uint_t         tcount;
 	uint_t         terrainTileType;
 	uint_t         particleType;
+	uint_t         variant;  /* Key of the expected shader variant, for sorting; */
 	DList          units;
 	DList          chunks;
+	DArray        *ranges;   /* <int>: (triangle offset, count, first vertex, last vertex); */
+	DArray        *instances;  /* <DaoxMatrix4D>: object to world matrices of the instances; */
+	DArray        *instanceCounts;  /* <int>: instances of each unit, for merged instanced tasks; */
+	uint_t         instanceOffset;
+	float          depth;    /* Distance from the camera to the nearest chunk bound; */
+	int            depthLayer;   /* Coarse depth layer for front to back sorting; */
+	uchar_t        blending;     /* Needs alpha blending (drawn after opaque tasks); */
+	uchar_t        batched;      /* Drawn in a batch of indirect commands; */
+	int            commandOffset;  /* Commands of the batch, set for the first task of the batch; */
+	int            commandCount;
+	int            batchTriangles;
+	int            objectSlot;    /* Object block in the object buffer, -1 for instances; */
+	int            materialSlot;  /* Material block in the material cache; */
+	int            boneOffset;    /* First skinning matrix in the bone palette; */
 	DaoxMatrix4D   matrix;   /* Object to world matrix; */
 	DaoxMaterial  *material;
+	DaoxBuffer    *buffer;
 	DaoxTerrainBlock  *hexTile;
 	DaoxTerrain       *hexTerrain;
 	DaoxSkeleton      *skeleton;
+	DaoxSkeleton      *skinning;  /* Skeleton for the skinning on the CPU; */
+};
+
+
+
+#define DAOX_SKINNING_PIECE  1024
+
+/*
+// Vertices of a unit to be skinned on the CPU, split into pieces for the workers:
+*/
+struct DaoxSkinningPiece
+{
+	DaoxDrawTask   *task;
+	DaoxMeshUnit   *unit;
+	int             first;
+	int             last;
+	void           *glvertices;
+};
+
+
+
+/*
+// Retained region of a mesh unit in a buffer:
+// -- The vertices of the unit are stored in their original order;
+// -- The triangles are stored in the order of the leaf chunks (see DaoxMeshChunk::offset),
+//    so that visible chunks can be drawn directly from the region;
+// -- The region is uploaded again only when the version of the unit has changed;
+*/
+struct DaoxMeshRegion
+{
+	DaoxMeshUnit  *unit;
+	uint_t         version;
+	uint_t         frame;      /* the last frame in which the region was used; */
+	uint_t         vertexOffset;
+	uint_t         vertexCount;
+	uint_t         vertexCapacity;
+	uint_t         triangleOffset;
+	uint_t         triangleCount;
+	uint_t         triangleCapacity;
+};
+
+struct DaoxMeshStorage
+{
+	DaoxBuffer  *buffer;
+	DMap        *regions;  /* <DaoxMeshUnit*,DaoxMeshRegion*>; */
+	uint_t       wastedVertices;
+	uint_t       wastedTriangles;
+	uint_t       uploadedBytes;   /* counted for the profiler; */
+};
+
+
+
+/*
+// Material blocks cached in a uniform buffer:
+// -- Each material used in the recent frames has a slot in the buffer;
+// -- A slot is uploaded again only when its block has changed;
+// -- Slot zero holds the default material for the tasks without material;
+*/
+struct DaoxMaterialSlot
+{
+	DaoxMaterial       *material;
+	uint_t              frame;   /* the last frame in which the slot was used; */
+	DaoxMaterialBlock   block;   /* shadow copy of the uploaded block; */
+};
+
+struct DaoxMaterialCache
+{
+	DaoxUniformBuffer  *buffer;
+	DMap               *slots;      /* <DaoxMaterial*,int>; */
+	DArray             *entries;    /* <DaoxMaterialSlot>; */
+	DArray             *freeSlots;  /* <int>; */
+};
+
+
+
+/*
+// Draw tasks prepared from a part of the scene:
+// -- Each job of the parallel preparation fills its own list without shared states;
+// -- The lists are merged in the order of the jobs, so the result does not depend
+//    on the scheduling of the jobs;
+// -- Emitters and skinning matrices are handled serially after the merging,
+//    because they modify states that might be shared by the scene nodes;
+*/
+struct DaoxDrawList
+{
+	uchar_t  serial;      /* prepared by the rendering thread; */
+	int      first;       /* the range of the top level nodes; */
+	int      last;
+
+	DList   *tasks;
+	DList   *tasks2;
+	DList   *canvases;
+	DList   *emitters;    /* deferred emitters; */
+	DList   *skeletons;   /* skeletons to update; */
+	DList   *taskCache;
+	DMap    *map;
+	DMap    *instanceTasks;  /* <DaoxMeshUnit*,DaoxDrawTask*>; */
+
+	DList   *chunks;      /* mesh chunks to be culled in batch; */
+	DList   *chunks2;
+	DArray  *boxes;       /* <DaoxOBBox3D>: world space bounding boxes for culling; */
+	DArray  *checks;      /* <int>: culling results of the boxes; */
+
+	uint_t   culledChunks;
+	uint_t   occludedChunks;
+};
+
+
+
+/*
+// Shadow copy of the uniforms, block ranges and texture bindings set by the last draw task,
+// which is used to skip the redundant state changes between draw tasks:
+*/
+struct DaoxRenderState
+{
+	uchar_t        valid;
+	int            objectSlot;
+	int            materialSlot;
+	float          tileTextureScale;
+	int            skinning;
+	int            particleType;
+	int            terrainTileType;
+	int            tileTextureCount;
+	int            hasTextures[3];  /* diffuse, emission and bump; */
+	int            boneOffset;
+	uint_t         textures[DAOX_TILE_TEXTURE6+1];
 };
 
 
@@ -63,8 +217,26 @@ struct DaoxRenderer
 
 	uchar_t  showAxis;
 	uchar_t  showMesh;
+	uchar_t  retainMeshes;
+	uchar_t  instancing;
+	uchar_t  parallel;
+	uchar_t  occlusion;
+	uchar_t  lod;
+	uchar_t  cpuSkinning;
+	uchar_t  depthPrepass;  /* depth-only pass for the opaque tasks; */
+	uchar_t  frontToBack;   /* sort the opaque tasks roughly front to back; */
+	uchar_t  particleScale; /* 1: full; 2: half; 4: quarter resolution for particles; */
+	uchar_t  compact;       /* compact vertex layout and 16-bit indices for the meshes; */
+	uchar_t  indirect;      /* batch the retained tasks of the same state into indirect draws; */
+	uchar_t  variants;      /* draw the mesh tasks with the specialized shader variants; */
+	uchar_t  streamTextures;  /* asynchronous texture uploads, on by default; */
+	uchar_t  hasDepthTexture;  /* uniforms of the current pass, set on each shader switch; */
+	uchar_t  depthOnly;
+	uint_t   frameIndex;
+	float    lodTolerance;  /* maximum projected LOD error in pixels; */
 
 	DaoxViewFrustum  frustum;
+	DaoxRenderState  state;
 
 	DaoxScene    *scene;
 	DaoxCamera   *camera;
@@ -75,16 +247,45 @@ struct DaoxRenderer
 
 	DaoxContext  *context;
 	DaoxShader   *shader;
+	DaoxShader   *current;  /* current program: the 3D shader, a variant or a screen shader; */
+	DaoxShader   *downsampleShader;  /* for the reduced resolution particles; */
+	DaoxShader   *compositeShader;   /* for the reduced resolution particles; */
 	DaoxBuffer   *buffer;
 	DaoxBuffer   *bufferSK;
 	DaoxBuffer   *bufferVG;
+	DaoxBuffer   *bufferRT;   /* retained buffer for static meshes; */
+
+	DaoxMeshStorage  *storage;
+	DaoxMeshStorage  *storageSK;
+
+	DaoxMaterialCache  *materials;
+	DaoxUniformBuffer  *objectBuffer;  /* object blocks of the draw tasks in the frame; */
 
 	DList   *tasks;
 	DList   *tasks2;
 	DList   *canvases;
 	DList   *taskCache;
 	DMap    *map;
+	DMap    *instanceTasks;  /* <DaoxMeshUnit*,DaoxDrawTask*>; */
+
+	DList           *drawLists;
+	DList           *visibleNodes;  /* top level nodes passing the scene BVH culling; */
+	DaoxThreadPool  *workers;
 
+	DaoxOcclusionBuffer  *occlusionBuffer;  /* for the optional occlusion culling; */
+	DaoxLightClusters    *lightClusters;    /* for the clustered forward lighting; */
+	DaoxProfiler         *profiler;
+
+	DMap    *boneOffsets;   /* <DaoxSkeleton*,int>: skeletons in the bone palette; */
+	DArray  *bonePalette;   /* <float>: skinning matrices of the frame, 3 rows each; */
+	DArray  *skinningPieces;  /* <DaoxSkinningPiece>; */
+	uint_t   boneTexture;
+
+	struct {
+		uint_t  lights;
+		uint_t  clusters;
+		uint_t  indices;
+	} lightTextures;
 };
 extern DaoType *daox_type_renderer;
 
@@ -93,8 +294,14 @@ void DaoxRenderer_Delete( DaoxRenderer *self );
 void DaoxRenderer_InitShaders( DaoxRenderer *self );
 void DaoxRenderer_InitBuffers( DaoxRenderer *self );
 void DaoxRenderer_Render( DaoxRenderer *self, DaoxScene *scene, DaoxCamera *cam );
+void DaoxRenderer_RetainMeshes( DaoxRenderer *self, int retain );
+void DaoxRenderer_UseCompactLayout( DaoxRenderer *self, int compact );
 
 void DaoxRenderer_SetCurrentCamera( DaoxRenderer *self, DaoxCamera *camera );
 DaoxCamera* DaoxRenderer_GetCurrentCamera( DaoxRenderer *self );
 
+/* Report the mesh units and materials held by the caches to the GC: */
+void DaoxMeshStorage_HandleGC( DaoxMeshStorage *self, DList *values, int remove );
+void DaoxMaterialCache_HandleGC( DaoxMaterialCache *self, DList *values, int remove );
+
 #endif
@@ -30,19 +30,28 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "dao_opengl.h"
 #include "dao_particle.h"
 #include "dao_scene.h"
+#include "dao_bvh.h"
+
 
 
 
 
 
+static uint_t daox_texture_ids = 0;
+static uint_t daox_material_ids = 0;
 
 DaoxTexture* DaoxTexture_New()
 {
 	DaoxTexture *self = (DaoxTexture*) dao_calloc( 1, sizeof(DaoxTexture) );
 	DaoCstruct_Init( (DaoCstruct*) self, daox_type_texture );
+	self->id = ++ daox_texture_ids;
 	return self;
 }
 void DaoxTexture_Delete( DaoxTexture *self )
@@ -54,6 +63,7 @@ void DaoxTexture_Delete( DaoxTexture *self )
 void DaoxTexture_SetImage( DaoxTexture *self, DaoImage *image )
 {
 	self->changed = 1;
+	self->translucent = 0;
 	GC_Assign( & self->image, image );
 }
 void DaoxTexture_LoadImage( DaoxTexture *self, const char *file )
@@ -61,6 +71,7 @@ void DaoxTexture_LoadImage( DaoxTexture *self, const char *file )
 	DaoImage *image = self->image;
 	int ok = 0;
 	self->changed = 1;
+	self->translucent = 0;
 	if( image == NULL || image->refCount > 1 ){
 		image = _DaoImage_New( _DaoImage_Type( DaoType_GetVmSpace( self->ctype ) ) );
 		DaoxTexture_SetImage( self, image );
@@ -68,6 +79,29 @@ void DaoxTexture_LoadImage( DaoxTexture *self, const char *file )
 	if( ok == 0 ) ok = _DaoImage_LoadPNG( self->image, file );
 	if( ok == 0 ) ok = _DaoImage_LoadBMP( self->image, file );
 }
+/*
+// Check (once) if the texture image has any pixel that is not fully opaque:
+*/
+int DaoxTexture_IsTranslucent( DaoxTexture *self )
+{
+	DaoImage *image = self->image;
+	int i, j;
+
+	if( self->translucent ) return self->translucent == 2;
+
+	self->translucent = 1;
+	if( image == NULL || image->depth != DAOX_IMAGE_BIT32 ) return 0;
+	for(i=0; i<image->height; ++i){
+		uchar_t *row = image->buffer.data.uchars + i * image->stride;
+		for(j=0; j<image->width; ++j){
+			if( row[4*j+3] < 255 ){
+				self->translucent = 2;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
 
 
 
@@ -77,6 +111,7 @@ DaoxMaterial* DaoxMaterial_New()
 {
 	DaoxMaterial *self = (DaoxMaterial*) dao_calloc( 1, sizeof(DaoxMaterial) );
 	DaoCstruct_Init( (DaoCstruct*) self, daox_type_material );
+	self->id = ++ daox_material_ids;
 	self->shininess = 2.0;
 	self->ambient = daox_black_color;
 	self->diffuse = daox_black_color;
@@ -111,6 +146,15 @@ void DaoxMaterial_SetTexture( DaoxMaterial *self, DaoxTexture *texture, int whic
 	case DAOX_BUMP_TEXTURE : GC_Assign( & self->bumpTexture, texture ); break;
 	}
 }
+/*
+// Materials that need alpha blending:
+*/
+int DaoxMaterial_IsTranslucent( DaoxMaterial *self )
+{
+	if( self->diffuse.alpha < 1.0 ) return 1;
+	if( self->diffuseTexture && DaoxTexture_IsTranslucent( self->diffuseTexture ) ) return 1;
+	return 0;
+}
 
 
 
@@ -288,11 +332,11 @@ static int CheckBox( DaoxVector3D point, DaoxVector3D norm, DaoxOBBox3D *box )
 
 	return C4;
 }
-int  DaoxViewFrustum_SphereCheck( DaoxViewFrustum *self, DaoxOBBox3D *box )
+static int DaoxViewFrustum_CheckSphere( DaoxViewFrustum *self, DaoxVector3D center, float radius )
 {
-	DaoxVector3D C = DaoxVector3D_Sub( & box->C, & self->cameraPosition );
+	DaoxVector3D C = DaoxVector3D_Sub( & center, & self->cameraPosition );
 	double D0 = DaoxVector3D_Dot( & C, & self->viewDirection );
-	double D1, D2, D3, D4, margin = box->R + EPSILON;
+	double D1, D2, D3, D4, margin = radius + EPSILON;
 	if( D0 > (self->far + margin) ) return -1;
 	if( D0 < (self->near - margin) ) return -1;
 	if( (D1 = DaoxVector3D_Dot( & C, & self->leftPlaneNorm )) > margin ) return -1;
@@ -302,11 +346,13 @@ int  DaoxViewFrustum_SphereCheck( DaoxViewFrustum *self, DaoxOBBox3D *box )
 	if( D0 > (self->near + margin) && D0 < (self->far - margin) && D1 < -margin && D2 < -margin && D3 < -margin && D4 < -margin ) return 1;
 	return 0;
 }
-int  DaoxViewFrustum_Visible( DaoxViewFrustum *self, DaoxOBBox3D *box )
+int  DaoxViewFrustum_SphereCheck( DaoxViewFrustum *self, DaoxOBBox3D *box )
+{
+	return DaoxViewFrustum_CheckSphere( self, box->C, box->R );
+}
+static int DaoxViewFrustum_BoxCheck( DaoxViewFrustum *self, DaoxOBBox3D *box )
 {
 	int C1, C2, C3, C4, C5, C6;
-	int C0 = DaoxViewFrustum_SphereCheck( self, box );
-	if( C0 != 0 ) return C0;
 
 	C1 = C2 = C3 = C4 = C5 = C6 = 0;
 	if( (C1 = CheckBox( self->nearViewCenter, self->viewDirection, box )) < 0 ) return -1;
@@ -318,6 +364,100 @@ int  DaoxViewFrustum_Visible( DaoxViewFrustum *self, DaoxOBBox3D *box )
 	if( C1 >= 0 && C2 <= 0 && C3 <= 0 && C4 <= 0 && C5 <= 0 && C6 <= 0 ) return 1;
 	return 0;
 }
+int  DaoxViewFrustum_Visible( DaoxViewFrustum *self, DaoxOBBox3D *box )
+{
+	int C0 = DaoxViewFrustum_SphereCheck( self, box );
+	if( C0 != 0 ) return C0;
+	return DaoxViewFrustum_BoxCheck( self, box );
+}
+
+#ifdef __SSE2__
+static __m128 DaoxSSE_Dot( __m128 X, __m128 Y, __m128 Z, DaoxVector3D *vector )
+{
+	__m128 dot = _mm_mul_ps( X, _mm_set1_ps( vector->x ) );
+	dot = _mm_add_ps( dot, _mm_mul_ps( Y, _mm_set1_ps( vector->y ) ) );
+	return _mm_add_ps( dot, _mm_mul_ps( Z, _mm_set1_ps( vector->z ) ) );
+}
+#endif
+
+/*
+// Check a batch of bounding spheres stored as separated arrays of the center
+// coordinates and the radii. With SSE, four spheres are classified at once.
+// The results are the same as DaoxViewFrustum_SphereCheck();
+*/
+void DaoxViewFrustum_CheckSpheres( DaoxViewFrustum *self, float *X, float *Y, float *Z, float *R, int *checks, int count )
+{
+	int i = 0, j;
+#ifdef __SSE2__
+	DaoxVector3D *planes[4];
+	__m128 camX = _mm_set1_ps( self->cameraPosition.x );
+	__m128 camY = _mm_set1_ps( self->cameraPosition.y );
+	__m128 camZ = _mm_set1_ps( self->cameraPosition.z );
+	__m128 nearPlane = _mm_set1_ps( self->near );
+	__m128 farPlane = _mm_set1_ps( self->far );
+	__m128 eps = _mm_set1_ps( EPSILON );
+
+	planes[0] = & self->leftPlaneNorm;
+	planes[1] = & self->rightPlaneNorm;
+	planes[2] = & self->topPlaneNorm;
+	planes[3] = & self->bottomPlaneNorm;
+	for(; (i+4)<=count; i+=4){
+		__m128 CX = _mm_sub_ps( _mm_loadu_ps( X + i ), camX );
+		__m128 CY = _mm_sub_ps( _mm_loadu_ps( Y + i ), camY );
+		__m128 CZ = _mm_sub_ps( _mm_loadu_ps( Z + i ), camZ );
+		__m128 margin = _mm_add_ps( _mm_loadu_ps( R + i ), eps );
+		__m128 margin2 = _mm_sub_ps( _mm_setzero_ps(), margin );
+		__m128 D0 = DaoxSSE_Dot( CX, CY, CZ, & self->viewDirection );
+		__m128 outside = _mm_cmpgt_ps( D0, _mm_add_ps( farPlane, margin ) );
+		__m128 inside = _mm_cmpgt_ps( D0, _mm_add_ps( nearPlane, margin ) );
+		int outMask, inMask;
+
+		outside = _mm_or_ps( outside, _mm_cmplt_ps( D0, _mm_sub_ps( nearPlane, margin ) ) );
+		inside = _mm_and_ps( inside, _mm_cmplt_ps( D0, _mm_sub_ps( farPlane, margin ) ) );
+		for(j=0; j<4; ++j){
+			__m128 D = DaoxSSE_Dot( CX, CY, CZ, planes[j] );
+			outside = _mm_or_ps( outside, _mm_cmpgt_ps( D, margin ) );
+			inside = _mm_and_ps( inside, _mm_cmplt_ps( D, margin2 ) );
+		}
+		outMask = _mm_movemask_ps( outside );
+		inMask = _mm_movemask_ps( inside );
+		for(j=0; j<4; ++j){
+			checks[i+j] = (outMask & (1<<j)) ? -1 : ((inMask >> j) & 1);
+		}
+	}
+#endif
+	for(; i<count; ++i){
+		DaoxVector3D center = DaoxVector3D_XYZ( X[i], Y[i], Z[i] );
+		checks[i] = DaoxViewFrustum_CheckSphere( self, center, R[i] );
+	}
+}
+/*
+// Check a batch of bounding boxes with the same results as DaoxViewFrustum_Visible().
+// The bounding spheres are gathered into blocks and checked together,
+// then only the boxes intersecting the frustum by the spheres are checked by planes;
+*/
+void DaoxViewFrustum_CheckBoxes( DaoxViewFrustum *self, DaoxOBBox3D *boxes, int *checks, int count )
+{
+	float X[DAOX_CULLING_BLOCK], Y[DAOX_CULLING_BLOCK];
+	float Z[DAOX_CULLING_BLOCK], R[DAOX_CULLING_BLOCK];
+	int i, j, n;
+
+	for(i=0; i<count; i+=DAOX_CULLING_BLOCK){
+		n = count - i;
+		if( n > DAOX_CULLING_BLOCK ) n = DAOX_CULLING_BLOCK;
+		for(j=0; j<n; ++j){
+			DaoxOBBox3D *box = boxes + i + j;
+			X[j] = box->C.x;
+			Y[j] = box->C.y;
+			Z[j] = box->C.z;
+			R[j] = box->R;
+		}
+		DaoxViewFrustum_CheckSpheres( self, X, Y, Z, R, checks + i, n );
+	}
+	for(i=0; i<count; ++i){
+		if( checks[i] == 0 ) checks[i] = DaoxViewFrustum_BoxCheck( self, boxes + i );
+	}
+}
 
 
 
@@ -377,6 +517,7 @@ void DaoxSceneNode_Init( DaoxSceneNode *self, DaoType *type, int renderable )
 	self->children = DList_New( DAO_DATA_VALUE );
 	self->scale = DaoxVector3D_XYZ( 1.0, 1.0, 1.0 );
 	self->rotation = self->translation = DaoxVector3D_XYZ( 0.0, 0.0, 0.0 );
+	self->cached = 0;
 }
 void DaoxSceneNode_Free( DaoxSceneNode *self )
 {
@@ -404,12 +545,14 @@ void DaoxSceneNode_MoveByXYZ( DaoxSceneNode *self, float dx, float dy, float dz
 	self->translation.x += dx;
 	self->translation.y += dy;
 	self->translation.z += dz;
+	DaoxSceneNode_MarkDirty( self );
 }
 void DaoxSceneNode_MoveXYZ( DaoxSceneNode *self, float x, float y, float z )
 {
 	self->translation.x = x;
 	self->translation.y = y;
 	self->translation.z = z;
+	DaoxSceneNode_MarkDirty( self );
 }
 void DaoxSceneNode_MoveBy( DaoxSceneNode *self, DaoxVector3D delta )
 {
@@ -419,7 +562,35 @@ void DaoxSceneNode_Move( DaoxSceneNode *self, DaoxVector3D pos )
 {
 	DaoxSceneNode_MoveXYZ( self, pos.x, pos.y, pos.z );
 }
-DaoxMatrix4D DaoxSceneNode_GetParentTransform( DaoxSceneNode *self )
+static void DaoxSceneNode_MarkWorldDirty( DaoxSceneNode *self )
+{
+	daoint i;
+	/*
+	// A world transform is only cached after the parent one is cached,
+	// so the descendants of a world-dirty node are all world-dirty:
+	*/
+	if( (self->cached & DAOX_WORLD_TRANSFORM) == 0 ) return;
+	self->cached &= ~DAOX_WORLD_TRANSFORM;
+	if( self->children == NULL ) return;
+	for(i=0; i<self->children->size; ++i){
+		DaoxSceneNode_MarkWorldDirty( self->children->items.pSceneNode[i] );
+	}
+}
+void DaoxSceneNode_MarkDirty( DaoxSceneNode *self )
+{
+	DaoxSceneNode *node;
+	self->cached &= ~DAOX_LOCAL_TRANSFORM;
+	DaoxSceneNode_MarkWorldDirty( self );
+	self->cached &= ~DAOX_WORLD_BOUNDS;
+	/*
+	// The bounds are updated for whole subtrees, so the ancestors of an ancestor
+	// with dirty bounds are dirty (but not necessarily those of this node):
+	*/
+	for(node=self->parent; node && (node->cached & DAOX_WORLD_BOUNDS); node=node->parent){
+		node->cached &= ~DAOX_WORLD_BOUNDS;
+	}
+}
+static DaoxMatrix4D DaoxSceneNode_ComputeLocalTransform( DaoxSceneNode *self )
 {
 	DaoxMatrix4D trans;
 
@@ -448,15 +619,26 @@ DaoxMatrix4D DaoxSceneNode_GetParentTransform( DaoxSceneNode *self )
 
 	return trans;
 }
+DaoxMatrix4D DaoxSceneNode_GetParentTransform( DaoxSceneNode *self )
+{
+	if( self->cached & DAOX_LOCAL_TRANSFORM ) return self->localTransform;
+	self->localTransform = DaoxSceneNode_ComputeLocalTransform( self );
+	self->cached |= DAOX_LOCAL_TRANSFORM;
+	return self->localTransform;
+}
 DaoxMatrix4D DaoxSceneNode_GetWorldTransform( DaoxSceneNode *self )
 {
-	DaoxMatrix4D transform = DaoxSceneNode_GetParentTransform( self );
-	DaoxSceneNode *node = self;
-	while( node->parent ){
-		DaoxMatrix4D trans = DaoxSceneNode_GetParentTransform( node->parent );
+	DaoxMatrix4D transform;
+
+	if( self->cached & DAOX_WORLD_TRANSFORM ) return self->worldTransform;
+
+	transform = DaoxSceneNode_GetParentTransform( self );
+	if( self->parent ){
+		DaoxMatrix4D trans = DaoxSceneNode_GetWorldTransform( self->parent );
 		transform = DaoxMatrix4D_Product( & trans, & transform );
-		node = node->parent;
 	}
+	self->worldTransform = transform;
+	self->cached |= DAOX_WORLD_TRANSFORM;
 	return transform;
 }
 DaoxVector3D DaoxSceneNode_GetWorldPosition( DaoxSceneNode *self )
@@ -469,6 +651,7 @@ void DaoxSceneNode_AddChild( DaoxSceneNode *self, DaoxSceneNode *child )
 {
 	GC_Assign( & child->parent, self );
 	DList_Append( self->children, child );
+	DaoxSceneNode_MarkDirty( child );
 }
 static int DaoxAnimation_Compare( void *first, void *second )
 {
@@ -508,6 +691,7 @@ void DaoxPointable_PointAt( DaoxPointable *self, DaoxVector3D pos )
 		DaoxQuaternion rot = DaoxQuaternion_FromAxisAngle( & axis, -angle );
 		rot = DaoxQuaternion_Product( & rot, & rotation );
 		self->base.rotation = DaoxQuaternion_ToRotation( & rot );
+		DaoxSceneNode_MarkDirty( (DaoxSceneNode*) self );
 	}
 }
 void DaoxPointable_PointAtXYZ( DaoxPointable *self, float x, float y, float z )
@@ -540,6 +724,7 @@ void DaoxPointable_Move( DaoxPointable *self, DaoxVector3D pos )
 		self->base.rotation = DaoxQuaternion_ToRotation( & rot );
 	}
 	self->base.translation = pos;
+	DaoxSceneNode_MarkDirty( (DaoxSceneNode*) self );
 
 	DaoxPointable_PointAt( self, self->targetPosition );
 }
@@ -652,6 +837,7 @@ void DaoxCamera_RotateBy( DaoxCamera *self, float alpha )
 	DaoxQuaternion rotation2 = DaoxQuaternion_FromAxisAngle( & cameraDirection, alpha );
 	rotation = DaoxQuaternion_Product( & rotation2, & rotation );
 	self->base.rotation = DaoxQuaternion_ToRotation( & rotation );
+	DaoxSceneNode_MarkDirty( (DaoxSceneNode*) self );
 }
 void DaoxCamera_Orient( DaoxCamera *self, int xyz )
 {
@@ -709,6 +895,7 @@ void DaoxLight_CopyFrom( DaoxLight *self, DaoxLight *other )
 {
 	self->targetPosition = other->targetPosition;
 	self->intensity = other->intensity;
+	self->range = other->range;
 }
 
 void DaoxLight_Move( DaoxLight *self, DaoxVector3D pos )
@@ -785,6 +972,75 @@ void DaoxSkeleton_UpdateSkinningMatrices( DaoxSkeleton *self )
 		self->skinMats2->data.matrices4d[i] = DaoxMatrix4D_Product( & world, & mat );;
 	}
 }
+/*
+// Skin the vertices [first,last) of the unit on the CPU by the current skinning
+// matrices, in the same way as the vertex shader does:
+// -- The positions are transformed by "objectToWorld" before blending, so the
+//    skinned positions are in the world space;
+// -- The normals are blended without "objectToWorld", and the tangents are copied;
+*/
+void DaoxSkeleton_SkinVertices( DaoxSkeleton *self, DaoxMeshUnit *unit, DaoxMatrix4D *objectToWorld, int first, int last, DaoxVertex *output )
+{
+	DaoxMatrix4D *mats = self->skinMats2->data.matrices4d;
+	int count = self->skinMats2->size;
+	int i, k;
+
+	if( last > unit->vertices->size ) last = unit->vertices->size;
+	if( last > unit->skinParams->size ) last = unit->skinParams->size;
+	for(k=first; k<last; ++k, ++output){
+		DaoxVertex *vertex = unit->vertices->data.vertices + k;
+		DaoxSkinParam *param = unit->skinParams->data.skinparams + k;
+		DaoxVector3D pos = DaoxMatrix4D_MulVector( objectToWorld, & vertex->pos, 1.0 );
+#ifdef __SSE2__
+		__m128 row0 = _mm_setzero_ps();
+		__m128 row1 = _mm_setzero_ps();
+		__m128 row2 = _mm_setzero_ps();
+		__m128 row3 = _mm_setzero_ps();
+		float res[4];
+
+		for(i=0; i<4; ++i){
+			int joint = param->joints[i];
+			__m128 weight = _mm_set1_ps( param->weights[i] );
+			float *mat;
+			if( param->weights[i] == 0.0 || joint < 0 || joint >= count ) continue;
+			mat = (float*) (mats + joint);
+			row0 = _mm_add_ps( row0, _mm_mul_ps( weight, _mm_loadu_ps( mat ) ) );
+			row1 = _mm_add_ps( row1, _mm_mul_ps( weight, _mm_loadu_ps( mat + 4 ) ) );
+			row2 = _mm_add_ps( row2, _mm_mul_ps( weight, _mm_loadu_ps( mat + 8 ) ) );
+		}
+		/* Transpose the blended rows to columns, then row3 holds the translation: */
+		_MM_TRANSPOSE4_PS( row0, row1, row2, row3 );
+		_mm_storeu_ps( res, _mm_add_ps( _mm_add_ps( _mm_mul_ps( row0, _mm_set1_ps( pos.x ) ),
+						_mm_mul_ps( row1, _mm_set1_ps( pos.y ) ) ),
+					_mm_add_ps( _mm_mul_ps( row2, _mm_set1_ps( pos.z ) ), row3 ) ) );
+		output->pos.x = res[0];
+		output->pos.y = res[1];
+		output->pos.z = res[2];
+		_mm_storeu_ps( res, _mm_add_ps( _mm_add_ps( _mm_mul_ps( row0, _mm_set1_ps( vertex->norm.x ) ),
+						_mm_mul_ps( row1, _mm_set1_ps( vertex->norm.y ) ) ),
+					_mm_mul_ps( row2, _mm_set1_ps( vertex->norm.z ) ) ) );
+		output->norm.x = res[0];
+		output->norm.y = res[1];
+		output->norm.z = res[2];
+#else
+		DaoxMatrix4D blend;
+		float *B = (float*) & blend;
+
+		memset( & blend, 0, sizeof(DaoxMatrix4D) );
+		for(i=0; i<4; ++i){
+			int j, joint = param->joints[i];
+			float *mat, weight = param->weights[i];
+			if( weight == 0.0 || joint < 0 || joint >= count ) continue;
+			mat = (float*) (mats + joint);
+			for(j=0; j<12; ++j) B[j] += weight * mat[j];
+		}
+		output->pos = DaoxMatrix4D_MulVector( & blend, & pos, 1.0 );
+		output->norm = DaoxMatrix4D_MulVector( & blend, & vertex->norm, 0.0 );
+#endif
+		output->tan = vertex->tan;
+		output->tex = vertex->tex;
+	}
+}
 
 
 
@@ -801,6 +1057,7 @@ void DaoxModel_Init( DaoxModel *self, DaoType *type, DaoxMesh *mesh )
 	DaoxSceneNode_Init( (DaoxSceneNode*) self, type, 1 );
 	DaoxModel_SetMesh( self, mesh );
 	self->skeleton = NULL;
+	self->occluder = 0;
 }
 void DaoxModel_Free( DaoxModel *self )
 {
@@ -817,6 +1074,7 @@ void DaoxModel_SetMesh( DaoxModel *self, DaoxMesh *mesh )
 {
 	GC_Assign( & self->mesh, mesh );
 	if( mesh ) self->base.obbox = mesh->obbox;
+	DaoxSceneNode_MarkDirty( (DaoxSceneNode*) self );
 }
 
 
@@ -837,6 +1095,7 @@ void DaoxScene_Delete( DaoxScene *self )
 {
 	if( self->pathCache ) GC_DecRC( self->pathCache );
 	_DaoRandGenerator_Delete( self->randGenerator );
+	if( self->bvh ) DaoxSceneBVH_Delete( self->bvh );
 	DaoCstruct_Free( (DaoCstruct*) self );
 	DList_Delete( self->nodes );
 	DList_Delete( self->lights );
@@ -846,6 +1105,7 @@ void DaoxScene_Delete( DaoxScene *self )
 void DaoxScene_AddNode( DaoxScene *self, DaoxSceneNode *node )
 {
 	DList_Append( self->nodes, node );
+	self->changes += 1;
 	if( node->ctype == daox_type_light ) DList_Append( self->lights, node );
 	if( node->ctype == daox_type_camera ) self->camera = (DaoxCamera*) node;
 }
@@ -857,7 +1117,10 @@ void DaoxScene_UpdateNode( DaoxScene *self, DaoxSceneNode *node, float dtime )
 		DaoxSceneNode *node2 = node->children->items.pSceneNode[i];
 		DaoxScene_UpdateNode( self, node2, dtime );
 	}
-	if( node->controller ) DaoxController_Update( node->controller, dtime );
+	if( node->controller && node->controller->animations ){
+		DaoxController_Update( node->controller, dtime );
+		DaoxSceneNode_MarkDirty( node );
+	}
 	if( DaoType_ChildOf( node->ctype, daox_type_emitter ) ){
 		DaoxEmitter *emitter = (DaoxEmitter*) node;
 		emitter->randGenerator = self->randGenerator;
@@ -874,4 +1137,24 @@ void DaoxScene_Update( DaoxScene *self, float dtime )
 	}
 }
 
+static void DaoxSceneNode_MakeLODs( DaoxSceneNode *self, int levels )
+{
+	int i;
+	for(i=0; i<self->children->size; ++i){
+		DaoxSceneNode_MakeLODs( self->children->items.pSceneNode[i], levels );
+	}
+	if( self->ctype == daox_type_model ){
+		DaoxMesh *mesh = ((DaoxModel*) self)->mesh;
+		/* Units of meshes shared by several models are only simplified once: */
+		if( mesh != NULL ) DaoxMesh_MakeLODs( mesh, levels );
+	}
+}
+void DaoxScene_MakeLODs( DaoxScene *self, int levels )
+{
+	int i;
+	for(i=0; i<self->nodes->size; ++i){
+		DaoxSceneNode_MakeLODs( self->nodes->items.pSceneNode[i], levels );
+	}
+}
+
 
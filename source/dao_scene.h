@@ -51,6 +51,7 @@ typedef struct DaoxLight       DaoxLight;
 typedef struct DaoxJoint       DaoxJoint;
 typedef struct DaoxModel       DaoxModel;
 typedef struct DaoxScene       DaoxScene;
+typedef struct DaoxSceneBVH    DaoxSceneBVH;
 
 
 
@@ -81,10 +82,17 @@ struct DaoxTexture
 {
 	DAO_CSTRUCT_COMMON;
 
+	uint_t      id;           /* in creation order, a stable key for sorting; */
 	uint_t      tid;
 	uint_t      changed;
+	uint_t      translucent;  /* 0: not checked; 1: opaque; 2: translucent; */
+	uint_t      normalMap;    /* used as a bump texture (for the compression format); */
+	uint_t      format;       /* DaoxTextureFormat of the GL texture; */
+	uint_t      lastUse;      /* frame of the last use, for the eviction; */
+	daoint      memory;       /* GPU memory of the GL texture; */
 	DaoImage   *image;
 	void       *ctx;
+	void       *job;          /* streaming job (DaoxTextureJob), if any; */
 };
 extern DaoType *daox_type_texture;
 
@@ -92,6 +100,7 @@ DaoxTexture* DaoxTexture_New();
 void DaoxTexture_Delete( DaoxTexture *self );
 void DaoxTexture_SetImage( DaoxTexture *self, DaoImage *image );
 void DaoxTexture_LoadImage( DaoxTexture *self, const char *file );
+int DaoxTexture_IsTranslucent( DaoxTexture *self );
 
 
 
@@ -101,6 +110,8 @@ struct DaoxMaterial
 {
 	DAO_CSTRUCT_COMMON;
 
+	uint_t     id;  /* in creation order, a stable key for sorting; */
+
 	DaoxColor  ambient;
 	DaoxColor  diffuse;
 	DaoxColor  specular;
@@ -125,12 +136,15 @@ void DaoxMaterial_Delete( DaoxMaterial *self );
 
 void DaoxMaterial_CopyFrom( DaoxMaterial *self, DaoxMaterial *other );
 void DaoxMaterial_SetTexture( DaoxMaterial *self, DaoxTexture *texture, int which );
+int DaoxMaterial_IsTranslucent( DaoxMaterial *self );
 
 
 
 
 typedef struct DaoxViewFrustum  DaoxViewFrustum;
 
+#define DAOX_CULLING_BLOCK  64
+
 struct DaoxViewFrustum
 {
 	float  left;
@@ -159,6 +173,8 @@ struct DaoxViewFrustum
 
 void DaoxViewFrustum_Init( DaoxViewFrustum *self, DaoxCamera *camera );
 int  DaoxViewFrustum_Visible( DaoxViewFrustum *self, DaoxOBBox3D *box );
+void DaoxViewFrustum_CheckSpheres( DaoxViewFrustum *self, float *X, float *Y, float *Z, float *R, int *checks, int count );
+void DaoxViewFrustum_CheckBoxes( DaoxViewFrustum *self, DaoxOBBox3D *boxes, int *checks, int count );
 DaoxViewFrustum DaoxViewFrustum_Transform( DaoxViewFrustum *self, DaoxMatrix4D *transform );
 double DaoxViewFrustum_Difference( DaoxViewFrustum *self, DaoxViewFrustum *other );
 
@@ -175,11 +191,19 @@ void DaoxController_Delete( DaoxController *self );
 
 
 
+enum DaoxTransformCache
+{
+	DAOX_LOCAL_TRANSFORM = 1 ,  /* localTransform is up to date; */
+	DAOX_WORLD_TRANSFORM = 2 ,  /* worldTransform is up to date; */
+	DAOX_WORLD_BOUNDS    = 4    /* the subtree bounds in DaoxSceneBVH are up to date; */
+};
+
 struct DaoxSceneNode
 {
 	DAO_CSTRUCT_COMMON;
 
 	uchar_t  renderable;
+	uchar_t  cached;  /* DaoxTransformCache flags; zero means all dirty; */
 
 	DaoxOBBox3D     obbox;        /* local space; */
 	DaoxVector3D    scale;        /* local space; */
@@ -188,6 +212,9 @@ struct DaoxSceneNode
 	DaoxController *controller;   /* control for additional transform; */
 	DaoxSceneNode  *parent;
 	DList          *children;
+
+	DaoxMatrix4D    localTransform;  /* cached, local to parent space; */
+	DaoxMatrix4D    worldTransform;  /* cached, local to world space; */
 };
 extern DaoType *daox_type_scene_node;
 
@@ -206,6 +233,13 @@ void DaoxSceneNode_Move( DaoxSceneNode *self, DaoxVector3D pos );
 
 void DaoxSceneNode_SortAnimations( DaoxSceneNode *self );
 
+/*
+// Invalidate the cached transforms of the node and the world transforms
+// of its descendants, and the bounds of its ancestors. It must be called
+// after modifying the scale, rotation, translation or bounding box of a node.
+*/
+void DaoxSceneNode_MarkDirty( DaoxSceneNode *self );
+
 DaoxMatrix4D DaoxSceneNode_GetParentTransform( DaoxSceneNode *self );
 DaoxMatrix4D DaoxSceneNode_GetWorldTransform( DaoxSceneNode *self );
 
@@ -263,6 +297,7 @@ struct DaoxLight
 	DaoxVector3D   targetPosition;
 	DaoxColor      intensity;
 	uint_t         lightType;
+	float          range;  /* influence radius, zero for unbounded lights; */
 };
 extern DaoType *daox_type_light;
 
@@ -304,6 +339,7 @@ extern DaoType *daox_type_skeleton;
 DaoxSkeleton* DaoxSkeleton_New();
 void DaoxSkeleton_Delete( DaoxSkeleton *self );
 void DaoxSkeleton_UpdateSkinningMatrices( DaoxSkeleton *self );
+void DaoxSkeleton_SkinVertices( DaoxSkeleton *self, DaoxMeshUnit *unit, DaoxMatrix4D *objectToWorld, int first, int last, DaoxVertex *output );
 
 
 
@@ -313,6 +349,7 @@ struct DaoxModel
 	DaoxSceneNode  base;
 	DaoxMesh      *mesh;
 	DaoxSkeleton  *skeleton;
+	uchar_t        occluder;  /* rasterized for occlusion culling; */
 };
 extern DaoType *daox_type_model;
 
@@ -335,9 +372,12 @@ struct DaoxScene
 
 	DList  *nodes;
 	DList  *lights;
+	uint_t  changes;  /* changes of the top level nodes (adding or removing); */
 
 	DaoxPathCache *pathCache;
 	DaoRandGenerator  *randGenerator;
+
+	DaoxSceneBVH  *bvh;  /* for culling, created by the renderer; */
 };
 extern DaoType *daox_type_scene;
 
@@ -349,6 +389,7 @@ void DaoxScene_AddMaterial( DaoxScene *self, DString *name, DaoxMaterial *materi
 
 void DaoxScene_UpdateNode( DaoxScene *self, DaoxSceneNode *node, float dtime );
 void DaoxScene_Update( DaoxScene *self, float dtime );
+void DaoxScene_MakeLODs( DaoxScene *self, int levels );
 
 
 #endif
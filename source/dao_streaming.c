@@ -0,0 +1,645 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dao_streaming.h"
+
+
+
+static DaoxTextureJob* DaoxTextureJob_New( DaoxTexture *texture, int format, DString *cache )
+{
+	DaoxTextureJob *self = (DaoxTextureJob*) dao_calloc( 1, sizeof(DaoxTextureJob) );
+	int width = texture->image->width;
+	int height = texture->image->height;
+
+	self->texture = texture;
+	self->image = texture->image;
+	self->format = format;
+	if( format != DAOX_TEXTURE_RGBA8 && cache != NULL && cache->size ){
+		self->cache = DString_Copy( cache );
+	}
+	GC_IncRC( self->texture );
+	GC_IncRC( self->image );
+	while( self->levels < DAOX_MAX_MIPMAPS ){
+		int i = self->levels ++;
+		self->widths[i] = width;
+		self->heights[i] = height;
+		self->offsets[i+1] = self->offsets[i] + DaoxTextureFormat_LevelSize( format, width, height );
+		if( width == 1 && height == 1 ) break;
+		if( width > 1 ) width /= 2;
+		if( height > 1 ) height /= 2;
+	}
+	self->level = self->levels - 1;
+	return self;
+}
+static void DaoxTextureJob_Delete( DaoxTextureJob *self )
+{
+	if( self->tid && self->swapped == 0 ) glDeleteTextures( 1, & self->tid );
+	if( self->texture->job == self ) self->texture->job = NULL;
+	if( self->pixels ) dao_free( self->pixels );
+	if( self->cache ) DString_Delete( self->cache );
+	GC_DecRC( self->texture );
+	GC_DecRC( self->image );
+	dao_free( self );
+}
+/*
+// Convert the image to RGBA, and generate the mip chain with a box filter
+// (the last row or column is repeated for the odd sizes):
+*/
+static uchar_t* DaoxTextureJob_MakeMipmaps( DaoxTextureJob *self, daoint offsets[] )
+{
+	DaoImage *image = self->image;
+	int bytes = image->depth == DAOX_IMAGE_BIT32 ? 4 : 3;
+	int i, j, k, level;
+	uchar_t *pixels;
+
+	offsets[0] = 0;
+	for(level=0; level<self->levels; ++level){
+		offsets[level+1] = offsets[level] + 4 * (daoint) self->widths[level] * self->heights[level];
+	}
+	pixels = (uchar_t*) dao_malloc( offsets[self->levels] );
+	for(i=0; i<image->height; ++i){
+		uchar_t *src = image->buffer.data.uchars + i * image->stride;
+		uchar_t *dest = pixels + 4 * (daoint) i * image->width;
+		for(j=0; j<image->width; ++j, src += bytes, dest += 4){
+			dest[0] = src[0];
+			dest[1] = src[1];
+			dest[2] = src[2];
+			dest[3] = bytes == 4 ? src[3] : 255;
+		}
+	}
+	for(level=1; level<self->levels; ++level){
+		int W = self->widths[level-1], H = self->heights[level-1];
+		int w = self->widths[level], h = self->heights[level];
+		uchar_t *src = pixels + offsets[level-1];
+		uchar_t *dest = pixels + offsets[level];
+		for(i=0; i<h; ++i){
+			uchar_t *row1 = src + 4 * (daoint) W * (2*i < H ? 2*i : H-1);
+			uchar_t *row2 = src + 4 * (daoint) W * (2*i+1 < H ? 2*i+1 : H-1);
+			for(j=0; j<w; ++j){
+				int x1 = 4 * (2*j < W ? 2*j : W-1);
+				int x2 = 4 * (2*j+1 < W ? 2*j+1 : W-1);
+				for(k=0; k<4; ++k){
+					int sum = row1[x1+k] + row1[x2+k] + row2[x1+k] + row2[x2+k];
+					*dest++ = (sum + 2) >> 2;
+				}
+			}
+		}
+	}
+	return pixels;
+}
+/*
+// Generate the mip chain and compress its levels into the format of the job:
+*/
+static void DaoxTextureJob_Compress( DaoxTextureJob *self, DaoxThreadPool *workers )
+{
+	daoint offsets[DAOX_MAX_MIPMAPS+1];
+	uchar_t *rgba = DaoxTextureJob_MakeMipmaps( self, offsets );
+	int level;
+
+	if( self->format == DAOX_TEXTURE_RGBA8 ){
+		self->pixels = rgba;
+		return;
+	}
+	self->pixels = (uchar_t*) dao_malloc( self->offsets[self->levels] );
+	for(level=0; level<self->levels; ++level){
+		int width = self->widths[level], height = self->heights[level];
+		uchar_t *dest = self->pixels + self->offsets[level];
+		DaoxTextureFormat_Compress( self->format, rgba + offsets[level], width, height, dest, workers );
+	}
+	dao_free( rgba );
+}
+
+
+/*
+// Texture cache:
+// The compressed levels are saved in the cache directory, in files named by
+// a hash (FNV-1a) of the image content, its size and depth, and the format.
+// A file starts with a magic string, followed by the format, the size and
+// the number of levels (as 32-bit integers), and then the levels.
+*/
+#define DAOX_TEXTURE_CACHE_MAGIC  "DAOXTEX1"
+
+static void DaoxTextureJob_HashBytes( unsigned long long *hash, const uchar_t *bytes, daoint count )
+{
+	daoint i;
+	for(i=0; i<count; ++i){
+		*hash ^= bytes[i];
+		*hash *= 1099511628211ULL;
+	}
+}
+static int DaoxTextureJob_GetCacheFile( DaoxTextureJob *self, DString *file )
+{
+	DaoImage *image = self->image;
+	unsigned long long hash = 14695981039346656037ULL;
+	int bytes = image->depth == DAOX_IMAGE_BIT32 ? 4 : 3;
+	int header[4];
+	char name[32];
+	int i;
+
+	if( self->cache == NULL ) return 0;
+	header[0] = self->format;
+	header[1] = image->width;
+	header[2] = image->height;
+	header[3] = image->depth;
+	DaoxTextureJob_HashBytes( & hash, (uchar_t*) header, sizeof(header) );
+	for(i=0; i<image->height; ++i){
+		uchar_t *row = image->buffer.data.uchars + i * image->stride;
+		DaoxTextureJob_HashBytes( & hash, row, bytes * (daoint) image->width );
+	}
+	sprintf( name, "/%016llx.tex", hash );
+	DString_Assign( file, self->cache );
+	DString_AppendChars( file, name );
+	return 1;
+}
+static void DaoxTextureJob_GetCacheHeader( DaoxTextureJob *self, int header[4] )
+{
+	header[0] = self->format;
+	header[1] = self->widths[0];
+	header[2] = self->heights[0];
+	header[3] = self->levels;
+}
+static int DaoxTextureJob_LoadCache( DaoxTextureJob *self )
+{
+	DString *file = DString_New();
+	daoint size = self->offsets[self->levels];
+	int header[4], header2[4];
+	char magic[8];
+	int ok = 0;
+	FILE *fin;
+
+	if( DaoxTextureJob_GetCacheFile( self, file ) == 0 ) goto Done;
+	fin = fopen( DString_GetData( file ), "rb" );
+	if( fin == NULL ) goto Done;
+	DaoxTextureJob_GetCacheHeader( self, header );
+	if( fread( magic, 1, 8, fin ) == 8 && memcmp( magic, DAOX_TEXTURE_CACHE_MAGIC, 8 ) == 0
+			&& fread( header2, sizeof(int), 4, fin ) == 4
+			&& memcmp( header, header2, sizeof(header) ) == 0 ){
+		self->pixels = (uchar_t*) dao_malloc( size );
+		ok = fread( self->pixels, 1, size, fin ) == (size_t) size;
+		if( ok == 0 ){
+			dao_free( self->pixels );
+			self->pixels = NULL;
+		}
+	}
+	fclose( fin );
+Done:
+	DString_Delete( file );
+	return ok;
+}
+static void DaoxTextureJob_SaveCache( DaoxTextureJob *self )
+{
+	DString *file = DString_New();
+	DString *temp = DString_New();
+	int header[4];
+	FILE *fout;
+
+	if( DaoxTextureJob_GetCacheFile( self, file ) == 0 ) goto Done;
+	/* Write to a temporary file first, so that no partial file is loaded: */
+	DString_Assign( temp, file );
+	DString_AppendChars( temp, ".tmp" );
+	fout = fopen( DString_GetData( temp ), "wb" );
+	if( fout == NULL ) goto Done;
+	DaoxTextureJob_GetCacheHeader( self, header );
+	fwrite( DAOX_TEXTURE_CACHE_MAGIC, 1, 8, fout );
+	fwrite( header, sizeof(int), 4, fout );
+	fwrite( self->pixels, 1, self->offsets[self->levels], fout );
+	if( fclose( fout ) == 0 ){
+		remove( DString_GetData( file ) );
+		rename( DString_GetData( temp ), DString_GetData( file ) );
+	}else{
+		remove( DString_GetData( temp ) );
+	}
+Done:
+	DString_Delete( file );
+	DString_Delete( temp );
+}
+
+/*
+// Prepare the pixels of the job for uploading (run by the streaming thread):
+*/
+static void DaoxTextureStreamer_Process( DaoxTextureStreamer *self, DaoxTextureJob *job )
+{
+	if( job->format == DAOX_TEXTURE_RGBA8 ){
+		DaoxTextureJob_Compress( job, NULL );
+		return;
+	}
+	if( DaoxTextureJob_LoadCache( job ) ) return;
+	if( self->workers == NULL ) self->workers = DaoxThreadPool_New(0);
+	DaoxTextureJob_Compress( job, self->workers );
+	DaoxTextureJob_SaveCache( job );
+}
+
+
+#ifdef DAO_WITH_THREAD
+static void DaoxTextureStreamer_Loop( void *p )
+{
+	DaoxTextureStreamer *self = (DaoxTextureStreamer*) p;
+
+	DMutex_Lock( & self->mutex );
+	while( self->quit == 0 ){
+		DaoxTextureJob *job;
+		if( self->pending->size == 0 ){
+			DCondVar_Wait( & self->condv, & self->mutex );
+			continue;
+		}
+		job = (DaoxTextureJob*) DList_Front( self->pending );
+		DList_PopFront( self->pending );
+		self->working = job;
+		DMutex_Unlock( & self->mutex );
+
+		DaoxTextureStreamer_Process( self, job );
+
+		DMutex_Lock( & self->mutex );
+		job->ready = 1;
+		self->working = NULL;
+		DCondVar_BroadCast( & self->condv2 );
+	}
+	DMutex_Unlock( & self->mutex );
+}
+#endif
+
+
+DaoxTextureStreamer* DaoxTextureStreamer_New( DaoxContext *context )
+{
+	DaoxTextureStreamer *self = (DaoxTextureStreamer*) dao_calloc( 1, sizeof(DaoxTextureStreamer) );
+	self->context = context;
+	self->jobs = DList_New(0);
+	self->lru = DList_New(0);
+	self->chunks = DArray_New( sizeof(DaoxTextureChunk) );
+	self->budget = DAOX_TEXTURE_BUDGET;
+	self->upload = DAOX_TEXTURE_UPLOAD;
+	self->compression = 1;
+	self->formats = -1;
+#ifdef DAO_WITH_THREAD
+	DMutex_Init( & self->mutex );
+	DCondVar_Init( & self->condv );
+	DCondVar_Init( & self->condv2 );
+	self->pending = DList_New(0);
+#endif
+	return self;
+}
+void DaoxTextureStreamer_Delete( DaoxTextureStreamer *self )
+{
+	DaoxTextureStreamer_Clear( self );
+#ifdef DAO_WITH_THREAD
+	if( self->started ){
+		DMutex_Lock( & self->mutex );
+		self->quit = 1;
+		DCondVar_BroadCast( & self->condv );
+		DMutex_Unlock( & self->mutex );
+		DThread_Join( & self->thread );
+		DThread_Destroy( & self->thread );
+	}
+	DMutex_Destroy( & self->mutex );
+	DCondVar_Destroy( & self->condv );
+	DCondVar_Destroy( & self->condv2 );
+	DList_Delete( self->pending );
+#endif
+	if( self->workers ) DaoxThreadPool_Delete( self->workers );
+	DList_Delete( self->jobs );
+	DList_Delete( self->lru );
+	DArray_Delete( self->chunks );
+	dao_free( self );
+}
+void DaoxTextureStreamer_Clear( DaoxTextureStreamer *self )
+{
+	int i;
+
+#ifdef DAO_WITH_THREAD
+	DMutex_Lock( & self->mutex );
+	DList_Clear( self->pending );
+	while( self->working ) DCondVar_Wait( & self->condv2, & self->mutex );
+	DMutex_Unlock( & self->mutex );
+#endif
+	for(i=0; i<self->jobs->size; ++i){
+		DaoxTextureJob_Delete( (DaoxTextureJob*) self->jobs->items.pVoid[i] );
+	}
+	DList_Clear( self->jobs );
+	if( self->pixelBuffer ) glDeleteBuffers( 1, & self->pixelBuffer );
+	self->pixelBuffer = 0;
+	self->formats = -1;
+}
+
+/*
+// The job may be in use by the streaming thread or the uploading,
+// so it is only marked for deletion in the next update:
+*/
+void DaoxTextureStreamer_Cancel( DaoxTextureStreamer *self, DaoxTextureJob *job )
+{
+	int i;
+
+	job->stale = 1;
+	if( job->texture->job == job ) job->texture->job = NULL;
+#ifdef DAO_WITH_THREAD
+	DMutex_Lock( & self->mutex );
+	for(i=0; i<self->pending->size; ++i){
+		if( self->pending->items.pVoid[i] != job ) continue;
+		DList_Erase( self->pending, i, 1 );
+		job->ready = 1;  /* Never generated; */
+		break;
+	}
+	DMutex_Unlock( & self->mutex );
+#endif
+}
+
+/*
+// S3TC is an extension in desktop GL (but widely supported), RGTC is core
+// since GL 3.0, and ETC2 is core in GLES 3.0:
+*/
+static void DaoxTextureStreamer_CheckFormats( DaoxTextureStreamer *self )
+{
+#ifdef DAO_GRAPHICS_USE_GLES
+	self->formats = (1<<DAOX_TEXTURE_ETC2_RGB) | (1<<DAOX_TEXTURE_ETC2_RGBA);
+#else
+	GLint i, count = 0;
+
+	self->formats = 1<<DAOX_TEXTURE_BC5;
+	glGetIntegerv( GL_NUM_EXTENSIONS, & count );
+	for(i=0; i<count; ++i){
+		const char *name = (const char*) glGetStringi( GL_EXTENSIONS, i );
+		if( name == NULL || strcmp( name, "GL_EXT_texture_compression_s3tc" ) != 0 ) continue;
+		self->formats |= (1<<DAOX_TEXTURE_BC1) | (1<<DAOX_TEXTURE_BC3);
+		break;
+	}
+#endif
+}
+/*
+// BC3 or ETC2 with EAC alpha for the translucent textures, BC5 (with the
+// normal Z component reconstructed in the shader) for the normal maps,
+// and BC1 or ETC2 for the others:
+*/
+static int DaoxTextureStreamer_GetFormat( DaoxTextureStreamer *self, DaoxTexture *texture )
+{
+	int format;
+
+	if( self->compression == 0 ) return DAOX_TEXTURE_RGBA8;
+	if( self->formats < 0 ) DaoxTextureStreamer_CheckFormats( self );
+#ifdef DAO_GRAPHICS_USE_GLES
+	format = DAOX_TEXTURE_ETC2_RGB;
+	if( DaoxTexture_IsTranslucent( texture ) ) format = DAOX_TEXTURE_ETC2_RGBA;
+#else
+	format = DAOX_TEXTURE_BC1;
+	if( texture->normalMap ){
+		format = DAOX_TEXTURE_BC5;
+	}else if( DaoxTexture_IsTranslucent( texture ) ){
+		format = DAOX_TEXTURE_BC3;
+	}
+#endif
+	if( self->formats & (1<<format) ) return format;
+	return DAOX_TEXTURE_RGBA8;
+}
+
+uint_t DaoxTextureStreamer_Request( DaoxTextureStreamer *self, DaoxTexture *texture )
+{
+	DaoxContext *ctx = self->context;
+	DaoImage *image = texture->image;
+	DaoxTextureJob *job;
+
+	texture->lastUse = self->frameIndex;
+	if( texture->changed == 0 && (texture->job || (texture->ctx == ctx && texture->tid)) ){
+		return texture->tid;
+	}
+	if( image == NULL || image->width == 0 || image->height == 0 ) return 0;
+	if( image->depth != DAOX_IMAGE_BIT24 && image->depth != DAOX_IMAGE_BIT32 ) return 0;
+
+	if( texture->ctx != ctx ){
+		if( texture->tid ) DaoxTexture_Free( texture );
+		DList_Append( ctx->textures, texture );
+		texture->ctx = ctx;
+	}
+	if( texture->job ) DaoxTextureStreamer_Cancel( self, (DaoxTextureJob*) texture->job );
+	texture->changed = 0;
+
+	job = DaoxTextureJob_New( texture, DaoxTextureStreamer_GetFormat( self, texture ), ctx->textureCache );
+	texture->job = job;
+	DList_Append( self->jobs, job );
+
+#ifdef DAO_WITH_THREAD
+	if( self->started == 0 ){
+		DThread_Init( & self->thread );
+		self->started = DThread_Start( & self->thread, DaoxTextureStreamer_Loop, self ) != 0;
+		if( self->started == 0 ) DThread_Destroy( & self->thread );
+	}
+	if( self->started ){
+		DMutex_Lock( & self->mutex );
+		DList_Append( self->pending, job );
+		DCondVar_Signal( & self->condv );
+		DMutex_Unlock( & self->mutex );
+		return texture->tid;
+	}
+#endif
+	DaoxTextureStreamer_Process( self, job );
+	job->ready = 1;
+	return texture->tid;
+}
+
+/*
+// Allocate all the levels of the new GL texture, so that it is complete
+// for any base level (this must be done without the pixel buffer bound);
+// The compressed levels are allocated by their uploading, which goes from
+// the coarsest level to the finest one, following the base level:
+*/
+static void DaoxTextureJob_InitTexture( DaoxTextureJob *self )
+{
+	int i;
+
+	glGenTextures( 1, & self->tid );
+	glBindTexture( GL_TEXTURE_2D, self->tid );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, self->levels - 1 );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, self->levels - 1 );
+	if( self->format != DAOX_TEXTURE_RGBA8 ) return;
+	for(i=0; i<self->levels; ++i){
+		glTexImage2D( GL_TEXTURE_2D, i, GL_RGBA8, self->widths[i], self->heights[i], 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	}
+}
+/*
+// Plan the uploads of the ready jobs within the upload limit, and copy
+// their pixels into the mapped pixel buffer:
+*/
+static daoint DaoxTextureStreamer_MapChunks( DaoxTextureStreamer *self, daoint size )
+{
+	uchar_t *buffer;
+	daoint used = 0;
+	int i;
+
+	glBufferData( GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW );
+	buffer = (uchar_t*) glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT );
+	if( buffer == NULL ) return 0;
+
+	for(i=0; i<self->jobs->size && used < size; ++i){
+		DaoxTextureJob *job = (DaoxTextureJob*) self->jobs->items.pVoid[i];
+		if( job->loaded == 0 || job->stale ) continue;
+		while( job->level >= 0 ){
+			DaoxTextureChunk *chunk;
+			daoint rowSize = 4 * job->widths[job->level];
+			int rows = job->heights[job->level] - job->row;
+			if( job->format != DAOX_TEXTURE_RGBA8 ){
+				/* A compressed level is uploaded as a whole: */
+				rowSize = job->offsets[job->level+1] - job->offsets[job->level];
+				rows = 1;
+				if( rowSize > size - used ) break;
+			}else if( rows * rowSize > size - used ){
+				rows = (size - used) / rowSize;
+			}
+			if( rows == 0 ) break;
+
+			chunk = (DaoxTextureChunk*) DArray_Push( self->chunks );
+			chunk->job = job;
+			chunk->level = job->level;
+			chunk->row = job->row;
+			chunk->rows = rows;
+			chunk->offset = used;
+			memcpy( buffer + used, job->pixels + job->offsets[job->level] + job->row * rowSize, rows * rowSize );
+			used += rows * rowSize;
+			job->row += job->format == DAOX_TEXTURE_RGBA8 ? rows : job->heights[job->level];
+			if( job->row < job->heights[job->level] ) break;
+			job->level -= 1;
+			job->row = 0;
+		}
+	}
+	glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+	return used;
+}
+static void DaoxTextureStreamer_UploadChunks( DaoxTextureStreamer *self )
+{
+	int i;
+
+	for(i=0; i<self->chunks->size; ++i){
+		DaoxTextureChunk *chunk = (DaoxTextureChunk*) self->chunks->data.base + i;
+		DaoxTextureJob *job = chunk->job;
+		DaoxTexture *texture = job->texture;
+		int width = job->widths[chunk->level];
+		int height = job->heights[chunk->level];
+
+		glBindTexture( GL_TEXTURE_2D, job->tid );
+		if( job->format != DAOX_TEXTURE_RGBA8 ){
+			daoint size = job->offsets[chunk->level+1] - job->offsets[chunk->level];
+			int format = DaoxTextureFormat_GLFormat( job->format );
+			glCompressedTexImage2D( GL_TEXTURE_2D, chunk->level, format, width, height, 0,
+					size, (void*) chunk->offset );
+		}else{
+			glTexSubImage2D( GL_TEXTURE_2D, chunk->level, 0, chunk->row, width, chunk->rows,
+					GL_RGBA, GL_UNSIGNED_BYTE, (void*) chunk->offset );
+			if( chunk->row + chunk->rows < height ) continue;
+		}
+
+		/* The level is complete: */
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, chunk->level );
+		if( chunk->level == job->levels - 1 ){
+			DaoxTexture_Free( texture );
+			texture->tid = job->tid;
+			texture->format = job->format;
+			texture->memory = job->offsets[job->levels];
+			job->swapped = 1;
+			self->usage += texture->memory;
+		}
+	}
+	DArray_Clear( self->chunks );
+}
+static int DaoxTexture_CompareUse( const void *p1, const void *p2 )
+{
+	DaoxTexture *texture1 = *(DaoxTexture**) p1;
+	DaoxTexture *texture2 = *(DaoxTexture**) p2;
+	if( texture1->lastUse == texture2->lastUse ) return 0;
+	return texture1->lastUse < texture2->lastUse ? -1 : 1;
+}
+static void DaoxTextureStreamer_Evict( DaoxTextureStreamer *self )
+{
+	DList *textures = self->context->textures;
+	int i;
+
+	if( self->budget <= 0 || self->usage <= self->budget ) return;
+
+	DList_Clear( self->lru );
+	for(i=0; i<textures->size; ++i){
+		DaoxTexture *texture = (DaoxTexture*) textures->items.pValue[i];
+		if( texture->tid == 0 || texture->job != NULL ) continue;
+		if( texture->lastUse + 2 >= self->frameIndex ) continue;
+		DList_Append( self->lru, texture );
+	}
+	qsort( self->lru->items.pVoid, self->lru->size, sizeof(void*), DaoxTexture_CompareUse );
+	for(i=0; i<self->lru->size && self->usage > self->budget; ++i){
+		DaoxTexture_Free( (DaoxTexture*) self->lru->items.pVoid[i] );
+	}
+	DList_Clear( self->lru );
+}
+daoint DaoxTextureStreamer_Update( DaoxTextureStreamer *self )
+{
+	daoint size = self->upload;
+	daoint used = 0;
+	int i, j, ready = 0;
+
+	self->frameIndex += 1;
+
+#ifdef DAO_WITH_THREAD
+	/* The ready flags are set by the streaming thread, only they are read under the lock: */
+	DMutex_Lock( & self->mutex );
+#endif
+	for(i=0; i<self->jobs->size; ++i){
+		DaoxTextureJob *job = (DaoxTextureJob*) self->jobs->items.pVoid[i];
+		job->loaded = job->ready;
+	}
+#ifdef DAO_WITH_THREAD
+	DMutex_Unlock( & self->mutex );
+#endif
+
+	for(i=0,j=0; i<self->jobs->size; ++i){
+		DaoxTextureJob *job = (DaoxTextureJob*) self->jobs->items.pVoid[i];
+		if( job->loaded && (job->stale || job->level < 0) ){
+			DaoxTextureJob_Delete( job );
+			continue;
+		}
+		self->jobs->items.pVoid[j++] = job;
+		if( job->loaded == 0 ) continue;
+		if( job->tid == 0 ) DaoxTextureJob_InitTexture( job );
+		/* At least a row, or a whole compressed level: */
+		if( job->format != DAOX_TEXTURE_RGBA8 ){
+			if( job->offsets[1] > size ) size = job->offsets[1];
+		}else if( 4 * job->widths[0] > size ){
+			size = 4 * job->widths[0];
+		}
+		ready += 1;
+	}
+	DList_Erase( self->jobs, j, self->jobs->size - j );
+
+	if( ready ){
+		if( self->pixelBuffer == 0 ) glGenBuffers( 1, & self->pixelBuffer );
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, self->pixelBuffer );
+		used = DaoxTextureStreamer_MapChunks( self, size );
+		DaoxTextureStreamer_UploadChunks( self );
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+		glBindTexture( GL_TEXTURE_2D, 0 );
+	}
+	DaoxTextureStreamer_Evict( self );
+	return used;
+}
@@ -0,0 +1,166 @@
+/*
+// Dao Graphics Engine
+// http://www.daovm.net
+//
+// Copyright (c) 2016, Limin Fu
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __DAO_STREAMING__
+#define __DAO_STREAMING__
+
+#include "dao_opengl.h"
+#include "dao_compression.h"
+
+#ifdef DAO_WITH_THREAD
+#include "daoThread.h"
+#endif
+
+
+#define DAOX_MAX_MIPMAPS  16
+
+#define DAOX_TEXTURE_BUDGET   (512<<20)  /* default GPU memory budget for the textures; */
+#define DAOX_TEXTURE_UPLOAD   (4<<20)    /* default bytes uploaded per frame; */
+
+
+typedef struct DaoxTextureJob    DaoxTextureJob;
+typedef struct DaoxTextureChunk  DaoxTextureChunk;
+
+
+/*
+// DaoxTextureJob:
+// -- Streaming job of a texture;
+// -- The RGBA mip chain is generated by the streaming thread, and then uploaded
+//    by the rendering thread from the coarsest level to the finest one, a number
+//    of rows at a time;
+// -- With a compressed format, the levels are compressed by the streaming thread
+//    (or loaded from the texture cache), and uploaded a whole level at a time;
+// -- The texture switches to the new GL texture once its coarsest level has been
+//    uploaded, and its base level follows the finest level uploaded so far;
+*/
+struct DaoxTextureJob
+{
+	DaoxTexture  *texture;
+	DaoImage     *image;    /* image of the texture when the job is queued; */
+	uchar_t       ready;    /* mip chain generated, set by the streaming thread; */
+	uchar_t       loaded;   /* copy of "ready" taken by the rendering thread under the lock; */
+	uchar_t       stale;    /* cancelled, to be deleted once it is ready; */
+	uchar_t       swapped;  /* the texture has switched to the GL texture of the job; */
+	GLuint        tid;      /* new GL texture of the job; */
+	int           format;   /* DaoxTextureFormat of the GL texture; */
+	DString      *cache;    /* directory of the texture cache, or NULL; */
+	int           levels;
+	int           level;    /* level being uploaded; */
+	int           row;      /* next row of the level to upload; */
+	int           widths[DAOX_MAX_MIPMAPS];
+	int           heights[DAOX_MAX_MIPMAPS];
+	daoint        offsets[DAOX_MAX_MIPMAPS+1];  /* offsets[levels]: total size; */
+	uchar_t      *pixels;   /* all the levels in the format of the job; */
+};
+
+
+/* Rows of a level uploaded from the pixel buffer: */
+struct DaoxTextureChunk
+{
+	DaoxTextureJob  *job;
+	int              level;
+	int              row;
+	int              rows;
+	daoint           offset;  /* in the pixel buffer; */
+};
+
+
+/*
+// DaoxTextureStreamer:
+// -- Asynchronous streaming of the textures of a context;
+// -- Requested textures are queued for mip chain generation on a worker thread
+//    (synchronously without thread support), and drawn without the texture
+//    (or with the previous GL texture if the image has changed) until the
+//    coarsest level is uploaded;
+// -- Uploads go through a pixel buffer object, with at most "upload" bytes
+//    per frame (or a whole level if it is compressed and larger);
+// -- Textures are compressed as BC1/BC3/BC5 (S3TC and RGTC) on desktop GL and
+//    ETC2 on GLES, if the format is supported; The compressed levels are saved
+//    in the texture cache of the context (if any), keyed by the image content;
+// -- The least recently used textures (not used in the last two frames) are
+//    evicted when the GPU memory of the textures exceeds the budget, and they
+//    are streamed again on their next use;
+*/
+struct DaoxTextureStreamer
+{
+	DaoxContext  *context;
+	DList        *jobs;     /* <DaoxTextureJob*>: in queue order; */
+	DList        *lru;      /* <DaoxTexture*>: eviction candidates; */
+	DArray       *chunks;   /* <DaoxTextureChunk>: uploads of the frame; */
+	daoint        budget;   /* GPU memory budget in bytes, 0 for unlimited; */
+	daoint        upload;   /* bytes uploaded per frame; */
+	daoint        usage;    /* GPU memory of the textures; */
+	uint_t        frameIndex;
+	GLuint        pixelBuffer;
+	uchar_t       compression;  /* compress the textures if possible; */
+	short         formats;      /* bit set of the supported formats, -1: not checked; */
+
+	DaoxThreadPool  *workers;   /* block compression, used by the streaming thread; */
+
+#ifdef DAO_WITH_THREAD
+	DThread       thread;
+	DMutex        mutex;
+	DCondVar      condv;    /* new jobs or quit; */
+	DCondVar      condv2;   /* job finished; */
+	DList        *pending;  /* <DaoxTextureJob*>: jobs for the streaming thread; */
+	DaoxTextureJob  *working;
+	uchar_t       started;
+	uchar_t       quit;
+#endif
+};
+
+DaoxTextureStreamer* DaoxTextureStreamer_New( DaoxContext *context );
+void DaoxTextureStreamer_Delete( DaoxTextureStreamer *self );
+
+/*
+// Cancel the jobs and release the GL resources of the streamer
+// (the textures are freed by the context):
+*/
+void DaoxTextureStreamer_Clear( DaoxTextureStreamer *self );
+
+/*
+// Mark the texture as used in the current frame, and queue it for streaming
+// if it has no GL texture or its image has changed. Return the GL texture
+// that can be used for drawing, or zero if none is available yet:
+*/
+uint_t DaoxTextureStreamer_Request( DaoxTextureStreamer *self, DaoxTexture *texture );
+
+/*
+// Detach the job from its texture, and remove it from the queue of the streaming
+// thread if it has not been started; It is deleted by DaoxTextureStreamer_Update():
+*/
+void DaoxTextureStreamer_Cancel( DaoxTextureStreamer *self, DaoxTextureJob *job );
+
+/*
+// Start a new frame: upload the ready levels within the upload limit, and
+// evict the least recently used textures over the budget. Return the number
+// of bytes uploaded:
+*/
+daoint DaoxTextureStreamer_Update( DaoxTextureStreamer *self );
+
+#endif
@@ -1001,6 +1001,7 @@ void DaoxTerrain_FinalizeMesh( DaoxTerrain *self )
 	DaoxMesh_UpdateTree( self->mesh, 128 );
 	DaoxMesh_ResetBoundingBox( self->mesh );
 	self->base.base.obbox = self->mesh->obbox;
+	DaoxSceneNode_MarkDirty( (DaoxSceneNode*) self );
 }
 void DaoxTerrain_Rebuild( DaoxTerrain *self )
 {
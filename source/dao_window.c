@@ -406,7 +406,9 @@ static void WIN_Show( DaoProcess *proc, DaoValue *p[], int N )
 			frame += 1;
 			if( frame > 155 ) break;
 #else
+			double updateStart = Dao_GetCurrentTime();
 			DaoxScene_Update( scene, frameStartTime - lastFrameStart );
+			DaoxProfiler_AddTime( self->renderer->profiler, DAOX_PROFILE_UPDATE, Dao_GetCurrentTime() - updateStart );
 			DaoxRenderer_Render( self->renderer, scene, scene->camera );
 #endif
 		}